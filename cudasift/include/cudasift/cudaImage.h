@@ -32,6 +32,16 @@ public:
   double CopyToTexture(CudaImage &dst, bool host);
 };
 
+// Non-owning view of a float image in host memory, used by the CPU code paths
+struct HostImage {
+  float *data;
+  int width, height;
+  int pitch;
+  HostImage(float *data_ = nullptr, int width_ = 0, int height_ = 0, int pitch_ = 0) :
+    data(data_), width(width_), height(height_), pitch(pitch_ ? pitch_ : width_) {}
+  float *row(int y) const { return data + (size_t)y*pitch; }
+};
+
 int iDivUp(int a, int b);
 int iDivDown(int a, int b);
 int iAlignUp(int a, int b);
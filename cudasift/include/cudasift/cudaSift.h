@@ -2,6 +2,8 @@
 #define CUDASIFT_H
 
 #include "cudasift/cudaImage.h"
+#include "cudasift/hostutils.h"
+#include <cstdint>
 #include <vector>
 
 struct SiftPoint {
@@ -34,6 +36,36 @@ struct SiftData {
   SiftPoint *h_data;  // Host (CPU) data
 };
 
+// Descriptors quantized to signed 8 bits with one scale per point, 132 bytes
+// per point instead of 512. Element j of point i is approximately
+// codes[128*i + j]*scales[i].
+struct QuantizedSiftData {
+  int numPts = 0;
+  AlignedVector<int8_t> codes;
+  AlignedVector<float> scales;
+};
+
+// Structure-of-arrays counterpart of SiftData, with one contiguous array per
+// SiftPoint field and the descriptors as a dense numPts x 128 matrix
+struct SiftFeatureSet {
+  explicit SiftFeatureSet(int num = 0) { resize(num); }
+  void resize(int num);
+  float *descriptor(int i) { return &descriptors[(size_t)i*128]; }
+  const float *descriptor(int i) const { return &descriptors[(size_t)i*128]; }
+
+  int numPts = 0;
+  // Keypoint geometry
+  AlignedVector<float> xpos, ypos, scale, sharpness, edgeness, orientation, subsampling;
+  // Match results
+  AlignedVector<float> score, ambiguity, match_xpos, match_ypos, match_error;
+  AlignedVector<int> match;
+  AlignedVector<float> descriptors;
+};
+
+void ToFeatureSet(const SiftData &src, SiftFeatureSet &dst);
+// Throws std::invalid_argument if dst cannot hold all points
+void ToSiftData(const SiftFeatureSet &src, SiftData &dst);
+
 struct DeviceSiftData {
   explicit DeviceSiftData(int num = 1024);
   void uploadFeatures(const SiftData &src, cudaStream_t stream = 0);
@@ -70,10 +102,15 @@ public:
   TempMemory(TempMemory &&other) noexcept;
   TempMemory &operator =(TempMemory &&other) noexcept;
   ~TempMemory();
+  // Restricts the images, and the extent of their textures, to a size within
+  // the allocated one
   void setSize(int w, int h);
+  // Bytes allocated by the constructor with the same arguments
+  static size_t requiredSize(int width, int height, int num_octaves, bool scale_up = false);
 
 private:
   float *imageBuffer() const { return d_data + laplace_buffer_size; }
+  void createTextures();
 
   std::vector<cudaTextureObject_t> textures;
   float *d_data = nullptr;
@@ -84,6 +121,26 @@ private:
   unsigned int *d_PointCounter;
 };
 
+// Scratch memory of the CPU extraction path, laid out like TempMemory
+class HostTempMemory {
+public:
+  float *laplaceBuffer() const { return const_cast<float *>(laplace.data()); }
+  HostImage image(int octave) const;
+
+  HostTempMemory(int width, int height, int num_octaves, bool scale_up = false);
+  // Restricts the images to a size within the allocated one, throwing
+  // std::invalid_argument for a larger size
+  void setSize(int w, int h);
+  static size_t requiredSize(int width, int height, int num_octaves, bool scale_up = false);
+
+private:
+  AlignedVector<float> laplace;
+  AlignedVector<float> images;
+  int width, height;
+  int restrict_width, restrict_height;
+  int num_octaves;
+};
+
 struct DescriptorNormalizerData {
   /*
    * Possible normalizer steps:
@@ -111,6 +168,30 @@ struct DescriptorNormalizerData {
   float *data;
 };
 
+// Step lists from the comment above that have fused, compile-time specialized
+// implementations. Any other list is run by the generic step interpreter.
+enum DescriptorNormalizerPreset {
+  NORMALIZER_CUSTOM = 0,
+  NORMALIZER_SIFT,        // 1, 4, 1, 3, 0
+  NORMALIZER_RSIFT,       // 1, 4, 2, 3, 0
+  NORMALIZER_ZCA_RSIFT,   // 1, 4, 2, 3, 5, 6, 1, 3, 0
+  NORMALIZER_PLUS_RSIFT   // 1, 4, 2, 3, 5, 6, 2, 3, 7, 0
+};
+
+// Returns the preset with the same step list and enough data, or
+// NORMALIZER_CUSTOM
+DescriptorNormalizerPreset FindNormalizerPreset(const DescriptorNormalizerData &normalizer);
+
+// Shape of the fused pipelines: clamp at alpha*l2, normalize (l1 or l2), and
+// for the ZCA presets add the mean, whiten, normalize again and maybe sqrt
+template <int Preset>
+struct NormalizerTraits {
+  static constexpr bool firstL1 = (Preset!=NORMALIZER_SIFT);
+  static constexpr bool whiten = (Preset==NORMALIZER_ZCA_RSIFT || Preset==NORMALIZER_PLUS_RSIFT);
+  static constexpr bool secondL1 = (Preset==NORMALIZER_PLUS_RSIFT);
+  static constexpr bool signedSqrt = (Preset==NORMALIZER_PLUS_RSIFT);
+};
+
 class DeviceDescriptorNormalizerData {
 public:
   explicit DeviceDescriptorNormalizerData(const DescriptorNormalizerData &normalizer);
@@ -121,9 +202,12 @@ public:
   DeviceDescriptorNormalizerData &operator=(DeviceDescriptorNormalizerData &&) noexcept;
 
   const DescriptorNormalizerData *get() const { return d_normalizer; }
+  // Fused kernel selected for the step list at construction
+  DescriptorNormalizerPreset preset() const { return m_preset; }
 
 private:
   DescriptorNormalizerData *d_normalizer;
+  DescriptorNormalizerPreset m_preset;
 };
 
 void InitCuda(int maxPts, int numOctaves, float initBlur, int devNum = 0);
@@ -134,22 +218,131 @@ void ExtractSift(DeviceSiftData &siftData,
                  float lowestScale, bool scaleUp,
                  TempMemory &tempMemory, cudaStream_t stream = 0);
 
-inline
+// Same as above with scratch memory from GlobalTempMemoryPool()
 void ExtractSift(DeviceSiftData &siftData,
                  const DeviceDescriptorNormalizerData &d_normalizer,
                  const CudaImage &img, int numOctaves, float thresh,
                  float lowestScale = 0.0f, bool scaleUp = false,
-                 cudaStream_t stream = 0) {
-  TempMemory tmp(img.width, img.height, numOctaves, scaleUp);
-  ExtractSift(siftData, d_normalizer, img, numOctaves, thresh,
-              lowestScale, scaleUp, tmp, stream);
-}
+                 cudaStream_t stream = 0);
+
+// CPU version of ExtractSift, running the same stages as the device path on
+// all cores of the host. The image is given in host memory and initBlur plays
+// the role it has in InitCuda. Features are written directly to siftData.
+//
+// All filters use the same coefficients and order of operations as the device
+// kernels, so DoG values agree to within float rounding. Keypoints with a DoG
+// response very close to thresh may therefore be found by only one of the
+// two paths, while all others agree to within 1e-3 pixels in position and
+// scale. Orientations and descriptors sample the image with emulated texture
+// filtering (8-bit fractional weights), so the remaining differences come from
+// fast math intrinsics and orientations are expected to agree within 0.1
+// degrees and descriptor dot products to exceed 0.999. The point order within
+// an octave is row-major and deterministic, unlike the atomic order of the
+// device, and secondary orientations of the finest octave are always kept,
+// whereas the device count omits them. Neither is the device limit of 32
+// candidates per 30x8 pixel tile applied.
+//
+// numOctaves must be in [1, 7], as for InitCuda, or std::invalid_argument is
+// thrown.
+void ExtractSift(SiftData &siftData, const DescriptorNormalizerData &normalizer,
+                 const HostImage &img, int numOctaves, float initBlur, float thresh,
+                 float lowestScale, bool scaleUp, HostTempMemory &tempMemory);
+
+// Same as above with scratch memory from GlobalHostTempMemoryPool()
+void ExtractSift(SiftData &siftData, const DescriptorNormalizerData &normalizer,
+                 const HostImage &img, int numOctaves, float initBlur, float thresh,
+                 float lowestScale = 0.0f, bool scaleUp = false);
 
 void PrintSiftData(SiftData &data);
 double MatchSiftData(const DeviceSiftData &data1, const DeviceSiftData &data2, cudaStream_t stream = 0);
+// CPU version of MatchSiftData. For every point in data1 it fills score,
+// ambiguity, match, match_xpos and match_ypos like FindMaxCorr10, using a
+// multithreaded and cache blocked SIMD kernel. Points without any positive
+// correlation, or all points if data2 is empty, get match = -1 with zero
+// score, ambiguity and match position. Returns the time spent in milliseconds.
+double MatchSiftData(SiftData &data1, const SiftData &data2);
+double MatchSiftData(SiftFeatureSet &data1, const SiftFeatureSet &data2);
+// Symmetric CPU matching that correlates every pair of points once, keeping
+// the best and second best match of the points of both sets. Fills the match
+// fields of data1 and data2 like MatchSiftData(data1, data2) and
+// MatchSiftData(data2, data1) at about half the cost. If mutual is not null,
+// mutual[i] is set to 1 if point i of data1 and its match are each other's
+// best match and to 0 otherwise. If either set is empty, all points of both
+// get match = -1 and mutual is zero. Returns the time spent in milliseconds.
+double MatchSiftDataMutual(SiftData &data1, SiftData &data2, uint8_t *mutual = nullptr);
+double MatchSiftDataMutual(SiftFeatureSet &data1, SiftFeatureSet &data2, uint8_t *mutual = nullptr);
+
+// Geometric priors of MatchSiftDataGuided, row-major 3x3 matrices
+enum GuidedMatchPrior {
+  GUIDED_HOMOGRAPHY,    // x2 ~ H x1, as returned by FindHomography
+  GUIDED_FUNDAMENTAL    // x2^T F x1 = 0
+};
+// CPU matching restricted by a known approximate geometry. A point of data1
+// is only correlated with the points of data2 within tolerance pixels of its
+// position mapped by the homography, or of its epipolar line through the
+// fundamental matrix. The points of data2 are bucketed into a spatial grid,
+// so that only the grid cells overlapping that region are visited, which
+// reduces the cost from O(N*M) to about O(N*k) for k points per region.
+// Fills the match fields of data1 like MatchSiftData, with ambiguities only
+// among the candidates in the region, and match = -1 for points without
+// candidates, as for all points if data2 is empty. Returns the time spent in
+// milliseconds.
+double MatchSiftDataGuided(SiftData &data1, const SiftData &data2, const float *model,
+                           GuidedMatchPrior prior, float tolerance);
+double MatchSiftDataGuided(SiftFeatureSet &data1, const SiftFeatureSet &data2, const float *model,
+                           GuidedMatchPrior prior, float tolerance);
+
+// Largest number of candidates kept per point by MatchSiftDataTopK
+#define SIFT_TOPK_MAX 8
+// Point of the second set of a match and its correlation
+struct SiftMatchCandidate {
+  int index;
+  float score;
+};
+// Writes the K best matches of every point of data1 to the numPts x K array
+// matches, in decreasing order of correlation and increasing index for equal
+// correlations, padded with index -1 and score 0. As with MatchSiftData only
+// positive correlations count. The candidates are kept sorted in registers,
+// so K up to 8 costs little more than MatchSiftData. Instantiated for K from
+// 1 to SIFT_TOPK_MAX. Returns the time spent in milliseconds.
+template <int K>
+double MatchSiftDataTopK(const SiftData &data1, const SiftData &data2, SiftMatchCandidate *matches);
+template <int K>
+double MatchSiftDataTopK(const SiftFeatureSet &data1, const SiftFeatureSet &data2,
+                         SiftMatchCandidate *matches);
+// Device version with d_matches in device memory
+template <int K>
+double MatchSiftDataTopK(const DeviceSiftData &data1, const DeviceSiftData &data2,
+                         SiftMatchCandidate *d_matches, cudaStream_t stream = 0);
+// Quantizes the normalized descriptors of data, mapping the largest absolute
+// element of every descriptor to 127.
+void QuantizeDescriptors(const SiftData &data, QuantizedSiftData &quantized);
+void QuantizeDescriptors(const SiftFeatureSet &data, QuantizedSiftData &quantized);
+void DequantizeDescriptors(const QuantizedSiftData &quantized, SiftData &data);
+// CPU matching on quantized descriptors using 8-bit integer dot products,
+// otherwise like MatchSiftData above. The positions come from data1 and data2,
+// which must hold the same points as quantized1 and quantized2, or
+// std::invalid_argument is thrown. Compared to float matching on SIFT
+// descriptors it runs 2-3 times faster, scores differ by about 0.0005 on
+// average and 1-2% of the matches with an ambiguity above 0.95 pick a
+// different point, while matches with a lower ambiguity are hardly ever
+// affected.
+double MatchSiftData(SiftData &data1, const QuantizedSiftData &quantized1,
+                     const SiftData &data2, const QuantizedSiftData &quantized2);
+double MatchSiftData(SiftFeatureSet &data1, const QuantizedSiftData &quantized1,
+                     const SiftFeatureSet &data2, const QuantizedSiftData &quantized2);
+// The hypotheses are sampled from a random stream seeded with seed, so that
+// the result only depends on the matches and parameters, as with the seed of
+// RansacParams in siftGeometry.h
 double FindHomography(DeviceSiftData &data,  float *homography, int *numMatches,
                       int numLoops = 1000, float minScore = 0.85f,
                       float maxAmbiguity = 0.95f, float thresh = 5.0f,
-                      cudaStream_t stream = 0);
+                      cudaStream_t stream = 0, uint32_t seed = 1);
+// Same as above for matched features in host memory, estimated on the host
+// by EstimateHomography of siftGeometry.h without any device allocation or
+// transfer
+double FindHomography(const SiftFeatureSet &data, float *homography, int *numMatches,
+                      int numLoops = 1000, float minScore = 0.85f,
+                      float maxAmbiguity = 0.95f, float thresh = 5.0f, uint32_t seed = 1);
 
 #endif
@@ -3,6 +3,7 @@
 
 #include "cudasift/cudautils.h"
 #include "cudasift/cudaImage.h"
+#include "cudasift/deviceProfiler.h"
 
 //********************************************************//
 // CUDA SIFT extractor by Marten Bjorkman aka Celebrandil //
@@ -11,11 +12,13 @@
 int ExtractSiftLoop(DeviceSiftData &siftData, const CudaImage &img,
                     const DeviceDescriptorNormalizerData &d_normalizer,
                     int numOctaves, double initBlur, float thresh, float lowestScale,
-                    float subsampling, TempMemory &memorySub, cudaStream_t stream);
+                    float subsampling, TempMemory &memorySub, StreamProfiler &profiler,
+                    cudaStream_t stream);
 void ExtractSiftOctave(DeviceSiftData &siftData, const CudaImage &img,
                        const DeviceDescriptorNormalizerData &d_normalizer,
                        int octave, float thresh, float lowestScale,
-                       float subsampling, TempMemory &memoryTmp, cudaStream_t stream);
+                       float subsampling, TempMemory &memoryTmp, StreamProfiler &profiler,
+                       cudaStream_t stream);
 double ScaleDown(const CudaImage &res, const CudaImage &src, cudaStream_t stream);
 double ScaleUp(const CudaImage &res, const CudaImage &src, cudaStream_t stream);
 double ComputeOrientations(cudaTextureObject_t texObj, DeviceSiftData &siftData,
@@ -28,7 +31,6 @@ double OrientAndExtract(cudaTextureObject_t texObj, DeviceSiftData &siftData,
                         const TempMemory tempMemory, float subsampling, int octave, cudaStream_t stream);
 double RescalePositions(DeviceSiftData &siftData, float scale, cudaStream_t stream);
 double LowPass(const CudaImage &res, const CudaImage &src, cudaStream_t stream);
-void PrepareLaplaceKernels(int numOctaves, float initBlur, float *kernel);
 double LaplaceMulti(const CudaImage &baseImage, const CudaImage *results, int octave, cudaStream_t stream);
 double FindPointsMulti(const CudaImage *sources, DeviceSiftData &siftData,
                        const TempMemory &tempMemory,
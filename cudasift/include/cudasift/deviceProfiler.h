@@ -0,0 +1,75 @@
+#ifndef DEVICEPROFILER_H
+#define DEVICEPROFILER_H
+
+#include <memory>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "cudasift/profiler.h"
+
+//********************************************************//
+// CUDA event timing of device stages for SiftProfiler    //
+//********************************************************//
+
+struct ProfileCalibration;
+
+// Collects the stages queued on one stream during a call. The events are
+// resolved by the profiler once the stream has passed them, and placed on
+// the host clock through a per-device reference event. Does nothing if the
+// profiler is disabled at construction.
+class StreamProfiler {
+public:
+  explicit StreamProfiler(cudaStream_t stream, SiftProfiler &profiler = SiftProfiler::global());
+  ~StreamProfiler();
+  StreamProfiler(const StreamProfiler &) = delete;
+  StreamProfiler &operator=(const StreamProfiler &) = delete;
+
+  bool active() const { return !events.empty(); }
+  // Records an event on the stream and returns its index, or -1 if inactive
+  int mark();
+  void add(ProfileStage stage, int octave, int begin, int end);
+  // Sets the point count of the stages added or yet to be added
+  void setPoints(ProfileStage stage, int octave, int numPts);
+
+private:
+  struct Interval {
+    ProfileStage stage;
+    int octave;
+    int numPts;
+    int begin, end;
+  };
+
+  SiftProfiler &prof;
+  cudaStream_t stream;
+  int device;
+  uint64_t thread;
+  std::shared_ptr<ProfileCalibration> calibration;
+  std::vector<cudaEvent_t> events;
+  std::vector<Interval> intervals;
+  std::vector<Interval> points;
+};
+
+// Times the device work queued on the stream within the enclosing scope
+class DeviceProfileScope {
+public:
+  DeviceProfileScope(StreamProfiler &profiler, ProfileStage stage, int octave = -1)
+    : prof(profiler), stage(stage), octave(octave), begin(profiler.mark()) {}
+  DeviceProfileScope(const DeviceProfileScope &) = delete;
+  DeviceProfileScope &operator=(const DeviceProfileScope &) = delete;
+  ~DeviceProfileScope() {
+    if (begin>=0)
+      prof.add(stage, octave, begin, prof.mark());
+  }
+
+private:
+  StreamProfiler &prof;
+  const ProfileStage stage;
+  const int octave;
+  const int begin;
+};
+
+// cudaStreamSynchronize with the time the host is blocked recorded as
+// PROFILE_SYNC
+void SynchronizeStream(cudaStream_t stream);
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef HOSTSIFTH_H
+#define HOSTSIFTH_H
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "cudasift/cudaImage.h"
+#include "cudasift/cudaSift.h"
+#include "cudasift/profiler.h"
+
+//********************************************************//
+// CPU counterparts of the stages in cudaSiftH.h          //
+//********************************************************//
+
+void PrepareLaplaceKernels(int numOctaves, float initBlur, float *kernel);
+void PrepareLowPassKernel(float initBlur, float *kernel);
+void PrepareScaleDownKernel(float *kernel);
+
+int ExtractSiftLoopHost(SiftData &siftData, const HostImage &img,
+                        const DescriptorNormalizerData &normalizer,
+                        int numOctaves, float thresh, float lowestScale,
+                        float subsampling, HostTempMemory &memoryTmp,
+                        const float *laplaceKernels);
+void ExtractSiftOctaveHost(SiftData &siftData, const HostImage &img,
+                           const DescriptorNormalizerData &normalizer,
+                           int octave, float thresh, float lowestScale,
+                           float subsampling, HostTempMemory &memoryTmp,
+                           const float *laplaceKernels);
+void ScaleDownHost(const HostImage &res, const HostImage &src, const float *kernel);
+void ScaleUpHost(const HostImage &res, const HostImage &src);
+void LowPassHost(const HostImage &res, const HostImage &src, const float *kernel);
+void LaplaceMultiHost(const HostImage &baseImage, const HostImage *results,
+                      const float *laplaceKernels, int octave);
+int FindPointsMultiHost(const HostImage *sources, SiftData &siftData,
+                        float thresh, float edgeLimit, float factor,
+                        float lowestScale, float subsampling);
+int ComputeOrientationsHost(const HostImage &img, SiftData &siftData,
+                            int fstPts, int totPts);
+void ExtractSiftDescriptorsHost(const HostImage &img, SiftData &siftData,
+                                const DescriptorNormalizerData &normalizer,
+                                float subsampling, int fstPts, int totPts);
+void NormalizeDescriptorHost(float *buffer, float *desc,
+                             const DescriptorNormalizerData &normalizer);
+// Fused SIMD normalizer for one of the presets, see NormalizerTraits. The
+// buffer of 128 floats is used as scratch space.
+template <int Preset>
+void NormalizeDescriptorFusedHost(float *buffer, float *desc,
+                                  const DescriptorNormalizerData &normalizer);
+typedef void (*HostNormalizerFunc)(float *buffer, float *desc,
+                                   const DescriptorNormalizerData &normalizer);
+// Returns the fused normalizer of a preset, or the step interpreter
+// NormalizeDescriptorHost for NORMALIZER_CUSTOM
+HostNormalizerFunc GetHostNormalizer(DescriptorNormalizerPreset preset);
+void RescalePositionsHost(SiftData &siftData, float scale);
+
+// Descriptors of the second set of a match, transposed into panels of
+// MATCH_PANEL points so that a panel can be correlated with SIMD loads
+#define MATCH_PANEL 16
+struct PackedDescriptors {
+  AlignedVector<float> panels;
+  int numPts = 0;
+  int numPanels = 0;
+};
+void PackDescriptors(const float *desc, size_t stride, int numPts,
+                     PackedDescriptors &packed);
+// For each descriptor of the first set, finds the best and second best
+// correlation and the index of the best one among the packed descriptors
+void FindMaxCorrHost(const float *desc1, size_t stride1, int numPts1,
+                     const PackedDescriptors &desc2, float *maxScore,
+                     float *secScore, int *index);
+// FindMaxCorrHost that also finds the best and second best correlation and
+// the index of the best one among the first set for each packed descriptor
+void FindMutualHost(const float *desc1, size_t stride1, int numPts1,
+                    const PackedDescriptors &desc2, float *maxScore1,
+                    float *secScore1, int *index1, float *maxScore2,
+                    float *secScore2, int *index2);
+// FindMaxCorrHost over the points of the second set within tolerance pixels
+// of the region predicted by the model, see MatchSiftDataGuided
+void FindMaxCorrGuidedHost(const float *desc1, size_t stride1, const float *xpos1,
+                           const float *ypos1, int numPts1, const float *desc2,
+                           size_t stride2, const float *xpos2, const float *ypos2,
+                           int numPts2, const float *model, GuidedMatchPrior prior,
+                           float tolerance, float *maxScore, float *secScore, int *index);
+// For each descriptor of the first set, writes the K best candidates among
+// the packed descriptors to matches[K*i + j], as MatchSiftDataTopK
+template <int K>
+void FindTopKHost(const float *desc1, size_t stride1, int numPts1,
+                  const PackedDescriptors &desc2, SiftMatchCandidate *matches);
+
+// Quantized descriptors packed into panels of MATCH_PANEL points, with groups
+// of four consecutive elements of a point stored next to each other, and the
+// scales of the points. The code layout depends on the instruction set.
+struct PackedCodes {
+  AlignedVector<int8_t> panels;
+  AlignedVector<float> scales;
+  int numPts = 0;
+  int numPanels = 0;
+};
+void PackCodes(const int8_t *codes, const float *scales, int numPts,
+               PackedCodes &packed);
+// FindMaxCorrHost for quantized descriptors
+void FindMaxCorrQuantizedHost(const int8_t *codes1, const float *scales1,
+                              int numPts1, const PackedCodes &codes2,
+                              float *maxScore, float *secScore, int *index);
+
+// Matches every point of data1 against a descriptor index with the two best
+// results of its search, filling the match fields like StoreMatches does for
+// FindMaxCorrHost. An Index provides size(), xpos(i), ypos(i) and
+// search(queries, stride, numQueries, k, indices, scores, param).
+template <class Index, class Store>
+double MatchIndexHost(const float *desc1, size_t stride1, int numPts1, const Index &index,
+                      int param, Store store)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  if (!index.size()) {
+    // No match rather than the fields of an earlier call
+    for (int i=0;i<numPts1;i++)
+      store(i, 0.0f, 0.0f, -1, 0.0f, 0.0f);
+    return 0.0;
+  }
+  if (!numPts1)
+    return 0.0;
+  std::vector<int> indices(2*(size_t)numPts1);
+  std::vector<float> scores(2*(size_t)numPts1);
+  index.search(desc1, stride1, numPts1, 2, indices.data(), scores.data(), param);
+  for (int i=0;i<numPts1;i++) {
+    // Only positive similarities count, as in FindMaxCorrHost
+    const float maxScore = std::max(scores[2*i], 0.0f);
+    const float secScore = std::max(scores[2*i + 1], 0.0f);
+    const int idx = (scores[2*i]>0.0f ? indices[2*i] : -1);
+    store(i, maxScore, secScore / (maxScore + 1e-6f), idx,
+          (idx<0 ? 0.0f : index.xpos(idx)), (idx<0 ? 0.0f : index.ypos(idx)));
+  }
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+template <class Index>
+double MatchIndexHost(SiftData &data1, const Index &index, int param)
+{
+  return MatchIndexHost(data1.numPts ? data1.h_data[0].data : nullptr, sizeof(SiftPoint)/sizeof(float),
+                        data1.numPts, index, param,
+                        [&](int i, float score, float ambiguity, int match, float x, float y) {
+    SiftPoint &pt = data1.h_data[i];
+    pt.score = score;
+    pt.ambiguity = ambiguity;
+    pt.match = match;
+    pt.match_xpos = x;
+    pt.match_ypos = y;
+  });
+}
+
+template <class Index>
+double MatchIndexHost(SiftFeatureSet &data1, const Index &index, int param)
+{
+  return MatchIndexHost(data1.numPts ? data1.descriptor(0) : nullptr, 128, data1.numPts, index, param,
+                        [&](int i, float score, float ambiguity, int match, float x, float y) {
+    data1.score[i] = score;
+    data1.ambiguity[i] = ambiguity;
+    data1.match[i] = match;
+    data1.match_xpos[i] = x;
+    data1.match_ypos[i] = y;
+  });
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef HOSTUTILS_H
+#define HOSTUTILS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+//********************************************************//
+// Host side counterparts of cudautils.h: a small thread  //
+// pool for the CPU code paths and aligned host storage.  //
+//********************************************************//
+
+template <class T, size_t Align = 64>
+struct AlignedAllocator {
+  typedef T value_type;
+  template <class U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+  AlignedAllocator() noexcept = default;
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Align> &) noexcept {}
+
+  T *allocate(size_t n) {
+    void *ptr = nullptr;
+    size_t bytes = (n*sizeof(T) + Align - 1)/Align*Align;
+#ifdef _WIN32
+    ptr = _aligned_malloc(bytes, Align);
+#else
+    if (posix_memalign(&ptr, Align, bytes))
+      ptr = nullptr;
+#endif
+    if (ptr==nullptr)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+  void deallocate(T *ptr, size_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+  }
+  template <class U>
+  bool operator==(const AlignedAllocator<U, Align> &) const noexcept { return true; }
+  template <class U>
+  bool operator!=(const AlignedAllocator<U, Align> &) const noexcept { return false; }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Persistent pool of worker threads. The calling thread always takes part in
+// the work, so nested and concurrent parallelFor calls cannot deadlock.
+class HostThreadPool {
+public:
+  explicit HostThreadPool(int numThreads = 0) {
+    if (numThreads<=0)
+      numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i=1;i<numThreads;i++)
+      workers.emplace_back([this] { workerLoop(); });
+  }
+  ~HostThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto &w : workers)
+      w.join();
+  }
+  HostThreadPool(const HostThreadPool &) = delete;
+  HostThreadPool &operator=(const HostThreadPool &) = delete;
+
+  int numThreads() const { return (int)workers.size() + 1; }
+
+  // Calls body(i0, i1) on disjoint chunks [i0, i1) of [begin, end), each
+  // at most grain items long, and returns once all chunks are done.
+  template <class F>
+  void parallelFor(int begin, int end, int grain, F &&body) {
+    if (end<=begin)
+      return;
+    grain = std::max(grain, 1);
+    const int numChunks = (end - begin + grain - 1)/grain;
+    if (numChunks==1 || workers.empty()) {
+      for (int i=begin;i<end;i+=grain)
+        body(i, std::min(i + grain, end));
+      return;
+    }
+    std::function<void(int, int)> fn(std::ref(body));
+    Job job(fn, begin, end, grain, numChunks);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(&job);
+    }
+    wakeup.notify_all();
+    runChunks(job);
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = std::find(jobs.begin(), jobs.end(), &job);
+    if (it!=jobs.end())
+      jobs.erase(it);
+    finished.wait(lock, [&job] { return job.done==job.numChunks && job.users==0; });
+  }
+
+  // Splits [begin, end) into about four chunks per thread.
+  template <class F>
+  void parallelFor(int begin, int end, F &&body) {
+    int grain = (end - begin + 4*numThreads() - 1)/(4*numThreads());
+    parallelFor(begin, end, grain, std::forward<F>(body));
+  }
+
+  static HostThreadPool &global() {
+    static HostThreadPool pool;
+    return pool;
+  }
+
+private:
+  struct Job {
+    Job(const std::function<void(int, int)> &fn_, int begin_, int end_, int grain_, int numChunks_)
+      : fn(fn_), begin(begin_), end(end_), grain(grain_), numChunks(numChunks_) {}
+    const std::function<void(int, int)> &fn;
+    const int begin, end, grain, numChunks;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    int users = 0;  // Workers holding a pointer to the job, guarded by mutex
+  };
+
+  void runChunks(Job &job) {
+    int count = 0;
+    for (int c=job.next++;c<job.numChunks;c=job.next++) {
+      int i0 = job.begin + c*job.grain;
+      job.fn(i0, std::min(i0 + job.grain, job.end));
+      count++;
+    }
+    if (count && job.done.fetch_add(count) + count==job.numChunks) {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.notify_all();
+    }
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      Job *job = jobs.front();
+      if (job->next>=job->numChunks) {
+        jobs.pop_front();
+        continue;
+      }
+      job->users++;
+      lock.unlock();
+      runChunks(*job);
+      lock.lock();
+      auto it = std::find(jobs.begin(), jobs.end(), job);
+      if (it!=jobs.end())
+        jobs.erase(it);
+      if (--job->users==0)
+        finished.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<Job *> jobs;
+  std::mutex mutex;
+  std::condition_variable wakeup, finished;
+  bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+//********************************************************//
+// Runtime switchable timing of the extraction and        //
+// matching stages on the host and the device             //
+//********************************************************//
+
+enum ProfileStage {
+  PROFILE_EXTRACT = 0,      // Whole ExtractSift call, numPts = all points
+  PROFILE_OCTAVE,           // One octave, numPts = points of the octave
+  PROFILE_SCALE_UP,
+  PROFILE_LOW_PASS,
+  PROFILE_SCALE_DOWN,
+  PROFILE_LAPLACE,
+  PROFILE_FIND_POINTS,
+  PROFILE_ORIENTATIONS,
+  PROFILE_DESCRIPTORS,
+  PROFILE_RESCALE,
+  PROFILE_MATCH,
+  PROFILE_HOMOGRAPHY,
+  PROFILE_AFFINE,
+  PROFILE_SIMILARITY,
+  PROFILE_FUNDAMENTAL,
+  PROFILE_ESSENTIAL,
+  PROFILE_DOWNLOAD,
+  PROFILE_READBACK,
+  PROFILE_COPY_TO_TEXTURE,
+  PROFILE_ALLOCATE,         // Host time of scratch and texture allocations
+  PROFILE_SYNC,             // Host blocked waiting for a stream
+  PROFILE_NUM_STAGES
+};
+
+const char *ProfileStageName(ProfileStage stage);
+
+struct ProfileRecord {
+  ProfileStage stage;
+  int octave;           // -1 if not tied to an octave
+  int numPts;           // -1 if not counted
+  bool device;          // Timed with CUDA events rather than the host clock
+  double startMs;       // Since the creation of the profiler
+  double durationMs;
+  uint64_t thread;      // SiftProfiler::threadId() of the caller
+  uint64_t stream;      // cudaStream_t of device and synchronization records
+};
+
+// Aggregate over all records of one stage, octave and timer kind
+struct ProfileStats {
+  ProfileStage stage;
+  int octave;
+  bool device;
+  size_t count = 0;
+  double totalMs = 0.0;
+  double minMs = 0.0;
+  double maxMs = 0.0;
+  long long numPts = 0;   // Sum over the counted records
+  double meanMs() const { return count ? totalMs/count : 0.0; }
+};
+
+// Collects ProfileRecords while enabled. Disabled, each instrumented stage
+// costs a relaxed atomic load. Enabled, host stages read a steady clock
+// twice and device stages record two CUDA events on the stream, resolved
+// only once the stream has passed them, so no synchronization is added.
+// The aggregates cover all records since the last clear(), while the
+// records themselves are kept in a ring buffer of the given capacity.
+// SiftProfiler::global() is enabled at startup if the environment variable
+// CUDASIFT_PROFILE is set to anything but 0.
+class SiftProfiler {
+public:
+  // Appends the records of deferred device timings and returns true once
+  // they are available, waiting for them if wait is set
+  typedef std::function<bool(bool wait, std::vector<ProfileRecord> &records)> Resolver;
+
+  explicit SiftProfiler(size_t capacity = 65536);
+  SiftProfiler(const SiftProfiler &) = delete;
+  SiftProfiler &operator=(const SiftProfiler &) = delete;
+
+  static SiftProfiler &global();
+  static uint64_t threadId();
+
+  void setEnabled(bool enable) { on.store(enable, std::memory_order_relaxed); }
+  bool enabled() const { return on.load(std::memory_order_relaxed); }
+  void setCapacity(size_t capacity);
+
+  // Milliseconds since the creation of the profiler
+  double time(std::chrono::steady_clock::time_point t) const {
+    return std::chrono::duration<double, std::milli>(t - epoch).count();
+  }
+  double now() const { return time(std::chrono::steady_clock::now()); }
+
+  void record(const ProfileRecord &record);
+  void defer(Resolver resolver);
+
+  // Queries wait for deferred device timings
+  std::vector<ProfileRecord> records();
+  std::vector<ProfileStats> summary();
+  void clear();
+
+  // {"records": [...], "summary": [...]} with the fields of the structs above
+  // and stage names as strings
+  std::string toJson();
+  // Throws std::runtime_error if the file cannot be written
+  void writeJson(const char *filename);
+
+  // Records in the Chrome trace event format, for chrome://tracing or
+  // ui.perfetto.dev. Host records appear on one track per thread and device
+  // records on one track per stream, each with the octave, point count and
+  // the queueing thread or stream as arguments.
+  std::string toChromeTrace();
+  void writeChromeTrace(const char *filename);
+
+private:
+  void resolve(bool wait);
+  void add(const ProfileRecord &record);
+
+  std::atomic<bool> on;
+  const std::chrono::steady_clock::time_point epoch;
+  std::mutex mutex;          // Guards the records and aggregates
+  std::mutex resolveMutex;   // Serializes resolvers
+  std::deque<ProfileRecord> ring;
+  size_t capacity;
+  std::map<std::tuple<int, int, bool>, ProfileStats> stats;
+  std::vector<Resolver> pending;
+};
+
+// Times the enclosing host scope. The record is only made if the profiler
+// was enabled at construction.
+class ProfileScope {
+public:
+  ProfileScope(ProfileStage stage, int octave = -1, SiftProfiler &profiler = SiftProfiler::global())
+    : prof(profiler), active(profiler.enabled()), stage(stage), octave(octave), numPts(-1),
+      stream(0), start(active ? profiler.now() : 0.0) {}
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+  ~ProfileScope() {
+    if (active) {
+      double end = prof.now();
+      prof.record({stage, octave, numPts, false, start, end - start, SiftProfiler::threadId(), stream});
+    }
+  }
+  void setPoints(int num) { numPts = num; }
+  void setStream(uint64_t id) { stream = id; }
+
+private:
+  SiftProfiler &prof;
+  const bool active;
+  const ProfileStage stage;
+  const int octave;
+  int numPts;
+  uint64_t stream;
+  const double start;
+};
+
+#endif
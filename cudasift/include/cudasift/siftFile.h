@@ -0,0 +1,108 @@
+#ifndef SIFTFILE_H
+#define SIFTFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Binary on-disk format for feature sets and a read-only //
+// memory mapped view of such files                       //
+//********************************************************//
+
+// All values are little-endian and every block starts at a multiple of 64
+// bytes from the beginning of the file. The header is followed by the keypoint
+// block with seven columns of numPts floats (xpos, ypos, scale, sharpness,
+// edgeness, orientation, subsampling), each padded to columnStride bytes, and
+// the descriptor block with numPts x 128 floats, or numPts x 128 signed bytes
+// followed by numPts scales if the descriptors are quantized.
+#define SIFT_FILE_MAGIC "CUDASIFT"
+#define SIFT_FILE_VERSION 1
+#define SIFT_FILE_QUANTIZED 1u
+
+struct SiftFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t numPts;
+  uint64_t columnStride;      // Bytes per keypoint column
+  uint64_t keypointOffset;
+  uint64_t descriptorOffset;
+  uint64_t scaleOffset;       // 0 unless quantized
+  uint64_t fileSize;
+};
+static_assert(sizeof(SiftFileHeader)==64, "SiftFileHeader must be 64 bytes");
+
+// Non-owning read-only view of a feature set, as found in a mapped file.
+// Either descriptors or codes and scales are set.
+struct SiftFeatureView {
+  int numPts = 0;
+  const float *xpos = nullptr;
+  const float *ypos = nullptr;
+  const float *scale = nullptr;
+  const float *sharpness = nullptr;
+  const float *edgeness = nullptr;
+  const float *orientation = nullptr;
+  const float *subsampling = nullptr;
+  const float *descriptors = nullptr;   // numPts x 128
+  const int8_t *codes = nullptr;        // numPts x 128
+  const float *scales = nullptr;
+};
+
+// Writes the keypoints and descriptors of data, optionally quantized as by
+// QuantizeDescriptors. Match results are not stored. Throws
+// std::runtime_error if the file cannot be written.
+void WriteSiftFeatures(const char *filename, const SiftFeatureSet &data, bool quantize = false);
+void WriteSiftFeatures(const char *filename, const SiftData &data, bool quantize = false);
+
+struct PackedDescriptors;
+struct PackedCodes;
+
+// Memory maps a feature file and exposes it without copying. Throws
+// std::runtime_error if the file cannot be opened or is not a valid feature
+// file of a supported version.
+class MappedSiftFeatures {
+public:
+  explicit MappedSiftFeatures(const char *filename);
+  ~MappedSiftFeatures();
+  MappedSiftFeatures(const MappedSiftFeatures &) = delete;
+  MappedSiftFeatures &operator=(const MappedSiftFeatures &) = delete;
+  MappedSiftFeatures(MappedSiftFeatures &&other) noexcept;
+  MappedSiftFeatures &operator=(MappedSiftFeatures &&other) noexcept;
+
+  const SiftFileHeader &header() const { return *(const SiftFileHeader *)base; }
+  const SiftFeatureView &view() const { return features; }
+
+  // The descriptors in the panel layout of the host matcher, packed on the
+  // first call and kept with the mapping, so that repeated matching against
+  // the file scans them directly. packedDescriptors() is null for a quantized
+  // file and packedCodes() otherwise. Safe to call from several threads.
+  const PackedDescriptors *packedDescriptors() const;
+  const PackedCodes *packedCodes() const;
+
+private:
+  struct Panels;
+
+  void unmap();
+  const Panels *panels() const;
+
+  const uint8_t *base;
+  size_t size;
+  SiftFeatureView features;
+  std::unique_ptr<Panels> packed;
+};
+
+// Copies a view into a feature set, dequantizing the descriptors if needed
+void ToFeatureSet(const SiftFeatureView &src, SiftFeatureSet &dst);
+
+// Matches data1 against a feature view like MatchSiftData on the host. For a
+// quantized view the descriptors of data1 are quantized first and the integer
+// matcher is used. The descriptors of the view are packed on every call,
+// while the overload for a mapped file packs them once and reuses them for
+// all later queries.
+double MatchSiftData(SiftFeatureSet &data1, const SiftFeatureView &data2);
+double MatchSiftData(SiftFeatureSet &data1, const MappedSiftFeatures &data2);
+
+#endif
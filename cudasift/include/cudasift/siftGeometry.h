@@ -0,0 +1,173 @@
+#ifndef SIFTGEOMETRY_H
+#define SIFTGEOMETRY_H
+
+#include <cstdint>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Robust estimation of geometric models from matched     //
+// features on the host                                   //
+//********************************************************//
+
+enum RansacSampling {
+  RANSAC_UNIFORM,             // Samples drawn uniformly from all matches
+  RANSAC_PROSAC               // Samples drawn from the best matches first
+};
+
+struct RansacParams {
+  int numLoops = 1000;        // Hypotheses evaluated at most
+  float thresh = 5.0f;        // Inlier distance in pixels
+  float minScore = 0.85f;     // Matches with a higher score and a lower
+  float maxAmbiguity = 0.95f; // ambiguity take part in the estimation
+  uint32_t seed = 1;
+  // If above 0, typically 0.99 or 0.999, the estimation stops as soon as a
+  // sample of only inliers has been drawn with this probability, given the
+  // inlier ratio of the best model so far
+  float confidence = 0.0f;
+  RansacSampling sampling = RANSAC_UNIFORM;
+  // Iterations of the reweighted least-squares refinement of every new best
+  // model, 0 for plain RANSAC
+  int refineLoops = 0;
+};
+
+enum FundamentalSolver {
+  FUNDAMENTAL_7POINT,         // Up to three models from seven matches
+  FUNDAMENTAL_8POINT          // One model from eight matches, projected to rank two
+};
+
+// Pinhole camera, mapping pixels to calibrated coordinates ((x - cx)/fx,
+// (y - cy)/fy)
+struct CameraIntrinsics {
+  float fx = 1.0f, fy = 1.0f;
+  float cx = 0.0f, cy = 0.0f;
+};
+
+struct RansacResult {
+  int numInliers = 0;         // Among the matches taking part
+  int numHypotheses = 0;      // Evaluated
+};
+
+// Host counterpart of FindHomography for the matches of data, that is the
+// points with a score above params.minScore and an ambiguity below
+// params.maxAmbiguity, each mapped to (match_xpos, match_ypos). Every
+// hypothesis is solved from four random matches and scored by the number
+// of matches it maps within params.thresh pixels, counted with SIMD
+// instructions as in TestHomographies. Hypotheses are evaluated in parallel
+// on the host thread pool, each drawing its sample from its own random
+// stream derived from params.seed and its number, and the best one and the
+// adaptive termination are then decided in the order of the hypotheses, so
+// that the result only depends on the matches and parameters.
+//
+// With RANSAC_PROSAC the matches are ordered by score*(1 - ambiguity) and
+// hypothesis t samples the best n(t) of them, n(t) growing from four to all
+// matches over params.numLoops hypotheses as in PROSAC (Chum and Matas).
+// As good matches are mostly inliers, an all-inlier sample is typically
+// found within the first few hypotheses, which together with a confidence
+// ends the search far earlier than uniform sampling.
+//
+// With params.refineLoops above 0 this is LO-RANSAC (Chum, Matas and
+// Kittler): every model with more inliers than the best so far is refined by
+// iteratively reweighted least squares over the matches within twice the
+// threshold, with Cauchy weights on their distances, and replaces the best
+// unless it then has fewer inliers. The normal equations are summed with SIMD
+// instructions over blocks of matches in parallel, so the refined model and
+// its inliers come out of the same call.
+//
+// Writes the row-major homography with homography[8] = 1, the identity if
+// there are fewer than 8 matches, and if inliers is not null inliers[i] = 1
+// for the inlying points of data and 0 otherwise. Returns the time spent in
+// milliseconds.
+double EstimateHomography(const SiftData &data, float *homography, RansacResult &result,
+                          const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+double EstimateHomography(const SiftFeatureSet &data, float *homography, RansacResult &result,
+                          const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+
+// EstimateHomography for each of numSets feature sets, such as the matches
+// of many candidate image pairs, writing 9 floats per set to homographies,
+// a result per set and, if inliers is not null, the mask of set k to
+// inliers[k] unless that is null. The sets are spread over the host threads,
+// each estimated in a single thread, so that many small sets keep all cores
+// busy without the synchronization of the parallel hypotheses of single
+// calls. The results are the same as from separate calls. Returns the time
+// spent in milliseconds.
+double EstimateHomographies(const SiftData *data, int numSets, float *homographies,
+                            RansacResult *results, const RansacParams &params = RansacParams(),
+                            uint8_t *const *inliers = nullptr);
+double EstimateHomographies(const SiftFeatureSet *data, int numSets, float *homographies,
+                            RansacResult *results, const RansacParams &params = RansacParams(),
+                            uint8_t *const *inliers = nullptr);
+
+// Refines a given homography, for instance from FindHomography, by
+// max(params.refineLoops, 1) iterations of the reweighted least squares of
+// EstimateHomography, keeping it unless that maps at least as many matches
+// within params.thresh pixels. Writes inliers and result.numInliers for the
+// final homography and returns the time spent in milliseconds.
+double RefineHomography(const SiftData &data, float *homography, RansacResult &result,
+                        const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+double RefineHomography(const SiftFeatureSet &data, float *homography, RansacResult &result,
+                        const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+
+// Affine transform [a b tx; c d ty; 0 0 1] of the matches of data, by the
+// RANSAC of EstimateHomography with hypotheses from three matches, for
+// scenes that are nearly planar and far away. Writes the row-major 3 x 3
+// matrix, the identity if there are fewer than 4 matches.
+double EstimateAffine(const SiftData &data, float *affine, RansacResult &result,
+                      const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+double EstimateAffine(const SiftFeatureSet &data, float *affine, RansacResult &result,
+                      const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+
+// Similarity [a -b tx; b a ty; 0 0 1], a rotation, uniform scale and
+// translation, of the matches of data, with hypotheses from two matches.
+// Writes the row-major 3 x 3 matrix, the identity if there are fewer than 3
+// matches.
+double EstimateSimilarity(const SiftData &data, float *similarity, RansacResult &result,
+                          const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+double EstimateSimilarity(const SiftFeatureSet &data, float *similarity, RansacResult &result,
+                          const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+// As above, with hypotheses from single matches of data1 into data2, as set
+// by MatchSiftData. The scale ratio and orientation difference of the two
+// keypoints give the rotation and scale, so that a sample is all inliers
+// with the probability of one match being an inlier and a few hypotheses
+// suffice with params.confidence. As orientations are only accurate to a
+// few degrees, params.refineLoops should be set for the local optimization
+// to fit the model to all the inliers.
+double EstimateSimilarity(const SiftData &data1, const SiftData &data2, float *similarity,
+                          RansacResult &result, const RansacParams &params = RansacParams(),
+                          uint8_t *inliers = nullptr);
+double EstimateSimilarity(const SiftFeatureSet &data1, const SiftFeatureSet &data2, float *similarity,
+                          RansacResult &result, const RansacParams &params = RansacParams(),
+                          uint8_t *inliers = nullptr);
+
+// Fundamental matrix F with p2^T F p1 = 0 for the matches of data, with
+// p1 = (xpos, ypos, 1) and p2 = (match_xpos, match_ypos, 1), by the same
+// RANSAC as EstimateHomography. Hypotheses are solved by the normalized
+// seven- or eight-point algorithm in coordinates centred and scaled as for
+// the homography, and matches are inliers if their Sampson distance, a
+// first-order approximation of the distance to the epipolar lines in both
+// images, is below params.thresh pixels, tested with SIMD instructions over
+// the coordinate arrays. The local optimization minimizes the reweighted
+// algebraic error and projects back to rank two. Writes the row-major F with
+// unit Frobenius norm, all zeros if there are too few matches.
+double EstimateFundamental(const SiftData &data, float *fundamental, RansacResult &result,
+                           const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr,
+                           FundamentalSolver solver = FUNDAMENTAL_7POINT);
+double EstimateFundamental(const SiftFeatureSet &data, float *fundamental, RansacResult &result,
+                           const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr,
+                           FundamentalSolver solver = FUNDAMENTAL_7POINT);
+
+// Essential matrix E with q2^T E q1 = 0 for the calibrated coordinates q1
+// and q2 of the matches of data in the two cameras, by Nister's five-point
+// algorithm with up to ten models per sample. The Sampson distance is
+// measured in calibrated coordinates, with params.thresh divided by the mean
+// focal length, and the local optimization projects to two equal singular
+// values. Writes the row-major E with unit Frobenius norm, all zeros if
+// there are too few matches.
+double EstimateEssential(const SiftData &data, const CameraIntrinsics &camera1,
+                         const CameraIntrinsics &camera2, float *essential, RansacResult &result,
+                         const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+double EstimateEssential(const SiftFeatureSet &data, const CameraIntrinsics &camera1,
+                         const CameraIntrinsics &camera2, float *essential, RansacResult &result,
+                         const RansacParams &params = RansacParams(), uint8_t *inliers = nullptr);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SIFTINDEX_H
+#define SIFTINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Approximate nearest neighbour index over descriptors,  //
+// for matching against large feature databases           //
+//********************************************************//
+
+#define SIFT_INDEX_MAGIC "CSIFTHNS"
+#define SIFT_INDEX_VERSION 1
+
+struct SiftIndexParams {
+  int M = 16;                 // Links per point on the upper layers, 2*M on the lowest
+  int efConstruction = 200;   // Candidates kept while inserting a point
+  int efSearch = 64;          // Default candidates kept while searching
+  uint32_t seed = 1;          // Seed of the layer assignment
+};
+
+// Hierarchical navigable small world graph (Malkov and Yashunin) over the
+// descriptors and positions of any number of feature sets. Similarities are
+// descriptor dot products, as in MatchSiftData, so the descriptors should be
+// normalized. Points are numbered in the order they were added. Insertion
+// runs in parallel on the host thread pool, so graphs built from the same
+// points may differ slightly between runs, while queries on a given graph are
+// deterministic. A larger ef gives higher recall at a lower speed; ef = 64
+// typically finds the true nearest neighbour for over 95% of SIFT queries.
+//
+// Queries may run concurrently with each other, but not with add, clear or
+// assignment.
+class SiftIndex {
+public:
+  explicit SiftIndex(const SiftIndexParams &params = SiftIndexParams());
+  ~SiftIndex();
+  SiftIndex(SiftIndex &&other) noexcept;
+  SiftIndex &operator=(SiftIndex &&other) noexcept;
+  SiftIndex(const SiftIndex &) = delete;
+  SiftIndex &operator=(const SiftIndex &) = delete;
+
+  // Inserts numPts descriptors, stride floats apart, with their positions and
+  // returns the number of the first. Throws std::invalid_argument if the index
+  // would exceed INT_MAX points.
+  int add(const float *descriptors, size_t stride, const float *xpos, const float *ypos, int numPts);
+  int add(const SiftData &data);
+  int add(const SiftFeatureSet &data);
+  void clear();
+
+  int size() const { return numPts; }
+  const SiftIndexParams &params() const { return param; }
+  void setEfSearch(int ef) { param.efSearch = ef; }
+  float xpos(int i) const { return px[i]; }
+  float ypos(int i) const { return py[i]; }
+  const float *descriptor(int i) const { return &vectors[(size_t)i*128]; }
+
+  // For each of numQueries descriptors, stride floats apart, writes the k
+  // most similar points in decreasing order of similarity to
+  // indices[k*q + j] and scores[k*q + j], padded with -1 and 0 if the index
+  // holds fewer than k points. An ef of 0 means params().efSearch.
+  void search(const float *queries, size_t stride, int numQueries, int k,
+              int *indices, float *scores, int ef = 0) const;
+  void search(const SiftData &queries, int k, int *indices, float *scores, int ef = 0) const;
+  void search(const SiftFeatureSet &queries, int k, int *indices, float *scores, int ef = 0) const;
+
+  // Little-endian binary file with the parameters, descriptors, positions and
+  // graph. Throw std::runtime_error if the file cannot be written or read, or
+  // is not a valid index file of a supported version.
+  void save(const char *filename) const;
+  static SiftIndex load(const char *filename);
+
+private:
+  struct VisitedPool;
+  struct Candidate;
+
+  int *links(int i, int level) {
+    return (level ? &upper[i][(size_t)(level - 1)*(param.M + 1)] : &links0[(size_t)i*(2*param.M + 1)]);
+  }
+  const int *links(int i, int level) const { return const_cast<SiftIndex *>(this)->links(i, level); }
+  int maxLinks(int level) const { return (level ? param.M : 2*param.M); }
+  int randomLevel(int i) const;
+  void insert(int i, std::vector<std::mutex> &locks, std::mutex &entryLock);
+  int greedyClosest(const float *query, int entry, float &sim, int level, std::vector<std::mutex> *locks) const;
+  void searchLayer(const float *query, int entry, float sim, int ef, int level,
+                   std::vector<std::mutex> *locks, std::vector<Candidate> &result) const;
+  void selectNeighbours(std::vector<Candidate> &candidates, int maxNum) const;
+
+  SiftIndexParams param;
+  int numPts;
+  int entryPoint;
+  int maxLevel;
+  AlignedVector<float> vectors;         // numPts x 128
+  AlignedVector<float> px, py;
+  std::vector<int> levels;
+  std::vector<int> links0;              // Per point the count and 2*M links
+  std::vector<std::vector<int>> upper;  // Per point and upper layer the count and M links
+  std::unique_ptr<VisitedPool> visited;
+};
+
+// Matches every point of data1 against the index, filling score, ambiguity,
+// match, match_xpos and match_ypos like MatchSiftData with the two most
+// similar points found. Points without any positive similarity get
+// match = -1. Returns the time spent in milliseconds.
+double MatchSiftData(SiftData &data1, const SiftIndex &index, int ef = 0);
+double MatchSiftData(SiftFeatureSet &data1, const SiftIndex &index, int ef = 0);
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SIFTPQ_H
+#define SIFTPQ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Product quantization of descriptors and an inverted    //
+// file index over the compressed descriptors             //
+//********************************************************//
+
+#define SIFT_IVFPQ_MAGIC "CSIFTIVF"
+#define SIFT_IVFPQ_VERSION 1
+
+// Splits descriptors into numSubspaces equally long subvectors and codes each
+// by the nearest of 16 centroids trained for its subspace, so that a
+// descriptor takes numSubspaces/2 bytes: 16 bytes with the default of 32
+// subspaces of 4 elements, or 8 and 32 bytes with 16 and 64 subspaces. Two
+// codes share a byte, the even subspace in the low nibble. The 16 centroids
+// allow similarity tables of a query to be held in SIMD registers while
+// scanning, see SiftIVFPQIndex.
+class ProductQuantizer {
+public:
+  // Throws std::invalid_argument unless numSubspaces is 16, 32 or 64
+  explicit ProductQuantizer(int numSubspaces = 32);
+
+  // k-means on each subspace of numPts descriptors, stride floats apart.
+  // Throws std::invalid_argument if there are fewer than 16 descriptors.
+  void train(const float *descriptors, size_t stride, int numPts, int iterations = 20,
+             uint32_t seed = 1);
+  void train(const SiftData &data, int iterations = 20, uint32_t seed = 1);
+  void train(const SiftFeatureSet &data, int iterations = 20, uint32_t seed = 1);
+  bool trained() const { return !codebook.empty(); }
+
+  int numSubspaces() const { return M; }
+  int subspaceSize() const { return 128/M; }
+  int codeSize() const { return M/2; }
+  // numSubspaces x 16 x subspaceSize floats
+  const float *centroids() const { return codebook.data(); }
+
+  // Writes codeSize() bytes per descriptor
+  void encode(const float *descriptors, size_t stride, int numPts, uint8_t *codes) const;
+  void encode(const SiftData &data, std::vector<uint8_t> &codes) const;
+  void encode(const SiftFeatureSet &data, std::vector<uint8_t> &codes) const;
+  // Writes 128 floats per code
+  void decode(const uint8_t *codes, int numPts, float *descriptors) const;
+
+  // Dot products of the subvectors of a query with the centroids of their
+  // subspaces, numSubspaces x 16 floats. The similarity of the query to an
+  // encoded descriptor is the sum of the table entries selected by its codes.
+  void similarityTable(const float *query, float *table) const;
+
+private:
+  friend class SiftIVFPQIndex;
+  int nearest(const float *sub, int m) const;
+
+  int M;
+  AlignedVector<float> codebook;
+};
+
+struct SiftIVFPQParams {
+  int numLists = 1024;        // Coarse centroids, each with an inverted list
+  int numSubspaces = 32;      // Of the residual quantizer, see ProductQuantizer
+  int numProbes = 16;         // Default lists scanned per query
+  int rerank = 64;            // Candidates rescored with exact tables, at least k
+  int iterations = 20;        // Of k-means when training
+  uint32_t seed = 1;
+};
+
+// Inverted file index with product quantized residuals (Jegou et al.).
+// Points are assigned to the most similar of numLists coarse centroids and
+// stored as the ProductQuantizer code of their difference to it, in blocks of
+// 32 points with the codes of a subspace interleaved. A query computes the
+// similarity table of the residual quantizer once, as the dot product with a
+// point is that with its coarse centroid plus that with the residual. The
+// numProbes lists with the most similar centroids are scanned with the table
+// quantized to 8 bits and held in SIMD registers, looking up the codes of 32
+// points per shuffle instruction (Andre et al.). The best rerank candidates
+// are finally rescored with the float table. With the defaults a point takes
+// 16 bytes for its codes, 4 for its number and 8 for its position.
+//
+// Queries may run concurrently with each other, but not with train, add,
+// clear or assignment.
+class SiftIVFPQIndex {
+public:
+  // Throws std::invalid_argument for invalid parameters
+  explicit SiftIVFPQIndex(const SiftIVFPQParams &params = SiftIVFPQParams());
+
+  // Trains the coarse centroids and the residual quantizer on a sample of
+  // descriptors, typically a few hundred per list. Removes all points. Throws
+  // std::invalid_argument if there are fewer descriptors than lists.
+  void train(const float *descriptors, size_t stride, int numPts);
+  void train(const SiftData &data);
+  void train(const SiftFeatureSet &data);
+  bool trained() const { return pq.trained(); }
+
+  // Appends points and returns the number of the first, as in SiftIndex.
+  // Throws std::runtime_error if the index is not trained and
+  // std::invalid_argument if it would exceed INT_MAX points.
+  int add(const float *descriptors, size_t stride, const float *xpos, const float *ypos, int numPts);
+  int add(const SiftData &data);
+  int add(const SiftFeatureSet &data);
+  // Removes all points, keeping the training
+  void clear();
+
+  int size() const { return numPts; }
+  const SiftIVFPQParams &params() const { return param; }
+  void setNumProbes(int numProbes) { param.numProbes = numProbes; }
+  const ProductQuantizer &quantizer() const { return pq; }
+  float xpos(int i) const { return px[i]; }
+  float ypos(int i) const { return py[i]; }
+
+  // As SiftIndex::search, with similarities approximated from the codes. A
+  // numProbes of 0 means params().numProbes.
+  void search(const float *queries, size_t stride, int numQueries, int k,
+              int *indices, float *scores, int numProbes = 0) const;
+  void search(const SiftData &queries, int k, int *indices, float *scores, int numProbes = 0) const;
+  void search(const SiftFeatureSet &queries, int k, int *indices, float *scores, int numProbes = 0) const;
+
+  // As SiftIndex::save and load
+  void save(const char *filename) const;
+  static SiftIVFPQIndex load(const char *filename);
+
+private:
+  struct List {
+    AlignedVector<uint8_t> blocks;   // Per block of 32 points and subspace 16 bytes
+    std::vector<int> ids;
+  };
+  void probe(const float *query, int numProbes, int *lists, float *offsets) const;
+
+  SiftIVFPQParams param;
+  int numPts;
+  AlignedVector<float> coarse;       // numLists x 128
+  AlignedVector<float> coarseDirs;   // Unit length directions of the coarse centroids
+  ProductQuantizer pq;
+  std::vector<List> lists;
+  AlignedVector<float> px, py;
+};
+
+// As MatchSiftData with a SiftIndex
+double MatchSiftData(SiftData &data1, const SiftIVFPQIndex &index, int numProbes = 0);
+double MatchSiftData(SiftFeatureSet &data1, const SiftIVFPQIndex &index, int numProbes = 0);
+
+#endif
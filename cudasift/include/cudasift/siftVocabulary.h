@@ -0,0 +1,127 @@
+#ifndef SIFTVOCABULARY_H
+#define SIFTVOCABULARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Vocabulary tree of visual words and an inverted file   //
+// database for retrieving similar images                 //
+//********************************************************//
+
+#define SIFT_VOCABULARY_MAGIC "CSIFTVOC"
+#define SIFT_VOCABULARY_VERSION 1
+
+struct SiftVocabularyParams {
+  int branching = 10;         // Children per node
+  int depth = 6;              // Levels below the root, at most branching^depth words
+  int iterations = 10;        // Of k-means at every node
+  uint32_t seed = 1;
+};
+
+// Word of a bag-of-words vector and its tf-idf weight
+struct SiftBowEntry {
+  int word;
+  float weight;
+};
+// Sorted by word, with weights summing to one
+typedef std::vector<SiftBowEntry> SiftBowVector;
+
+// Hierarchical k-means tree (Nister and Stewenius) over normalized
+// descriptors. Every node splits its training descriptors into branching
+// clusters by spherical k-means, down to depth levels or to nodes with too
+// few descriptors to split, and the leaves are the words. A descriptor is
+// quantized by descending to the child with the most similar centroid, at a
+// cost of branching*depth dot products. Words are weighted by their smoothed
+// inverse document frequency log((N + 1)/(N_i + 1)) + 1 among the N training
+// images, N_i of which contain word i. Training runs in parallel on the host
+// thread pool and only depends on the descriptors, parameters and seed.
+class SiftVocabulary {
+public:
+  // Throws std::invalid_argument for invalid parameters
+  explicit SiftVocabulary(const SiftVocabularyParams &params = SiftVocabularyParams());
+
+  // Trains on numImages images whose descriptors, stride floats apart, are
+  // offsets[i] to offsets[i + 1] - 1. Throws std::invalid_argument if there
+  // are fewer descriptors than params().branching.
+  void train(const float *descriptors, size_t stride, const int *offsets, int numImages);
+  void train(const SiftData *images, int numImages);
+  void train(const SiftFeatureSet *images, int numImages);
+  bool trained() const { return !words.empty(); }
+
+  const SiftVocabularyParams &params() const { return param; }
+  int numWords() const { return (int)weights.size(); }
+  float weight(int word) const { return weights[word]; }
+
+  // Writes the word of each of numPts descriptors, stride floats apart
+  void quantize(const float *descriptors, size_t stride, int numPts, int *result) const;
+  // Weighted histogram of the words of an image
+  void transform(const float *descriptors, size_t stride, int numPts, SiftBowVector &bow) const;
+  void transform(const SiftData &data, SiftBowVector &bow) const;
+  void transform(const SiftFeatureSet &data, SiftBowVector &bow) const;
+
+  // Little-endian binary file with the parameters, tree and weights. Throw
+  // std::runtime_error if the file cannot be written or read, or is not a
+  // valid vocabulary file of a supported version.
+  void save(const char *filename) const;
+  static SiftVocabulary load(const char *filename);
+
+private:
+  SiftVocabularyParams param;
+  AlignedVector<float> centers;   // numNodes x 128 unit directions, zero for the root
+  std::vector<int> children;      // Per node the first child, or -1 for a leaf
+  std::vector<int> numChildren;
+  std::vector<int> words;         // Per node the word, or -1 for an inner node
+  std::vector<float> weights;     // Per word
+};
+
+// Inverted files of the bag-of-words vectors of a growing set of images,
+// numbered in the order they were added. Images are scored against a query
+// by the L1 distance of their normalized vectors, as the similarity
+// sum_i min(q_i, d_i) in [0, 1], which only involves the words they share.
+// A query visits the inverted files of its words, with the images split
+// into ranges scored in parallel, so only the short list of best candidates
+// needs full descriptor matching. The vocabulary must outlive the database.
+//
+// Queries may run concurrently with each other, but not with add or clear.
+class SiftImageDatabase {
+public:
+  // Throws std::invalid_argument if the vocabulary is not trained
+  explicit SiftImageDatabase(const SiftVocabulary &vocabulary);
+
+  // Adds an image and returns its number
+  int add(const SiftBowVector &bow);
+  int add(const float *descriptors, size_t stride, int numPts);
+  int add(const SiftData &data);
+  int add(const SiftFeatureSet &data);
+  void clear();
+
+  int size() const { return numImages; }
+  const SiftVocabulary &vocabulary() const { return *voc; }
+
+  // Writes the numResults most similar of the first maxImage images (all if
+  // maxImage < 0) in decreasing order of similarity to images and scores,
+  // padded with -1 and 0. Returns the number of images found, which only
+  // includes images sharing words with the query.
+  int query(const SiftBowVector &bow, int numResults, int *images, float *scores,
+            int maxImage = -1) const;
+  int query(const SiftData &data, int numResults, int *images, float *scores,
+            int maxImage = -1) const;
+  int query(const SiftFeatureSet &data, int numResults, int *images, float *scores,
+            int maxImage = -1) const;
+
+private:
+  struct Posting {
+    int image;
+    float weight;
+  };
+
+  const SiftVocabulary *voc;
+  int numImages;
+  std::vector<std::vector<Posting>> files;   // Per word, in order of image
+};
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef TEMPMEMORYPOOL_H
+#define TEMPMEMORYPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "cudasift/cudaSift.h"
+
+//********************************************************//
+// Pool of scratch memory for ExtractSift, so that images //
+// of recurring sizes do not reallocate on every call     //
+//********************************************************//
+
+// Buffers are keyed by the scaled image size (doubled if scaleUp is set), the
+// number of octaves and the allocator context, e.g. the current device. A
+// request is served by an idle buffer with the same key, or else by the
+// smallest idle buffer of the same context and number of octaves that is at
+// least as large, restricted to the requested size with setSize. Otherwise a
+// new buffer is allocated, after evicting least recently used idle buffers
+// until it fits within the capacity. Buffers in use are never evicted, so the
+// pool can temporarily exceed its capacity; it shrinks back on release.
+//
+// An Allocator provides
+//   typedef ... Memory;    // with setSize(int width, int height)
+//   int context() const;
+//   size_t bytes(int width, int height, int numOctaves) const;
+//   std::unique_ptr<Memory> allocate(int width, int height, int numOctaves) const;
+// where sizes are already scaled. All members of the pool are thread-safe.
+template <class Allocator>
+class TempMemoryPoolT {
+  struct Entry;
+
+public:
+  typedef typename Allocator::Memory Memory;
+  static constexpr size_t defaultCapacity = (size_t)1 << 30;
+
+  struct Stats {
+    size_t hits = 0;        // Served by a buffer of the same size
+    size_t resized = 0;     // Served by a larger buffer
+    size_t misses = 0;      // Newly allocated
+    size_t evictions = 0;
+  };
+
+  // Exclusive use of a pooled buffer, returned to the pool on destruction.
+  // Work queued on the buffer, e.g. on a CUDA stream, must have completed by
+  // then.
+  class Lease {
+  public:
+    Lease() : pool(nullptr), entry(nullptr) {}
+    Lease(Lease &&other) noexcept : pool(other.pool), entry(other.entry) {
+      other.pool = nullptr;
+      other.entry = nullptr;
+    }
+    Lease &operator=(Lease &&other) noexcept {
+      if (&other != this) {
+        release();
+        pool = other.pool;
+        entry = other.entry;
+        other.pool = nullptr;
+        other.entry = nullptr;
+      }
+      return *this;
+    }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    ~Lease() { release(); }
+
+    Memory &operator*() const { return *entry->memory; }
+    Memory *operator->() const { return entry->memory.get(); }
+    Memory *get() const { return entry ? entry->memory.get() : nullptr; }
+    explicit operator bool() const { return entry!=nullptr; }
+
+    void release() {
+      if (pool)
+        pool->release(entry);
+      pool = nullptr;
+      entry = nullptr;
+    }
+
+  private:
+    friend class TempMemoryPoolT;
+    Lease(TempMemoryPoolT *pool_, Entry *entry_) : pool(pool_), entry(entry_) {}
+
+    TempMemoryPoolT *pool;
+    Entry *entry;
+  };
+
+  explicit TempMemoryPoolT(size_t capacity = defaultCapacity, Allocator allocator = Allocator())
+    : alloc(std::move(allocator)), capacity(capacity), total(0), clock(0) {}
+  TempMemoryPoolT(const TempMemoryPoolT &) = delete;
+  TempMemoryPoolT &operator=(const TempMemoryPoolT &) = delete;
+  // All leases must have been released
+  ~TempMemoryPoolT() = default;
+
+  Lease acquire(int width, int height, int numOctaves, bool scaleUp = false) {
+    const int w = width*(scaleUp ? 2 : 1);
+    const int h = height*(scaleUp ? 2 : 1);
+    const int context = alloc.context();
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry *best = nullptr;
+    for (Entry &e : entries) {
+      if (e.inUse || e.context!=context || e.numOctaves!=numOctaves || e.width<w || e.height<h)
+        continue;
+      if (best==nullptr || e.bytes<best->bytes || (e.width==w && e.height==h))
+        best = &e;
+      if (e.width==w && e.height==h)
+        break;
+    }
+    if (best) {
+      if (best->width==w && best->height==h)
+        stats_.hits++;
+      else
+        stats_.resized++;
+      best->inUse = true;
+      best->lastUse = ++clock;
+      best->memory->setSize(w, h);
+      return Lease(this, best);
+    }
+
+    // Reserve the size before allocating outside the lock
+    const size_t bytes = alloc.bytes(w, h, numOctaves);
+    evict(bytes);
+    total += bytes;
+    stats_.misses++;
+    lock.unlock();
+    std::unique_ptr<Memory> memory;
+    try {
+      memory = alloc.allocate(w, h, numOctaves);
+    } catch (...) {
+      lock.lock();
+      total -= bytes;
+      throw;
+    }
+    lock.lock();
+    entries.emplace_back();
+    Entry &e = entries.back();
+    e.memory = std::move(memory);
+    e.context = context;
+    e.width = w;
+    e.height = h;
+    e.numOctaves = numOctaves;
+    e.bytes = bytes;
+    e.inUse = true;
+    e.lastUse = ++clock;
+    return Lease(this, &e);
+  }
+
+  // Frees idle buffers until the pool holds at most capacity bytes
+  void setCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+    evict(0);
+  }
+
+  // Frees all idle buffers
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it!=entries.end();) {
+      if (it->inUse) {
+        ++it;
+        continue;
+      }
+      total -= it->bytes;
+      it = entries.erase(it);
+    }
+  }
+
+  size_t getCapacity() const { std::lock_guard<std::mutex> lock(mutex); return capacity; }
+  // Bytes held, including buffers in use and allocations in progress
+  size_t size() const { std::lock_guard<std::mutex> lock(mutex); return total; }
+  size_t count() const { std::lock_guard<std::mutex> lock(mutex); return entries.size(); }
+  Stats stats() const { std::lock_guard<std::mutex> lock(mutex); return stats_; }
+
+private:
+  struct Entry {
+    std::unique_ptr<Memory> memory;
+    int context;
+    int width, height;
+    int numOctaves;
+    size_t bytes;
+    bool inUse;
+    uint64_t lastUse;
+  };
+
+  void release(Entry *entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entry->inUse = false;
+    entry->lastUse = ++clock;
+    evict(0);
+  }
+
+  // Evicts idle buffers in LRU order until extra more bytes fit. Called with
+  // the mutex held.
+  void evict(size_t extra) {
+    while (total + extra > capacity) {
+      auto lru = entries.end();
+      for (auto it = entries.begin(); it!=entries.end(); ++it)
+        if (!it->inUse && (lru==entries.end() || it->lastUse<lru->lastUse))
+          lru = it;
+      if (lru==entries.end())
+        return;
+      total -= lru->bytes;
+      entries.erase(lru);
+      stats_.evictions++;
+    }
+  }
+
+  Allocator alloc;
+  mutable std::mutex mutex;
+  std::list<Entry> entries;   // Stable addresses for the leases
+  size_t capacity;
+  size_t total;
+  uint64_t clock;
+  Stats stats_;
+};
+
+// Device buffers on the current device
+struct DeviceTempMemoryAllocator {
+  typedef TempMemory Memory;
+  int context() const;
+  size_t bytes(int width, int height, int numOctaves) const;
+  std::unique_ptr<TempMemory> allocate(int width, int height, int numOctaves) const;
+};
+
+struct HostTempMemoryAllocator {
+  typedef HostTempMemory Memory;
+  int context() const { return 0; }
+  size_t bytes(int width, int height, int numOctaves) const {
+    return HostTempMemory::requiredSize(width, height, numOctaves);
+  }
+  std::unique_ptr<HostTempMemory> allocate(int width, int height, int numOctaves) const {
+    return std::unique_ptr<HostTempMemory>(new HostTempMemory(width, height, numOctaves));
+  }
+};
+
+typedef TempMemoryPoolT<DeviceTempMemoryAllocator> TempMemoryPool;
+typedef TempMemoryPoolT<HostTempMemoryAllocator> HostTempMemoryPool;
+
+// Pools used by the ExtractSift overloads without explicit scratch memory.
+// The device pool is never destroyed, as the CUDA runtime may already be shut
+// down at exit; call clear() to free its buffers earlier.
+TempMemoryPool &GlobalTempMemoryPool();
+HostTempMemoryPool &GlobalHostTempMemoryPool();
+
+#endif
@@ -358,6 +358,7 @@ __device__ void normalize(float *buffer, float *desc, int idx,
         acc += data->data[offset + idx * 128 + i] * buffer[i];
       __syncthreads();
       buffer[idx] = acc;
+      offset += 128 * 128;
     } break;
     case 7: {
       const float v = buffer[idx];
@@ -368,6 +369,57 @@ __device__ void normalize(float *buffer, float *desc, int idx,
   __syncthreads();
 }
 
+// Sum of one value per thread over the 128 threads of a descriptor block.
+// Consecutive calls must alternate between the two halves of sums.
+__device__ float DescriptorSum(float sum, float *sums, int idx)
+{
+  for (int i = 16; i > 0; i /= 2)
+    sum += ShiftDown(sum, i);
+  if ((idx & 31) == 0)
+    sums[idx / 32] = sum;
+  __syncthreads();
+  return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+// Fused version of normalize() for the step lists of NormalizerTraits. The
+// element stays in a register, the scalars are read once and only the
+// reductions and the whitening need barriers.
+template <int Preset>
+__device__ void NormalizeDescriptor(float *buffer, float *desc, int idx,
+                                    const DescriptorNormalizerData *normalizer) {
+  typedef NormalizerTraits<Preset> Traits;
+  __shared__ float sums[2][4];
+  const float *data = normalizer->data;
+  float v = buffer[idx];
+  const float threshold = data[0] * sqrtf(DescriptorSum(v * v, sums[0], idx));
+  v = fminf(fmaxf(v, -threshold), threshold);
+  float norm = (Traits::firstL1 ? DescriptorSum(fabsf(v), sums[1], idx)
+                                : sqrtf(DescriptorSum(v * v, sums[1], idx)));
+  v = v / norm;
+  if (Traits::whiten) {
+    buffer[idx] = v + data[1 + idx];
+    __syncthreads();
+    const float *zca = data + 1 + 128 + idx * 128;
+    float acc = 0.f;
+    for (int i = 0; i < 128; ++i)
+      acc += zca[i] * buffer[i];
+    norm = (Traits::secondL1 ? DescriptorSum(fabsf(acc), sums[0], idx)
+                             : sqrtf(DescriptorSum(acc * acc, sums[0], idx)));
+    v = acc / norm;
+    if (Traits::signedSqrt)
+      v = v < 0.f ? -sqrtf(-v) : sqrtf(v);
+  }
+  desc[idx] = v;
+  __syncthreads();
+}
+
+template <>
+__device__ void NormalizeDescriptor<NORMALIZER_CUSTOM>(float *buffer, float *desc, int idx,
+                                                       const DescriptorNormalizerData *normalizer) {
+  normalize(buffer, desc, idx, normalizer);
+}
+
+template <int Preset>
 __global__ void
 ExtractSiftDescriptorsCONSTNew(cudaTextureObject_t texObj, SiftPoint *d_sift,
                                const DescriptorNormalizerData *normalizer_d,
@@ -452,7 +504,7 @@ ExtractSiftDescriptorsCONSTNew(cudaTextureObject_t texObj, SiftPoint *d_sift,
       }
     }
     __syncthreads();
-    normalize(buffer, d_sift[bx].data, idx, normalizer_d);
+    NormalizeDescriptor<Preset>(buffer, d_sift[bx].data, idx, normalizer_d);
     if (idx == 0) {
       d_sift[bx].xpos *= subsampling;
       d_sift[bx].ypos *= subsampling;
@@ -13,6 +13,9 @@
 #include "cudasift/cudaSift.h"
 #include "cudasift/cudaSiftD.h"
 #include "cudasift/cudaSiftH.h"
+#include "cudasift/deviceProfiler.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/tempMemoryPool.h"
 
 #include "cudaSiftD.cu"
 
@@ -28,17 +31,16 @@ void InitCuda(int maxPts, int numOctaves, float initBlur, int devNum)
   deviceInit(devNum);
   cudaDeviceProp prop;
   cudaGetDeviceProperties(&prop, devNum);
-  printf("Device Number: %d\n", devNum);
-  printf("  Device name: %s\n", prop.name);
-  printf("  Memory Clock Rate (MHz): %d\n", prop.memoryClockRate/1000);
-  printf("  Memory Bus Width (bits): %d\n", prop.memoryBusWidth);
-  printf("  Peak Memory Bandwidth (GB/s): %.1f\n\n",
-     2.0*prop.memoryClockRate*(prop.memoryBusWidth/8)/1.0e6);
-  printf("Initializing constant memory. \n"
-         "This operation shouldn't be performed while SIFT extraction "
-         "is running.\n");
-  float variance = 0.5f;
-  float scale = max(initBlur, 0.001f);
+  // Device information goes to stderr, leaving stdout to the caller
+  fprintf(stderr, "Device Number: %d\n", devNum);
+  fprintf(stderr, "  Device name: %s\n", prop.name);
+  fprintf(stderr, "  Memory Clock Rate (MHz): %d\n", prop.memoryClockRate/1000);
+  fprintf(stderr, "  Memory Bus Width (bits): %d\n", prop.memoryBusWidth);
+  fprintf(stderr, "  Peak Memory Bandwidth (GB/s): %.1f\n\n",
+          2.0*prop.memoryClockRate*(prop.memoryBusWidth/8)/1.0e6);
+  fprintf(stderr, "Initializing constant memory. \n"
+          "This operation shouldn't be performed while SIFT extraction "
+          "is running.\n");
   {
     safeCall(cudaMemcpyToSymbol(d_MaxNumPoints, &maxPts,
                                 sizeof(int), 0, cudaMemcpyHostToDevice));
@@ -52,26 +54,13 @@ void InitCuda(int maxPts, int numOctaves, float initBlur, int devNum)
   }
   {
     float h_Kernel[5];
-    float kernelSum = 0.0f;
-    for (int j=0;j<5;j++) {
-      h_Kernel[j] = (float)expf(-(double)(j-2)*(j-2)/2.0/variance);
-      kernelSum += h_Kernel[j];
-    }
-    for (int j=0;j<5;j++)
-      h_Kernel[j] /= kernelSum;
+    PrepareScaleDownKernel(h_Kernel);
     safeCall(cudaMemcpyToSymbol(d_ScaleDownKernel, h_Kernel, sizeof(h_Kernel),
                                 0, cudaMemcpyHostToDevice));
   }
   {
     float kernel[2*LOWPASS_R+1];
-    float kernelSum = 0.0f;
-    float ivar2 = 1.0f/(2.0f*scale*scale);
-    for (int j=-LOWPASS_R;j<=LOWPASS_R;j++) {
-      kernel[j+LOWPASS_R] = (float)expf(-(double)j*j*ivar2);
-      kernelSum += kernel[j+LOWPASS_R];
-    }
-    for (int j=-LOWPASS_R;j<=LOWPASS_R;j++)
-      kernel[j+LOWPASS_R] /= kernelSum;
+    PrepareLowPassKernel(initBlur, kernel);
     safeCall(cudaMemcpyToSymbol(d_LowPassKernel, kernel, sizeof(kernel),
                                 0, cudaMemcpyHostToDevice));
   }
@@ -88,9 +77,66 @@ void forOctaves(int width, int height, int num_octaves, T &&cb) {
   }
 }
 
+size_t TempMemory::requiredSize(int width, int height, int num_octaves, bool scale_up) {
+  width *= (scale_up ? 2 : 1);
+  height *= (scale_up ? 2 : 1);
+  const int nd = NUM_SCALES + 3;
+  size_t size = 0;
+  forOctaves(width, height, num_octaves,
+             [&size](int, int, int h, int p) {
+    size += (nd + 1)*h*p;
+    return true;
+  });
+  return (size+4095)/4096*4096*sizeof(float) + (8*2+1)*sizeof(unsigned int);
+}
+
 void TempMemory::setSize(int w, int h) {
+  if (w==restrict_width && h==restrict_height)
+    return;
   restrict_width = w;
   restrict_height = h;
+  createTextures();
+}
+
+// Texture objects of the octave images with the restricted sizes, so that
+// clamped reads stop at the borders of the current image rather than at those
+// of the allocated buffer, whose remaining area holds old data
+void TempMemory::createTextures() {
+  for (auto tex : textures)
+    safeCall(cudaDestroyTextureObject(tex));
+  textures.clear();
+  float *img_offset = imageBuffer();
+  int rw = restrict_width, rh = restrict_height;
+  forOctaves(width, height, num_octaves,
+             [&](int i, int, int h, int p) {
+    if (i == num_octaves)
+      return false;
+    // Specify texture
+    struct cudaResourceDesc resDesc;
+    memset(&resDesc, 0, sizeof(resDesc));
+    resDesc.resType = cudaResourceTypePitch2D;
+    resDesc.res.pitch2D.devPtr = img_offset;
+    resDesc.res.pitch2D.width = rw;
+    resDesc.res.pitch2D.height = rh;
+    resDesc.res.pitch2D.pitchInBytes = p * sizeof(float);
+    resDesc.res.pitch2D.desc = cudaCreateChannelDesc<float>();
+    // Specify texture object parameters
+    struct cudaTextureDesc texDesc;
+    memset(&texDesc, 0, sizeof(texDesc));
+    texDesc.addressMode[0] = cudaAddressModeClamp;
+    texDesc.addressMode[1] = cudaAddressModeClamp;
+    texDesc.filterMode = cudaFilterModeLinear;
+    texDesc.readMode = cudaReadModeElementType;
+    texDesc.normalizedCoords = 0;
+    // Create texture object
+    cudaTextureObject_t texObj = 0;
+    cudaCreateTextureObject(&texObj, &resDesc, &texDesc, nullptr);
+    textures.push_back(texObj);
+    img_offset += h*p;
+    rw /= 2;
+    rh /= 2;
+    return true;
+  });
 }
 
 CudaImage TempMemory::image(int octave, cudaStream_t stream) const {
@@ -120,9 +166,7 @@ TempMemory::TempMemory(int width_, int height_, int num_octaves_, bool scale_up)
       height(height_*(scale_up ? 2 : 1)),
       restrict_width(width), restrict_height(height),
       num_octaves(num_octaves_) {
-#ifdef VERBOSE
-  TimerGPU timer(0);
-#endif
+  ProfileScope profile(PROFILE_ALLOCATE);
   const int nd = NUM_SCALES + 3;
   size_t images_size = 0;
   laplace_buffer_size = 0;
@@ -135,40 +179,8 @@ TempMemory::TempMemory(int width_, int height_, int num_octaves_, bool scale_up)
   size_t pitch;
   const size_t size = images_size + laplace_buffer_size;
   safeCall(cudaMallocPitch((void **)&d_data, &pitch, (size_t)4096, (size+4095)/4096*sizeof(float)));
-#ifdef VERBOSE
-  printf("Allocated memory size: %d bytes\n", size);
-  printf("Memory allocation time =      %.2f ms\n\n", timer.read());
-#endif
 
-  float *img_offset = imageBuffer();
-  forOctaves(width, height, num_octaves,
-             [this, &img_offset](int i, int w, int h, int p) {
-    if (i == num_octaves)
-      return false;
-    // Specify texture
-    struct cudaResourceDesc resDesc;
-    memset(&resDesc, 0, sizeof(resDesc));
-    resDesc.resType = cudaResourceTypePitch2D;
-    resDesc.res.pitch2D.devPtr = img_offset;
-    resDesc.res.pitch2D.width = w;
-    resDesc.res.pitch2D.height = h;
-    resDesc.res.pitch2D.pitchInBytes = p * sizeof(float);
-    resDesc.res.pitch2D.desc = cudaCreateChannelDesc<float>();
-    // Specify texture object parameters
-    struct cudaTextureDesc texDesc;
-    memset(&texDesc, 0, sizeof(texDesc));
-    texDesc.addressMode[0] = cudaAddressModeClamp;
-    texDesc.addressMode[1] = cudaAddressModeClamp;
-    texDesc.filterMode = cudaFilterModeLinear;
-    texDesc.readMode = cudaReadModeElementType;
-    texDesc.normalizedCoords = 0;
-    // Create texture object
-    cudaTextureObject_t texObj = 0;
-    cudaCreateTextureObject(&texObj, &resDesc, &texDesc, nullptr);
-    textures.push_back(texObj);
-    img_offset += h*p;
-    return true;
-  });
+  createTextures();
 
   d_PointCounter = nullptr;
   safeCall(cudaMalloc(&d_PointCounter, (8*2+1)*sizeof(*d_PointCounter)));
@@ -216,63 +228,100 @@ void ExtractSift(DeviceSiftData &siftData,
                  const CudaImage &img, int numOctaves, float thresh,
                  float lowestScale, bool scaleUp, TempMemory &tempMemory,
                  cudaStream_t stream) {
-//  TimerGPU timer(stream);
+  StreamProfiler profiler(stream);
+  DeviceProfileScope profile(profiler, PROFILE_EXTRACT);
   safeCall(cudaMemsetAsync(tempMemory.pointCounter(), 0, (8*2+1)*sizeof(int), stream));
 
   int width = img.width*(scaleUp ? 2 : 1);
   int height = img.height*(scaleUp ? 2 : 1);
 
   CudaImage lowImg = tempMemory.image(numOctaves, stream);
-  if (!scaleUp) {
-    LowPass(lowImg, img, stream);
-//    TimerGPU timer1(stream);
-    ExtractSiftLoop(siftData, lowImg, d_normalizer, numOctaves, 0.0f, thresh, lowestScale, 1.0f, tempMemory, stream);
-    safeCall(cudaMemcpyAsync(&siftData.numPts, &tempMemory.pointCounter()[2*numOctaves],
-             sizeof(int), cudaMemcpyDeviceToHost, stream));
-    safeCall(cudaStreamSynchronize(stream));
-    siftData.numPts = (siftData.numPts<siftData.maxPts ? siftData.numPts : siftData.maxPts);
-//    printf("SIFT extraction time =        %.2f ms %d\n", timer1.read(), siftData.numPts);
-  } else {
+  if (scaleUp) {
     CudaImage upImg;
     upImg.Allocate(width, height, lowImg.pitch, false, tempMemory.laplaceBuffer(), nullptr, stream);
-//    TimerGPU timer1(stream);
-    ScaleUp(upImg, img, stream);
+    {
+      DeviceProfileScope stage(profiler, PROFILE_SCALE_UP);
+      ScaleUp(upImg, img, stream);
+    }
+    DeviceProfileScope stage(profiler, PROFILE_LOW_PASS);
     LowPass(lowImg, upImg, stream);
-    ExtractSiftLoop(siftData, lowImg, d_normalizer, numOctaves, 0.0f, thresh, lowestScale*2.0f,
-                    1.0f, tempMemory, stream);
-    safeCall(cudaMemcpyAsync(&siftData.numPts, &tempMemory.pointCounter()[2*numOctaves],
+  } else {
+    DeviceProfileScope stage(profiler, PROFILE_LOW_PASS);
+    LowPass(lowImg, img, stream);
+  }
+  ExtractSiftLoop(siftData, lowImg, d_normalizer, numOctaves, 0.0f, thresh,
+                  lowestScale*(scaleUp ? 2.0f : 1.0f), 1.0f, tempMemory, profiler, stream);
+  // The cumulative point counts of all octaves are only needed for profiling
+  unsigned int counts[8*2+1] = {0};
+  if (profiler.active())
+    safeCall(cudaMemcpyAsync(counts, tempMemory.pointCounter(), sizeof(counts),
+                             cudaMemcpyDeviceToHost, stream));
+  else
+    safeCall(cudaMemcpyAsync(&counts[2*numOctaves], &tempMemory.pointCounter()[2*numOctaves],
                              sizeof(int), cudaMemcpyDeviceToHost, stream));
-    safeCall(cudaStreamSynchronize(stream));
-    siftData.numPts = (siftData.numPts<siftData.maxPts ? siftData.numPts : siftData.maxPts);
-    if (siftData.numPts > 0)
-      RescalePositions(siftData, 0.5f, stream);
-//    printf("SIFT extraction time =        %.2f ms\n", timer1.read());
+  SynchronizeStream(stream);
+  siftData.numPts = (counts[2*numOctaves]<(unsigned int)siftData.maxPts ? counts[2*numOctaves] : siftData.maxPts);
+  if (profiler.active()) {
+    for (int octave=1;octave<=numOctaves;octave++) {
+      unsigned int fstPts = std::min(counts[2*octave-1], (unsigned int)siftData.maxPts);
+      unsigned int totPts = std::min(counts[2*octave+1], (unsigned int)siftData.maxPts);
+      profiler.setPoints(PROFILE_OCTAVE, octave, totPts - fstPts);
+    }
+    profiler.setPoints(PROFILE_EXTRACT, -1, siftData.numPts);
   }
-//  double totTime = timer.read();
-//  printf("Incl prefiltering & memcpy =  %.2f ms %d\n\n", totTime, siftData.numPts);
+  if (scaleUp && siftData.numPts > 0) {
+    DeviceProfileScope stage(profiler, PROFILE_RESCALE);
+    RescalePositions(siftData, 0.5f, stream);
+  }
+}
+
+void ExtractSift(DeviceSiftData &siftData,
+                 const DeviceDescriptorNormalizerData &d_normalizer,
+                 const CudaImage &img, int numOctaves, float thresh,
+                 float lowestScale, bool scaleUp, cudaStream_t stream) {
+  // The scratch memory is no longer accessed by the device once this returns
+  auto tmp = GlobalTempMemoryPool().acquire(img.width, img.height, numOctaves, scaleUp);
+  ExtractSift(siftData, d_normalizer, img, numOctaves, thresh,
+              lowestScale, scaleUp, *tmp, stream);
+}
+
+int DeviceTempMemoryAllocator::context() const {
+  int device = 0;
+  safeCall(cudaGetDevice(&device));
+  return device;
+}
+
+size_t DeviceTempMemoryAllocator::bytes(int width, int height, int numOctaves) const {
+  return TempMemory::requiredSize(width, height, numOctaves);
+}
+
+std::unique_ptr<TempMemory> DeviceTempMemoryAllocator::allocate(int width, int height, int numOctaves) const {
+  return std::unique_ptr<TempMemory>(new TempMemory(width, height, numOctaves));
+}
+
+TempMemoryPool &GlobalTempMemoryPool() {
+  static TempMemoryPool *pool = new TempMemoryPool();
+  return *pool;
 }
 
 int ExtractSiftLoop(DeviceSiftData &siftData, const CudaImage &img,
                     const DeviceDescriptorNormalizerData &d_normalizer,
                     int numOctaves, double initBlur, float thresh, float lowestScale,
-                    float subsampling, TempMemory &memoryTmp, cudaStream_t stream)
+                    float subsampling, TempMemory &memoryTmp, StreamProfiler &profiler,
+                    cudaStream_t stream)
 {
-#ifdef VERBOSE
-  TimerGPU timer(stream);
-#endif
   if (numOctaves>1) {
     CudaImage subImg = memoryTmp.image(numOctaves - 1, stream);
-    ScaleDown(subImg, img, stream);
+    {
+      DeviceProfileScope stage(profiler, PROFILE_SCALE_DOWN, numOctaves - 1);
+      ScaleDown(subImg, img, stream);
+    }
     float totInitBlur = (float)sqrt(initBlur*initBlur + 0.5f*0.5f) / 2.0f;
     ExtractSiftLoop(siftData, subImg, d_normalizer, numOctaves-1, totInitBlur, thresh,
-                    lowestScale, subsampling*2.0f, memoryTmp, stream);
+                    lowestScale, subsampling*2.0f, memoryTmp, profiler, stream);
   }
   ExtractSiftOctave(siftData, img, d_normalizer, numOctaves, thresh, lowestScale,
-                    subsampling, memoryTmp, stream);
-#ifdef VERBOSE
-  double totTime = timer.read();
-  printf("ExtractSift time total =      %.2f ms %d\n\n", totTime, numOctaves);
-#endif
+                    subsampling, memoryTmp, profiler, stream);
   return 0;
 }
 
@@ -280,15 +329,10 @@ void ExtractSiftOctave(DeviceSiftData &siftData, const CudaImage &img,
                        const DeviceDescriptorNormalizerData &d_normalizer,
                        int octave, float thresh, float lowestScale,
                        float subsampling, TempMemory &memoryTmp,
-                       cudaStream_t stream)
+                       StreamProfiler &profiler, cudaStream_t stream)
 {
   const int nd = NUM_SCALES + 3;
-#ifdef VERBOSE
-  safeCall(cudaGetSymbolAddress((void**)&tempMemory.pointCounter(), d_PointCounter));
-  unsigned int fstPts, totPts;
-  safeCall(cudaMemcpy(&fstPts, &tempMemory.pointCounter()[2*octave-1], sizeof(int), cudaMemcpyDeviceToHost));
-  TimerGPU timer0;
-#endif
+  DeviceProfileScope profile(profiler, PROFILE_OCTAVE, octave);
   CudaImage diffImg[nd];
   int w = img.width;
   int h = img.height;
@@ -300,29 +344,23 @@ void ExtractSiftOctave(DeviceSiftData &siftData, const CudaImage &img,
 
   auto texObj = memoryTmp.texture(octave);
 
-#ifdef VERBOSE
-  TimerGPU timer1;
-#endif
   float baseBlur = pow(2.0f, -1.0f/NUM_SCALES);
   float diffScale = pow(2.0f, 1.0f/NUM_SCALES);
-  LaplaceMulti(img, diffImg, octave, stream);
-  FindPointsMulti(diffImg, siftData, memoryTmp, thresh, 10.0f, 1.0f/NUM_SCALES, lowestScale/subsampling, subsampling, octave, stream);
-#ifdef VERBOSE
-  double gpuTimeDoG = timer1.read();
-  TimerGPU timer4;
-#endif
-  ComputeOrientations(texObj, siftData, memoryTmp, octave, stream);
+  {
+    DeviceProfileScope stage(profiler, PROFILE_LAPLACE, octave);
+    LaplaceMulti(img, diffImg, octave, stream);
+  }
+  {
+    DeviceProfileScope stage(profiler, PROFILE_FIND_POINTS, octave);
+    FindPointsMulti(diffImg, siftData, memoryTmp, thresh, 10.0f, 1.0f/NUM_SCALES, lowestScale/subsampling, subsampling, octave, stream);
+  }
+  {
+    DeviceProfileScope stage(profiler, PROFILE_ORIENTATIONS, octave);
+    ComputeOrientations(texObj, siftData, memoryTmp, octave, stream);
+  }
+  DeviceProfileScope stage(profiler, PROFILE_DESCRIPTORS, octave);
   ExtractSiftDescriptors(texObj, siftData, memoryTmp, d_normalizer, subsampling, octave, stream);
   //OrientAndExtract(texObj, siftData, subsampling, octave, stream);
-#ifdef VERBOSE
-  double gpuTimeSift = timer4.read();
-  double totTime = timer0.read();
-  printf("GPU time : %.2f ms + %.2f ms + %.2f ms = %.2f ms\n", totTime-gpuTimeDoG-gpuTimeSift, gpuTimeDoG, gpuTimeSift, totTime);
-  safeCall(cudaMemcpy(&totPts, &tempMemory.pointCounter()[2*octave+1], sizeof(int), cudaMemcpyDeviceToHost));
-  totPts = (totPts<siftData.maxPts ? totPts : siftData.maxPts);
-  if (totPts>0)
-    printf("           %.2f ms / DoG,  %.4f ms / Sift,  #Sift = %d\n", gpuTimeDoG/NUM_SCALES, gpuTimeSift/(totPts-fstPts), totPts-fstPts);
-#endif
 }
 
 void PrintSiftData(SiftData &data)
@@ -421,8 +459,27 @@ double ExtractSiftDescriptors(cudaTextureObject_t texObj, DeviceSiftData &siftDa
   ExtractSiftDescriptorsCONST<<<blocks, threads, 0, stream>>>(
       texObj, siftData.m_data, normalizer_d, subsampling, octave);
 #else
-  ExtractSiftDescriptorsCONSTNew<<<blocks, threads, 0, stream>>>(
-      texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+  switch (d_normalizer.preset()) {
+  case NORMALIZER_SIFT:
+    ExtractSiftDescriptorsCONSTNew<NORMALIZER_SIFT><<<blocks, threads, 0, stream>>>(
+        texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+    break;
+  case NORMALIZER_RSIFT:
+    ExtractSiftDescriptorsCONSTNew<NORMALIZER_RSIFT><<<blocks, threads, 0, stream>>>(
+        texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+    break;
+  case NORMALIZER_ZCA_RSIFT:
+    ExtractSiftDescriptorsCONSTNew<NORMALIZER_ZCA_RSIFT><<<blocks, threads, 0, stream>>>(
+        texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+    break;
+  case NORMALIZER_PLUS_RSIFT:
+    ExtractSiftDescriptorsCONSTNew<NORMALIZER_PLUS_RSIFT><<<blocks, threads, 0, stream>>>(
+        texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+    break;
+  default:
+    ExtractSiftDescriptorsCONSTNew<NORMALIZER_CUSTOM><<<blocks, threads, 0, stream>>>(
+        texObj, siftData.d_data, d_normalizer.get(), tempMemory.pointCounter(), subsampling, octave);
+  }
 #endif
   checkMsg("ExtractSiftDescriptors() execution failed\n");
   return 0.0;
@@ -472,27 +529,6 @@ double LowPass(const CudaImage &res, const CudaImage &src, cudaStream_t stream)
 
 //==================== Multi-scale functions ===================//
 
-void PrepareLaplaceKernels(int numOctaves, float initBlur, float *kernel)
-{
-  if (numOctaves>1) {
-    float totInitBlur = (float)sqrt(initBlur*initBlur + 0.5f*0.5f) / 2.0f;
-    PrepareLaplaceKernels(numOctaves-1, totInitBlur, kernel);
-  }
-  float scale = pow(2.0f, -1.0f/NUM_SCALES);
-  float diffScale = pow(2.0f, 1.0f/NUM_SCALES);
-  for (int i=0;i<NUM_SCALES+3;i++) {
-    float kernelSum = 0.0f;
-    float var = scale*scale - initBlur*initBlur;
-    for (int j=0;j<=LAPLACE_R;j++) {
-      kernel[numOctaves*12*16 + 16*i + j] = (float)expf(-(double)j*j/2.0/var);
-      kernelSum += (j==0 ? 1 : 2)*kernel[numOctaves*12*16 + 16*i + j];
-    }
-    for (int j=0;j<=LAPLACE_R;j++)
-      kernel[numOctaves*12*16 + 16*i + j] /= kernelSum;
-    scale *= diffScale;
-  }
-}
-
 double LaplaceMulti(const CudaImage &baseImage, const CudaImage *results,
                     int octave, cudaStream_t stream)
 {
@@ -678,6 +714,7 @@ void DeviceSiftData::downloadMatches(SiftData &dst, cudaStream_t stream) const {
 
 DeviceDescriptorNormalizerData::DeviceDescriptorNormalizerData(const DescriptorNormalizerData &normalizer) {
   d_normalizer = nullptr;
+  m_preset = FindNormalizerPreset(normalizer);
 
   int sz = sizeof(DescriptorNormalizerData) +
            normalizer.n_steps * sizeof(int) +
@@ -704,7 +741,7 @@ DeviceDescriptorNormalizerData::~DeviceDescriptorNormalizerData() {
 }
 
 DeviceDescriptorNormalizerData::DeviceDescriptorNormalizerData(DeviceDescriptorNormalizerData &&other) noexcept
-  : d_normalizer(other.d_normalizer) {
+  : d_normalizer(other.d_normalizer), m_preset(other.m_preset) {
   other.d_normalizer = nullptr;
 }
 
@@ -712,6 +749,7 @@ DeviceDescriptorNormalizerData &DeviceDescriptorNormalizerData::operator=(Device
   if (&other == this)
     return *this;
   d_normalizer = other.d_normalizer;
+  m_preset = other.m_preset;
   other.d_normalizer = nullptr;
   return *this;
 }
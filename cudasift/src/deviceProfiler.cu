@@ -0,0 +1,174 @@
+//********************************************************//
+// CUDA event timing for SiftProfiler                     //
+//********************************************************//
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "cudasift/cudautils.h"
+#include "cudasift/deviceProfiler.h"
+
+// Reference event on a device and the host time at which it completed. Event
+// times are only kept to float precision, so the reference is renewed
+// regularly.
+struct ProfileCalibration {
+  cudaEvent_t event = nullptr;
+  std::chrono::steady_clock::time_point time;
+  ~ProfileCalibration() {
+    if (event)
+      cudaEventDestroy(event);
+  }
+};
+
+// Recycled events and the current calibration of each device. Never
+// destroyed, as the CUDA runtime may already be shut down at exit.
+struct ProfileEvents {
+  std::mutex mutex;
+  std::map<int, std::vector<cudaEvent_t>> free;
+  std::map<int, std::shared_ptr<ProfileCalibration>> calibration;
+  std::map<int, cudaStream_t> streams;
+
+  static ProfileEvents &get() {
+    static ProfileEvents *events = new ProfileEvents();
+    return *events;
+  }
+
+  cudaEvent_t acquire(int device) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &list = free[device];
+      if (!list.empty()) {
+        cudaEvent_t event = list.back();
+        list.pop_back();
+        return event;
+      }
+    }
+    cudaEvent_t event = nullptr;
+    if (cudaEventCreate(&event)!=cudaSuccess)
+      return nullptr;
+    return event;
+  }
+
+  void release(int device, const std::vector<cudaEvent_t> &events) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &list = free[device];
+    list.insert(list.end(), events.begin(), events.end());
+  }
+
+  // Records an event on an otherwise idle stream and waits for it, so that
+  // the event time and the host time agree to within the wakeup latency
+  std::shared_ptr<ProfileCalibration> calibrate(int device) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &current = calibration[device];
+    if (current && now - current->time<std::chrono::seconds(60))
+      return current;
+    cudaStream_t &stream = streams[device];
+    if (stream==nullptr && cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking)!=cudaSuccess)
+      return current;
+    auto next = std::make_shared<ProfileCalibration>();
+    if (cudaEventCreate(&next->event)!=cudaSuccess || cudaEventRecord(next->event, stream)!=cudaSuccess ||
+        cudaEventSynchronize(next->event)!=cudaSuccess)
+      return current;
+    next->time = std::chrono::steady_clock::now();
+    current = next;
+    return current;
+  }
+};
+
+StreamProfiler::StreamProfiler(cudaStream_t stream_, SiftProfiler &profiler)
+  : prof(profiler), stream(stream_), device(0), thread(0)
+{
+  if (!prof.enabled() || cudaGetDevice(&device)!=cudaSuccess)
+    return;
+  thread = SiftProfiler::threadId();
+  calibration = ProfileEvents::get().calibrate(device);
+  if (calibration)
+    mark();
+}
+
+int StreamProfiler::mark()
+{
+  if (!calibration)
+    return -1;
+  cudaEvent_t event = ProfileEvents::get().acquire(device);
+  if (event==nullptr || cudaEventRecord(event, stream)!=cudaSuccess) {
+    // Keep the indices valid, the stages ending here are dropped
+    if (event)
+      ProfileEvents::get().release(device, {event});
+    events.push_back(nullptr);
+    return (int)events.size() - 1;
+  }
+  events.push_back(event);
+  return (int)events.size() - 1;
+}
+
+void StreamProfiler::add(ProfileStage stage, int octave, int begin, int end)
+{
+  if (begin>=0 && end>=0)
+    intervals.push_back({stage, octave, -1, begin, end});
+}
+
+void StreamProfiler::setPoints(ProfileStage stage, int octave, int numPts)
+{
+  if (calibration)
+    points.push_back({stage, octave, numPts, 0, 0});
+}
+
+StreamProfiler::~StreamProfiler()
+{
+  if (events.empty())
+    return;
+  for (auto &in : intervals)
+    for (const auto &p : points)
+      if (p.stage==in.stage && p.octave==in.octave)
+        in.numPts = p.numPts;
+  // The resolver owns the events from here on
+  std::vector<cudaEvent_t> evs;
+  evs.swap(events);
+  std::vector<Interval> ins;
+  ins.swap(intervals);
+  auto calib = calibration;
+  SiftProfiler &profiler = prof;
+  const int dev = device;
+  const uint64_t thr = thread;
+  const uint64_t str = (uint64_t)(uintptr_t)stream;
+  prof.defer([evs, ins, calib, &profiler, dev, thr, str]
+             (bool wait, std::vector<ProfileRecord> &records) {
+    cudaEvent_t last = nullptr;
+    for (auto ev : evs)
+      if (ev)
+        last = ev;
+    if (last) {
+      cudaError_t status = (wait ? cudaEventSynchronize(last) : cudaEventQuery(last));
+      if (status==cudaErrorNotReady)
+        return false;
+    }
+    float origin = 0.0f;
+    bool valid = evs[0] && cudaEventElapsedTime(&origin, calib->event, evs[0])==cudaSuccess;
+    const double originMs = profiler.time(calib->time) + origin;
+    for (const auto &in : ins) {
+      float start = 0.0f, duration = 0.0f;
+      if (!valid || !evs[in.begin] || !evs[in.end] ||
+          cudaEventElapsedTime(&start, evs[0], evs[in.begin])!=cudaSuccess ||
+          cudaEventElapsedTime(&duration, evs[in.begin], evs[in.end])!=cudaSuccess)
+        continue;
+      records.push_back({in.stage, in.octave, in.numPts, true, originMs + start, duration, thr, str});
+    }
+    std::vector<cudaEvent_t> used;
+    for (auto ev : evs)
+      if (ev)
+        used.push_back(ev);
+    ProfileEvents::get().release(dev, used);
+    return true;
+  });
+}
+
+void SynchronizeStream(cudaStream_t stream)
+{
+  ProfileScope profile(PROFILE_SYNC);
+  profile.setStream((uint64_t)(uintptr_t)stream);
+  safeCall(cudaStreamSynchronize(stream));
+}
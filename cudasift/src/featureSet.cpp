@@ -0,0 +1,69 @@
+//********************************************************//
+// Conversions between SiftData and SiftFeatureSet        //
+//********************************************************//
+
+#include <cstring>
+#include <stdexcept>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostutils.h"
+
+void SiftFeatureSet::resize(int num)
+{
+  numPts = num;
+  for (auto *v : {&xpos, &ypos, &scale, &sharpness, &edgeness, &orientation, &subsampling,
+                  &score, &ambiguity, &match_xpos, &match_ypos, &match_error})
+    v->resize(num);
+  match.resize(num);
+  descriptors.resize((size_t)num*128);
+}
+
+void ToFeatureSet(const SiftData &src, SiftFeatureSet &dst)
+{
+  dst.resize(src.numPts);
+  HostThreadPool::global().parallelFor(0, src.numPts, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const SiftPoint &pt = src.h_data[i];
+      dst.xpos[i] = pt.xpos;
+      dst.ypos[i] = pt.ypos;
+      dst.scale[i] = pt.scale;
+      dst.sharpness[i] = pt.sharpness;
+      dst.edgeness[i] = pt.edgeness;
+      dst.orientation[i] = pt.orientation;
+      dst.subsampling[i] = pt.subsampling;
+      dst.score[i] = pt.score;
+      dst.ambiguity[i] = pt.ambiguity;
+      dst.match[i] = pt.match;
+      dst.match_xpos[i] = pt.match_xpos;
+      dst.match_ypos[i] = pt.match_ypos;
+      dst.match_error[i] = pt.match_error;
+      std::memcpy(dst.descriptor(i), pt.data, 128*sizeof(float));
+    }
+  });
+}
+
+void ToSiftData(const SiftFeatureSet &src, SiftData &dst)
+{
+  if (src.numPts > dst.maxPts)
+    throw std::invalid_argument("Target storage is smaller than source");
+  dst.numPts = src.numPts;
+  HostThreadPool::global().parallelFor(0, src.numPts, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      SiftPoint &pt = dst.h_data[i];
+      pt.xpos = src.xpos[i];
+      pt.ypos = src.ypos[i];
+      pt.scale = src.scale[i];
+      pt.sharpness = src.sharpness[i];
+      pt.edgeness = src.edgeness[i];
+      pt.orientation = src.orientation[i];
+      pt.subsampling = src.subsampling[i];
+      pt.score = src.score[i];
+      pt.ambiguity = src.ambiguity[i];
+      pt.match = src.match[i];
+      pt.match_xpos = src.match_xpos[i];
+      pt.match_ypos = src.match_ypos[i];
+      pt.match_error = src.match_error[i];
+      std::memcpy(pt.data, src.descriptor(i), 128*sizeof(float));
+    }
+  });
+}
@@ -0,0 +1,112 @@
+//********************************************************//
+// Lloyd's k-means shared by the host quantizers, see     //
+// hostinternal.h                                         //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "cudasift/hostutils.h"
+
+#include "hostinternal.h"
+
+static void Normalize(float *x, int dim)
+{
+  const float norm = std::sqrt(Dot(x, x, dim));
+  for (int d=0;d<dim;d++)
+    x[d] = (norm>0.0f ? x[d]/norm : 0.0f);
+}
+
+void KMeansHost(const float *data, size_t stride, const int *ids, int n, int dim, int k,
+                int iterations, uint32_t seed, bool spherical, float *centroids, int *assign,
+                const std::function<void(const float *centroids, int *assign)> &assignStep)
+{
+  auto point = [&](int i) { return data + (size_t)(ids ? ids[i] : i)*stride; };
+  std::mt19937 rng(seed);
+  std::vector<int> perm(n);
+  std::iota(perm.begin(), perm.end(), 0);
+  for (int c=0;c<k;c++) {
+    std::swap(perm[c], perm[c + rng()%(n - c)]);
+    std::memcpy(centroids + (size_t)c*dim, point(perm[c]), dim*sizeof(float));
+    if (spherical)
+      Normalize(centroids + (size_t)c*dim, dim);
+  }
+  const bool finalAssign = (assign!=nullptr);
+  std::vector<int> ownAssign(finalAssign ? 0 : n);
+  if (!finalAssign)
+    assign = ownAssign.data();
+  std::vector<float> halfNorms(k, 0.0f);
+  auto assignPoints = [&]() {
+    if (assignStep) {
+      assignStep(centroids, assign);
+      return;
+    }
+    if (!spherical)
+      for (int c=0;c<k;c++)
+        halfNorms[c] = 0.5f*Dot(centroids + (size_t)c*dim, centroids + (size_t)c*dim, dim);
+    HostThreadPool::global().parallelFor(0, n, 1024, [&](int i0, int i1) {
+      for (int i=i0;i<i1;i++) {
+        const float *x = point(i);
+        float best = -INFINITY;
+        for (int c=0;c<k;c++) {
+          const float *y = centroids + (size_t)c*dim;
+          const float s = (dim==128 ? Dot128(x, y) : Dot(x, y, dim)) - halfNorms[c];
+          if (s>best) {
+            best = s;
+            assign[i] = c;
+          }
+        }
+      }
+    });
+  };
+  std::vector<double> sums((size_t)k*dim);
+  std::vector<int> counts(k);
+  for (int it=0;it<iterations;it++) {
+    assignPoints();
+    std::fill(sums.begin(), sums.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (int i=0;i<n;i++) {
+      const float *x = point(i);
+      double *sum = &sums[(size_t)assign[i]*dim];
+      for (int d=0;d<dim;d++)
+        sum[d] += x[d];
+      counts[assign[i]]++;
+    }
+    for (int c=0;c<k;c++) {
+      if (counts[c]==0)
+        continue;
+      float *y = centroids + (size_t)c*dim;
+      for (int d=0;d<dim;d++)
+        y[d] = (float)(sums[(size_t)c*dim + d]/counts[c]);
+      if (spherical)
+        Normalize(y, dim);
+    }
+    // An empty cluster takes half of the largest one, the two centroids
+    // pushed apart in alternating directions
+    for (int c=0;c<k;c++) {
+      if (counts[c])
+        continue;
+      const int big = (int)(std::max_element(counts.begin(), counts.end()) - counts.begin());
+      float *y = centroids + (size_t)c*dim;
+      float *z = centroids + (size_t)big*dim;
+      for (int d=0;d<dim;d++) {
+        const float v = z[d];
+        const float eps = (d%2 ? 1.0f : -1.0f)*1e-3f*(std::fabs(v) + 1e-3f);
+        y[d] = v + eps;
+        z[d] = v - eps;
+      }
+      if (spherical) {
+        Normalize(y, dim);
+        Normalize(z, dim);
+      }
+      counts[c] = counts[big]/2;
+      counts[big] -= counts[c];
+    }
+  }
+  if (finalAssign)
+    assignPoints();
+}
@@ -0,0 +1,1135 @@
+//********************************************************//
+// CPU matching of SIFT features, following the device    //
+// matcher FindMaxCorr10 in matching.cu                   //
+//********************************************************//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaImage.h"
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/profiler.h"
+#include "cudasift/siftFile.h"
+
+#include "hostinternal.h"
+
+#define NDIM 128
+
+// Query points per register tile
+#define MATCH_QR 4
+// Candidate points per register tile, one or two panels
+#if defined(__AVX512F__)
+#define MATCH_TILE 32
+#else
+#define MATCH_TILE 16
+#endif
+// Query points per parallel task
+#define MATCH_QB 64
+// Candidate points per cache block, 128 KB of descriptors kept in L2
+#define MATCH_CB 256
+
+void PackDescriptors(const float *desc, size_t stride, int numPts,
+                     PackedDescriptors &packed)
+{
+  const int tilePanels = MATCH_TILE/MATCH_PANEL;
+  packed.numPts = numPts;
+  packed.numPanels = iAlignUp(iDivUp(numPts, MATCH_PANEL), tilePanels);
+  packed.panels.resize((size_t)packed.numPanels*NDIM*MATCH_PANEL);
+  float *panels = packed.panels.data();
+  HostThreadPool::global().parallelFor(0, packed.numPanels, [&](int p0, int p1) {
+    for (int p=p0;p<p1;p++) {
+      float *panel = panels + (size_t)p*NDIM*MATCH_PANEL;
+      for (int l=0;l<MATCH_PANEL;l++) {
+        int idx = p*MATCH_PANEL + l;
+        if (idx<numPts) {
+          const float *src = desc + idx*stride;
+          for (int d=0;d<NDIM;d++)
+            panel[d*MATCH_PANEL + l] = src[d];
+        } else {
+          for (int d=0;d<NDIM;d++)
+            panel[d*MATCH_PANEL + l] = 0.0f;
+        }
+      }
+    }
+  });
+}
+
+// Correlates MATCH_QR consecutive query descriptors with MATCH_TILE packed
+// candidates, writing scores[q*MATCH_TILE + c]
+static inline void CorrelateTile(const float *query, const float *panel, float *scores)
+{
+#if defined(__AVX512F__)
+  const float *panel2 = panel + NDIM*MATCH_PANEL;
+  __m512 acc[MATCH_QR][2];
+  for (int q=0;q<MATCH_QR;q++)
+    acc[q][0] = acc[q][1] = _mm512_setzero_ps();
+  for (int d=0;d<NDIM;d++) {
+    __m512 c0 = _mm512_load_ps(panel + d*MATCH_PANEL);
+    __m512 c1 = _mm512_load_ps(panel2 + d*MATCH_PANEL);
+    for (int q=0;q<MATCH_QR;q++) {
+      __m512 v = _mm512_set1_ps(query[q*NDIM + d]);
+      acc[q][0] = _mm512_fmadd_ps(v, c0, acc[q][0]);
+      acc[q][1] = _mm512_fmadd_ps(v, c1, acc[q][1]);
+    }
+  }
+  for (int q=0;q<MATCH_QR;q++) {
+    _mm512_store_ps(scores + q*MATCH_TILE, acc[q][0]);
+    _mm512_store_ps(scores + q*MATCH_TILE + 16, acc[q][1]);
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc[MATCH_QR][2];
+  for (int q=0;q<MATCH_QR;q++)
+    acc[q][0] = acc[q][1] = _mm256_setzero_ps();
+  for (int d=0;d<NDIM;d++) {
+    __m256 c0 = _mm256_load_ps(panel + d*MATCH_PANEL);
+    __m256 c1 = _mm256_load_ps(panel + d*MATCH_PANEL + 8);
+    for (int q=0;q<MATCH_QR;q++) {
+      __m256 v = _mm256_broadcast_ss(query + q*NDIM + d);
+      acc[q][0] = _mm256_fmadd_ps(v, c0, acc[q][0]);
+      acc[q][1] = _mm256_fmadd_ps(v, c1, acc[q][1]);
+    }
+  }
+  for (int q=0;q<MATCH_QR;q++) {
+    _mm256_store_ps(scores + q*MATCH_TILE, acc[q][0]);
+    _mm256_store_ps(scores + q*MATCH_TILE + 8, acc[q][1]);
+  }
+#else
+  for (int i=0;i<MATCH_QR*MATCH_TILE;i++)
+    scores[i] = 0.0f;
+  for (int d=0;d<NDIM;d++) {
+    const float *c = panel + d*MATCH_PANEL;
+    for (int q=0;q<MATCH_QR;q++) {
+      float v = query[q*NDIM + d];
+      for (int l=0;l<MATCH_TILE;l++)
+        scores[q*MATCH_TILE + l] += v*c[l];
+    }
+  }
+#endif
+}
+
+// Returns true if any of the n scores, a multiple of 16, exceeds the threshold
+static inline bool AnyAbove(const float *scores, int n, float thresh)
+{
+#if defined(__AVX512F__)
+  __m512 t = _mm512_set1_ps(thresh);
+  __mmask16 mask = 0;
+  for (int l=0;l<n;l+=16)
+    mask |= _mm512_cmp_ps_mask(_mm512_load_ps(scores + l), t, _CMP_GT_OQ);
+  return mask!=0;
+#elif defined(__AVX2__)
+  __m256 t = _mm256_set1_ps(thresh);
+  __m256 mask = _mm256_setzero_ps();
+  for (int l=0;l<n;l+=8)
+    mask = _mm256_or_ps(mask, _mm256_cmp_ps(_mm256_load_ps(scores + l), t, _CMP_GT_OQ));
+  return _mm256_movemask_ps(mask)!=0;
+#else
+  for (int l=0;l<n;l++)
+    if (scores[l]>thresh)
+      return true;
+  return false;
+#endif
+}
+
+// Merges n scores of consecutive candidates starting at base into the best
+// and second best score, in increasing index order as on the device
+static inline void UpdateBest(const float *scores, int n, int base, float &maxScore,
+                              float &secScore, int &index)
+{
+  if (!AnyAbove(scores, n, secScore))
+    return;
+  for (int l=0;l<n;l++) {
+    if (scores[l]>maxScore) {
+      secScore = maxScore;
+      maxScore = scores[l];
+      index = base + l;
+    } else if (scores[l]>secScore)
+      secScore = scores[l];
+  }
+}
+
+// Merges the MATCH_QR x n tile of scores of the consecutive queries from
+// query on into the best and second best score of each of the n candidates,
+// like UpdateBest but with the roles of queries and candidates swapped
+static inline void UpdateColumns(const float *scores, int n, int query, float *maxScore,
+                                 float *secScore, int *index)
+{
+#if defined(__AVX512F__)
+  for (int l=0;l<n;l+=16) {
+    __m512 m = _mm512_loadu_ps(maxScore + l);
+    __m512 s2 = _mm512_loadu_ps(secScore + l);
+    __m512i ix = _mm512_loadu_si512((const void *)(index + l));
+    for (int r=0;r<MATCH_QR;r++) {
+      __m512 s = _mm512_load_ps(scores + r*MATCH_TILE + l);
+      __mmask16 gt = _mm512_cmp_ps_mask(s, m, _CMP_GT_OQ);
+      s2 = _mm512_mask_blend_ps(gt, _mm512_max_ps(s2, s), m);
+      m = _mm512_mask_blend_ps(gt, m, s);
+      ix = _mm512_mask_blend_epi32(gt, ix, _mm512_set1_epi32(query + r));
+    }
+    _mm512_storeu_ps(maxScore + l, m);
+    _mm512_storeu_ps(secScore + l, s2);
+    _mm512_storeu_si512((void *)(index + l), ix);
+  }
+#elif defined(__AVX2__)
+  for (int l=0;l<n;l+=8) {
+    __m256 m = _mm256_loadu_ps(maxScore + l);
+    __m256 s2 = _mm256_loadu_ps(secScore + l);
+    __m256 ix = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(index + l)));
+    for (int r=0;r<MATCH_QR;r++) {
+      __m256 s = _mm256_load_ps(scores + r*MATCH_TILE + l);
+      __m256 gt = _mm256_cmp_ps(s, m, _CMP_GT_OQ);
+      s2 = _mm256_blendv_ps(_mm256_max_ps(s2, s), m, gt);
+      m = _mm256_blendv_ps(m, s, gt);
+      ix = _mm256_blendv_ps(ix, _mm256_castsi256_ps(_mm256_set1_epi32(query + r)), gt);
+    }
+    _mm256_storeu_ps(maxScore + l, m);
+    _mm256_storeu_ps(secScore + l, s2);
+    _mm256_storeu_si256((__m256i *)(index + l), _mm256_castps_si256(ix));
+  }
+#else
+  for (int r=0;r<MATCH_QR;r++) {
+    for (int l=0;l<n;l++) {
+      const float s = scores[r*MATCH_TILE + l];
+      if (s>maxScore[l]) {
+        secScore[l] = maxScore[l];
+        maxScore[l] = s;
+        index[l] = query + r;
+      } else if (s>secScore[l])
+        secScore[l] = s;
+    }
+  }
+#endif
+}
+
+// Correlates every query with every packed candidate in cache blocks and
+// register tiles, keeping the best and second best candidate of every query
+// and, with Columns, the best and second best query of every candidate.
+// Column results are gathered per chunk of queries and merged so that they
+// equal a scan of the queries in increasing order.
+template <bool Columns>
+static void FindMaxCorrTiles(const float *desc1, size_t stride1, int numPts1,
+                             const PackedDescriptors &desc2, float *maxScore,
+                             float *secScore, int *index, float *maxScore2,
+                             float *secScore2, int *index2)
+{
+  const int numBlocks = iDivUp(numPts1, MATCH_QB);
+  const int tilePanels = MATCH_TILE/MATCH_PANEL;
+  const int chunkPanels = MATCH_CB/MATCH_PANEL;
+  const int numCols = desc2.numPanels*MATCH_PANEL;
+  const int numThreads = HostThreadPool::global().numThreads();
+  // Every chunk of queries has its own column results, so chunks are larger
+  // when those are kept
+  const int grain = (Columns ? iDivUp(numBlocks, 4*numThreads) : 1);
+  if (Columns) {
+    std::fill(maxScore2, maxScore2 + desc2.numPts, 0.0f);
+    std::fill(secScore2, secScore2 + desc2.numPts, 0.0f);
+    std::fill(index2, index2 + desc2.numPts, -1);
+  }
+  std::mutex mutex;
+  HostThreadPool::global().parallelFor(0, numBlocks, grain, [&](int b0, int b1) {
+    AlignedVector<float> query(MATCH_QB*NDIM);
+    alignas(64) float scores[MATCH_QR*MATCH_TILE];
+    AlignedVector<float> colMax, colSec;
+    AlignedVector<int> colIndex;
+    if (Columns) {
+      colMax.assign(numCols, 0.0f);
+      colSec.assign(numCols, 0.0f);
+      colIndex.assign(numCols, -1);
+    }
+    for (int b=b0;b<b1;b++) {
+      const int q0 = b*MATCH_QB;
+      const int nq = std::min(MATCH_QB, numPts1 - q0);
+      const int nqUp = iAlignUp(nq, MATCH_QR);
+      for (int q=0;q<nqUp;q++) {
+        if (q<nq)
+          std::memcpy(&query[q*NDIM], desc1 + (q0 + q)*stride1, NDIM*sizeof(float));
+        else
+          std::memset(&query[q*NDIM], 0, NDIM*sizeof(float));
+      }
+      float max_score[MATCH_QB];
+      float sec_score[MATCH_QB];
+      int max_index[MATCH_QB];
+      for (int q=0;q<MATCH_QB;q++) {
+        max_score[q] = 0.0f;
+        sec_score[q] = 0.0f;
+        max_index[q] = -1;
+      }
+      for (int c0=0;c0<desc2.numPanels;c0+=chunkPanels) {
+        const int c1 = std::min(c0 + chunkPanels, desc2.numPanels);
+        for (int qg=0;qg<nqUp;qg+=MATCH_QR) {
+          for (int p=c0;p<c1;p+=tilePanels) {
+            CorrelateTile(&query[qg*NDIM], desc2.panels.data() + (size_t)p*NDIM*MATCH_PANEL, scores);
+            for (int r=0;r<MATCH_QR;r++)
+              UpdateBest(scores + r*MATCH_TILE, MATCH_TILE, p*MATCH_PANEL,
+                         max_score[qg + r], sec_score[qg + r], max_index[qg + r]);
+            // Padded queries have zero scores and never become the best
+            if (Columns)
+              UpdateColumns(scores, MATCH_TILE, q0 + qg, &colMax[p*MATCH_PANEL],
+                            &colSec[p*MATCH_PANEL], &colIndex[p*MATCH_PANEL]);
+          }
+        }
+      }
+      for (int q=0;q<nq;q++) {
+        maxScore[q0 + q] = max_score[q];
+        secScore[q0 + q] = sec_score[q];
+        index[q0 + q] = max_index[q];
+      }
+    }
+    if (Columns) {
+      // The best query of two chunks is the better one, or the lower
+      // numbered of equal ones, and the second best the better of the
+      // other's best and its own second best
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int l=0;l<desc2.numPts;l++) {
+        if (colIndex[l]<0)
+          continue;
+        if (colMax[l]>maxScore2[l] || (colMax[l]==maxScore2[l] && colIndex[l]<index2[l])) {
+          secScore2[l] = std::max(maxScore2[l], colSec[l]);
+          maxScore2[l] = colMax[l];
+          index2[l] = colIndex[l];
+        } else
+          secScore2[l] = std::max(secScore2[l], colMax[l]);
+      }
+    }
+  });
+}
+
+void FindMaxCorrHost(const float *desc1, size_t stride1, int numPts1,
+                     const PackedDescriptors &desc2, float *maxScore,
+                     float *secScore, int *index)
+{
+  FindMaxCorrTiles<false>(desc1, stride1, numPts1, desc2, maxScore, secScore, index,
+                          nullptr, nullptr, nullptr);
+}
+
+void FindMutualHost(const float *desc1, size_t stride1, int numPts1,
+                    const PackedDescriptors &desc2, float *maxScore1,
+                    float *secScore1, int *index1, float *maxScore2,
+                    float *secScore2, int *index2)
+{
+  FindMaxCorrTiles<true>(desc1, stride1, numPts1, desc2, maxScore1, secScore1, index1,
+                         maxScore2, secScore2, index2);
+}
+
+// Writes the results of FindMaxCorrHost to the first numPts points of data1
+static void StoreMatches(SiftData &data1, const SiftData &data2, int numPts,
+                         const float *maxScore, const float *secScore, const int *index)
+{
+  for (int i=0;i<numPts;i++) {
+    SiftPoint &pt = data1.h_data[i];
+    pt.score = maxScore[i];
+    pt.match = index[i];
+    pt.match_xpos = (index[i]<0 ? 0.0f : data2.h_data[index[i]].xpos);
+    pt.match_ypos = (index[i]<0 ? 0.0f : data2.h_data[index[i]].ypos);
+    pt.ambiguity = secScore[i] / (maxScore[i] + 1e-6f);
+  }
+}
+
+static void StoreMatches(SiftFeatureSet &data1, const SiftFeatureSet &data2, int numPts,
+                         const float *maxScore, const float *secScore, const int *index)
+{
+  for (int i=0;i<numPts;i++) {
+    data1.score[i] = maxScore[i];
+    data1.match[i] = index[i];
+    data1.match_xpos[i] = (index[i]<0 ? 0.0f : data2.xpos[index[i]]);
+    data1.match_ypos[i] = (index[i]<0 ? 0.0f : data2.ypos[index[i]]);
+    data1.ambiguity[i] = secScore[i] / (maxScore[i] + 1e-6f);
+  }
+}
+
+static void StoreMatches(SiftFeatureSet &data1, const SiftFeatureView &data2, int numPts,
+                         const float *maxScore, const float *secScore, const int *index)
+{
+  for (int i=0;i<numPts;i++) {
+    data1.score[i] = maxScore[i];
+    data1.match[i] = index[i];
+    data1.match_xpos[i] = (index[i]<0 ? 0.0f : data2.xpos[index[i]]);
+    data1.match_ypos[i] = (index[i]<0 ? 0.0f : data2.ypos[index[i]]);
+    data1.ambiguity[i] = secScore[i] / (maxScore[i] + 1e-6f);
+  }
+}
+
+// Match fields of data1 when there is nothing to match against, so that none
+// of them keeps the result of an earlier call
+static void ClearMatches(SiftData &data1)
+{
+  for (int i=0;i<data1.numPts;i++) {
+    SiftPoint &pt = data1.h_data[i];
+    pt.score = 0.0f;
+    pt.match = -1;
+    pt.match_xpos = 0.0f;
+    pt.match_ypos = 0.0f;
+    pt.ambiguity = 0.0f;
+  }
+}
+
+static void ClearMatches(SiftFeatureSet &data1)
+{
+  std::fill(data1.score.begin(), data1.score.begin() + data1.numPts, 0.0f);
+  std::fill(data1.match.begin(), data1.match.begin() + data1.numPts, -1);
+  std::fill(data1.match_xpos.begin(), data1.match_xpos.begin() + data1.numPts, 0.0f);
+  std::fill(data1.match_ypos.begin(), data1.match_ypos.begin() + data1.numPts, 0.0f);
+  std::fill(data1.ambiguity.begin(), data1.ambiguity.begin() + data1.numPts, 0.0f);
+}
+
+double MatchSiftData(SiftData &data1, const SiftData &data2)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  const size_t stride = sizeof(SiftPoint)/sizeof(float);
+  PackedDescriptors packed;
+  PackDescriptors(data2.h_data[0].data, stride, numPts2, packed);
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  FindMaxCorrHost(data1.h_data[0].data, stride, numPts1, packed,
+                  maxScore.data(), secScore.data(), index.data());
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const SiftFeatureSet &data2)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  PackedDescriptors packed;
+  PackDescriptors(data2.descriptor(0), NDIM, numPts2, packed);
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  FindMaxCorrHost(data1.descriptor(0), NDIM, numPts1, packed,
+                  maxScore.data(), secScore.data(), index.data());
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Mutual matching
+///////////////////////////////////////////////////////////////////////////////
+
+template <class Features>
+static double MatchMutual(Features &data1, Features &data2, const float *desc1, const float *desc2,
+                          size_t stride, uint8_t *mutual)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    ClearMatches(data2);
+    if (mutual)
+      std::fill(mutual, mutual + numPts1, 0);
+    return 0.0;
+  }
+  PackedDescriptors packed;
+  PackDescriptors(desc2, stride, numPts2, packed);
+  std::vector<float> maxScore1(numPts1), secScore1(numPts1);
+  std::vector<float> maxScore2(numPts2), secScore2(numPts2);
+  std::vector<int> index1(numPts1), index2(numPts2);
+  FindMutualHost(desc1, stride, numPts1, packed, maxScore1.data(), secScore1.data(), index1.data(),
+                 maxScore2.data(), secScore2.data(), index2.data());
+  StoreMatches(data1, data2, numPts1, maxScore1.data(), secScore1.data(), index1.data());
+  StoreMatches(data2, data1, numPts2, maxScore2.data(), secScore2.data(), index2.data());
+  if (mutual)
+    for (int i=0;i<numPts1;i++)
+      mutual[i] = (index1[i]>=0 && index2[index1[i]]==i);
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double MatchSiftDataMutual(SiftData &data1, SiftData &data2, uint8_t *mutual)
+{
+  return MatchMutual(data1, data2, data1.numPts ? data1.h_data[0].data : nullptr,
+                     data2.numPts ? data2.h_data[0].data : nullptr,
+                     sizeof(SiftPoint)/sizeof(float), mutual);
+}
+
+double MatchSiftDataMutual(SiftFeatureSet &data1, SiftFeatureSet &data2, uint8_t *mutual)
+{
+  return MatchMutual(data1, data2, data1.numPts ? data1.descriptor(0) : nullptr,
+                     data2.numPts ? data2.descriptor(0) : nullptr, NDIM, mutual);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Guided matching
+///////////////////////////////////////////////////////////////////////////////
+
+// Points of the second set sorted into square cells, with their positions
+// and descriptors copied in cell order so that a cell is read contiguously
+struct MatchGrid {
+  float x0, y0, cellSize;
+  int width, height;
+  std::vector<int> cellStart;   // width*height + 1 offsets into the arrays below
+  std::vector<int> ids;
+  std::vector<float> xpos, ypos;
+  AlignedVector<float> descriptors;
+
+  int cellX(float x) const { return std::min(std::max((int)std::floor((x - x0)/cellSize), 0), width - 1); }
+  int cellY(float y) const { return std::min(std::max((int)std::floor((y - y0)/cellSize), 0), height - 1); }
+};
+
+// Cells are at least tolerance wide, and wider if the points are so sparse
+// that the cells would outnumber them
+static void BuildMatchGrid(const float *desc, size_t stride, const float *xpos, const float *ypos,
+                           int numPts, float tolerance, MatchGrid &grid)
+{
+  float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+  for (int i=0;i<numPts;i++) {
+    minX = std::min(minX, xpos[i]);
+    maxX = std::max(maxX, xpos[i]);
+    minY = std::min(minY, ypos[i]);
+    maxY = std::max(maxY, ypos[i]);
+  }
+  const float w = maxX - minX + 1.0f;
+  const float h = maxY - minY + 1.0f;
+  grid.x0 = minX;
+  grid.y0 = minY;
+  grid.cellSize = std::max(std::max(tolerance, 1.0f), std::sqrt(w*h/numPts));
+  grid.width = std::max((int)std::ceil(w/grid.cellSize), 1);
+  grid.height = std::max((int)std::ceil(h/grid.cellSize), 1);
+  const int numCells = grid.width*grid.height;
+  std::vector<int> cell(numPts);
+  grid.cellStart.assign(numCells + 1, 0);
+  for (int i=0;i<numPts;i++) {
+    cell[i] = grid.cellY(ypos[i])*grid.width + grid.cellX(xpos[i]);
+    grid.cellStart[cell[i] + 1]++;
+  }
+  for (int c=0;c<numCells;c++)
+    grid.cellStart[c + 1] += grid.cellStart[c];
+  std::vector<int> next(grid.cellStart.begin(), grid.cellStart.end() - 1);
+  grid.ids.resize(numPts);
+  for (int i=0;i<numPts;i++)
+    grid.ids[next[cell[i]]++] = i;
+  grid.xpos.resize(numPts);
+  grid.ypos.resize(numPts);
+  grid.descriptors.resize((size_t)numPts*NDIM);
+  HostThreadPool::global().parallelFor(0, numPts, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const int id = grid.ids[i];
+      grid.xpos[i] = xpos[id];
+      grid.ypos[i] = ypos[id];
+      std::memcpy(&grid.descriptors[(size_t)i*NDIM], desc + id*stride, NDIM*sizeof(float));
+    }
+  });
+}
+
+// Correlates a query with the points of cells [cx0, cx1] of grid row cy that
+// are within the region, keeping the best and second best as in UpdateBest,
+// with the lower index winning equal scores
+template <class Inside>
+static inline void MatchGridCells(const MatchGrid &grid, const float *query, int cy, int cx0, int cx1,
+                                  Inside inside, float &maxScore, float &secScore, int &index)
+{
+  const int i0 = grid.cellStart[cy*grid.width + cx0];
+  const int i1 = grid.cellStart[cy*grid.width + cx1 + 1];
+  for (int i=i0;i<i1;i++) {
+    if (!inside(grid.xpos[i], grid.ypos[i]))
+      continue;
+    const float s = Dot128(query, &grid.descriptors[(size_t)i*NDIM]);
+    const int id = grid.ids[i];
+    if (s>maxScore || (s==maxScore && index>=0 && id<index)) {
+      secScore = maxScore;
+      maxScore = s;
+      index = id;
+    } else if (s>secScore)
+      secScore = s;
+  }
+}
+
+void FindMaxCorrGuidedHost(const float *desc1, size_t stride1, const float *xpos1,
+                           const float *ypos1, int numPts1, const float *desc2,
+                           size_t stride2, const float *xpos2, const float *ypos2,
+                           int numPts2, const float *model, GuidedMatchPrior prior,
+                           float tolerance, float *maxScore, float *secScore, int *index)
+{
+  MatchGrid grid;
+  BuildMatchGrid(desc2, stride2, xpos2, ypos2, numPts2, tolerance, grid);
+  const float tol2 = tolerance*tolerance;
+  const float *m = model;
+  HostThreadPool::global().parallelFor(0, numPts1, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const float *query = desc1 + i*stride1;
+      const float x1 = xpos1[i];
+      const float y1 = ypos1[i];
+      float max_score = 0.0f;
+      float sec_score = 0.0f;
+      int max_index = -1;
+      if (prior==GUIDED_HOMOGRAPHY) {
+        const float z = m[6]*x1 + m[7]*y1 + m[8];
+        if (z!=0.0f) {
+          const float px = (m[0]*x1 + m[1]*y1 + m[2])/z;
+          const float py = (m[3]*x1 + m[4]*y1 + m[5])/z;
+          auto inside = [&](float x, float y) {
+            return (x - px)*(x - px) + (y - py)*(y - py)<=tol2;
+          };
+          if (px + tolerance>=grid.x0 && px - tolerance<=grid.x0 + grid.width*grid.cellSize &&
+              py + tolerance>=grid.y0 && py - tolerance<=grid.y0 + grid.height*grid.cellSize) {
+            const int cx0 = grid.cellX(px - tolerance), cx1 = grid.cellX(px + tolerance);
+            const int cy0 = grid.cellY(py - tolerance), cy1 = grid.cellY(py + tolerance);
+            for (int cy=cy0;cy<=cy1;cy++)
+              MatchGridCells(grid, query, cy, cx0, cx1, inside, max_score, sec_score, max_index);
+          }
+        }
+      } else {
+        // Epipolar line a*x + b*y + c = 0, visited one grid row at a time
+        // through the cells that the band of half width tolerance crosses
+        float a = m[0]*x1 + m[1]*y1 + m[2];
+        float b = m[3]*x1 + m[4]*y1 + m[5];
+        float c = m[6]*x1 + m[7]*y1 + m[8];
+        const float norm = std::sqrt(a*a + b*b);
+        if (norm>0.0f) {
+          a /= norm;
+          b /= norm;
+          c /= norm;
+          auto inside = [&](float x, float y) { return std::fabs(a*x + b*y + c)<=tolerance; };
+          const float right = grid.x0 + grid.width*grid.cellSize;
+          for (int cy=0;cy<grid.height;cy++) {
+            // a*x lies in [lo, hi] for the points of the band in this row
+            const float ya = grid.y0 + cy*grid.cellSize;
+            const float yb = ya + grid.cellSize;
+            const float lo = -tolerance - c - std::max(b*ya, b*yb);
+            const float hi = tolerance - c - std::min(b*ya, b*yb);
+            float xa = grid.x0, xb = right;
+            if (std::fabs(a)>1e-6f) {
+              xa = std::max(xa, (a>0.0f ? lo : hi)/a);
+              xb = std::min(xb, (a>0.0f ? hi : lo)/a);
+            } else if (lo>std::max(a*xa, a*xb) || hi<std::min(a*xa, a*xb))
+              continue;
+            if (xa>xb)
+              continue;
+            MatchGridCells(grid, query, cy, grid.cellX(xa), grid.cellX(xb), inside,
+                           max_score, sec_score, max_index);
+          }
+        }
+      }
+      maxScore[i] = max_score;
+      secScore[i] = sec_score;
+      index[i] = max_index;
+    }
+  });
+}
+
+double MatchSiftDataGuided(SiftData &data1, const SiftData &data2, const float *model,
+                           GuidedMatchPrior prior, float tolerance)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  const size_t stride = sizeof(SiftPoint)/sizeof(float);
+  std::vector<float> xpos1(numPts1), ypos1(numPts1), xpos2(numPts2), ypos2(numPts2);
+  for (int i=0;i<numPts1;i++) {
+    xpos1[i] = data1.h_data[i].xpos;
+    ypos1[i] = data1.h_data[i].ypos;
+  }
+  for (int i=0;i<numPts2;i++) {
+    xpos2[i] = data2.h_data[i].xpos;
+    ypos2[i] = data2.h_data[i].ypos;
+  }
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  FindMaxCorrGuidedHost(data1.h_data[0].data, stride, xpos1.data(), ypos1.data(), numPts1,
+                        data2.h_data[0].data, stride, xpos2.data(), ypos2.data(), numPts2,
+                        model, prior, tolerance, maxScore.data(), secScore.data(), index.data());
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double MatchSiftDataGuided(SiftFeatureSet &data1, const SiftFeatureSet &data2, const float *model,
+                           GuidedMatchPrior prior, float tolerance)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  FindMaxCorrGuidedHost(data1.descriptor(0), NDIM, data1.xpos.data(), data1.ypos.data(), numPts1,
+                        data2.descriptor(0), NDIM, data2.xpos.data(), data2.ypos.data(), numPts2,
+                        model, prior, tolerance, maxScore.data(), secScore.data(), index.data());
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Top-k matching
+///////////////////////////////////////////////////////////////////////////////
+
+// Merges n scores of consecutive candidates starting at base into the K best
+// scores and their indices, sorted in decreasing order. The lists are copied
+// into local arrays that the fully unrolled insertion keeps in registers, and
+// every score passes through all K slots with selects instead of branches.
+template <int K>
+static inline void UpdateTopK(const float *scores, int n, int base, float *topScore, int *topIndex)
+{
+  if (!AnyAbove(scores, n, topScore[K - 1]))
+    return;
+  float best[K];
+  int index[K];
+  for (int j=0;j<K;j++) {
+    best[j] = topScore[j];
+    index[j] = topIndex[j];
+  }
+  for (int l=0;l<n;l++) {
+    float s = scores[l];
+    if (!(s>best[K - 1]))
+      continue;
+    int i = base + l;
+    for (int j=0;j<K;j++) {
+      const bool above = s>best[j];
+      const float ts = best[j];
+      const int ti = index[j];
+      best[j] = (above ? s : ts);
+      index[j] = (above ? i : ti);
+      s = (above ? ts : s);
+      i = (above ? ti : i);
+    }
+  }
+  for (int j=0;j<K;j++) {
+    topScore[j] = best[j];
+    topIndex[j] = index[j];
+  }
+}
+
+template <int K>
+void FindTopKHost(const float *desc1, size_t stride1, int numPts1,
+                  const PackedDescriptors &desc2, SiftMatchCandidate *matches)
+{
+  static_assert(K>=1 && K<=SIFT_TOPK_MAX, "K must be in [1, SIFT_TOPK_MAX]");
+  const int numBlocks = iDivUp(numPts1, MATCH_QB);
+  const int tilePanels = MATCH_TILE/MATCH_PANEL;
+  const int chunkPanels = MATCH_CB/MATCH_PANEL;
+  HostThreadPool::global().parallelFor(0, numBlocks, 1, [&](int b0, int b1) {
+    AlignedVector<float> query(MATCH_QB*NDIM);
+    alignas(64) float scores[MATCH_QR*MATCH_TILE];
+    for (int b=b0;b<b1;b++) {
+      const int q0 = b*MATCH_QB;
+      const int nq = std::min(MATCH_QB, numPts1 - q0);
+      const int nqUp = iAlignUp(nq, MATCH_QR);
+      for (int q=0;q<nqUp;q++) {
+        if (q<nq)
+          std::memcpy(&query[q*NDIM], desc1 + (q0 + q)*stride1, NDIM*sizeof(float));
+        else
+          std::memset(&query[q*NDIM], 0, NDIM*sizeof(float));
+      }
+      float top_score[MATCH_QB][K];
+      int top_index[MATCH_QB][K];
+      for (int q=0;q<MATCH_QB;q++) {
+        for (int j=0;j<K;j++) {
+          top_score[q][j] = 0.0f;
+          top_index[q][j] = -1;
+        }
+      }
+      for (int c0=0;c0<desc2.numPanels;c0+=chunkPanels) {
+        const int c1 = std::min(c0 + chunkPanels, desc2.numPanels);
+        for (int qg=0;qg<nqUp;qg+=MATCH_QR) {
+          for (int p=c0;p<c1;p+=tilePanels) {
+            CorrelateTile(&query[qg*NDIM], desc2.panels.data() + (size_t)p*NDIM*MATCH_PANEL, scores);
+            for (int r=0;r<MATCH_QR;r++)
+              UpdateTopK<K>(scores + r*MATCH_TILE, MATCH_TILE, p*MATCH_PANEL,
+                            top_score[qg + r], top_index[qg + r]);
+          }
+        }
+      }
+      for (int q=0;q<nq;q++) {
+        for (int j=0;j<K;j++) {
+          matches[(size_t)(q0 + q)*K + j].index = top_index[q][j];
+          matches[(size_t)(q0 + q)*K + j].score = top_score[q][j];
+        }
+      }
+    }
+  });
+}
+
+template <int K>
+double MatchSiftDataTopK(const SiftData &data1, const SiftData &data2, SiftMatchCandidate *matches)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1)
+    return 0.0;
+  if (!numPts2) {
+    std::fill(matches, matches + (size_t)numPts1*K, SiftMatchCandidate{-1, 0.0f});
+    return 0.0;
+  }
+  const size_t stride = sizeof(SiftPoint)/sizeof(float);
+  PackedDescriptors packed;
+  PackDescriptors(data2.h_data[0].data, stride, numPts2, packed);
+  FindTopKHost<K>(data1.h_data[0].data, stride, numPts1, packed, matches);
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+template <int K>
+double MatchSiftDataTopK(const SiftFeatureSet &data1, const SiftFeatureSet &data2,
+                         SiftMatchCandidate *matches)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1)
+    return 0.0;
+  if (!numPts2) {
+    std::fill(matches, matches + (size_t)numPts1*K, SiftMatchCandidate{-1, 0.0f});
+    return 0.0;
+  }
+  PackedDescriptors packed;
+  PackDescriptors(data2.descriptor(0), NDIM, numPts2, packed);
+  FindTopKHost<K>(data1.descriptor(0), NDIM, numPts1, packed, matches);
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+#define INSTANTIATE_TOPK(K)                                                          \
+  template void FindTopKHost<K>(const float *, size_t, int, const PackedDescriptors &, \
+                                SiftMatchCandidate *);                               \
+  template double MatchSiftDataTopK<K>(const SiftData &, const SiftData &,           \
+                                       SiftMatchCandidate *);                        \
+  template double MatchSiftDataTopK<K>(const SiftFeatureSet &, const SiftFeatureSet &, \
+                                       SiftMatchCandidate *);
+INSTANTIATE_TOPK(1)
+INSTANTIATE_TOPK(2)
+INSTANTIATE_TOPK(3)
+INSTANTIATE_TOPK(4)
+INSTANTIATE_TOPK(5)
+INSTANTIATE_TOPK(6)
+INSTANTIATE_TOPK(7)
+INSTANTIATE_TOPK(8)
+#undef INSTANTIATE_TOPK
+
+///////////////////////////////////////////////////////////////////////////////
+// Matching of 8-bit quantized descriptors
+///////////////////////////////////////////////////////////////////////////////
+
+// With VNNI the candidates are stored offset by 128 as unsigned bytes, so that
+// vpdpbusd can multiply them with the signed query bytes, and the offset is
+// subtracted per query. Otherwise the codes stay signed and vpmaddubsw gets
+// the absolute query values and the candidates with the query signs applied.
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+#define QUANT_VNNI
+#define QUANT_TILE 32
+#else
+#define QUANT_TILE 16
+#endif
+
+static void QuantizeDescriptors(const float *desc, size_t stride, int numPts,
+                                QuantizedSiftData &quantized)
+{
+  quantized.numPts = numPts;
+  quantized.codes.resize((size_t)numPts*NDIM);
+  quantized.scales.resize(numPts);
+  HostThreadPool::global().parallelFor(0, numPts, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const float *src = desc + i*stride;
+      float maxAbs = 0.0f;
+      for (int d=0;d<NDIM;d++)
+        maxAbs = std::max(maxAbs, std::fabs(src[d]));
+      const float scale = maxAbs/127.0f;
+      const float invScale = (maxAbs>0.0f ? 127.0f/maxAbs : 0.0f);
+      int8_t *codes = &quantized.codes[(size_t)i*NDIM];
+      for (int d=0;d<NDIM;d++)
+        codes[d] = (int8_t)std::lrint(std::min(std::max(src[d]*invScale, -127.0f), 127.0f));
+      quantized.scales[i] = scale;
+    }
+  });
+}
+
+void QuantizeDescriptors(const SiftData &data, QuantizedSiftData &quantized)
+{
+  QuantizeDescriptors(data.numPts ? data.h_data[0].data : nullptr,
+                      sizeof(SiftPoint)/sizeof(float), data.numPts, quantized);
+}
+
+void QuantizeDescriptors(const SiftFeatureSet &data, QuantizedSiftData &quantized)
+{
+  QuantizeDescriptors(data.numPts ? data.descriptor(0) : nullptr, NDIM, data.numPts, quantized);
+}
+
+void DequantizeDescriptors(const QuantizedSiftData &quantized, SiftData &data)
+{
+  const int numPts = std::min(quantized.numPts, data.numPts);
+  for (int i=0;i<numPts;i++) {
+    const int8_t *codes = &quantized.codes[(size_t)i*NDIM];
+    for (int d=0;d<NDIM;d++)
+      data.h_data[i].data[d] = codes[d]*quantized.scales[i];
+  }
+}
+
+void PackCodes(const int8_t *codes, const float *scales, int numPts,
+               PackedCodes &packed)
+{
+  const int tilePanels = QUANT_TILE/MATCH_PANEL;
+  packed.numPts = numPts;
+  packed.numPanels = iAlignUp(iDivUp(numPts, MATCH_PANEL), tilePanels);
+  packed.panels.resize((size_t)packed.numPanels*NDIM*MATCH_PANEL);
+  packed.scales.resize((size_t)packed.numPanels*MATCH_PANEL);
+  HostThreadPool::global().parallelFor(0, packed.numPanels, [&](int p0, int p1) {
+    for (int p=p0;p<p1;p++) {
+      int8_t *panel = &packed.panels[(size_t)p*NDIM*MATCH_PANEL];
+      for (int l=0;l<MATCH_PANEL;l++) {
+        int idx = p*MATCH_PANEL + l;
+        for (int d=0;d<NDIM;d++) {
+          int8_t c = (idx<numPts ? codes[(size_t)idx*NDIM + d] : 0);
+#ifdef QUANT_VNNI
+          c = (int8_t)(c ^ 0x80);
+#endif
+          panel[(d/4)*4*MATCH_PANEL + 4*l + (d&3)] = c;
+        }
+        packed.scales[p*MATCH_PANEL + l] = (idx<numPts ? scales[idx] : 0.0f);
+      }
+    }
+  });
+}
+
+// Integer version of CorrelateTile. The integer dot products are scaled by the
+// query and candidate scales into scores[q*QUANT_TILE + c].
+static inline void CorrelateCodes(const int8_t *query, const float *queryScale,
+                                  const int8_t *panel, const float *scales, float *scores)
+{
+  int32_t words[MATCH_QR][NDIM/4];
+  for (int q=0;q<MATCH_QR;q++)
+    std::memcpy(words[q], query + q*NDIM, NDIM);
+#if defined(QUANT_VNNI)
+  const int8_t *panel2 = panel + NDIM*MATCH_PANEL;
+  __m512i acc[MATCH_QR][2];
+  for (int q=0;q<MATCH_QR;q++)
+    acc[q][0] = acc[q][1] = _mm512_setzero_si512();
+  for (int g=0;g<NDIM/4;g++) {
+    __m512i c0 = _mm512_load_si512((const void *)(panel + g*4*MATCH_PANEL));
+    __m512i c1 = _mm512_load_si512((const void *)(panel2 + g*4*MATCH_PANEL));
+    for (int q=0;q<MATCH_QR;q++) {
+      __m512i v = _mm512_set1_epi32(words[q][g]);
+      acc[q][0] = _mm512_dpbusd_epi32(acc[q][0], c0, v);
+      acc[q][1] = _mm512_dpbusd_epi32(acc[q][1], c1, v);
+    }
+  }
+  for (int q=0;q<MATCH_QR;q++) {
+    int sum = 0;
+    for (int d=0;d<NDIM;d++)
+      sum += query[q*NDIM + d];
+    __m512i offset = _mm512_set1_epi32(128*sum);
+    __m512 scale = _mm512_set1_ps(queryScale[q]);
+    for (int k=0;k<2;k++) {
+      __m512 s = _mm512_cvtepi32_ps(_mm512_sub_epi32(acc[q][k], offset));
+      s = _mm512_mul_ps(_mm512_mul_ps(s, scale), _mm512_load_ps(scales + 16*k));
+      _mm512_store_ps(scores + q*QUANT_TILE + 16*k, s);
+    }
+  }
+#elif defined(__AVX2__)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i acc[MATCH_QR][2];
+  for (int q=0;q<MATCH_QR;q++)
+    acc[q][0] = acc[q][1] = _mm256_setzero_si256();
+  for (int g=0;g<NDIM/4;g++) {
+    __m256i c0 = _mm256_load_si256((const __m256i *)(panel + g*4*MATCH_PANEL));
+    __m256i c1 = _mm256_load_si256((const __m256i *)(panel + g*4*MATCH_PANEL + 32));
+    for (int q=0;q<MATCH_QR;q++) {
+      __m256i v = _mm256_set1_epi32(words[q][g]);
+      __m256i a = _mm256_abs_epi8(v);
+      __m256i p0 = _mm256_maddubs_epi16(a, _mm256_sign_epi8(c0, v));
+      __m256i p1 = _mm256_maddubs_epi16(a, _mm256_sign_epi8(c1, v));
+      acc[q][0] = _mm256_add_epi32(acc[q][0], _mm256_madd_epi16(p0, ones));
+      acc[q][1] = _mm256_add_epi32(acc[q][1], _mm256_madd_epi16(p1, ones));
+    }
+  }
+  for (int q=0;q<MATCH_QR;q++) {
+    __m256 scale = _mm256_set1_ps(queryScale[q]);
+    for (int k=0;k<2;k++) {
+      __m256 s = _mm256_cvtepi32_ps(acc[q][k]);
+      s = _mm256_mul_ps(_mm256_mul_ps(s, scale), _mm256_load_ps(scales + 8*k));
+      _mm256_store_ps(scores + q*QUANT_TILE + 8*k, s);
+    }
+  }
+#else
+  int acc[MATCH_QR][QUANT_TILE] = {};
+  for (int g=0;g<NDIM/4;g++) {
+    const int8_t *c = panel + g*4*MATCH_PANEL;
+    for (int q=0;q<MATCH_QR;q++) {
+      const int8_t *v = query + q*NDIM + 4*g;
+      for (int l=0;l<QUANT_TILE;l++)
+        acc[q][l] += v[0]*c[4*l] + v[1]*c[4*l + 1] + v[2]*c[4*l + 2] + v[3]*c[4*l + 3];
+    }
+  }
+  for (int q=0;q<MATCH_QR;q++)
+    for (int l=0;l<QUANT_TILE;l++)
+      scores[q*QUANT_TILE + l] = acc[q][l]*queryScale[q]*scales[l];
+#endif
+}
+
+void FindMaxCorrQuantizedHost(const int8_t *codes1, const float *scales1,
+                              int numPts1, const PackedCodes &codes2,
+                              float *maxScore, float *secScore, int *index)
+{
+  const int numBlocks = iDivUp(numPts1, MATCH_QB);
+  const int tilePanels = QUANT_TILE/MATCH_PANEL;
+  // Four times as many candidates as for floats fit in the same cache block
+  const int chunkPanels = 4*MATCH_CB/MATCH_PANEL;
+  HostThreadPool::global().parallelFor(0, numBlocks, 1, [&](int b0, int b1) {
+    AlignedVector<int8_t> query(MATCH_QB*NDIM);
+    float queryScale[MATCH_QB];
+    alignas(64) float scores[MATCH_QR*QUANT_TILE];
+    for (int b=b0;b<b1;b++) {
+      const int q0 = b*MATCH_QB;
+      const int nq = std::min(MATCH_QB, numPts1 - q0);
+      const int nqUp = iAlignUp(nq, MATCH_QR);
+      std::memcpy(query.data(), codes1 + (size_t)q0*NDIM, (size_t)nq*NDIM);
+      std::memset(query.data() + nq*NDIM, 0, (size_t)(nqUp - nq)*NDIM);
+      float max_score[MATCH_QB];
+      float sec_score[MATCH_QB];
+      int max_index[MATCH_QB];
+      for (int q=0;q<MATCH_QB;q++) {
+        queryScale[q] = (q<nq ? scales1[q0 + q] : 0.0f);
+        max_score[q] = 0.0f;
+        sec_score[q] = 0.0f;
+        max_index[q] = -1;
+      }
+      for (int c0=0;c0<codes2.numPanels;c0+=chunkPanels) {
+        const int c1 = std::min(c0 + chunkPanels, codes2.numPanels);
+        for (int qg=0;qg<nqUp;qg+=MATCH_QR) {
+          for (int p=c0;p<c1;p+=tilePanels) {
+            CorrelateCodes(&query[qg*NDIM], &queryScale[qg],
+                           codes2.panels.data() + (size_t)p*NDIM*MATCH_PANEL,
+                           codes2.scales.data() + p*MATCH_PANEL, scores);
+            for (int r=0;r<MATCH_QR;r++)
+              UpdateBest(scores + r*QUANT_TILE, QUANT_TILE, p*MATCH_PANEL,
+                         max_score[qg + r], sec_score[qg + r], max_index[qg + r]);
+          }
+        }
+      }
+      for (int q=0;q<nq;q++) {
+        maxScore[q0 + q] = max_score[q];
+        secScore[q0 + q] = sec_score[q];
+        index[q0 + q] = max_index[q];
+      }
+    }
+  });
+}
+
+// Matches quantized1 against quantized2, which must hold the same points as
+// data1 and data2
+template <class Features>
+static double MatchQuantized(Features &data1, const QuantizedSiftData &quantized1,
+                             const Features &data2, const QuantizedSiftData &quantized2)
+{
+  if (data1.numPts!=quantized1.numPts || data2.numPts!=quantized2.numPts)
+    throw std::invalid_argument("Quantized descriptors must hold the same points as their features");
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  PackedCodes packed;
+  PackCodes(quantized2.codes.data(), quantized2.scales.data(), numPts2, packed);
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  FindMaxCorrQuantizedHost(quantized1.codes.data(), quantized1.scales.data(), numPts1,
+                           packed, maxScore.data(), secScore.data(), index.data());
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double MatchSiftData(SiftData &data1, const QuantizedSiftData &quantized1,
+                     const SiftData &data2, const QuantizedSiftData &quantized2)
+{
+  return MatchQuantized(data1, quantized1, data2, quantized2);
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const QuantizedSiftData &quantized1,
+                     const SiftFeatureSet &data2, const QuantizedSiftData &quantized2)
+{
+  return MatchQuantized(data1, quantized1, data2, quantized2);
+}
+
+// Matches data1 against the view data2 with its descriptors packed into
+// either descriptors or codes
+static void MatchPacked(SiftFeatureSet &data1, const SiftFeatureView &data2,
+                        const PackedDescriptors *descriptors, const PackedCodes *codes)
+{
+  int numPts1 = data1.numPts;
+  std::vector<float> maxScore(numPts1), secScore(numPts1);
+  std::vector<int> index(numPts1);
+  if (descriptors) {
+    FindMaxCorrHost(data1.descriptor(0), NDIM, numPts1, *descriptors,
+                    maxScore.data(), secScore.data(), index.data());
+  } else {
+    QuantizedSiftData quantized1;
+    QuantizeDescriptors(data1, quantized1);
+    FindMaxCorrQuantizedHost(quantized1.codes.data(), quantized1.scales.data(), numPts1,
+                             *codes, maxScore.data(), secScore.data(), index.data());
+  }
+  StoreMatches(data1, data2, numPts1, maxScore.data(), secScore.data(), index.data());
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const SiftFeatureView &data2)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1 || !numPts2) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  PackedDescriptors descriptors;
+  PackedCodes codes;
+  if (data2.descriptors)
+    PackDescriptors(data2.descriptors, NDIM, numPts2, descriptors);
+  else
+    PackCodes(data2.codes, data2.scales, numPts2, codes);
+  MatchPacked(data1, data2, (data2.descriptors ? &descriptors : nullptr), &codes);
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const MappedSiftFeatures &data2)
+{
+  ProfileScope profile(PROFILE_MATCH);
+  auto start = std::chrono::steady_clock::now();
+  const SiftFeatureView &view = data2.view();
+  if (!data1.numPts || !view.numPts) {
+    ClearMatches(data1);
+    return 0.0;
+  }
+  MatchPacked(data1, view, data2.packedDescriptors(), data2.packedCodes());
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
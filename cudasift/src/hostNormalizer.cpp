@@ -0,0 +1,287 @@
+//********************************************************//
+// CPU descriptor normalization, the step interpreter of  //
+// normalize() and fused pipelines for the common presets //
+//********************************************************//
+
+#include <cmath>
+#include <cstring>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+
+DescriptorNormalizerPreset FindNormalizerPreset(const DescriptorNormalizerData &normalizer)
+{
+  static const int sift[] = {1, 4, 1, 3, 0};
+  static const int rsift[] = {1, 4, 2, 3, 0};
+  static const int zcaRsift[] = {1, 4, 2, 3, 5, 6, 1, 3, 0};
+  static const int plusRsift[] = {1, 4, 2, 3, 5, 6, 2, 3, 7, 0};
+  struct {
+    DescriptorNormalizerPreset preset;
+    const int *steps;
+    int n_steps;
+    int n_data;
+  } presets[] = {
+    {NORMALIZER_SIFT, sift, 5, 1},
+    {NORMALIZER_RSIFT, rsift, 5, 1},
+    {NORMALIZER_ZCA_RSIFT, zcaRsift, 9, 1 + 128 + 128*128},
+    {NORMALIZER_PLUS_RSIFT, plusRsift, 10, 1 + 128 + 128*128}
+  };
+  if (normalizer.normalizer_steps==nullptr)
+    return NORMALIZER_CUSTOM;
+  for (const auto &p : presets) {
+    if (normalizer.n_steps==p.n_steps && normalizer.n_data>=p.n_data &&
+        !std::memcmp(normalizer.normalizer_steps, p.steps, p.n_steps*sizeof(int)))
+      return p.preset;
+  }
+  return NORMALIZER_CUSTOM;
+}
+
+// Same step interpreter as normalize() on the device, see DescriptorNormalizerData
+void NormalizeDescriptorHost(float *buffer, float *desc,
+                             const DescriptorNormalizerData &normalizer)
+{
+  float accumulator = -1.f;
+  int offset = 0;
+  for (int i = 0; i < normalizer.n_steps; ++i) {
+    switch (normalizer.normalizer_steps[i]) {
+    case 0: {
+      std::memcpy(desc, buffer, 128*sizeof(float));
+    } break;
+    case 1: {
+      float sum = 0.f;
+      for (int j = 0; j < 128; ++j)
+        sum += buffer[j] * buffer[j];
+      accumulator = sqrtf(sum);
+    } break;
+    case 2: {
+      float sum = 0.f;
+      for (int j = 0; j < 128; ++j)
+        sum += std::fabs(buffer[j]);
+      accumulator = sum;
+    } break;
+    case 3: {
+      for (int j = 0; j < 128; ++j)
+        buffer[j] = buffer[j] / accumulator;
+    } break;
+    case 4: {
+      const float alpha = normalizer.data[offset++];
+      const float threshold = alpha * accumulator;
+      for (int j = 0; j < 128; ++j) {
+        const float v = buffer[j];
+        buffer[j] = v >= 0.f ? (v > threshold ? threshold : v)
+                             : (v < -threshold ? -threshold : v);
+      }
+    } break;
+    case 5: {
+      for (int j = 0; j < 128; ++j)
+        buffer[j] = buffer[j] + normalizer.data[offset + j];
+      offset += 128;
+    } break;
+    case 6: {
+      alignas(64) float res[128];
+      for (int j = 0; j < 128; ++j) {
+        float acc = 0.f;
+        for (int k = 0; k < 128; ++k)
+          acc += normalizer.data[offset + j * 128 + k] * buffer[k];
+        res[j] = acc;
+      }
+      std::memcpy(buffer, res, 128*sizeof(float));
+      offset += 128 * 128;
+    } break;
+    case 7: {
+      for (int j = 0; j < 128; ++j) {
+        const float v = buffer[j];
+        buffer[j] = v < 0.f ? -sqrtf(-v) : sqrtf(v);
+      }
+    } break;
+    }
+  }
+}
+
+// Element-wise building blocks of the fused pipelines, each on 128 floats
+
+#if defined(__AVX2__)
+static inline float HorizontalSum(__m256 v)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+static inline __m256 AbsPs(__m256 v)
+{
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+}
+#endif
+
+static inline float SquareSum(const float *v)
+{
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 acc[4];
+  for (int i=0;i<4;i++)
+    acc[i] = _mm256_setzero_ps();
+  for (int j=0;j<128;j+=32)
+    for (int i=0;i<4;i++) {
+      __m256 x = _mm256_loadu_ps(v + j + 8*i);
+      acc[i] = _mm256_fmadd_ps(x, x, acc[i]);
+    }
+  return HorizontalSum(_mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3])));
+#else
+  float sum = 0.f;
+  for (int j=0;j<128;j++)
+    sum += v[j]*v[j];
+  return sum;
+#endif
+}
+
+static inline float AbsSum(const float *v)
+{
+#if defined(__AVX2__)
+  __m256 acc[4];
+  for (int i=0;i<4;i++)
+    acc[i] = _mm256_setzero_ps();
+  for (int j=0;j<128;j+=32)
+    for (int i=0;i<4;i++)
+      acc[i] = _mm256_add_ps(acc[i], AbsPs(_mm256_loadu_ps(v + j + 8*i)));
+  return HorizontalSum(_mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3])));
+#else
+  float sum = 0.f;
+  for (int j=0;j<128;j++)
+    sum += std::fabs(v[j]);
+  return sum;
+#endif
+}
+
+static inline void Clamp(float *v, float threshold)
+{
+#if defined(__AVX2__)
+  __m256 hi = _mm256_set1_ps(threshold);
+  __m256 lo = _mm256_set1_ps(-threshold);
+  for (int j=0;j<128;j+=8)
+    _mm256_storeu_ps(v + j, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(v + j), lo), hi));
+#else
+  for (int j=0;j<128;j++)
+    v[j] = std::fmin(std::fmax(v[j], -threshold), threshold);
+#endif
+}
+
+// dst = src/norm + add, with add optional
+static inline void Divide(const float *src, float norm, const float *add, float *dst)
+{
+#if defined(__AVX2__)
+  __m256 n = _mm256_set1_ps(norm);
+  for (int j=0;j<128;j+=8) {
+    __m256 x = _mm256_div_ps(_mm256_loadu_ps(src + j), n);
+    if (add)
+      x = _mm256_add_ps(x, _mm256_loadu_ps(add + j));
+    _mm256_storeu_ps(dst + j, x);
+  }
+#else
+  for (int j=0;j<128;j++)
+    dst[j] = (add ? src[j]/norm + add[j] : src[j]/norm);
+#endif
+}
+
+static inline void SignedSqrt(float *v)
+{
+#if defined(__AVX2__)
+  __m256 sign = _mm256_set1_ps(-0.0f);
+  for (int j=0;j<128;j+=8) {
+    __m256 x = _mm256_loadu_ps(v + j);
+    __m256 r = _mm256_sqrt_ps(_mm256_andnot_ps(sign, x));
+    _mm256_storeu_ps(v + j, _mm256_or_ps(r, _mm256_and_ps(sign, x)));
+  }
+#else
+  for (int j=0;j<128;j++)
+    v[j] = v[j] < 0.f ? -sqrtf(-v[j]) : sqrtf(v[j]);
+#endif
+}
+
+// res = mat*v with a row-major 128x128 matrix, four rows at a time
+static inline void MatVec(const float *mat, const float *v, float *res)
+{
+#if defined(__AVX512F__)
+  __m512 x[8];
+  for (int k=0;k<8;k++)
+    x[k] = _mm512_loadu_ps(v + 16*k);
+  for (int j=0;j<128;j+=4) {
+    __m512 acc[4];
+    for (int r=0;r<4;r++) {
+      const float *row = mat + (j + r)*128;
+      acc[r] = _mm512_mul_ps(_mm512_loadu_ps(row), x[0]);
+      for (int k=1;k<8;k++)
+        acc[r] = _mm512_fmadd_ps(_mm512_loadu_ps(row + 16*k), x[k], acc[r]);
+    }
+    for (int r=0;r<4;r++) {
+      alignas(64) float part[16];
+      _mm512_store_ps(part, acc[r]);
+      res[j + r] = HorizontalSum(_mm256_add_ps(_mm256_load_ps(part), _mm256_load_ps(part + 8)));
+    }
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  for (int j=0;j<128;j+=4) {
+    __m256 acc[4];
+    for (int r=0;r<4;r++)
+      acc[r] = _mm256_setzero_ps();
+    for (int k=0;k<128;k+=8) {
+      __m256 x = _mm256_loadu_ps(v + k);
+      for (int r=0;r<4;r++)
+        acc[r] = _mm256_fmadd_ps(_mm256_loadu_ps(mat + (j + r)*128 + k), x, acc[r]);
+    }
+    for (int r=0;r<4;r++)
+      res[j + r] = HorizontalSum(acc[r]);
+  }
+#else
+  for (int j=0;j<128;j++) {
+    float acc = 0.f;
+    for (int k=0;k<128;k++)
+      acc += mat[j*128 + k]*v[k];
+    res[j] = acc;
+  }
+#endif
+}
+
+template <int Preset>
+void NormalizeDescriptorFusedHost(float *buffer, float *desc,
+                                  const DescriptorNormalizerData &normalizer)
+{
+  typedef NormalizerTraits<Preset> Traits;
+  const float *data = normalizer.data;
+  Clamp(buffer, data[0]*sqrtf(SquareSum(buffer)));
+  float norm = (Traits::firstL1 ? AbsSum(buffer) : sqrtf(SquareSum(buffer)));
+  if (!Traits::whiten) {
+    Divide(buffer, norm, nullptr, desc);
+    return;
+  }
+  Divide(buffer, norm, data + 1, buffer);
+  MatVec(data + 1 + 128, buffer, desc);
+  norm = (Traits::secondL1 ? AbsSum(desc) : sqrtf(SquareSum(desc)));
+  Divide(desc, norm, nullptr, desc);
+  if (Traits::signedSqrt)
+    SignedSqrt(desc);
+}
+
+template void NormalizeDescriptorFusedHost<NORMALIZER_SIFT>(float *, float *, const DescriptorNormalizerData &);
+template void NormalizeDescriptorFusedHost<NORMALIZER_RSIFT>(float *, float *, const DescriptorNormalizerData &);
+template void NormalizeDescriptorFusedHost<NORMALIZER_ZCA_RSIFT>(float *, float *, const DescriptorNormalizerData &);
+template void NormalizeDescriptorFusedHost<NORMALIZER_PLUS_RSIFT>(float *, float *, const DescriptorNormalizerData &);
+
+HostNormalizerFunc GetHostNormalizer(DescriptorNormalizerPreset preset)
+{
+  switch (preset) {
+  case NORMALIZER_SIFT:
+    return NormalizeDescriptorFusedHost<NORMALIZER_SIFT>;
+  case NORMALIZER_RSIFT:
+    return NormalizeDescriptorFusedHost<NORMALIZER_RSIFT>;
+  case NORMALIZER_ZCA_RSIFT:
+    return NormalizeDescriptorFusedHost<NORMALIZER_ZCA_RSIFT>;
+  case NORMALIZER_PLUS_RSIFT:
+    return NormalizeDescriptorFusedHost<NORMALIZER_PLUS_RSIFT>;
+  default:
+    return NormalizeDescriptorHost;
+  }
+}
@@ -0,0 +1,1094 @@
+//********************************************************//
+// CPU version of the CUDA SIFT extractor by              //
+// Marten Bjorkman aka Celebrandil                        //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaImage.h"
+#include "cudasift/cudaSift.h"
+#include "cudasift/cudaSiftD.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/profiler.h"
+#include "cudasift/tempMemoryPool.h"
+
+static inline int ClampInt(int v, int lo, int hi)
+{
+  return v<lo ? lo : (v>hi ? hi : v);
+}
+
+// The Laplace kernels of all octaves are prepared in an array of 8 octaves,
+// indexed from 1, as for the constant memory of the device
+static void CheckNumOctaves(int numOctaves)
+{
+  if (numOctaves<1 || numOctaves>7)
+    throw std::invalid_argument("ExtractSift needs between 1 and 7 octaves");
+}
+
+template <typename T>
+static void forOctavesHost(int width, int height, int num_octaves, T &&cb) {
+  for (int i = 0; i < num_octaves; ++i) {
+    const int p = iAlignUp(width, 16);
+    if (!cb(i, width, height, p))
+      return;
+    width /= 2;
+    height /= 2;
+  }
+}
+
+HostTempMemory::HostTempMemory(int width_, int height_, int num_octaves_, bool scale_up)
+    : width( width_ *(scale_up ? 2 : 1)),
+      height(height_*(scale_up ? 2 : 1)),
+      restrict_width(width), restrict_height(height),
+      num_octaves(num_octaves_) {
+  ProfileScope profile(PROFILE_ALLOCATE);
+  const int nd = NUM_SCALES + 2;
+  size_t images_size = 0;
+  forOctavesHost(width, height, num_octaves,
+                 [&images_size](int, int, int h, int p) {
+    images_size += (size_t)h*p;
+    return true;
+  });
+  images.resize(images_size);
+  laplace.resize((size_t)nd*height*iAlignUp(width, 16));
+}
+
+size_t HostTempMemory::requiredSize(int width, int height, int num_octaves, bool scale_up) {
+  width *= (scale_up ? 2 : 1);
+  height *= (scale_up ? 2 : 1);
+  size_t images_size = 0;
+  forOctavesHost(width, height, num_octaves,
+                 [&images_size](int, int, int h, int p) {
+    images_size += (size_t)h*p;
+    return true;
+  });
+  return (images_size + (size_t)(NUM_SCALES + 2)*height*iAlignUp(width, 16))*sizeof(float);
+}
+
+void HostTempMemory::setSize(int w, int h) {
+  if (w<0 || h<0 || w>width || h>height)
+    throw std::invalid_argument("HostTempMemory size exceeds the allocated one");
+  restrict_width = w;
+  restrict_height = h;
+}
+
+HostImage HostTempMemory::image(int octave) const {
+  HostImage subImg;
+  float *img_offset = const_cast<float *>(images.data());
+  int rw = restrict_width, rh = restrict_height;
+  forOctavesHost(width, height, num_octaves,
+                 [&](int i, int, int h, int p) {
+                   if (i == num_octaves - octave) {
+                     subImg = HostImage(img_offset, rw, rh, p);
+                     return false;
+                   }
+                   img_offset += (size_t)h * p;
+                   rw /= 2;
+                   rh /= 2;
+                   return true;
+                 });
+  return subImg;
+}
+
+void ExtractSift(SiftData &siftData, const DescriptorNormalizerData &normalizer,
+                 const HostImage &img, int numOctaves, float initBlur, float thresh,
+                 float lowestScale, bool scaleUp, HostTempMemory &tempMemory)
+{
+  CheckNumOctaves(numOctaves);
+  ProfileScope profile(PROFILE_EXTRACT);
+  float lowPassKernel[2*LOWPASS_R+1];
+  float laplaceKernels[8*12*16];
+  PrepareLowPassKernel(initBlur, lowPassKernel);
+  PrepareLaplaceKernels(numOctaves, 0.0f, laplaceKernels);
+  siftData.numPts = 0;
+
+  HostImage lowImg = tempMemory.image(numOctaves);
+  if (!scaleUp) {
+    {
+      ProfileScope stage(PROFILE_LOW_PASS);
+      LowPassHost(lowImg, img, lowPassKernel);
+    }
+    ExtractSiftLoopHost(siftData, lowImg, normalizer, numOctaves, thresh, lowestScale,
+                        1.0f, tempMemory, laplaceKernels);
+  } else {
+    HostImage upImg(tempMemory.laplaceBuffer(), 2*img.width, 2*img.height, lowImg.pitch);
+    {
+      ProfileScope stage(PROFILE_SCALE_UP);
+      ScaleUpHost(upImg, img);
+    }
+    {
+      ProfileScope stage(PROFILE_LOW_PASS);
+      LowPassHost(lowImg, upImg, lowPassKernel);
+    }
+    ExtractSiftLoopHost(siftData, lowImg, normalizer, numOctaves, thresh, lowestScale*2.0f,
+                        1.0f, tempMemory, laplaceKernels);
+    ProfileScope stage(PROFILE_RESCALE);
+    RescalePositionsHost(siftData, 0.5f);
+  }
+  profile.setPoints(siftData.numPts);
+}
+
+void ExtractSift(SiftData &siftData, const DescriptorNormalizerData &normalizer,
+                 const HostImage &img, int numOctaves, float initBlur, float thresh,
+                 float lowestScale, bool scaleUp)
+{
+  CheckNumOctaves(numOctaves);
+  auto tmp = GlobalHostTempMemoryPool().acquire(img.width, img.height, numOctaves, scaleUp);
+  ExtractSift(siftData, normalizer, img, numOctaves, initBlur, thresh,
+              lowestScale, scaleUp, *tmp);
+}
+
+HostTempMemoryPool &GlobalHostTempMemoryPool()
+{
+  static HostTempMemoryPool pool;
+  return pool;
+}
+
+int ExtractSiftLoopHost(SiftData &siftData, const HostImage &img,
+                        const DescriptorNormalizerData &normalizer,
+                        int numOctaves, float thresh, float lowestScale,
+                        float subsampling, HostTempMemory &memoryTmp,
+                        const float *laplaceKernels)
+{
+  if (numOctaves>1) {
+    float scaleDownKernel[5];
+    PrepareScaleDownKernel(scaleDownKernel);
+    HostImage subImg = memoryTmp.image(numOctaves - 1);
+    {
+      ProfileScope stage(PROFILE_SCALE_DOWN, numOctaves - 1);
+      ScaleDownHost(subImg, img, scaleDownKernel);
+    }
+    ExtractSiftLoopHost(siftData, subImg, normalizer, numOctaves-1, thresh,
+                        lowestScale, subsampling*2.0f, memoryTmp, laplaceKernels);
+  }
+  ExtractSiftOctaveHost(siftData, img, normalizer, numOctaves, thresh, lowestScale,
+                        subsampling, memoryTmp, laplaceKernels);
+  return 0;
+}
+
+void ExtractSiftOctaveHost(SiftData &siftData, const HostImage &img,
+                           const DescriptorNormalizerData &normalizer,
+                           int octave, float thresh, float lowestScale,
+                           float subsampling, HostTempMemory &memoryTmp,
+                           const float *laplaceKernels)
+{
+  ProfileScope profile(PROFILE_OCTAVE, octave);
+  const int nd = NUM_SCALES + 3;
+  HostImage diffImg[nd];
+  int w = img.width;
+  int h = img.height;
+  int p = img.pitch;
+  for (int i=0;i<nd-1;i++)
+    diffImg[i] = HostImage(memoryTmp.laplaceBuffer() + (size_t)i*p*h, w, h, p);
+
+  {
+    ProfileScope stage(PROFILE_LAPLACE, octave);
+    LaplaceMultiHost(img, diffImg, laplaceKernels, octave);
+  }
+  int fstPts = siftData.numPts;
+  {
+    ProfileScope stage(PROFILE_FIND_POINTS, octave);
+    FindPointsMultiHost(diffImg, siftData, thresh, 10.0f, 1.0f/NUM_SCALES,
+                        lowestScale/subsampling, subsampling);
+  }
+  int totPts;
+  {
+    ProfileScope stage(PROFILE_ORIENTATIONS, octave);
+    totPts = ComputeOrientationsHost(img, siftData, fstPts, siftData.numPts);
+  }
+  {
+    ProfileScope stage(PROFILE_DESCRIPTORS, octave);
+    ExtractSiftDescriptorsHost(img, siftData, normalizer, subsampling, fstPts, totPts);
+  }
+  profile.setPoints(totPts - fstPts);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Filter kernels shared by the host and device paths
+///////////////////////////////////////////////////////////////////////////////
+
+void PrepareLaplaceKernels(int numOctaves, float initBlur, float *kernel)
+{
+  if (numOctaves>1) {
+    float totInitBlur = (float)sqrt(initBlur*initBlur + 0.5f*0.5f) / 2.0f;
+    PrepareLaplaceKernels(numOctaves-1, totInitBlur, kernel);
+  }
+  float scale = pow(2.0f, -1.0f/NUM_SCALES);
+  float diffScale = pow(2.0f, 1.0f/NUM_SCALES);
+  for (int i=0;i<NUM_SCALES+3;i++) {
+    float kernelSum = 0.0f;
+    float var = scale*scale - initBlur*initBlur;
+    for (int j=0;j<=LAPLACE_R;j++) {
+      kernel[numOctaves*12*16 + 16*i + j] = (float)expf(-(double)j*j/2.0/var);
+      kernelSum += (j==0 ? 1 : 2)*kernel[numOctaves*12*16 + 16*i + j];
+    }
+    for (int j=0;j<=LAPLACE_R;j++)
+      kernel[numOctaves*12*16 + 16*i + j] /= kernelSum;
+    scale *= diffScale;
+  }
+}
+
+void PrepareLowPassKernel(float initBlur, float *kernel)
+{
+  float scale = std::max(initBlur, 0.001f);
+  float kernelSum = 0.0f;
+  float ivar2 = 1.0f/(2.0f*scale*scale);
+  for (int j=-LOWPASS_R;j<=LOWPASS_R;j++) {
+    kernel[j+LOWPASS_R] = (float)expf(-(double)j*j*ivar2);
+    kernelSum += kernel[j+LOWPASS_R];
+  }
+  for (int j=-LOWPASS_R;j<=LOWPASS_R;j++)
+    kernel[j+LOWPASS_R] /= kernelSum;
+}
+
+void PrepareScaleDownKernel(float *kernel)
+{
+  float variance = 0.5f;
+  float kernelSum = 0.0f;
+  for (int j=0;j<5;j++) {
+    kernel[j] = (float)expf(-(double)(j-2)*(j-2)/2.0/variance);
+    kernelSum += kernel[j];
+  }
+  for (int j=0;j<5;j++)
+    kernel[j] /= kernelSum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Host side stage functions
+///////////////////////////////////////////////////////////////////////////////
+
+// The separable filters work on tiles of FILTER_TILE_H output rows by
+// FILTER_TILE_W output columns, small enough for the ring of horizontally
+// filtered rows of a tile to stay in the L1 cache while the input rows stream
+// through the L2 cache. Tiles are spread over the host threads, every tile
+// filtering the rows above and below it that it needs on its own.
+#define FILTER_TILE_W 512
+#define FILTER_TILE_H 64
+
+// Copies src[x0 - r .. x0 + n + r) into buf, clamping the columns to
+// [0, width) as the device kernels do at the image borders
+static inline void PadSegment(float *buf, const float *src, int width, int x0, int n, int r)
+{
+  const int lo = x0 - r;
+  const int hi = x0 + n + r;
+  const int a = std::max(lo, 0);
+  const int b = std::min(hi, width);
+  for (int x=lo;x<a;x++)
+    buf[x - lo] = src[0];
+  std::memcpy(buf + a - lo, src + a, sizeof(float)*(b - a));
+  for (int x=b;x<hi;x++)
+    buf[x - lo] = src[width - 1];
+}
+
+// Horizontal pass of ScaleDown, out[x] from in[2*x .. 2*x + 4]
+static void ScaleDownRow(float *out, const float *in, int n, float k0, float k1, float k2)
+{
+  int x = 0;
+#if defined(__AVX512F__)
+  const __m512i ie = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i io = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+  const __m512 c0 = _mm512_set1_ps(k0);
+  const __m512 c1 = _mm512_set1_ps(k1);
+  const __m512 c2 = _mm512_set1_ps(k2);
+  for (;x+16<=n;x+=16) {
+    const float *p = in + 2*x;
+    const __m512 a0 = _mm512_loadu_ps(p), b0 = _mm512_loadu_ps(p + 16);
+    const __m512 a2 = _mm512_loadu_ps(p + 2), b2 = _mm512_loadu_ps(p + 18);
+    const __m512 a4 = _mm512_loadu_ps(p + 4), b4 = _mm512_loadu_ps(p + 20);
+    const __m512 e0 = _mm512_permutex2var_ps(a0, ie, b0);
+    const __m512 o1 = _mm512_permutex2var_ps(a0, io, b0);
+    const __m512 e2 = _mm512_permutex2var_ps(a2, ie, b2);
+    const __m512 o3 = _mm512_permutex2var_ps(a2, io, b2);
+    const __m512 e4 = _mm512_permutex2var_ps(a4, ie, b4);
+    __m512 sum = _mm512_mul_ps(c0, _mm512_add_ps(e0, e4));
+    sum = _mm512_fmadd_ps(c1, _mm512_add_ps(o1, o3), sum);
+    _mm512_storeu_ps(out + x, _mm512_fmadd_ps(c2, e2, sum));
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  const __m256 c0 = _mm256_set1_ps(k0);
+  const __m256 c1 = _mm256_set1_ps(k1);
+  const __m256 c2 = _mm256_set1_ps(k2);
+  // Even and odd elements of 16 floats, in order
+  auto even = [](const float *p) {
+    __m256 v = _mm256_shuffle_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8), 0x88);
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), 0xd8));
+  };
+  auto odd = [](const float *p) {
+    __m256 v = _mm256_shuffle_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8), 0xdd);
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), 0xd8));
+  };
+  for (;x+8<=n;x+=8) {
+    const float *p = in + 2*x;
+    __m256 sum = _mm256_mul_ps(c0, _mm256_add_ps(even(p), even(p + 4)));
+    sum = _mm256_fmadd_ps(c1, _mm256_add_ps(odd(p), odd(p + 2)), sum);
+    _mm256_storeu_ps(out + x, _mm256_fmadd_ps(c2, even(p + 2), sum));
+  }
+#endif
+  for (;x<n;x++)
+    out[x] = k0*(in[2*x]+in[2*x+4]) + k1*(in[2*x+1]+in[2*x+3]) + k2*in[2*x+2];
+}
+
+// Vertical pass of ScaleDown over five filtered rows
+static void ScaleDownColumns(float *out, const float *const *b, int n, float k0, float k1, float k2)
+{
+  int x = 0;
+#if defined(__AVX512F__)
+  const __m512 c0 = _mm512_set1_ps(k0);
+  const __m512 c1 = _mm512_set1_ps(k1);
+  const __m512 c2 = _mm512_set1_ps(k2);
+  for (;x+16<=n;x+=16) {
+    __m512 sum = _mm512_mul_ps(c2, _mm512_loadu_ps(b[2] + x));
+    sum = _mm512_fmadd_ps(c0, _mm512_add_ps(_mm512_loadu_ps(b[0] + x), _mm512_loadu_ps(b[4] + x)), sum);
+    sum = _mm512_fmadd_ps(c1, _mm512_add_ps(_mm512_loadu_ps(b[1] + x), _mm512_loadu_ps(b[3] + x)), sum);
+    _mm512_storeu_ps(out + x, sum);
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  const __m256 c0 = _mm256_set1_ps(k0);
+  const __m256 c1 = _mm256_set1_ps(k1);
+  const __m256 c2 = _mm256_set1_ps(k2);
+  for (;x+8<=n;x+=8) {
+    __m256 sum = _mm256_mul_ps(c2, _mm256_loadu_ps(b[2] + x));
+    sum = _mm256_fmadd_ps(c0, _mm256_add_ps(_mm256_loadu_ps(b[0] + x), _mm256_loadu_ps(b[4] + x)), sum);
+    sum = _mm256_fmadd_ps(c1, _mm256_add_ps(_mm256_loadu_ps(b[1] + x), _mm256_loadu_ps(b[3] + x)), sum);
+    _mm256_storeu_ps(out + x, sum);
+  }
+#endif
+  for (;x<n;x++)
+    out[x] = k2*b[2][x] + k0*(b[0][x]+b[4][x]) + k1*(b[1][x]+b[3][x]);
+}
+
+// Horizontal pass of LowPass, out[x] from in[x - LOWPASS_R .. x + LOWPASS_R]
+static void LowPassRow(float *out, const float *in, int n, const float *k)
+{
+  int x = 0;
+#if defined(__AVX512F__)
+  __m512 c[LOWPASS_R + 1];
+  for (int i=0;i<=LOWPASS_R;i++)
+    c[i] = _mm512_set1_ps(k[i]);
+  for (;x+16<=n;x+=16) {
+    const float *p = in + x;
+    __m512 sum = _mm512_mul_ps(c[4], _mm512_loadu_ps(p));
+    sum = _mm512_fmadd_ps(c[3], _mm512_add_ps(_mm512_loadu_ps(p + 1), _mm512_loadu_ps(p - 1)), sum);
+    sum = _mm512_fmadd_ps(c[2], _mm512_add_ps(_mm512_loadu_ps(p + 2), _mm512_loadu_ps(p - 2)), sum);
+    sum = _mm512_fmadd_ps(c[1], _mm512_add_ps(_mm512_loadu_ps(p + 3), _mm512_loadu_ps(p - 3)), sum);
+    sum = _mm512_fmadd_ps(c[0], _mm512_add_ps(_mm512_loadu_ps(p + 4), _mm512_loadu_ps(p - 4)), sum);
+    _mm512_storeu_ps(out + x, sum);
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 c[LOWPASS_R + 1];
+  for (int i=0;i<=LOWPASS_R;i++)
+    c[i] = _mm256_set1_ps(k[i]);
+  for (;x+8<=n;x+=8) {
+    const float *p = in + x;
+    __m256 sum = _mm256_mul_ps(c[4], _mm256_loadu_ps(p));
+    sum = _mm256_fmadd_ps(c[3], _mm256_add_ps(_mm256_loadu_ps(p + 1), _mm256_loadu_ps(p - 1)), sum);
+    sum = _mm256_fmadd_ps(c[2], _mm256_add_ps(_mm256_loadu_ps(p + 2), _mm256_loadu_ps(p - 2)), sum);
+    sum = _mm256_fmadd_ps(c[1], _mm256_add_ps(_mm256_loadu_ps(p + 3), _mm256_loadu_ps(p - 3)), sum);
+    sum = _mm256_fmadd_ps(c[0], _mm256_add_ps(_mm256_loadu_ps(p + 4), _mm256_loadu_ps(p - 4)), sum);
+    _mm256_storeu_ps(out + x, sum);
+  }
+#endif
+  for (;x<n;x++)
+    out[x] = k[4]*in[x] +
+      k[3]*(in[x+1] + in[x-1]) +
+      k[2]*(in[x+2] + in[x-2]) +
+      k[1]*(in[x+3] + in[x-3]) +
+      k[0]*(in[x+4] + in[x-4]);
+}
+
+// Vertical pass of LowPass over 2*LOWPASS_R + 1 filtered rows
+static void LowPassColumns(float *out, const float *const *xr, int n, const float *k)
+{
+  int x = 0;
+#if defined(__AVX512F__)
+  __m512 c[LOWPASS_R + 1];
+  for (int i=0;i<=LOWPASS_R;i++)
+    c[i] = _mm512_set1_ps(k[i]);
+  for (;x+16<=n;x+=16) {
+    __m512 sum = _mm512_mul_ps(c[4], _mm512_loadu_ps(xr[4] + x));
+    for (int i=3;i>=0;i--)
+      sum = _mm512_fmadd_ps(c[i], _mm512_add_ps(_mm512_loadu_ps(xr[i] + x), _mm512_loadu_ps(xr[8 - i] + x)), sum);
+    _mm512_storeu_ps(out + x, sum);
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 c[LOWPASS_R + 1];
+  for (int i=0;i<=LOWPASS_R;i++)
+    c[i] = _mm256_set1_ps(k[i]);
+  for (;x+8<=n;x+=8) {
+    __m256 sum = _mm256_mul_ps(c[4], _mm256_loadu_ps(xr[4] + x));
+    for (int i=3;i>=0;i--)
+      sum = _mm256_fmadd_ps(c[i], _mm256_add_ps(_mm256_loadu_ps(xr[i] + x), _mm256_loadu_ps(xr[8 - i] + x)), sum);
+    _mm256_storeu_ps(out + x, sum);
+  }
+#endif
+  for (;x<n;x++)
+    out[x] = k[4]*xr[4][x] +
+      k[3]*(xr[3][x] + xr[5][x]) +
+      k[2]*(xr[2][x] + xr[6][x]) +
+      k[1]*(xr[1][x] + xr[7][x]) +
+      k[0]*(xr[0][x] + xr[8][x]);
+}
+
+void ScaleDownHost(const HostImage &res, const HostImage &src, const float *kernel)
+{
+  const int w = src.width;
+  const int h = src.height;
+  const int nw = res.width;
+  const float k0 = kernel[0];
+  const float k1 = kernel[1];
+  const float k2 = kernel[2];
+  // Output tiles of half the width, so that the input rows are as wide as
+  // those of LowPassHost
+  const int tileW = FILTER_TILE_W/2;
+  const int numCols = (nw + tileW - 1)/tileW;
+  const int numRows = (res.height + FILTER_TILE_H - 1)/FILTER_TILE_H;
+  HostThreadPool::global().parallelFor(0, numRows*numCols, 1, [&](int t0, int t1) {
+    // Ring of five horizontally filtered and subsampled rows, as in ScaleDown
+    AlignedVector<float> brows(5*tileW), inrow(2*tileW + 5);
+    for (int t=t0;t<t1;t++) {
+      const int ys0 = (t/numCols)*FILTER_TILE_H;
+      const int ys1 = std::min(ys0 + FILTER_TILE_H, res.height);
+      const int xs0 = (t%numCols)*tileW;
+      const int n = std::min(tileW, nw - xs0);
+      int rowIndex[5] = {INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN};
+      for (int ys=ys0;ys<ys1;ys++) {
+        const float *b[5];
+        for (int dy=-2;dy<=2;dy++) {
+          int y = 2*ys + dy;
+          int slot = (y + 8)%5;
+          b[dy + 2] = &brows[slot*tileW];
+          if (rowIndex[slot]==y)
+            continue;
+          rowIndex[slot] = y;
+          PadSegment(inrow.data(), src.row(ClampInt(y, 0, h-1)), w, 2*xs0, 2*n + 1, 2);
+          ScaleDownRow(&brows[slot*tileW], inrow.data(), n, k0, k1, k2);
+        }
+        ScaleDownColumns(res.row(ys) + xs0, b, n, k0, k1, k2);
+      }
+    }
+  });
+}
+
+void ScaleUpHost(const HostImage &res, const HostImage &src)
+{
+  const int w = src.width;
+  const int h = src.height;
+  HostThreadPool::global().parallelFor(0, h, [&](int y0, int y1) {
+    for (int yu=y0;yu<y1;yu++) {
+      const float *su = src.row(yu);
+      const float *sd = src.row(std::min(yu + 1, h - 1));
+      float *r0 = res.row(2*yu + 0);
+      float *r1 = res.row(2*yu + 1);
+      for (int xl=0;xl<w;xl++) {
+        int xr = std::min(xl + 1, w - 1);
+        float vul = su[xl];
+        float vur = su[xr];
+        float vdl = sd[xl];
+        float vdr = sd[xr];
+        r0[2*xl + 0] = vul;
+        r0[2*xl + 1] = 0.50f*(vul + vur);
+        r1[2*xl + 0] = 0.50f*(vul + vdl);
+        r1[2*xl + 1] = 0.25f*(vul + vur + vdl + vdr);
+      }
+    }
+  });
+}
+
+void LowPassHost(const HostImage &res, const HostImage &src, const float *k)
+{
+  const int w = res.width;
+  const int h = res.height;
+  const int N = 2*LOWPASS_R + 1;
+  const int numCols = (w + FILTER_TILE_W - 1)/FILTER_TILE_W;
+  const int numRows = (h + FILTER_TILE_H - 1)/FILTER_TILE_H;
+  HostThreadPool::global().parallelFor(0, numRows*numCols, 1, [&](int t0, int t1) {
+    // Horizontal filtering first into a ring of rows, as in LowPassBlock
+    AlignedVector<float> xrows(N*FILTER_TILE_W), inrow(FILTER_TILE_W + 2*LOWPASS_R);
+    for (int t=t0;t<t1;t++) {
+      const int y0 = (t/numCols)*FILTER_TILE_H;
+      const int y1 = std::min(y0 + FILTER_TILE_H, h);
+      const int x0 = (t%numCols)*FILTER_TILE_W;
+      const int n = std::min(FILTER_TILE_W, w - x0);
+      auto filterRow = [&](int y) {
+        PadSegment(inrow.data(), src.row(ClampInt(y, 0, h-1)), w, x0, n, LOWPASS_R);
+        LowPassRow(&xrows[((y + N*LOWPASS_R)%N)*FILTER_TILE_W], inrow.data() + LOWPASS_R, n, k);
+      };
+      for (int y=y0-LOWPASS_R;y<y0+LOWPASS_R;y++)
+        filterRow(y);
+      for (int y=y0;y<y1;y++) {
+        filterRow(y + LOWPASS_R);
+        const float *xr[N];
+        for (int i=0;i<N;i++)
+          xr[i] = &xrows[((y + i - LOWPASS_R + N*LOWPASS_R)%N)*FILTER_TILE_W];
+        LowPassColumns(res.row(y) + x0, xr, n, k);
+      }
+    }
+  });
+}
+
+// Vertical pass of LaplaceMulti for all LAPLACE_S scales at once, out[scale][i]
+// from column x0 + i of the 2*LAPLACE_R + 1 rows. The sums of the rows equally
+// far from the centre are shared by the scales.
+static void LaplaceColumns(float *const *out, const float *const *rows, int x0, int n,
+                           const float *kernels)
+{
+  int i = 0;
+#if defined(__AVX512F__)
+  for (;i+16<=n;i+=16) {
+    const int x = x0 + i;
+    __m512 v[LAPLACE_R + 1];
+    v[0] = _mm512_loadu_ps(rows[LAPLACE_R] + x);
+    for (int j=1;j<=LAPLACE_R;j++)
+      v[j] = _mm512_add_ps(_mm512_loadu_ps(rows[LAPLACE_R - j] + x), _mm512_loadu_ps(rows[LAPLACE_R + j] + x));
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      __m512 sum = _mm512_mul_ps(_mm512_set1_ps(kern[0]), v[0]);
+      for (int j=1;j<=LAPLACE_R;j++)
+        sum = _mm512_fmadd_ps(_mm512_set1_ps(kern[j]), v[j], sum);
+      _mm512_storeu_ps(out[scale] + i, sum);
+    }
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  for (;i+8<=n;i+=8) {
+    const int x = x0 + i;
+    __m256 v[LAPLACE_R + 1];
+    v[0] = _mm256_loadu_ps(rows[LAPLACE_R] + x);
+    for (int j=1;j<=LAPLACE_R;j++)
+      v[j] = _mm256_add_ps(_mm256_loadu_ps(rows[LAPLACE_R - j] + x), _mm256_loadu_ps(rows[LAPLACE_R + j] + x));
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      __m256 sum = _mm256_mul_ps(_mm256_set1_ps(kern[0]), v[0]);
+      for (int j=1;j<=LAPLACE_R;j++)
+        sum = _mm256_fmadd_ps(_mm256_set1_ps(kern[j]), v[j], sum);
+      _mm256_storeu_ps(out[scale] + i, sum);
+    }
+  }
+#endif
+  for (;i<n;i++) {
+    const int x = x0 + i;
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      float sum = kern[0]*rows[LAPLACE_R][x];
+      for (int j=1;j<=LAPLACE_R;j++)
+        sum += kern[j]*(rows[LAPLACE_R - j][x] + rows[LAPLACE_R + j][x]);
+      out[scale][i] = sum;
+    }
+  }
+}
+
+// Horizontal pass of LaplaceMulti, writing the differences of consecutive
+// scales, so that the blurred rows never leave the registers
+static void LaplaceRows(float *const *out, const float *const *in, int n, const float *kernels)
+{
+  int x = 0;
+#if defined(__AVX512F__)
+  for (;x+16<=n;x+=16) {
+    __m512 oldRes = _mm512_setzero_ps();
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      const float *p = in[scale] + x;
+      __m512 res = _mm512_mul_ps(_mm512_set1_ps(kern[0]), _mm512_loadu_ps(p));
+      for (int j=1;j<=LAPLACE_R;j++)
+        res = _mm512_fmadd_ps(_mm512_set1_ps(kern[j]), _mm512_add_ps(_mm512_loadu_ps(p - j), _mm512_loadu_ps(p + j)), res);
+      if (scale>0)
+        _mm512_storeu_ps(out[scale - 1] + x, _mm512_sub_ps(res, oldRes));
+      oldRes = res;
+    }
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  for (;x+8<=n;x+=8) {
+    __m256 oldRes = _mm256_setzero_ps();
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      const float *p = in[scale] + x;
+      __m256 res = _mm256_mul_ps(_mm256_set1_ps(kern[0]), _mm256_loadu_ps(p));
+      for (int j=1;j<=LAPLACE_R;j++)
+        res = _mm256_fmadd_ps(_mm256_set1_ps(kern[j]), _mm256_add_ps(_mm256_loadu_ps(p - j), _mm256_loadu_ps(p + j)), res);
+      if (scale>0)
+        _mm256_storeu_ps(out[scale - 1] + x, _mm256_sub_ps(res, oldRes));
+      oldRes = res;
+    }
+  }
+#endif
+  for (;x<n;x++) {
+    float oldRes = 0.0f;
+    for (int scale=0;scale<LAPLACE_S;scale++) {
+      const float *kern = kernels + scale*16;
+      const float *p = in[scale] + x;
+      float res = kern[0]*p[0];
+      for (int j=1;j<=LAPLACE_R;j++)
+        res += kern[j]*(p[-j] + p[j]);
+      if (scale>0)
+        out[scale - 1][x] = res - oldRes;
+      oldRes = res;
+    }
+  }
+}
+
+void LaplaceMultiHost(const HostImage &baseImage, const HostImage *results,
+                      const float *laplaceKernels, int octave)
+{
+  const int w = results[0].width;
+  const int h = results[0].height;
+  const float *kernels = laplaceKernels + octave*12*16;
+  const int numCols = (w + FILTER_TILE_W - 1)/FILTER_TILE_W;
+  const int numRows = (h + FILTER_TILE_H - 1)/FILTER_TILE_H;
+  // All the scales of a row of a tile are filtered and differenced in one
+  // pass over the input, vertically first and horizontally second as in
+  // LaplaceMultiMem, without writing the blurred images
+  HostThreadPool::global().parallelFor(0, numRows*numCols, 1, [&](int t0, int t1) {
+    const int bw = FILTER_TILE_W + 2*LAPLACE_R;
+    AlignedVector<float> vrows(LAPLACE_S*bw);
+    float *vrow[LAPLACE_S];
+    const float *in[LAPLACE_S];
+    for (int t=t0;t<t1;t++) {
+      const int y0 = (t/numCols)*FILTER_TILE_H;
+      const int y1 = std::min(y0 + FILTER_TILE_H, h);
+      const int x0 = (t%numCols)*FILTER_TILE_W;
+      const int n = std::min(FILTER_TILE_W, w - x0);
+      // Columns beyond the image are replicated from the vertical results at
+      // its borders, as the device clamps its reads
+      const int a = std::max(x0 - LAPLACE_R, 0);
+      const int b = std::min(x0 + n + LAPLACE_R, w);
+      for (int scale=0;scale<LAPLACE_S;scale++) {
+        vrow[scale] = &vrows[scale*bw] + LAPLACE_R;
+        in[scale] = vrow[scale];
+      }
+      const float *rows[2*LAPLACE_R + 1];
+      float *vout[LAPLACE_S];
+      float *out[LAPLACE_S - 1];
+      for (int y=y0;y<y1;y++) {
+        for (int i=0;i<=2*LAPLACE_R;i++)
+          rows[i] = baseImage.row(ClampInt(y + i - LAPLACE_R, 0, h - 1));
+        for (int scale=0;scale<LAPLACE_S;scale++)
+          vout[scale] = vrow[scale] + a - x0;
+        LaplaceColumns(vout, rows, a, b - a, kernels);
+        for (int scale=0;scale<LAPLACE_S;scale++) {
+          float *buf = vrow[scale];
+          for (int x=x0-LAPLACE_R;x<a;x++)
+            buf[x - x0] = buf[a - x0];
+          for (int x=b;x<x0+n+LAPLACE_R;x++)
+            buf[x - x0] = buf[b - 1 - x0];
+        }
+        for (int scale=0;scale<LAPLACE_S-1;scale++)
+          out[scale] = results[scale].row(y) + x0;
+        LaplaceRows(out, in, n, kernels);
+      }
+    }
+  });
+}
+
+// Subpixel refinement of a DoG extremum, identical to FindPointsMultiNew
+static bool RefinePoint(const HostImage *sources, int scale, int xpos, int ypos,
+                        float edgeLimit, float factor, float lowestScale,
+                        float subsampling, SiftPoint &pt)
+{
+  const int pitch = sources[0].pitch;
+  const float *data1 = sources[scale + 1].row(ypos) + xpos;
+  float val = data1[0];
+  float dxx = 2.0f*val - data1[-1] - data1[1];
+  float dyy = 2.0f*val - data1[-pitch] - data1[pitch];
+  float dxy = 0.25f*(data1[+pitch+1] + data1[-pitch-1] - data1[-pitch+1] - data1[+pitch-1]);
+  float tra = dxx + dyy;
+  float det = dxx*dyy - dxy*dxy;
+  if (!(tra*tra<edgeLimit*det))
+    return false;
+  float edge = tra*tra/det;
+  float dx = 0.5f*(data1[1] - data1[-1]);
+  float dy = 0.5f*(data1[pitch] - data1[-pitch]);
+  const float *data0 = sources[scale + 0].row(ypos) + xpos;
+  const float *data2 = sources[scale + 2].row(ypos) + xpos;
+  float ds = 0.5f*(data0[0] - data2[0]);
+  float dss = 2.0f*val - data2[0] - data0[0];
+  float dxs = 0.25f*(data2[1] + data0[-1] - data0[1] - data2[-1]);
+  float dys = 0.25f*(data2[pitch] + data0[-pitch] - data2[-pitch] - data0[pitch]);
+  float idxx = dyy*dss - dys*dys;
+  float idxy = dys*dxs - dxy*dss;
+  float idxs = dxy*dys - dyy*dxs;
+  float idet = 1.0f/(idxx*dxx + idxy*dxy + idxs*dxs);
+  float idyy = dxx*dss - dxs*dxs;
+  float idys = dxy*dxs - dxx*dys;
+  float idss = dxx*dyy - dxy*dxy;
+  float pdx = idet*(idxx*dx + idxy*dy + idxs*ds);
+  float pdy = idet*(idxy*dx + idyy*dy + idys*ds);
+  float pds = idet*(idxs*dx + idys*dy + idss*ds);
+  if (pdx<-0.5f || pdx>0.5f || pdy<-0.5f || pdy>0.5f || pds<-0.5f || pds>0.5f) {
+    pdx = dx/dxx;
+    pdy = dy/dyy;
+    pds = ds/dss;
+  }
+  float dval = 0.5f*(dx*pdx + dy*pdy + ds*pds);
+  float sc = powf(2.0f, (float)scale/NUM_SCALES) * exp2f(pds*factor);
+  if (!(sc>=lowestScale))
+    return false;
+  std::memset(&pt, 0, offsetof(SiftPoint, data));
+  pt.xpos = xpos + pdx;
+  pt.ypos = ypos + pdy;
+  pt.scale = sc;
+  pt.sharpness = val + dval;
+  pt.edgeness = edge;
+  pt.match = -1;
+  pt.subsampling = subsampling;
+  return true;
+}
+
+static inline bool IsExtremum(const HostImage *sources, int scale, int x, int y, float v)
+{
+  for (int s=scale;s<=scale+2;s++) {
+    for (int dy=-1;dy<=1;dy++) {
+      const float *row = sources[s].row(y + dy) + x;
+      for (int dx=-1;dx<=1;dx++) {
+        if (s==scale+1 && dy==0 && dx==0)
+          continue;
+        if (v>0.0f ? !(v>row[dx]) : !(v<row[dx]))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Writes to xs the columns in [x0, x1) of the centre rows[4] whose absolute
+// value is above thresh and that are above the maximum or below the minimum
+// of their 26 neighbours in rows, three rows of each of three scales, and
+// returns their number. This superset of the extrema is found with SIMD
+// compares, and vectors without a value above the threshold skip the
+// neighbours, as FindPointsMultiNew skips warps with __any_sync.
+static int ExtremumCandidates(const float *const *rows, int x0, int x1, float thresh, int *xs)
+{
+  int num = 0;
+  int x = x0;
+#if defined(__AVX512F__)
+  const __m512 t = _mm512_set1_ps(thresh);
+  for (;x+16<=x1;x+=16) {
+    const __m512 v = _mm512_loadu_ps(rows[4] + x);
+    const __mmask16 above = _mm512_cmp_ps_mask(_mm512_abs_ps(v), t, _CMP_GT_OQ);
+    if (!above)
+      continue;
+    __m512 maxv = _mm512_loadu_ps(rows[4] + x - 1);
+    __m512 minv = maxv;
+    for (int i=0;i<9;i++) {
+      for (int dx=-1;dx<=1;dx++) {
+        if (i==4 && dx==0)
+          continue;
+        const __m512 n = _mm512_loadu_ps(rows[i] + x + dx);
+        maxv = _mm512_max_ps(maxv, n);
+        minv = _mm512_min_ps(minv, n);
+      }
+    }
+    const int mask = _mm512_mask_cmp_ps_mask(above, v, maxv, _CMP_GT_OQ) |
+      _mm512_mask_cmp_ps_mask(above, v, minv, _CMP_LT_OQ);
+    for (int i=0;i<16;i++)
+      if (mask & (1<<i))
+        xs[num++] = x + i;
+  }
+#elif defined(__AVX2__)
+  const __m256 t = _mm256_set1_ps(thresh);
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  for (;x+8<=x1;x+=8) {
+    const __m256 v = _mm256_loadu_ps(rows[4] + x);
+    const __m256 above = _mm256_cmp_ps(_mm256_and_ps(v, absMask), t, _CMP_GT_OQ);
+    if (!_mm256_movemask_ps(above))
+      continue;
+    __m256 maxv = _mm256_loadu_ps(rows[4] + x - 1);
+    __m256 minv = maxv;
+    for (int i=0;i<9;i++) {
+      for (int dx=-1;dx<=1;dx++) {
+        if (i==4 && dx==0)
+          continue;
+        const __m256 n = _mm256_loadu_ps(rows[i] + x + dx);
+        maxv = _mm256_max_ps(maxv, n);
+        minv = _mm256_min_ps(minv, n);
+      }
+    }
+    const __m256 ext = _mm256_or_ps(_mm256_cmp_ps(v, maxv, _CMP_GT_OQ), _mm256_cmp_ps(v, minv, _CMP_LT_OQ));
+    const int mask = _mm256_movemask_ps(_mm256_and_ps(above, ext));
+    for (int i=0;i<8;i++)
+      if (mask & (1<<i))
+        xs[num++] = x + i;
+  }
+#endif
+  for (;x<x1;x++)
+    if (std::fabs(rows[4][x])>thresh)
+      xs[num++] = x;
+  return num;
+}
+
+int FindPointsMultiHost(const HostImage *sources, SiftData &siftData,
+                        float thresh, float edgeLimit, float factor,
+                        float lowestScale, float subsampling)
+{
+  const int w = sources[0].width;
+  const int h = sources[0].height;
+  if (w<3 || h<3)
+    return siftData.numPts;
+  // Points are collected per chunk of bands of rows, in the buffer of the
+  // first band of the chunk, and appended in band order, so the output is
+  // row-major regardless of the number of threads
+  const int bandHeight = 8;
+  const int numBands = (h - 2 + bandHeight - 1)/bandHeight;
+  std::vector<std::vector<SiftPoint>> bands(numBands);
+  HostThreadPool::global().parallelFor(0, numBands, [&](int b0, int b1) {
+    std::vector<SiftPoint> &points = bands[b0];
+    std::vector<int> xs(w);
+    for (int b=b0;b<b1;b++) {
+      int yEnd = std::min(1 + (b + 1)*bandHeight, h - 1);
+      for (int y=1 + b*bandHeight;y<yEnd;y++) {
+        for (int scale=0;scale<NUM_SCALES;scale++) {
+          const float *rows[9];
+          for (int s=0;s<3;s++)
+            for (int dy=-1;dy<=1;dy++)
+              rows[3*s + dy + 1] = sources[scale + s].row(y + dy);
+          int num = ExtremumCandidates(rows, 1, w - 1, thresh, xs.data());
+          for (int i=0;i<num;i++) {
+            int x = xs[i];
+            if (IsExtremum(sources, scale, x, y, rows[4][x])) {
+              SiftPoint pt;
+              if (RefinePoint(sources, scale, x, y, edgeLimit, factor, lowestScale, subsampling, pt))
+                points.push_back(pt);
+            }
+          }
+        }
+      }
+    }
+  });
+  for (auto &band : bands) {
+    for (auto &pt : band) {
+      if (siftData.numPts>=siftData.maxPts)
+        return siftData.numPts;
+      siftData.h_data[siftData.numPts++] = pt;
+    }
+  }
+  return siftData.numPts;
+}
+
+// Bilinear lookup matching tex2D with cudaFilterModeLinear and clamped
+// addressing, including the 8-bit fractional precision of the weights
+static inline float TexLinear(const HostImage &img, float x, float y)
+{
+  x -= 0.5f;
+  y -= 0.5f;
+  float fx = std::floor(x);
+  float fy = std::floor(y);
+  float a = std::nearbyint((x - fx)*256.0f)/256.0f;
+  float b = std::nearbyint((y - fy)*256.0f)/256.0f;
+  int x0 = (int)fx, y0 = (int)fy;
+  int x1 = ClampInt(x0 + 1, 0, img.width - 1);
+  int y1 = ClampInt(y0 + 1, 0, img.height - 1);
+  x0 = ClampInt(x0, 0, img.width - 1);
+  y0 = ClampInt(y0, 0, img.height - 1);
+  const float *r0 = img.row(y0);
+  const float *r1 = img.row(y1);
+  return (1.0f - b)*((1.0f - a)*r0[x0] + a*r0[x1]) + b*((1.0f - a)*r1[x0] + a*r1[x1]);
+}
+
+// Returns the primary orientation and, if there is a second peak within 80%
+// of the first, the secondary one in *second (otherwise -1)
+static float ComputeOrientation(const HostImage &img, const SiftPoint &pt, float *second)
+{
+  float hist[64], gauss[11];
+  float i2sigma2 = -1.0f/(2.0f*1.5f*1.5f*pt.scale*pt.scale);
+  for (int t=0;t<11;t++)
+    gauss[t] = expf(i2sigma2*(t-5)*(t-5));
+  for (int t=0;t<64;t++)
+    hist[t] = 0.0f;
+  float xp = pt.xpos - 4.5f;
+  float yp = pt.ypos - 4.5f;
+  for (int yd=0;yd<11;yd++) {
+    for (int xd=0;xd<11;xd++) {
+      float xf = xp + xd;
+      float yf = yp + yd;
+      float dx = TexLinear(img, xf+1.0f, yf) - TexLinear(img, xf-1.0f, yf);
+      float dy = TexLinear(img, xf, yf+1.0f) - TexLinear(img, xf, yf-1.0f);
+      int bin = 16.0f*atan2f(dy, dx)/3.1416f + 16.5f;
+      if (bin>31)
+        bin = 0;
+      float grad = sqrtf(dx*dx + dy*dy);
+      hist[bin] += grad*gauss[xd]*gauss[yd];
+    }
+  }
+  for (int t=0;t<32;t++) {
+    int x1m = (t>=1 ? t-1 : t+31);
+    int x1p = (t<=30 ? t+1 : t-31);
+    int x2m = (t>=2 ? t-2 : t+30);
+    int x2p = (t<=29 ? t+2 : t-30);
+    hist[t+32] = 6.0f*hist[t] + 4.0f*(hist[x1m] + hist[x1p]) + (hist[x2m] + hist[x2p]);
+  }
+  for (int t=0;t<32;t++) {
+    int x1m = (t>=1 ? t-1 : t+31);
+    int x1p = (t<=30 ? t+1 : t-31);
+    float v = hist[32+t];
+    hist[t] = (v>hist[32+x1m] && v>=hist[32+x1p] ? v : 0.0f);
+  }
+  float maxval1 = 0.0f;
+  float maxval2 = 0.0f;
+  int i1 = -1;
+  int i2 = -1;
+  for (int i=0;i<32;i++) {
+    float v = hist[i];
+    if (v>maxval1) {
+      maxval2 = maxval1;
+      maxval1 = v;
+      i2 = i1;
+      i1 = i;
+    } else if (v>maxval2) {
+      maxval2 = v;
+      i2 = i;
+    }
+  }
+  *second = -1.0f;
+  if (i1<0)
+    return 0.0f;
+  float val1 = hist[32+((i1+1)&31)];
+  float val2 = hist[32+((i1+31)&31)];
+  float peak = i1 + 0.5f*(val1-val2) / (2.0f*maxval1-val1-val2);
+  if (maxval2>0.8f*maxval1) {
+    float val1 = hist[32+((i2+1)&31)];
+    float val2 = hist[32+((i2+31)&31)];
+    float peak = i2 + 0.5f*(val1-val2) / (2.0f*maxval2-val1-val2);
+    *second = 11.25f*(peak<0.0f ? peak+32.0f : peak);
+  }
+  return 11.25f*(peak<0.0f ? peak+32.0f : peak);
+}
+
+int ComputeOrientationsHost(const HostImage &img, SiftData &siftData,
+                            int fstPts, int totPts)
+{
+  std::vector<float> second(totPts - fstPts);
+  SiftPoint *pts = siftData.h_data;
+  HostThreadPool::global().parallelFor(fstPts, totPts, 16, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++)
+      pts[i].orientation = ComputeOrientation(img, pts[i], &second[i - fstPts]);
+  });
+  // Secondary orientations are appended after the primary ones in point order
+  for (int i=fstPts;i<totPts;i++) {
+    if (second[i - fstPts]<0.0f)
+      continue;
+    if (siftData.numPts>=siftData.maxPts)
+      break;
+    SiftPoint &pt = pts[siftData.numPts++];
+    pt = pts[i];
+    pt.orientation = second[i - fstPts];
+  }
+  return siftData.numPts;
+}
+
+static inline float FastAtan2(float y, float x)
+{
+  float absx = std::fabs(x);
+  float absy = std::fabs(y);
+  float a = std::min(absx, absy) / std::max(absx, absy);
+  float s = a*a;
+  float r = ((-0.0464964749f*s + 0.15931422f)*s - 0.327622764f)*s*a + a;
+  r = (absy>absx ? 1.57079637f - r : r);
+  r = (x<0 ? 3.14159274f - r : r);
+  r = (y<0 ? -r : r);
+  return r;
+}
+
+static void ExtractSiftDescriptor(const HostImage &img, SiftPoint &pt,
+                                  const float *gauss, float *buffer)
+{
+  for (int i=0;i<128;i++)
+    buffer[i] = 0.0f;
+  float theta = 2.0f*3.1415f/360.0f*pt.orientation;
+  float sina = sinf(theta);           // cosa -sina
+  float cosa = cosf(theta);           // sina  cosa
+  float scale = 12.0f/16.0f*pt.scale;
+  float ssina = scale*sina;
+  float scosa = scale*cosa;
+
+  for (int y=0;y<16;y++) {
+    for (int tx=0;tx<16;tx++) {
+      float xpos = pt.xpos + (tx-7.5f)*scosa - (y-7.5f)*ssina + 0.5f;
+      float ypos = pt.ypos + (tx-7.5f)*ssina + (y-7.5f)*scosa + 0.5f;
+      float dx = TexLinear(img, xpos+cosa, ypos+sina) -
+        TexLinear(img, xpos-cosa, ypos-sina);
+      float dy = TexLinear(img, xpos-sina, ypos+cosa) -
+        TexLinear(img, xpos+sina, ypos-cosa);
+      float grad = gauss[y]*gauss[tx] * sqrtf(dx*dx + dy*dy);
+      float angf =
+          std::min(std::max(0.f, 4.0f / 3.1415f * FastAtan2(dy, dx) + 4.0f), 8.f - 1e-5f);
+
+      int hori = (tx + 2)/4 - 1;      // Convert from (tx,y,angle) to bins
+      float horf = (tx - 1.5f)/4.0f - hori;
+      float ihorf = 1.0f - horf;
+      int veri = (y + 2)/4 - 1;
+      float verf = (y - 1.5f)/4.0f - veri;
+      float iverf = 1.0f - verf;
+      int angi = angf;
+      int angp = (angi<7 ? angi+1 : 0);
+      angf -= angi;
+      float iangf = 1.0f - angf;
+
+      int hist = 8*(4*veri + hori);   // Each gradient measure is interpolated
+      int p1 = angi + hist;           // in angles, xpos and ypos -> 8 stores
+      int p2 = angp + hist;
+      if (tx>=2) {
+        float grad1 = ihorf*grad;
+        if (y>=2) {   // Upper left
+          float grad2 = iverf*grad1;
+          buffer[p1] += iangf*grad2;
+          buffer[p2] +=  angf*grad2;
+        }
+        if (y<=13) {  // Lower left
+          float grad2 = verf*grad1;
+          buffer[p1+32] += iangf*grad2;
+          buffer[p2+32] +=  angf*grad2;
+        }
+      }
+      if (tx<=13) {
+        float grad1 = horf*grad;
+        if (y>=2) {    // Upper right
+          float grad2 = iverf*grad1;
+          buffer[p1+8] += iangf*grad2;
+          buffer[p2+8] +=  angf*grad2;
+        }
+        if (y<=13) {   // Lower right
+          float grad2 = verf*grad1;
+          buffer[p1+40] += iangf*grad2;
+          buffer[p2+40] +=  angf*grad2;
+        }
+      }
+    }
+  }
+}
+
+void ExtractSiftDescriptorsHost(const HostImage &img, SiftData &siftData,
+                                const DescriptorNormalizerData &normalizer,
+                                float subsampling, int fstPts, int totPts)
+{
+  float gauss[16];
+  for (int t=0;t<16;t++)
+    gauss[t] = expf(-(t-7.5f)*(t-7.5f)/128.0f);
+  SiftPoint *pts = siftData.h_data;
+  HostNormalizerFunc normalize = GetHostNormalizer(FindNormalizerPreset(normalizer));
+  HostThreadPool::global().parallelFor(fstPts, totPts, 16, [&](int i0, int i1) {
+    alignas(64) float buffer[128];
+    for (int i=i0;i<i1;i++) {
+      ExtractSiftDescriptor(img, pts[i], gauss, buffer);
+      normalize(buffer, pts[i].data, normalizer);
+      pts[i].xpos *= subsampling;
+      pts[i].ypos *= subsampling;
+      pts[i].scale *= subsampling;
+    }
+  });
+}
+
+void RescalePositionsHost(SiftData &siftData, float scale)
+{
+  for (int i=0;i<siftData.numPts;i++) {
+    siftData.h_data[i].xpos *= scale;
+    siftData.h_data[i].ypos *= scale;
+    siftData.h_data[i].scale *= scale;
+  }
+}
@@ -0,0 +1,154 @@
+#ifndef HOSTINTERNAL_H
+#define HOSTINTERNAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+//********************************************************//
+// Helpers shared by the host translation units: binary   //
+// files, descriptor products and k-means clustering.     //
+//********************************************************//
+
+inline bool IsLittleEndian()
+{
+  const uint16_t one = 1;
+  uint8_t first;
+  std::memcpy(&first, &one, 1);
+  return first==1;
+}
+
+// Binary file of the save and load functions, closed when destroyed. Failed
+// reads and writes throw std::runtime_error naming the file. A file opened
+// for reading knows its size, so that counts read from it can be checked
+// against the remaining bytes before anything is allocated for them.
+class HostFile {
+public:
+  HostFile(const char *filename, bool writing)
+    : file(fopen(filename, writing ? "wb" : "rb")), name(filename), size(0), offset(0) {
+    if (file==nullptr)
+      throw std::runtime_error("Failed to open " + name + (writing ? " for writing" : ""));
+    if (!writing) {
+#ifdef _WIN32
+      const bool ok = !_fseeki64(file, 0, SEEK_END) && (size = _ftelli64(file))>=0 &&
+        !_fseeki64(file, 0, SEEK_SET);
+#else
+      const bool ok = !fseeko(file, 0, SEEK_END) && (size = ftello(file))>=0 &&
+        !fseeko(file, 0, SEEK_SET);
+#endif
+      if (!ok) {
+        fclose(file);
+        throw std::runtime_error("Failed to read " + name);
+      }
+    }
+  }
+  ~HostFile() {
+    if (file)
+      fclose(file);
+  }
+  HostFile(const HostFile &) = delete;
+  HostFile &operator=(const HostFile &) = delete;
+
+  void write(const void *data, size_t bytes) {
+    if (bytes && fwrite(data, 1, bytes, file)!=bytes)
+      throw std::runtime_error("Failed to write " + name);
+  }
+  void read(void *data, size_t bytes) {
+    if (bytes && fread(data, 1, bytes, file)!=bytes)
+      throw std::runtime_error(name + " is truncated or corrupt");
+    offset += bytes;
+  }
+  // Whether count items of itemSize bytes are left to read, without overflow
+  bool holds(uint64_t count, uint64_t itemSize) const {
+    return itemSize==0 || count<=(uint64_t)(size - offset)/itemSize;
+  }
+  // Closes a written file, throwing if the buffered data cannot be flushed
+  void close() {
+    FILE *f = file;
+    file = nullptr;
+    if (fclose(f))
+      throw std::runtime_error("Failed to write " + name);
+  }
+  const std::string &filename() const { return name; }
+
+private:
+  FILE *file;
+  std::string name;
+  int64_t size;
+  int64_t offset;
+};
+
+// Inner product of two vectors of n floats
+inline float Dot(const float *a, const float *b, int n)
+{
+  int d = 0;
+  float sum = 0.0f;
+#if defined(__AVX2__) && defined(__FMA__)
+  if (n>=8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (;d+8<=n;d+=8)
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d), acc);
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    sum = _mm_cvtss_f32(h);
+  }
+#endif
+  for (;d<n;d++)
+    sum += a[d]*b[d];
+  return sum;
+}
+
+// Inner product of two 128-dimensional descriptors
+inline float Dot128(const float *a, const float *b)
+{
+#if defined(__AVX512F__)
+  __m512 acc0 = _mm512_mul_ps(_mm512_loadu_ps(a), _mm512_loadu_ps(b));
+  __m512 acc1 = _mm512_mul_ps(_mm512_loadu_ps(a + 16), _mm512_loadu_ps(b + 16));
+  for (int d=32;d<128;d+=32) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d), acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + d + 16), _mm512_loadu_ps(b + d + 16), acc1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (int d=0;d<128;d+=16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8), acc1);
+  }
+  const __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_movehdup_ps(h));
+  return _mm_cvtss_f32(h);
+#else
+  float sum[8] = {0};
+  for (int d=0;d<128;d+=8)
+    for (int j=0;j<8;j++)
+      sum[j] += a[d + j]*b[d + j];
+  return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+#endif
+}
+
+// Lloyd's k-means on the n points data + ids[i]*stride, or data + i*stride
+// without ids, of dim floats each. The k centroids start from distinct points
+// drawn with seed. Each iteration assigns every point to its most similar
+// centroid, by x.c - |c|^2/2 or, if spherical, by x.c with unit centroids,
+// and moves the centroids to the mean, or its direction, of their points.
+// Clusters left empty are refilled by splitting the largest one. A final
+// assignment to the resulting centroids is written to assign, if not null.
+// assignStep, if given, replaces the default assignment. Updates run in point
+// order, so the result only depends on the seed.
+void KMeansHost(const float *data, size_t stride, const int *ids, int n, int dim, int k,
+                int iterations, uint32_t seed, bool spherical, float *centroids, int *assign,
+                const std::function<void(const float *centroids, int *assign)> &assignStep = nullptr);
+
+#endif
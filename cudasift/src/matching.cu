@@ -1,5 +1,9 @@
+#include <random>
+#include <vector>
+
 #include "cudasift/cudaSift.h"
 #include "cudasift/cudautils.h"
+#include "cudasift/deviceProfiler.h"
 
 //================= Device matching functions =====================//
 
@@ -397,6 +401,146 @@ __global__ void FindMaxCorr10(SiftPoint *sift1, SiftPoint *sift2, int numPts1, i
   }
 }
   
+// Inserts a score into a list of the K best, sorted in decreasing order and
+// held in registers as long as K is known and the loop unrolled
+template <int K>
+__device__ __forceinline__ void InsertTopK(float s, int i, float *best, int *index)
+{
+#pragma unroll
+  for (int j=0;j<K;j++) {
+    const bool above = s>best[j];
+    const float ts = best[j];
+    const int ti = index[j];
+    best[j] = (above ? s : ts);
+    index[j] = (above ? i : ti);
+    s = (above ? ts : s);
+    i = (above ? ti : i);
+  }
+}
+
+// FindMaxCorr10 keeping the K best candidates of every point. Each thread
+// keeps sorted lists for its NRX points over every M7H/M7R-th group of
+// candidates, then one thread per point merges the lists of its column in
+// shared memory. Unlike FindMaxCorr10 the last partial block of candidates
+// is scanned and out of range candidates are skipped rather than clamped.
+template <int K>
+__global__ void FindTopK10(SiftPoint *sift1, SiftPoint *sift2, int numPts1, int numPts2,
+                           SiftMatchCandidate *matches)
+{
+  __shared__ float4 buffer1[M7W*NDIM/4];
+  __shared__ float4 buffer2[M7H*NDIM/4];
+  int tx = threadIdx.x;
+  int ty = threadIdx.y;
+  int bp1 = M7W*blockIdx.x;
+  for (int j=ty;j<M7W;j+=M7H/M7R) {
+    int p1 = min(bp1 + j, numPts1 - 1);
+    for (int d=tx;d<NDIM/4;d+=M7W)
+      buffer1[j*NDIM/4 + (d + j)%(NDIM/4)] = ((float4*)&sift1[p1].data)[d];
+  }
+
+  float best[NRX][K];
+  int index[NRX][K];
+#pragma unroll
+  for (int i=0;i<NRX;i++) {
+#pragma unroll
+    for (int j=0;j<K;j++) {
+      best[i][j] = 0.0f;
+      index[i][j] = -1;
+    }
+  }
+  int idx = ty*M7W + tx;
+  int ix = idx%(M7W/NRX);
+  int iy = idx/(M7W/NRX);
+  for (int bp2=0;bp2<numPts2;bp2+=M7H) {
+    for (int j=ty;j<M7H;j+=M7H/M7R) {
+      int p2 = min(bp2 + j, numPts2 - 1);
+      for (int d=tx;d<NDIM/4;d+=M7W)
+        buffer2[j*NDIM/4 + d] = ((float4*)&sift2[p2].data)[d];
+    }
+    __syncthreads();
+
+    if (idx<M7W*M7H/M7R/NRX) {
+      float score[M7R][NRX];
+      for (int dy=0;dy<M7R;dy++)
+        for (int i=0;i<NRX;i++)
+          score[dy][i] = 0.0f;
+      for (int d=0;d<NDIM/4;d++) {
+        float4 v1[NRX];
+        for (int i=0;i<NRX;i++)
+          v1[i] = buffer1[((M7W/NRX)*i + ix)*NDIM/4 + (d + (M7W/NRX)*i + ix)%(NDIM/4)];
+        for (int dy=0;dy<M7R;dy++) {
+          float4 v2 = buffer2[(M7R*iy + dy)*(NDIM/4) + d];
+          for (int i=0;i<NRX;i++) {
+            score[dy][i] += v1[i].x*v2.x;
+            score[dy][i] += v1[i].y*v2.y;
+            score[dy][i] += v1[i].z*v2.z;
+            score[dy][i] += v1[i].w*v2.w;
+          }
+        }
+      }
+#pragma unroll
+      for (int dy=0;dy<M7R;dy++) {
+        const int p2 = bp2 + M7R*iy + dy;
+#pragma unroll
+        for (int i=0;i<NRX;i++)
+          if (p2<numPts2 && score[dy][i]>best[i][K - 1])
+            InsertTopK<K>(score[dy][i], p2, best[i], index[i]);
+      }
+    }
+    __syncthreads();
+  }
+
+  // M7H/M7R lists of K per point, at most 8 KB of scores and of indices
+  float *scores = (float*)buffer1;
+  int *indices = (int*)buffer2;
+  if (idx<M7W*M7H/M7R/NRX) {
+    for (int i=0;i<NRX;i++) {
+      for (int j=0;j<K;j++) {
+        scores[(iy*M7W + (M7W/NRX)*i + ix)*K + j] = best[i][j];
+        indices[(iy*M7W + (M7W/NRX)*i + ix)*K + j] = index[i][j];
+      }
+    }
+  }
+  __syncthreads();
+
+  if (ty==0 && bp1 + tx<numPts1) {
+    float top[K];
+    int topIndex[K];
+#pragma unroll
+    for (int j=0;j<K;j++) {
+      top[j] = scores[tx*K + j];
+      topIndex[j] = indices[tx*K + j];
+    }
+    // The lists cover disjoint candidates, so no index appears twice. Equal
+    // scores are ordered by index as on the host.
+    for (int y=1;y<M7H/M7R;y++) {
+      for (int j=0;j<K;j++) {
+        const float s = scores[(y*M7W + tx)*K + j];
+        const int i = indices[(y*M7W + tx)*K + j];
+        if (i<0 || s<top[K - 1] || (s==top[K - 1] && (topIndex[K - 1]>=0 && i>topIndex[K - 1])))
+          break;
+#pragma unroll
+        for (int k=0;k<K;k++) {
+          const bool above = s>top[k] || (s==top[k] && (topIndex[k]<0 || i<topIndex[k]));
+          if (above) {
+            for (int m=K-1;m>k;m--) {
+              top[m] = top[m - 1];
+              topIndex[m] = topIndex[m - 1];
+            }
+            top[k] = s;
+            topIndex[k] = i;
+            break;
+          }
+        }
+      }
+    }
+    for (int j=0;j<K;j++) {
+      matches[(bp1 + tx)*K + j].index = topIndex[j];
+      matches[(bp1 + tx)*K + j].score = top[j];
+    }
+  }
+}
+
 #define FMC_GH  512
 #define FMC_BW   32
 #define FMC_BH   32
@@ -998,9 +1142,62 @@ __global__ void TestHomographies(float *d_coord, float *d_homo,
 
 //================= Host matching functions =====================//
 
+// RANSAC on the points validPts of d_coord, which holds xpos, ypos,
+// match_xpos and match_ypos in four rows of numPtsUp floats. The samples are
+// drawn from a Mersenne Twister seeded with seed, whose output is the same
+// with every standard library, so the result is reproducible.
+static void EstimateHomography(float *d_coord, int numPtsUp, const int *validPts,
+                               int numValid, float *homography, int *numMatches,
+                               int numLoops, float thresh, uint32_t seed, cudaStream_t stream)
+{
+  float *d_homo;
+  int *d_randPts, *h_randPts;
+  int randSize = 4*sizeof(int)*numLoops;
+  int szFl = sizeof(float);
+  safeCall(cudaMalloc((void **)&d_randPts, randSize));
+  safeCall(cudaMalloc((void **)&d_homo, 8*sizeof(float)*numLoops));
+  h_randPts = (int*)malloc(randSize);
+  std::mt19937 rng(seed);
+  for (int i=0;i<numLoops;i++) {
+    int p1 = rng() % numValid;
+    int p2 = rng() % numValid;
+    int p3 = rng() % numValid;
+    int p4 = rng() % numValid;
+    while (p2==p1) p2 = rng() % numValid;
+    while (p3==p1 || p3==p2) p3 = rng() % numValid;
+    while (p4==p1 || p4==p2 || p4==p3) p4 = rng() % numValid;
+    h_randPts[i+0*numLoops] = validPts[p1];
+    h_randPts[i+1*numLoops] = validPts[p2];
+    h_randPts[i+2*numLoops] = validPts[p3];
+    h_randPts[i+3*numLoops] = validPts[p4];
+  }
+  safeCall(cudaMemcpyAsync(d_randPts, h_randPts, randSize, cudaMemcpyHostToDevice, stream));
+  ComputeHomographies<<<numLoops/16, 16, 0, stream>>>(d_coord, d_randPts, d_homo, numPtsUp);
+  SynchronizeStream(stream);
+  checkMsg("ComputeHomographies() execution failed\n");
+  dim3 blocks(1, numLoops/TESTHOMO_LOOPS);
+  dim3 threads(TESTHOMO_TESTS, TESTHOMO_LOOPS);
+  TestHomographies<<<blocks, threads, 0, stream>>>(d_coord, d_homo, d_randPts, numPtsUp, thresh*thresh);
+  SynchronizeStream(stream);
+  checkMsg("TestHomographies() execution failed\n");
+  safeCall(cudaMemcpyAsync(h_randPts, d_randPts, sizeof(int)*numLoops, cudaMemcpyDeviceToHost, stream));
+  int maxIndex = -1, maxCount = -1;
+  for (int i=0;i<numLoops;i++) 
+    if (h_randPts[i]>maxCount) {
+      maxCount = h_randPts[i];
+      maxIndex = i;
+    }
+  *numMatches = maxCount;
+  safeCall(cudaMemcpy2DAsync(homography, szFl, &d_homo[maxIndex], sizeof(float)*numLoops, szFl, 8, cudaMemcpyDeviceToHost, stream));
+  SynchronizeStream(stream);
+  free(h_randPts);
+  safeCall(cudaFree(d_homo));
+  safeCall(cudaFree(d_randPts));
+}
+
 double FindHomography(DeviceSiftData &data, float *homography, int *numMatches,
                       int numLoops, float minScore, float maxAmbiguity, float thresh,
-                      cudaStream_t stream)
+                      cudaStream_t stream, uint32_t seed)
 {
   *numMatches = 0;
   homography[0] = homography[4] = homography[8] = 1.0f;
@@ -1014,27 +1211,24 @@ double FindHomography(DeviceSiftData &data, float *homography, int *numMatches,
   SiftPoint *d_sift = data.d_data;
 #endif
   TimerGPU timer(stream);
+  StreamProfiler profiler(stream);
+  DeviceProfileScope profile(profiler, PROFILE_HOMOGRAPHY);
   numLoops = iDivUp(numLoops,16)*16;
   int numPts = data.numPts;
   if (numPts<8)
     return 0.0f;
   int numPtsUp = iDivUp(numPts, 16)*16;
-  float *d_coord, *d_homo;
-  int *d_randPts, *h_randPts;
-  int randSize = 4*sizeof(int)*numLoops;
+  float *d_coord;
   int szFl = sizeof(float);
   int szPt = sizeof(SiftPoint);
   safeCall(cudaMalloc((void **)&d_coord, 4*sizeof(float)*numPtsUp));
-  safeCall(cudaMalloc((void **)&d_randPts, randSize));
-  safeCall(cudaMalloc((void **)&d_homo, 8*sizeof(float)*numLoops));
-  h_randPts = (int*)malloc(randSize);
   float *h_scores = (float *)malloc(sizeof(float)*numPtsUp);
   float *h_ambiguities = (float *)malloc(sizeof(float)*numPtsUp);
   safeCall(cudaMemcpy2DAsync(h_scores, szFl, &d_sift[0].score, szPt, szFl, numPts, cudaMemcpyDeviceToHost, stream));
   safeCall(cudaMemcpy2DAsync(h_ambiguities, szFl, &d_sift[0].ambiguity, szPt, szFl, numPts, cudaMemcpyDeviceToHost, stream));
   int *validPts = (int *)malloc(sizeof(int)*numPts);
   int numValid = 0;
-  safeCall(cudaStreamSynchronize(stream));
+  SynchronizeStream(stream);
   for (int i=0;i<numPts;i++) {
     if (h_scores[i]>minScore && h_ambiguities[i]<maxAmbiguity)
       validPts[numValid++] = i;
@@ -1042,59 +1236,22 @@ double FindHomography(DeviceSiftData &data, float *homography, int *numMatches,
   free(h_scores);
   free(h_ambiguities);
   if (numValid>=8) {
-    for (int i=0;i<numLoops;i++) {
-      int p1 = rand() % numValid;
-      int p2 = rand() % numValid;
-      int p3 = rand() % numValid;
-      int p4 = rand() % numValid;
-      while (p2==p1) p2 = rand() % numValid;
-      while (p3==p1 || p3==p2) p3 = rand() % numValid;
-      while (p4==p1 || p4==p2 || p4==p3) p4 = rand() % numValid;
-      h_randPts[i+0*numLoops] = validPts[p1];
-      h_randPts[i+1*numLoops] = validPts[p2];
-      h_randPts[i+2*numLoops] = validPts[p3];
-      h_randPts[i+3*numLoops] = validPts[p4];
-    }
-    safeCall(cudaMemcpyAsync(d_randPts, h_randPts, randSize, cudaMemcpyHostToDevice, stream));
     safeCall(cudaMemcpy2DAsync(&d_coord[0*numPtsUp], szFl, &d_sift[0].xpos, szPt, szFl, numPts, cudaMemcpyDeviceToDevice, stream));
     safeCall(cudaMemcpy2DAsync(&d_coord[1*numPtsUp], szFl, &d_sift[0].ypos, szPt, szFl, numPts, cudaMemcpyDeviceToDevice, stream));
     safeCall(cudaMemcpy2DAsync(&d_coord[2*numPtsUp], szFl, &d_sift[0].match_xpos, szPt, szFl, numPts, cudaMemcpyDeviceToDevice, stream));
     safeCall(cudaMemcpy2DAsync(&d_coord[3*numPtsUp], szFl, &d_sift[0].match_ypos, szPt, szFl, numPts, cudaMemcpyDeviceToDevice, stream));
-    ComputeHomographies<<<numLoops/16, 16, 0, stream>>>(d_coord, d_randPts, d_homo, numPtsUp);
-    safeCall(cudaStreamSynchronize(stream));
-    checkMsg("ComputeHomographies() execution failed\n");
-    dim3 blocks(1, numLoops/TESTHOMO_LOOPS);
-    dim3 threads(TESTHOMO_TESTS, TESTHOMO_LOOPS);
-    TestHomographies<<<blocks, threads, 0, stream>>>(d_coord, d_homo, d_randPts, numPtsUp, thresh*thresh);
-    safeCall(cudaStreamSynchronize(stream));
-    checkMsg("TestHomographies() execution failed\n");
-    safeCall(cudaMemcpyAsync(h_randPts, d_randPts, sizeof(int)*numLoops, cudaMemcpyDeviceToHost, stream));
-    int maxIndex = -1, maxCount = -1;
-    for (int i=0;i<numLoops;i++) 
-      if (h_randPts[i]>maxCount) {
-	maxCount = h_randPts[i];
-	maxIndex = i;
-      }
-    *numMatches = maxCount;
-    safeCall(cudaMemcpy2DAsync(homography, szFl, &d_homo[maxIndex], sizeof(float)*numLoops, szFl, 8, cudaMemcpyDeviceToHost, stream));
-    safeCall(cudaStreamSynchronize(stream));
+    EstimateHomography(d_coord, numPtsUp, validPts, numValid, homography, numMatches,
+                       numLoops, thresh, seed, stream);
   }
   free(validPts);
-  free(h_randPts);
-  safeCall(cudaFree(d_homo));
-  safeCall(cudaFree(d_randPts));
   safeCall(cudaFree(d_coord));
-  double gpuTime = timer.read();
-#ifdef VERBOSE
-  printf("FindHomography time =         %.2f ms\n", gpuTime);
-#endif
-  return gpuTime;
+  return timer.read();
 }
 
-
 double MatchSiftData(const DeviceSiftData &data1, const DeviceSiftData &data2, cudaStream_t stream)
 {
-//  TimerGPU timer(stream);
+  StreamProfiler profiler(stream);
+  DeviceProfileScope profile(profiler, PROFILE_MATCH);
   int numPts1 = data1.numPts;
   int numPts2 = data2.numPts;
   if (!numPts1 || !numPts2) 
@@ -1195,11 +1352,50 @@ double MatchSiftData(const DeviceSiftData &data1, const DeviceSiftData &data2, c
   }
 #endif
 
-//  double gpuTime = timer.read();
-#ifndef VERBOSE
-//  printf("MatchSiftData time =          %.2f ms\n", gpuTime);
-#endif
   return 0;
-//  return gpuTime;
 }
+
+template <int K>
+double MatchSiftDataTopK(const DeviceSiftData &data1, const DeviceSiftData &data2,
+                         SiftMatchCandidate *d_matches, cudaStream_t stream)
+{
+  static_assert(K>=1 && K<=SIFT_TOPK_MAX, "K must be in [1, SIFT_TOPK_MAX]");
+  StreamProfiler profiler(stream);
+  DeviceProfileScope profile(profiler, PROFILE_MATCH);
+  int numPts1 = data1.numPts;
+  int numPts2 = data2.numPts;
+  if (!numPts1)
+    return 0.0;
+#ifdef MANAGEDMEM
+  SiftPoint *sift1 = data1.m_data;
+  SiftPoint *sift2 = data2.m_data;
+#else
+  if (data1.d_data==NULL || data2.d_data==NULL)
+    return 0.0;
+  SiftPoint *sift1 = data1.d_data;
+  SiftPoint *sift2 = data2.d_data;
+#endif
+  if (!numPts2) {
+    // All bytes of index -1 and score 0 would not do, so fill on the host
+    std::vector<SiftMatchCandidate> empty((size_t)numPts1*K, SiftMatchCandidate{-1, 0.0f});
+    safeCall(cudaMemcpyAsync(d_matches, empty.data(), empty.size()*sizeof(SiftMatchCandidate),
+                             cudaMemcpyHostToDevice, stream));
+    SynchronizeStream(stream);
+    return 0.0;
+  }
+  dim3 blocks(iDivUp(numPts1, M7W));
+  dim3 threads(M7W, M7H/M7R);
+  FindTopK10<K><<<blocks, threads, 0, stream>>>(sift1, sift2, numPts1, numPts2, d_matches);
+  checkMsg("FindTopK10() execution failed\n");
+  return 0.0;
+}
+
+template double MatchSiftDataTopK<1>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<2>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<3>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<4>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<5>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<6>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<7>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
+template double MatchSiftDataTopK<8>(const DeviceSiftData &, const DeviceSiftData &, SiftMatchCandidate *, cudaStream_t);
   
@@ -0,0 +1,254 @@
+//********************************************************//
+// Stage profiler, see profiler.h                         //
+//********************************************************//
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "cudasift/profiler.h"
+
+const char *ProfileStageName(ProfileStage stage)
+{
+  static const char *names[PROFILE_NUM_STAGES] = {
+    "ExtractSift", "Octave", "ScaleUp", "LowPass", "ScaleDown", "Laplace",
+    "FindPoints", "Orientations", "Descriptors", "RescalePositions",
+    "MatchSiftData", "FindHomography", "FindAffine", "FindSimilarity",
+    "FindFundamental", "FindEssential", "Download", "Readback", "CopyToTexture",
+    "Allocate", "Synchronize"
+  };
+  return (stage>=0 && stage<PROFILE_NUM_STAGES ? names[stage] : "Unknown");
+}
+
+SiftProfiler::SiftProfiler(size_t capacity_)
+  : on(false), epoch(std::chrono::steady_clock::now()), capacity(capacity_)
+{
+}
+
+SiftProfiler &SiftProfiler::global()
+{
+  static SiftProfiler profiler;
+  static bool init = [] {
+    const char *env = std::getenv("CUDASIFT_PROFILE");
+    profiler.setEnabled(env!=nullptr && *env && std::strcmp(env, "0"));
+    return true;
+  }();
+  (void)init;
+  return profiler;
+}
+
+uint64_t SiftProfiler::threadId()
+{
+  static std::atomic<uint64_t> next(1);
+  thread_local uint64_t id = next++;
+  return id;
+}
+
+void SiftProfiler::setCapacity(size_t capacity_)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = capacity_;
+  while (ring.size()>capacity)
+    ring.pop_front();
+}
+
+void SiftProfiler::add(const ProfileRecord &r)
+{
+  auto key = std::make_tuple((int)r.stage, r.octave, r.device);
+  auto it = stats.find(key);
+  if (it==stats.end()) {
+    ProfileStats s;
+    s.stage = r.stage;
+    s.octave = r.octave;
+    s.device = r.device;
+    s.minMs = s.maxMs = r.durationMs;
+    it = stats.emplace(key, s).first;
+  }
+  ProfileStats &s = it->second;
+  s.count++;
+  s.totalMs += r.durationMs;
+  s.minMs = std::min(s.minMs, r.durationMs);
+  s.maxMs = std::max(s.maxMs, r.durationMs);
+  if (r.numPts>0)
+    s.numPts += r.numPts;
+  if (capacity==0)
+    return;
+  if (ring.size()==capacity)
+    ring.pop_front();
+  ring.push_back(r);
+}
+
+void SiftProfiler::record(const ProfileRecord &r)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    add(r);
+  }
+  resolve(false);
+}
+
+void SiftProfiler::defer(Resolver resolver)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(std::move(resolver));
+  }
+  resolve(false);
+}
+
+// Runs the pending resolvers outside the record lock, as they may call into
+// the CUDA runtime. Without wait, a flush already in progress is not waited
+// for.
+void SiftProfiler::resolve(bool wait)
+{
+  std::unique_lock<std::mutex> serial(resolveMutex, std::defer_lock);
+  if (wait)
+    serial.lock();
+  else if (!serial.try_lock())
+    return;
+  std::vector<Resolver> todo;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.empty())
+      return;
+    todo.swap(pending);
+  }
+  std::vector<ProfileRecord> resolved;
+  std::vector<Resolver> unresolved;
+  for (auto &r : todo)
+    if (!r(wait, resolved))
+      unresolved.push_back(std::move(r));
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto &r : resolved)
+    add(r);
+  pending.insert(pending.begin(), std::make_move_iterator(unresolved.begin()),
+                 std::make_move_iterator(unresolved.end()));
+}
+
+std::vector<ProfileRecord> SiftProfiler::records()
+{
+  resolve(true);
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::vector<ProfileRecord>(ring.begin(), ring.end());
+}
+
+std::vector<ProfileStats> SiftProfiler::summary()
+{
+  resolve(true);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<ProfileStats> result;
+  result.reserve(stats.size());
+  for (const auto &s : stats)
+    result.push_back(s.second);
+  return result;
+}
+
+void SiftProfiler::clear()
+{
+  resolve(true);
+  std::lock_guard<std::mutex> lock(mutex);
+  ring.clear();
+  stats.clear();
+}
+
+std::string SiftProfiler::toJson()
+{
+  std::vector<ProfileRecord> recs = records();
+  std::vector<ProfileStats> sums = summary();
+  std::string json = "{\n  \"records\": [";
+  char line[512];
+  for (size_t i=0;i<recs.size();i++) {
+    const ProfileRecord &r = recs[i];
+    snprintf(line, sizeof(line), "%s\n    {\"stage\": \"%s\", \"octave\": %d, \"numPts\": %d, "
+             "\"device\": %s, \"startMs\": %.4f, \"durationMs\": %.4f, \"thread\": %" PRIu64
+             ", \"stream\": %" PRIu64 "}", (i ? "," : ""), ProfileStageName(r.stage), r.octave,
+             r.numPts, (r.device ? "true" : "false"), r.startMs, r.durationMs, r.thread, r.stream);
+    json += line;
+  }
+  json += "\n  ],\n  \"summary\": [";
+  for (size_t i=0;i<sums.size();i++) {
+    const ProfileStats &s = sums[i];
+    snprintf(line, sizeof(line), "%s\n    {\"stage\": \"%s\", \"octave\": %d, \"device\": %s, "
+             "\"count\": %zu, \"totalMs\": %.4f, \"meanMs\": %.4f, \"minMs\": %.4f, "
+             "\"maxMs\": %.4f, \"numPts\": %lld}", (i ? "," : ""), ProfileStageName(s.stage),
+             s.octave, (s.device ? "true" : "false"), s.count, s.totalMs, s.meanMs(), s.minMs,
+             s.maxMs, s.numPts);
+    json += line;
+  }
+  json += "\n  ]\n}\n";
+  return json;
+}
+
+static void WriteText(const char *filename, const std::string &text)
+{
+  FILE *file = fopen(filename, "w");
+  if (file==nullptr)
+    throw std::runtime_error(std::string("Failed to open ") + filename + " for writing");
+  bool ok = fwrite(text.data(), 1, text.size(), file)==text.size();
+  if (fclose(file) || !ok)
+    throw std::runtime_error(std::string("Failed to write ") + filename);
+}
+
+void SiftProfiler::writeJson(const char *filename)
+{
+  WriteText(filename, toJson());
+}
+
+// Complete ("X") events in microseconds, with process 1 holding the host
+// threads and process 2 the streams, numbered in order of appearance
+std::string SiftProfiler::toChromeTrace()
+{
+  std::vector<ProfileRecord> recs = records();
+  std::map<uint64_t, int> streams;
+  std::map<uint64_t, bool> threads;
+  for (const auto &r : recs) {
+    if (r.device)
+      streams.emplace(r.stream, 0);
+    else
+      threads.emplace(r.thread, true);
+  }
+  int numStreams = 0;
+  for (auto &s : streams)
+    s.second = ++numStreams;
+  std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+    "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"Host\"}},\n"
+    "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"Device\"}}";
+  char line[512];
+  for (const auto &t : threads) {
+    snprintf(line, sizeof(line), ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+             "\"tid\": %" PRIu64 ", \"args\": {\"name\": \"Thread %" PRIu64 "\"}}", t.first, t.first);
+    json += line;
+  }
+  for (const auto &s : streams) {
+    snprintf(line, sizeof(line), ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, "
+             "\"tid\": %d, \"args\": {\"name\": \"Stream 0x%" PRIx64 "\"}}", s.second, s.first);
+    json += line;
+  }
+  for (const auto &r : recs) {
+    char name[64];
+    if (r.octave>=0)
+      snprintf(name, sizeof(name), "%s %d", ProfileStageName(r.stage), r.octave);
+    else
+      snprintf(name, sizeof(name), "%s", ProfileStageName(r.stage));
+    const char *cat = (r.device ? "device" : r.stage==PROFILE_SYNC ? "sync" : "host");
+    const int pid = (r.device ? 2 : 1);
+    const uint64_t tid = (r.device ? (uint64_t)streams[r.stream] : r.thread);
+    snprintf(line, sizeof(line), ",\n  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+             "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %" PRIu64 ", \"args\": "
+             "{\"octave\": %d, \"numPts\": %d, \"thread\": %" PRIu64 ", \"stream\": \"0x%" PRIx64 "\"}}",
+             name, cat, r.startMs*1000.0, r.durationMs*1000.0, pid, tid, r.octave, r.numPts,
+             r.thread, r.stream);
+    json += line;
+  }
+  json += "\n]}\n";
+  return json;
+}
+
+void SiftProfiler::writeChromeTrace(const char *filename)
+{
+  WriteText(filename, toChromeTrace());
+}
@@ -0,0 +1,284 @@
+//********************************************************//
+// Binary feature files, see siftFile.h for the format    //
+//********************************************************//
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <cstdlib>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/siftFile.h"
+
+#include "hostinternal.h"
+
+#define SIFT_FILE_ALIGN 64
+#define SIFT_FILE_COLUMNS 7
+
+static uint64_t AlignFileOffset(uint64_t offset)
+{
+  return (offset + SIFT_FILE_ALIGN - 1)/SIFT_FILE_ALIGN*SIFT_FILE_ALIGN;
+}
+
+// Whether count items of itemSize bytes from offset end within size bytes,
+// checked without overflow for values read from a file
+static bool BlockFits(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t size)
+{
+  return offset<=size && (itemSize==0 || count<=(size - offset)/itemSize);
+}
+
+static void WriteBlock(HostFile &file, const void *data, size_t bytes, uint64_t &offset)
+{
+  static const char zeros[SIFT_FILE_ALIGN] = {0};
+  file.write(data, bytes);
+  offset += bytes;
+  size_t pad = AlignFileOffset(offset) - offset;
+  file.write(zeros, pad);
+  offset += pad;
+}
+
+void WriteSiftFeatures(const char *filename, const SiftFeatureSet &data, bool quantize)
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Feature files are only supported on little-endian hosts");
+  const uint64_t numPts = data.numPts;
+  SiftFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SIFT_FILE_MAGIC, sizeof(header.magic));
+  header.version = SIFT_FILE_VERSION;
+  header.flags = (quantize ? SIFT_FILE_QUANTIZED : 0u);
+  header.numPts = numPts;
+  header.columnStride = AlignFileOffset(numPts*sizeof(float));
+  header.keypointOffset = AlignFileOffset(sizeof(header));
+  header.descriptorOffset = header.keypointOffset + SIFT_FILE_COLUMNS*header.columnStride;
+  QuantizedSiftData quantized;
+  if (quantize) {
+    QuantizeDescriptors(data, quantized);
+    header.scaleOffset = AlignFileOffset(header.descriptorOffset + numPts*128);
+    header.fileSize = AlignFileOffset(header.scaleOffset + numPts*sizeof(float));
+  } else
+    header.fileSize = AlignFileOffset(header.descriptorOffset + numPts*128*sizeof(float));
+
+  HostFile file(filename, true);
+  uint64_t offset = 0;
+  WriteBlock(file, &header, sizeof(header), offset);
+  const AlignedVector<float> *columns[SIFT_FILE_COLUMNS] = {
+    &data.xpos, &data.ypos, &data.scale, &data.sharpness, &data.edgeness,
+    &data.orientation, &data.subsampling };
+  for (auto *column : columns)
+    WriteBlock(file, column->data(), numPts*sizeof(float), offset);
+  if (quantize) {
+    WriteBlock(file, quantized.codes.data(), numPts*128, offset);
+    WriteBlock(file, quantized.scales.data(), numPts*sizeof(float), offset);
+  } else
+    WriteBlock(file, data.descriptors.data(), numPts*128*sizeof(float), offset);
+  file.close();
+}
+
+void WriteSiftFeatures(const char *filename, const SiftData &data, bool quantize)
+{
+  SiftFeatureSet features;
+  ToFeatureSet(data, features);
+  WriteSiftFeatures(filename, features, quantize);
+}
+
+struct MappedSiftFeatures::Panels {
+  std::once_flag once;
+  PackedDescriptors descriptors;
+  PackedCodes codes;
+};
+
+MappedSiftFeatures::MappedSiftFeatures(const char *filename)
+  : base(nullptr), size(0), packed(new Panels)
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Feature files are only supported on little-endian hosts");
+  const std::string name(filename);
+#ifdef _WIN32
+  // No mapping on Windows, the file is read into aligned memory instead
+  FILE *file = fopen(filename, "rb");
+  if (file==nullptr)
+    throw std::runtime_error("Failed to open " + name);
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (length<(long)sizeof(SiftFileHeader)) {
+    fclose(file);
+    throw std::runtime_error(name + " is not a feature file");
+  }
+  size = (size_t)length;
+  uint8_t *buffer = (uint8_t *)_aligned_malloc(size, SIFT_FILE_ALIGN);
+  if (buffer==nullptr || fread(buffer, 1, size, file)!=size) {
+    _aligned_free(buffer);
+    fclose(file);
+    throw std::runtime_error("Failed to read " + name);
+  }
+  fclose(file);
+  base = buffer;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd<0)
+    throw std::runtime_error("Failed to open " + name);
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size<(off_t)sizeof(SiftFileHeader)) {
+    close(fd);
+    throw std::runtime_error(name + " is not a feature file");
+  }
+  size = (size_t)st.st_size;
+  void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr==MAP_FAILED)
+    throw std::runtime_error("Failed to map " + name);
+  base = (const uint8_t *)ptr;
+#endif
+
+  const SiftFileHeader &h = header();
+  const char *error = nullptr;
+  const uint64_t numPts = h.numPts;
+  const bool quantized = (h.flags & SIFT_FILE_QUANTIZED)!=0;
+  if (std::memcmp(h.magic, SIFT_FILE_MAGIC, sizeof(h.magic)))
+    error = " is not a feature file";
+  else if (h.version==0 || h.version>SIFT_FILE_VERSION)
+    error = " has an unsupported version";
+  else if (numPts>INT_MAX || h.columnStride<numPts*sizeof(float) ||
+           h.columnStride%SIFT_FILE_ALIGN || h.keypointOffset%SIFT_FILE_ALIGN ||
+           h.descriptorOffset%SIFT_FILE_ALIGN || h.scaleOffset%SIFT_FILE_ALIGN ||
+           h.fileSize>size || h.keypointOffset<sizeof(SiftFileHeader) ||
+           !BlockFits(h.keypointOffset, SIFT_FILE_COLUMNS, h.columnStride, h.fileSize) ||
+           !BlockFits(h.descriptorOffset, numPts, (quantized ? 128 : 128*sizeof(float)), h.fileSize) ||
+           (quantized && !BlockFits(h.scaleOffset, numPts, sizeof(float), h.fileSize)))
+    error = " is truncated or corrupt";
+  if (error) {
+    unmap();
+    throw std::runtime_error(name + error);
+  }
+
+  const float *columns[SIFT_FILE_COLUMNS];
+  for (int c=0;c<SIFT_FILE_COLUMNS;c++)
+    columns[c] = (const float *)(base + h.keypointOffset + c*h.columnStride);
+  features.numPts = (int)numPts;
+  features.xpos = columns[0];
+  features.ypos = columns[1];
+  features.scale = columns[2];
+  features.sharpness = columns[3];
+  features.edgeness = columns[4];
+  features.orientation = columns[5];
+  features.subsampling = columns[6];
+  if (quantized) {
+    features.codes = (const int8_t *)(base + h.descriptorOffset);
+    features.scales = (const float *)(base + h.scaleOffset);
+  } else
+    features.descriptors = (const float *)(base + h.descriptorOffset);
+}
+
+MappedSiftFeatures::~MappedSiftFeatures()
+{
+  unmap();
+}
+
+MappedSiftFeatures::MappedSiftFeatures(MappedSiftFeatures &&other) noexcept
+  : base(other.base), size(other.size), features(other.features),
+    packed(std::move(other.packed))
+{
+  other.base = nullptr;
+  other.size = 0;
+  other.features = SiftFeatureView();
+}
+
+MappedSiftFeatures &MappedSiftFeatures::operator=(MappedSiftFeatures &&other) noexcept
+{
+  if (&other == this)
+    return *this;
+  unmap();
+  base = other.base;
+  size = other.size;
+  features = other.features;
+  packed = std::move(other.packed);
+  other.base = nullptr;
+  other.size = 0;
+  other.features = SiftFeatureView();
+  return *this;
+}
+
+void MappedSiftFeatures::unmap()
+{
+  if (base==nullptr)
+    return;
+#ifdef _WIN32
+  _aligned_free((void *)base);
+#else
+  munmap((void *)base, size);
+#endif
+  base = nullptr;
+  size = 0;
+}
+
+const MappedSiftFeatures::Panels *MappedSiftFeatures::panels() const
+{
+  if (!packed)
+    return nullptr;
+  std::call_once(packed->once, [this] {
+    if (features.descriptors)
+      PackDescriptors(features.descriptors, 128, features.numPts, packed->descriptors);
+    else if (features.codes)
+      PackCodes(features.codes, features.scales, features.numPts, packed->codes);
+  });
+  return packed.get();
+}
+
+const PackedDescriptors *MappedSiftFeatures::packedDescriptors() const
+{
+  const Panels *p = (features.descriptors ? panels() : nullptr);
+  return p ? &p->descriptors : nullptr;
+}
+
+const PackedCodes *MappedSiftFeatures::packedCodes() const
+{
+  const Panels *p = (features.codes ? panels() : nullptr);
+  return p ? &p->codes : nullptr;
+}
+
+void ToFeatureSet(const SiftFeatureView &src, SiftFeatureSet &dst)
+{
+  const int numPts = src.numPts;
+  dst.resize(numPts);
+  if (numPts==0)
+    return;
+  const size_t bytes = numPts*sizeof(float);
+  std::memcpy(dst.xpos.data(), src.xpos, bytes);
+  std::memcpy(dst.ypos.data(), src.ypos, bytes);
+  std::memcpy(dst.scale.data(), src.scale, bytes);
+  std::memcpy(dst.sharpness.data(), src.sharpness, bytes);
+  std::memcpy(dst.edgeness.data(), src.edgeness, bytes);
+  std::memcpy(dst.orientation.data(), src.orientation, bytes);
+  std::memcpy(dst.subsampling.data(), src.subsampling, bytes);
+  std::fill(dst.score.begin(), dst.score.end(), 0.0f);
+  std::fill(dst.ambiguity.begin(), dst.ambiguity.end(), 0.0f);
+  std::fill(dst.match.begin(), dst.match.end(), -1);
+  std::fill(dst.match_xpos.begin(), dst.match_xpos.end(), 0.0f);
+  std::fill(dst.match_ypos.begin(), dst.match_ypos.end(), 0.0f);
+  std::fill(dst.match_error.begin(), dst.match_error.end(), 0.0f);
+  if (src.descriptors) {
+    std::memcpy(dst.descriptors.data(), src.descriptors, bytes*128);
+  } else {
+    HostThreadPool::global().parallelFor(0, numPts, [&](int i0, int i1) {
+      for (int i=i0;i<i1;i++)
+        for (int d=0;d<128;d++)
+          dst.descriptor(i)[d] = src.codes[(size_t)i*128 + d]*src.scales[i];
+    });
+  }
+}
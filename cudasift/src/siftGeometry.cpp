@@ -0,0 +1,1927 @@
+//********************************************************//
+// Host RANSAC estimation of geometric models, see        //
+// siftGeometry.h                                         //
+//********************************************************//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/profiler.h"
+#include "cudasift/siftGeometry.h"
+
+// Hypotheses evaluated in parallel between updates of the best model, the
+// first batch being the smallest and later ones growing to the largest
+#define RANSAC_MIN_BATCH 32
+#define RANSAC_MAX_BATCH 256
+// Hypotheses per parallel task
+#define RANSAC_GRAIN 16
+// Match arrays are padded to a multiple of this
+#define RANSAC_PAD 16
+// Matches per block of the normal equations of the refinement, summed in
+// single precision within a block and in double precision over blocks
+#define RANSAC_REFINE_BLOCK 256
+
+///////////////////////////////////////////////////////////////////////////////
+// Matches
+///////////////////////////////////////////////////////////////////////////////
+
+// Matches taking part in the estimation, with the coordinates of both images
+// translated to their centroids and scaled by a common factor so that they
+// lie about sqrt(2) from the origin. The arrays are padded with NaN, which
+// fails every inlier test.
+struct RansacData {
+  int numPts = 0;
+  int numPtsUp = 0;
+  AlignedVector<float> x1, y1, x2, y2;
+  std::vector<int> ids;           // Point numbers in the feature set
+  std::vector<float> frameA;      // Similarity of the keypoints, s cos(theta)
+  std::vector<float> frameB;      // and s sin(theta), if known
+  double cx1 = 0.0, cy1 = 0.0;    // Centroids
+  double cx2 = 0.0, cy2 = 0.0;
+  double scale = 1.0;
+  bool parallel = true;           // Work may be split over the thread pool
+};
+
+// Calls body on chunks of [begin, end) on the thread pool, or on the whole
+// range in the calling thread if the matches are one of a batch estimated
+// in parallel
+template <class F>
+static void ForRange(const RansacData &data, int begin, int end, int grain, F &&body)
+{
+  if (data.parallel)
+    HostThreadPool::global().parallelFor(begin, end, grain, std::forward<F>(body));
+  else if (end>begin)
+    body(begin, end);
+}
+
+// Selects the matches and normalizes their coordinates
+template <class Access>
+static void PrepareRansacData(int numPts, Access access, const RansacParams &params, RansacData &data)
+{
+  data.ids.clear();
+  std::vector<float> quality;
+  for (int i=0;i<numPts;i++) {
+    float score, ambiguity;
+    access.quality(i, score, ambiguity);
+    if (score>params.minScore && ambiguity<params.maxAmbiguity) {
+      data.ids.push_back(i);
+      quality.push_back(score*(1.0f - ambiguity));
+    }
+  }
+  const int num = (int)data.ids.size();
+  if (params.sampling==RANSAC_PROSAC) {
+    std::vector<int> order(num);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return quality[a]>quality[b]; });
+    std::vector<int> ids(num);
+    for (int i=0;i<num;i++)
+      ids[i] = data.ids[order[i]];
+    data.ids.swap(ids);
+  }
+  data.numPts = num;
+  data.numPtsUp = iAlignUp(std::max(num, 1), RANSAC_PAD);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  data.x1.assign(data.numPtsUp, nan);
+  data.y1.assign(data.numPtsUp, nan);
+  data.x2.assign(data.numPtsUp, nan);
+  data.y2.assign(data.numPtsUp, nan);
+  if (!num)
+    return;
+  std::vector<double> p(4*(size_t)num);
+  double sum[4] = {0.0, 0.0, 0.0, 0.0};
+  for (int i=0;i<num;i++) {
+    access.coords(data.ids[i], &p[4*i]);
+    for (int k=0;k<4;k++)
+      sum[k] += p[4*i + k];
+  }
+  data.cx1 = sum[0]/num;
+  data.cy1 = sum[1]/num;
+  data.cx2 = sum[2]/num;
+  data.cy2 = sum[3]/num;
+  double dist = 0.0;
+  for (int i=0;i<num;i++) {
+    dist += std::hypot(p[4*i] - data.cx1, p[4*i + 1] - data.cy1);
+    dist += std::hypot(p[4*i + 2] - data.cx2, p[4*i + 3] - data.cy2);
+  }
+  data.scale = (dist>0.0 ? std::sqrt(2.0)*2*num/dist : 1.0);
+  for (int i=0;i<num;i++) {
+    data.x1[i] = (float)((p[4*i] - data.cx1)*data.scale);
+    data.y1[i] = (float)((p[4*i + 1] - data.cy1)*data.scale);
+    data.x2[i] = (float)((p[4*i + 2] - data.cx2)*data.scale);
+    data.y2[i] = (float)((p[4*i + 3] - data.cy2)*data.scale);
+  }
+}
+
+// Replaces the normalized coordinates by calibrated ones, (x - cx)/fx and
+// (y - cy)/fy, with the scale of the threshold set by the mean focal length
+static void CalibrateRansacData(RansacData &data, const CameraIntrinsics &camera1,
+                                const CameraIntrinsics &camera2)
+{
+  const double inv = 1.0/data.scale;
+  for (int i=0;i<data.numPts;i++) {
+    data.x1[i] = (float)((data.x1[i]*inv + data.cx1 - camera1.cx)/camera1.fx);
+    data.y1[i] = (float)((data.y1[i]*inv + data.cy1 - camera1.cy)/camera1.fy);
+    data.x2[i] = (float)((data.x2[i]*inv + data.cx2 - camera2.cx)/camera2.fx);
+    data.y2[i] = (float)((data.y2[i]*inv + data.cy2 - camera2.cy)/camera2.fy);
+  }
+  data.cx1 = data.cy1 = data.cx2 = data.cy2 = 0.0;
+  data.scale = 4.0/(camera1.fx + camera1.fy + camera2.fx + camera2.fy);
+}
+
+// Sets the similarity of the keypoint frames of the matches, NaN where the
+// match is not a point of the second set
+template <class Access>
+static void PrepareFrames(Access access, RansacData &data)
+{
+  data.frameA.resize(data.numPts);
+  data.frameB.resize(data.numPts);
+  for (int i=0;i<data.numPts;i++) {
+    float scale, angle;
+    if (access.frame(data.ids[i], scale, angle)) {
+      data.frameA[i] = scale*std::cos(angle);
+      data.frameB[i] = scale*std::sin(angle);
+    } else
+      data.frameA[i] = data.frameB[i] = std::numeric_limits<float>::quiet_NaN();
+  }
+}
+
+struct SiftDataAccess {
+  const SiftData &data;
+  int matchOf(int i) const { return data.h_data[i].match; }
+  static void keypoint(const SiftData &set, int i, float &scale, float &orientation) {
+    scale = set.h_data[i].scale;
+    orientation = set.h_data[i].orientation;
+  }
+  void quality(int i, float &score, float &ambiguity) const {
+    score = data.h_data[i].score;
+    ambiguity = data.h_data[i].ambiguity;
+  }
+  void coords(int i, double *p) const {
+    const SiftPoint &pt = data.h_data[i];
+    p[0] = pt.xpos;
+    p[1] = pt.ypos;
+    p[2] = pt.match_xpos;
+    p[3] = pt.match_ypos;
+  }
+};
+
+struct SiftFeatureSetAccess {
+  const SiftFeatureSet &data;
+  int matchOf(int i) const { return data.match[i]; }
+  static void keypoint(const SiftFeatureSet &set, int i, float &scale, float &orientation) {
+    scale = set.scale[i];
+    orientation = set.orientation[i];
+  }
+  void quality(int i, float &score, float &ambiguity) const {
+    score = data.score[i];
+    ambiguity = data.ambiguity[i];
+  }
+  void coords(int i, double *p) const {
+    p[0] = data.xpos[i];
+    p[1] = data.ypos[i];
+    p[2] = data.match_xpos[i];
+    p[3] = data.match_ypos[i];
+  }
+};
+
+// Matches of data1 into data2 with the keypoint frames of both
+template <class Base, class Set>
+struct FramePairAccess : Base {
+  const Set &data2;
+  FramePairAccess(const Set &data1, const Set &data2) : Base{data1}, data2(data2) {}
+  // Scale ratio and rotation in radians from point i to its match
+  bool frame(int i, float &scale, float &angle) const {
+    const int j = Base::matchOf(i);
+    if (j<0 || j>=data2.numPts)
+      return false;
+    float scale1, orient1, scale2, orient2;
+    Base::keypoint(Base::data, i, scale1, orient1);
+    Base::keypoint(data2, j, scale2, orient2);
+    if (!(scale1>0.0f))
+      return false;
+    scale = scale2/scale1;
+    angle = (orient2 - orient1)*(3.14159265f/180.0f);
+    return true;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Random samples
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t SplitMix64(uint64_t &state)
+{
+  uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Draws size distinct numbers below n for hypothesis h, from a stream that
+// only depends on the seed and h. With last, the final number is n - 1 and
+// the others are below n - 1.
+static inline void DrawSample(uint32_t seed, int h, int n, int size, int *sample, bool last = false)
+{
+  uint64_t state = ((uint64_t)seed << 32) ^ (uint64_t)(uint32_t)h;
+  SplitMix64(state);
+  if (last) {
+    sample[--size] = --n;
+  }
+  for (int k=0;k<size;k++) {
+    bool unique;
+    do {
+      sample[k] = (int)((SplitMix64(state) >> 33)%(uint64_t)n);
+      unique = true;
+      for (int j=0;j<k;j++)
+        unique = unique && sample[j]!=sample[k];
+    } while (!unique);
+  }
+}
+
+// Set of best matches sampled by each PROSAC hypothesis. With T_n the
+// expected number of samples among the best n matches out of maxSamples
+// uniform samples, the set grows to n + 1 matches after hypothesis T'_n,
+// the hypotheses up to T'_n + 1 = T'_n + ceil(T_n+1 - T_n) then drawing
+// the new match and the rest from the better ones.
+class ProsacSchedule {
+public:
+  ProsacSchedule(int sampleSize, int numPts, int maxSamples)
+    : m(sampleSize), N(numPts), n(sampleSize), Tprime(1) {
+    Tn = maxSamples;
+    for (int i=0;i<m;i++)
+      Tn *= (double)(m - i)/(N - i);
+  }
+  // For hypotheses t = 0, 1, 2, ... in turn, the size of the set and
+  // whether the sample must include its last match
+  void next(int t, int &size, bool &last) {
+    if (t + 1>Tprime && n<N) {
+      const double Tnext = Tn*(n + 1)/(n + 1 - m);
+      Tprime += (int)std::ceil(Tnext - Tn);
+      Tn = Tnext;
+      n++;
+    }
+    size = n;
+    last = (t + 1<=Tprime);
+  }
+
+private:
+  const int m, N;
+  int n;
+  int Tprime;
+  double Tn;
+};
+
+// Hypotheses needed for an all-inlier sample with the given confidence
+static int RequiredHypotheses(double confidence, int numInliers, int numPts, int sampleSize, int maxHyps)
+{
+  const double p = std::pow((double)numInliers/numPts, sampleSize);
+  if (p>=1.0)
+    return 1;
+  if (p<=0.0)
+    return maxHyps;
+  const double n = std::log(1.0 - confidence)/std::log(1.0 - p);
+  return (n<maxHyps ? std::max((int)std::ceil(n), 1) : maxHyps);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Linear algebra
+///////////////////////////////////////////////////////////////////////////////
+
+// Solves the n x n system a x = b by Gaussian elimination with partial
+// pivoting, overwriting a and b. Returns false if a is numerically singular.
+template <int n>
+static bool SolveLinear(double a[n][n], double *b, double *x)
+{
+  for (int c=0;c<n;c++) {
+    int p = c;
+    for (int r=c+1;r<n;r++)
+      if (std::fabs(a[r][c])>std::fabs(a[p][c]))
+        p = r;
+    if (std::fabs(a[p][c])<1e-12)
+      return false;
+    if (p!=c) {
+      for (int k=0;k<n;k++)
+        std::swap(a[c][k], a[p][k]);
+      std::swap(b[c], b[p]);
+    }
+    const double inv = 1.0/a[c][c];
+    for (int r=c+1;r<n;r++) {
+      const double f = a[r][c]*inv;
+      if (f==0.0)
+        continue;
+      for (int k=c;k<n;k++)
+        a[r][k] -= f*a[c][k];
+      b[r] -= f*b[c];
+    }
+  }
+  for (int r=n-1;r>=0;r--) {
+    double sum = b[r];
+    for (int k=r+1;k<n;k++)
+      sum -= a[r][k]*x[k];
+    x[r] = sum/a[r][r];
+  }
+  return true;
+}
+
+// Eigenvalues and eigenvectors, as the columns of vecs, of the symmetric
+// n x n matrix a by cyclic Jacobi rotations, overwriting a
+template <int n>
+static void SymmetricEigen(double a[n][n], double *vals, double vecs[n][n])
+{
+  double norm = 0.0;
+  for (int r=0;r<n;r++)
+    for (int c=0;c<n;c++) {
+      vecs[r][c] = (r==c ? 1.0 : 0.0);
+      norm += a[r][c]*a[r][c];
+    }
+  for (int sweep=0;sweep<50;sweep++) {
+    double off = 0.0;
+    for (int p=0;p<n;p++)
+      for (int q=p+1;q<n;q++)
+        off += a[p][q]*a[p][q];
+    if (off<=1e-30*norm)
+      break;
+    for (int p=0;p<n;p++) {
+      for (int q=p+1;q<n;q++) {
+        if (a[p][q]==0.0)
+          continue;
+        const double theta = (a[q][q] - a[p][p])/(2.0*a[p][q]);
+        const double t = (theta>=0.0 ? 1.0 : -1.0)/(std::fabs(theta) + std::sqrt(theta*theta + 1.0));
+        const double c = 1.0/std::sqrt(t*t + 1.0);
+        const double s = t*c;
+        for (int k=0;k<n;k++) {
+          const double akp = a[k][p], akq = a[k][q];
+          a[k][p] = c*akp - s*akq;
+          a[k][q] = s*akp + c*akq;
+        }
+        for (int k=0;k<n;k++) {
+          const double apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c*apk - s*aqk;
+          a[q][k] = s*apk + c*aqk;
+        }
+        for (int k=0;k<n;k++) {
+          const double vkp = vecs[k][p], vkq = vecs[k][q];
+          vecs[k][p] = c*vkp - s*vkq;
+          vecs[k][q] = s*vkp + c*vkq;
+        }
+      }
+    }
+  }
+  for (int k=0;k<n;k++)
+    vals[k] = a[k][k];
+}
+
+// Unit eigenvector of the smallest eigenvalue of the symmetric matrix a
+template <int n>
+static void SmallestEigenvector(double a[n][n], double *v)
+{
+  double vals[n], vecs[n][n];
+  SymmetricEigen<n>(a, vals, vecs);
+  int k = 0;
+  for (int i=1;i<n;i++)
+    if (vals[i]<vals[k])
+      k = i;
+  for (int i=0;i<n;i++)
+    v[i] = vecs[i][k];
+}
+
+// Basis of the null space of the rows x 9 matrix a, by Gauss-Jordan
+// elimination with full pivoting, overwriting a. Returns false if a has
+// lower rank than rows.
+template <int rows>
+static bool NullSpace9(double a[rows][9], double basis[9 - rows][9])
+{
+  int pivots[rows];
+  bool pivot[9] = {false};
+  for (int r=0;r<rows;r++) {
+    int pr = r, pc = -1;
+    double best = 0.0;
+    for (int i=r;i<rows;i++)
+      for (int c=0;c<9;c++)
+        if (!pivot[c] && std::fabs(a[i][c])>best) {
+          best = std::fabs(a[i][c]);
+          pr = i;
+          pc = c;
+        }
+    if (best<1e-12)
+      return false;
+    for (int k=0;k<9;k++)
+      std::swap(a[r][k], a[pr][k]);
+    pivots[r] = pc;
+    pivot[pc] = true;
+    const double inv = 1.0/a[r][pc];
+    for (int k=0;k<9;k++)
+      a[r][k] *= inv;
+    for (int i=0;i<rows;i++) {
+      const double f = a[i][pc];
+      if (i==r || f==0.0)
+        continue;
+      for (int k=0;k<9;k++)
+        a[i][k] -= f*a[r][k];
+    }
+  }
+  int f = 0;
+  for (int c=0;c<9;c++) {
+    if (pivot[c])
+      continue;
+    for (int k=0;k<9;k++)
+      basis[f][k] = 0.0;
+    basis[f][c] = 1.0;
+    for (int r=0;r<rows;r++)
+      basis[f][pivots[r]] = -a[r][c];
+    f++;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Polynomials
+///////////////////////////////////////////////////////////////////////////////
+
+#define POLY_MAX_DEGREE 10
+
+// Value and derivative of c[0] + c[1] x + ... + c[degree] x^degree
+static inline void EvalPolynomial(const double *c, int degree, double x, double &f, double &df)
+{
+  f = c[degree];
+  df = 0.0;
+  for (int i=degree-1;i>=0;i--) {
+    df = df*x + f;
+    f = f*x + c[i];
+  }
+}
+
+// Root of a polynomial that changes sign between lo and hi, by Newton steps
+// that fall back to bisection when they leave the bracket
+static double BracketedRoot(const double *c, int degree, double lo, double hi)
+{
+  double flo, df;
+  EvalPolynomial(c, degree, lo, flo, df);
+  double x = 0.5*(lo + hi);
+  for (int it=0;it<100;it++) {
+    double f;
+    EvalPolynomial(c, degree, x, f, df);
+    if (f==0.0)
+      return x;
+    if ((f<0.0)==(flo<0.0)) {
+      lo = x;
+      flo = f;
+    } else
+      hi = x;
+    double next = (df!=0.0 ? x - f/df : lo);
+    if (!(next>lo && next<hi))
+      next = 0.5*(lo + hi);
+    if (std::fabs(next - x)<=1e-15*std::max(1.0, std::fabs(x)))
+      return next;
+    x = next;
+  }
+  return x;
+}
+
+// Real roots, in increasing order, of c[0] + c[1] x + ... + c[degree]
+// x^degree for degree <= POLY_MAX_DEGREE. Each derivative is monotonic
+// between the roots of the next one, which therefore bracket its roots, so
+// the roots are found from the highest derivative down. Returns their number.
+static int PolynomialRoots(const double *c, int degree, double *roots)
+{
+  double scale = 0.0;
+  for (int i=0;i<=degree;i++)
+    scale = std::max(scale, std::fabs(c[i]));
+  while (degree>0 && std::fabs(c[degree])<=1e-14*scale)
+    degree--;
+  if (degree<=0)
+    return 0;
+  // Monic polynomial and its derivatives, derivs[k] of degree k
+  double derivs[POLY_MAX_DEGREE + 1][POLY_MAX_DEGREE + 1];
+  double bound = 0.0;
+  for (int i=0;i<=degree;i++) {
+    derivs[degree][i] = c[i]/c[degree];
+    if (i<degree)
+      bound = std::max(bound, std::fabs(derivs[degree][i]));
+  }
+  bound += 1.0;
+  for (int k=degree-1;k>=1;k--)
+    for (int i=0;i<=k;i++)
+      derivs[k][i] = derivs[k + 1][i + 1]*(i + 1)/(k + 1);
+  double prev[POLY_MAX_DEGREE + 2];
+  double next[POLY_MAX_DEGREE + 2];
+  int numPrev = 0;
+  for (int k=1;k<=degree;k++) {
+    // Brackets: -bound, the roots of derivative k - 1, bound
+    double ends[POLY_MAX_DEGREE + 2];
+    int numEnds = 0;
+    ends[numEnds++] = -bound;
+    for (int i=0;i<numPrev;i++)
+      ends[numEnds++] = prev[i];
+    ends[numEnds++] = bound;
+    int num = 0;
+    double f0, f1, df;
+    EvalPolynomial(derivs[k], k, ends[0], f0, df);
+    for (int i=0;i+1<numEnds;i++) {
+      EvalPolynomial(derivs[k], k, ends[i + 1], f1, df);
+      if ((f0>0.0)!=(f1>0.0))
+        next[num++] = BracketedRoot(derivs[k], k, ends[i], ends[i + 1]);
+      f0 = f1;
+    }
+    for (int i=0;i<num;i++)
+      prev[i] = next[i];
+    numPrev = num;
+  }
+  for (int i=0;i<numPrev;i++)
+    roots[i] = prev[i];
+  return numPrev;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Homography refinement
+///////////////////////////////////////////////////////////////////////////////
+
+// Weighted sums u*p over the matches, for the weights u = w, w*x2, w*y2 and
+// w*(x2^2 + y2^2) and the products p = x1^2, x1*y1, y1^2, x1, y1 and 1, from
+// which the normal equations of the linear system of HomographyModel::solve
+// are assembled
+#define REFINE_WEIGHTS 4
+#define REFINE_PRODUCTS 6
+#define REFINE_SUMS (REFINE_WEIGHTS*REFINE_PRODUCTS)
+
+// Adds the sums of the matches i0 to i1 - 1, weighted for h by the Cauchy
+// weight t2/(t2 + e^2) of their distance e, times 1/deno^2 so that the
+// algebraic error of the linear system approximates the distance. Matches
+// farther away than twice the threshold are left out.
+static void AccumulateRefineSums(const RansacData &data, const float *h, float thresh2, int i0, int i1,
+                                 double *sums)
+{
+  float res[REFINE_SUMS];
+  const float cut = 4.0f*thresh2;
+  int i = i0;
+#if defined(__AVX512F__)
+  __m512 acc[REFINE_SUMS];
+  for (int k=0;k<REFINE_SUMS;k++)
+    acc[k] = _mm512_setzero_ps();
+  const __m512 t = _mm512_set1_ps(thresh2);
+  const __m512 c = _mm512_set1_ps(cut);
+  for (;i+16<=i1;i+=16) {
+    __m512 x1 = _mm512_load_ps(&data.x1[i]);
+    __m512 y1 = _mm512_load_ps(&data.y1[i]);
+    __m512 x2 = _mm512_load_ps(&data.x2[i]);
+    __m512 y2 = _mm512_load_ps(&data.y2[i]);
+    const __m512 nomx = _mm512_fmadd_ps(_mm512_set1_ps(h[0]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[1]), y1, _mm512_set1_ps(h[2])));
+    const __m512 nomy = _mm512_fmadd_ps(_mm512_set1_ps(h[3]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[4]), y1, _mm512_set1_ps(h[5])));
+    const __m512 deno = _mm512_fmadd_ps(_mm512_set1_ps(h[6]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[7]), y1, _mm512_set1_ps(h[8])));
+    const __m512 errx = _mm512_fmsub_ps(x2, deno, nomx);
+    const __m512 erry = _mm512_fmsub_ps(y2, deno, nomy);
+    const __m512 err2 = _mm512_fmadd_ps(errx, errx, _mm512_mul_ps(erry, erry));
+    const __m512 deno2 = _mm512_mul_ps(deno, deno);
+    const __mmask16 in = _mm512_cmp_ps_mask(err2, _mm512_mul_ps(c, deno2), _CMP_LT_OQ);
+    const __m512 w = _mm512_maskz_div_ps(in, t, _mm512_fmadd_ps(t, deno2, err2));
+    x1 = _mm512_maskz_mov_ps(in, x1);
+    y1 = _mm512_maskz_mov_ps(in, y1);
+    x2 = _mm512_maskz_mov_ps(in, x2);
+    y2 = _mm512_maskz_mov_ps(in, y2);
+    const __m512 u[REFINE_WEIGHTS] = {w, _mm512_mul_ps(w, x2), _mm512_mul_ps(w, y2),
+                                      _mm512_mul_ps(w, _mm512_fmadd_ps(x2, x2, _mm512_mul_ps(y2, y2)))};
+    const __m512 p[REFINE_PRODUCTS - 1] = {_mm512_mul_ps(x1, x1), _mm512_mul_ps(x1, y1), _mm512_mul_ps(y1, y1), x1, y1};
+    for (int a=0;a<REFINE_WEIGHTS;a++) {
+      for (int b=0;b<REFINE_PRODUCTS - 1;b++)
+        acc[a*REFINE_PRODUCTS + b] = _mm512_fmadd_ps(u[a], p[b], acc[a*REFINE_PRODUCTS + b]);
+      acc[a*REFINE_PRODUCTS + REFINE_PRODUCTS - 1] = _mm512_add_ps(u[a], acc[a*REFINE_PRODUCTS + REFINE_PRODUCTS - 1]);
+    }
+  }
+  for (int k=0;k<REFINE_SUMS;k++)
+    res[k] = _mm512_reduce_add_ps(acc[k]);
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc[REFINE_SUMS];
+  for (int k=0;k<REFINE_SUMS;k++)
+    acc[k] = _mm256_setzero_ps();
+  const __m256 t = _mm256_set1_ps(thresh2);
+  const __m256 c = _mm256_set1_ps(cut);
+  for (;i+8<=i1;i+=8) {
+    __m256 x1 = _mm256_load_ps(&data.x1[i]);
+    __m256 y1 = _mm256_load_ps(&data.y1[i]);
+    __m256 x2 = _mm256_load_ps(&data.x2[i]);
+    __m256 y2 = _mm256_load_ps(&data.y2[i]);
+    const __m256 nomx = _mm256_fmadd_ps(_mm256_set1_ps(h[0]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[1]), y1, _mm256_set1_ps(h[2])));
+    const __m256 nomy = _mm256_fmadd_ps(_mm256_set1_ps(h[3]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[4]), y1, _mm256_set1_ps(h[5])));
+    const __m256 deno = _mm256_fmadd_ps(_mm256_set1_ps(h[6]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[7]), y1, _mm256_set1_ps(h[8])));
+    const __m256 errx = _mm256_fmsub_ps(x2, deno, nomx);
+    const __m256 erry = _mm256_fmsub_ps(y2, deno, nomy);
+    const __m256 err2 = _mm256_fmadd_ps(errx, errx, _mm256_mul_ps(erry, erry));
+    const __m256 deno2 = _mm256_mul_ps(deno, deno);
+    const __m256 in = _mm256_cmp_ps(err2, _mm256_mul_ps(c, deno2), _CMP_LT_OQ);
+    const __m256 w = _mm256_and_ps(in, _mm256_div_ps(t, _mm256_fmadd_ps(t, deno2, err2)));
+    x1 = _mm256_and_ps(in, x1);
+    y1 = _mm256_and_ps(in, y1);
+    x2 = _mm256_and_ps(in, x2);
+    y2 = _mm256_and_ps(in, y2);
+    const __m256 u[REFINE_WEIGHTS] = {w, _mm256_mul_ps(w, x2), _mm256_mul_ps(w, y2),
+                                      _mm256_mul_ps(w, _mm256_fmadd_ps(x2, x2, _mm256_mul_ps(y2, y2)))};
+    const __m256 p[REFINE_PRODUCTS - 1] = {_mm256_mul_ps(x1, x1), _mm256_mul_ps(x1, y1), _mm256_mul_ps(y1, y1), x1, y1};
+    for (int a=0;a<REFINE_WEIGHTS;a++) {
+      for (int b=0;b<REFINE_PRODUCTS - 1;b++)
+        acc[a*REFINE_PRODUCTS + b] = _mm256_fmadd_ps(u[a], p[b], acc[a*REFINE_PRODUCTS + b]);
+      acc[a*REFINE_PRODUCTS + REFINE_PRODUCTS - 1] = _mm256_add_ps(u[a], acc[a*REFINE_PRODUCTS + REFINE_PRODUCTS - 1]);
+    }
+  }
+  for (int k=0;k<REFINE_SUMS;k++) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc[k]), _mm256_extractf128_ps(acc[k], 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    res[k] = _mm_cvtss_f32(s);
+  }
+#else
+  for (int k=0;k<REFINE_SUMS;k++)
+    res[k] = 0.0f;
+#endif
+  for (;i<i1;i++) {
+    const float x1 = data.x1[i], y1 = data.y1[i];
+    const float x2 = data.x2[i], y2 = data.y2[i];
+    const float deno = h[6]*x1 + h[7]*y1 + h[8];
+    const float errx = x2*deno - (h[0]*x1 + h[1]*y1 + h[2]);
+    const float erry = y2*deno - (h[3]*x1 + h[4]*y1 + h[5]);
+    const float err2 = errx*errx + erry*erry;
+    if (!(err2<cut*deno*deno))
+      continue;
+    const float w = thresh2/(thresh2*deno*deno + err2);
+    const float u[REFINE_WEIGHTS] = {w, w*x2, w*y2, w*(x2*x2 + y2*y2)};
+    const float p[REFINE_PRODUCTS] = {x1*x1, x1*y1, y1*y1, x1, y1, 1.0f};
+    for (int a=0;a<REFINE_WEIGHTS;a++)
+      for (int b=0;b<REFINE_PRODUCTS;b++)
+        res[a*REFINE_PRODUCTS + b] += u[a]*p[b];
+  }
+  for (int k=0;k<REFINE_SUMS;k++)
+    sums[k] = res[k];
+}
+
+// Iteratively reweighted least-squares refinement of h, with the normal
+// equations of each iteration summed over blocks of matches in parallel and
+// then over the blocks in order. With dof 8 h is a homography, and with dof
+// 6 or 4 an affine transform or a similarity [a -b tx; b a ty; 0 0 1], whose
+// normal equations follow from the same sums. Returns false if they become
+// singular.
+static bool ReweightHomography(const RansacData &data, float *h, float thresh2, int loops, int dof = 8)
+{
+  const int numBlocks = (data.numPts + RANSAC_REFINE_BLOCK - 1)/RANSAC_REFINE_BLOCK;
+  std::vector<double> blockSums((size_t)numBlocks*REFINE_SUMS);
+  // Position of the product of two of x1, y1 and 1 among the products
+  static const int pos[3][3] = {{0, 1, 3}, {1, 2, 4}, {3, 4, 5}};
+  for (int loop=0;loop<loops;loop++) {
+    ForRange(data, 0, numBlocks, 1, [&](int b0, int b1) {
+      for (int b=b0;b<b1;b++) {
+        const int i0 = b*RANSAC_REFINE_BLOCK;
+        const int i1 = std::min(i0 + RANSAC_REFINE_BLOCK, data.numPtsUp);
+        AccumulateRefineSums(data, h, thresh2, i0, i1, &blockSums[(size_t)b*REFINE_SUMS]);
+      }
+    });
+    double sums[REFINE_SUMS] = {0.0};
+    for (int b=0;b<numBlocks;b++)
+      for (int k=0;k<REFINE_SUMS;k++)
+        sums[k] += blockSums[(size_t)b*REFINE_SUMS + k];
+    const double *sw = &sums[0];
+    const double *swx = &sums[REFINE_PRODUCTS];
+    const double *swy = &sums[2*REFINE_PRODUCTS];
+    const double *swr = &sums[3*REFINE_PRODUCTS];
+    double x[8];
+    if (dof==4) {
+      // Unknowns a, b, tx and ty
+      double a[4][4] = {{sw[0] + sw[2], 0.0, sw[3], sw[4]},
+                        {0.0, sw[0] + sw[2], -sw[4], sw[3]},
+                        {sw[3], -sw[4], sw[5], 0.0},
+                        {sw[4], sw[3], 0.0, sw[5]}};
+      double rhs[4] = {swx[3] + swy[4], swy[3] - swx[4], swx[5], swy[5]};
+      double sim[4];
+      if (!SolveLinear<4>(a, rhs, sim))
+        return false;
+      const double res[8] = {sim[0], -sim[1], sim[2], sim[1], sim[0], sim[3], 0.0, 0.0};
+      std::copy(res, res + 8, x);
+    } else if (dof==6) {
+      // The same 3 x 3 system for both rows
+      for (int row=0;row<2;row++) {
+        double a[3][3], rhs[3];
+        for (int r=0;r<3;r++) {
+          for (int c=0;c<3;c++)
+            a[r][c] = sw[pos[r][c]];
+          rhs[r] = (row ? swy : swx)[pos[r][2]];
+        }
+        if (!SolveLinear<3>(a, rhs, &x[3*row]))
+          return false;
+      }
+      x[6] = x[7] = 0.0;
+    } else {
+      double a[8][8], rhs[8];
+      for (int r=0;r<8;r++)
+        for (int c=0;c<8;c++)
+          a[r][c] = 0.0;
+      for (int r=0;r<3;r++) {
+        for (int c=0;c<3;c++) {
+          a[r][c] = a[3 + r][3 + c] = sw[pos[r][c]];
+        }
+        for (int c=0;c<2;c++) {
+          a[r][6 + c] = a[6 + c][r] = -swx[pos[r][c]];
+          a[3 + r][6 + c] = a[6 + c][3 + r] = -swy[pos[r][c]];
+        }
+        rhs[r] = swx[pos[r][2]];
+        rhs[3 + r] = swy[pos[r][2]];
+      }
+      for (int r=0;r<2;r++) {
+        for (int c=0;c<2;c++)
+          a[6 + r][6 + c] = swr[pos[r][c]];
+        rhs[6 + r] = -swr[pos[r][2]];
+      }
+      if (!SolveLinear<8>(a, rhs, x))
+        return false;
+    }
+    for (int k=0;k<8;k++)
+      h[k] = (float)x[k];
+    h[8] = 1.0f;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Homography model
+///////////////////////////////////////////////////////////////////////////////
+
+struct HomographyModel {
+  static const ProfileStage stage = PROFILE_HOMOGRAPHY;
+  static const int sampleSize = 4;
+  static const int maxModels = 1;
+  static const int minPts = 8;
+
+  static void reset(float *h) {
+    for (int k=0;k<9;k++)
+      h[k] = (k%4==0 ? 1.0f : 0.0f);
+  }
+
+  // Direct linear transform of the sample with h[8] = 1, the same system as
+  // ComputeHomographies
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    double a[8][8], b[8], h[8];
+    for (int i=0;i<4;i++) {
+      const int pt = sample[i];
+      const double x1 = data.x1[pt], y1 = data.y1[pt];
+      const double x2 = data.x2[pt], y2 = data.y2[pt];
+      double *row1 = a[2*i];
+      double *row2 = a[2*i + 1];
+      row1[0] = x1;  row1[1] = y1;  row1[2] = 1.0;
+      row1[3] = 0.0; row1[4] = 0.0; row1[5] = 0.0;
+      row1[6] = -x2*x1;
+      row1[7] = -x2*y1;
+      row2[0] = 0.0; row2[1] = 0.0; row2[2] = 0.0;
+      row2[3] = x1;  row2[4] = y1;  row2[5] = 1.0;
+      row2[6] = -y2*x1;
+      row2[7] = -y2*y1;
+      b[2*i] = x2;
+      b[2*i + 1] = y2;
+    }
+    if (!SolveLinear<8>(a, b, h))
+      return 0;
+    for (int k=0;k<8;k++)
+      models[0][k] = (float)h[k];
+    models[0][8] = 1.0f;
+    return 1;
+  }
+
+  // Matches whose mapping is off by less than sqrt(thresh2), tested without
+  // division as in TestHomographies
+  static int count(const RansacData &data, const float *h, float thresh2) {
+    int cnt = 0;
+    int i = 0;
+#if defined(__AVX512F__)
+    __m512i acc = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512 t = _mm512_set1_ps(thresh2);
+    for (;i<data.numPtsUp;i+=16) {
+      const __m512 x1 = _mm512_load_ps(&data.x1[i]);
+      const __m512 y1 = _mm512_load_ps(&data.y1[i]);
+      const __m512 nomx = _mm512_fmadd_ps(_mm512_set1_ps(h[0]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[1]), y1, _mm512_set1_ps(h[2])));
+      const __m512 nomy = _mm512_fmadd_ps(_mm512_set1_ps(h[3]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[4]), y1, _mm512_set1_ps(h[5])));
+      const __m512 deno = _mm512_fmadd_ps(_mm512_set1_ps(h[6]), x1, _mm512_fmadd_ps(_mm512_set1_ps(h[7]), y1, _mm512_set1_ps(h[8])));
+      const __m512 errx = _mm512_fmsub_ps(_mm512_load_ps(&data.x2[i]), deno, nomx);
+      const __m512 erry = _mm512_fmsub_ps(_mm512_load_ps(&data.y2[i]), deno, nomy);
+      const __m512 err2 = _mm512_fmadd_ps(errx, errx, _mm512_mul_ps(erry, erry));
+      const __mmask16 in = _mm512_cmp_ps_mask(err2, _mm512_mul_ps(t, _mm512_mul_ps(deno, deno)), _CMP_LT_OQ);
+      acc = _mm512_mask_add_epi32(acc, in, acc, one);
+    }
+    cnt = _mm512_reduce_add_epi32(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256i acc = _mm256_setzero_si256();
+    const __m256 t = _mm256_set1_ps(thresh2);
+    for (;i<data.numPtsUp;i+=8) {
+      const __m256 x1 = _mm256_load_ps(&data.x1[i]);
+      const __m256 y1 = _mm256_load_ps(&data.y1[i]);
+      const __m256 nomx = _mm256_fmadd_ps(_mm256_set1_ps(h[0]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[1]), y1, _mm256_set1_ps(h[2])));
+      const __m256 nomy = _mm256_fmadd_ps(_mm256_set1_ps(h[3]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[4]), y1, _mm256_set1_ps(h[5])));
+      const __m256 deno = _mm256_fmadd_ps(_mm256_set1_ps(h[6]), x1, _mm256_fmadd_ps(_mm256_set1_ps(h[7]), y1, _mm256_set1_ps(h[8])));
+      const __m256 errx = _mm256_fmsub_ps(_mm256_load_ps(&data.x2[i]), deno, nomx);
+      const __m256 erry = _mm256_fmsub_ps(_mm256_load_ps(&data.y2[i]), deno, nomy);
+      const __m256 err2 = _mm256_fmadd_ps(errx, errx, _mm256_mul_ps(erry, erry));
+      const __m256 in = _mm256_cmp_ps(err2, _mm256_mul_ps(t, _mm256_mul_ps(deno, deno)), _CMP_LT_OQ);
+      acc = _mm256_sub_epi32(acc, _mm256_castps_si256(in));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    cnt = _mm_cvtsi128_si32(s);
+#endif
+    for (;i<data.numPts;i++)
+      cnt += inlier(data, h, i, thresh2);
+    return cnt;
+  }
+
+  // Local optimization of a new best model, returning its inliers after
+  // the refinement or -1 if it failed
+  static int refine(const RansacData &data, float *h, float thresh2, int loops) {
+    if (!ReweightHomography(data, h, thresh2, loops))
+      return -1;
+    return count(data, h, thresh2);
+  }
+
+  static bool inlier(const RansacData &data, const float *h, int i, float thresh2) {
+    const float x1 = data.x1[i], y1 = data.y1[i];
+    const float deno = h[6]*x1 + h[7]*y1 + h[8];
+    const float errx = data.x2[i]*deno - (h[0]*x1 + h[1]*y1 + h[2]);
+    const float erry = data.y2[i]*deno - (h[3]*x1 + h[4]*y1 + h[5]);
+    return errx*errx + erry*erry<thresh2*deno*deno;
+  }
+
+  // Hn = T2 H T1^-1 in normalized coordinates, scaled so that Hn[8] = 1
+  static void normalize(const RansacData &data, const float *h, float *hn) {
+    const double s = data.scale;
+    double m[9];
+    for (int r=0;r<3;r++) {
+      // H T1^-1, with T1^-1 = [1/s 0 cx1; 0 1/s cy1; 0 0 1]
+      m[3*r] = h[3*r]/s;
+      m[3*r + 1] = h[3*r + 1]/s;
+      m[3*r + 2] = h[3*r]*data.cx1 + h[3*r + 1]*data.cy1 + h[3*r + 2];
+    }
+    double res[9];
+    for (int c=0;c<3;c++) {
+      // T2 = [s 0 -s cx2; 0 s -s cy2; 0 0 1]
+      res[c] = s*(m[c] - data.cx2*m[6 + c]);
+      res[3 + c] = s*(m[3 + c] - data.cy2*m[6 + c]);
+      res[6 + c] = m[6 + c];
+    }
+    const double norm = (res[8]!=0.0 ? 1.0/res[8] : 1.0);
+    for (int k=0;k<9;k++)
+      hn[k] = (float)(res[k]*norm);
+  }
+
+  // H = T2^-1 Hn T1 in pixel coordinates, scaled so that H[8] = 1
+  static void denormalize(const RansacData &data, const float *hn, float *h) {
+    const double s = data.scale;
+    double m[9];
+    for (int r=0;r<3;r++) {
+      // Hn T1, with T1 = [s 0 -s cx1; 0 s -s cy1; 0 0 1]
+      m[3*r] = hn[3*r]*s;
+      m[3*r + 1] = hn[3*r + 1]*s;
+      m[3*r + 2] = hn[3*r + 2] - s*(hn[3*r]*data.cx1 + hn[3*r + 1]*data.cy1);
+    }
+    double res[9];
+    for (int c=0;c<3;c++) {
+      // T2^-1 = [1/s 0 cx2; 0 1/s cy2; 0 0 1]
+      res[c] = m[c]/s + data.cx2*m[6 + c];
+      res[3 + c] = m[3 + c]/s + data.cy2*m[6 + c];
+      res[6 + c] = m[6 + c];
+    }
+    const double norm = (res[8]!=0.0 ? 1.0/res[8] : 1.0);
+    for (int k=0;k<9;k++)
+      h[k] = (float)(res[k]*norm);
+  }
+};
+
+// Affine transform [a b tx; c d ty; 0 0 1] from three matches, scored and
+// denormalized as a homography
+struct AffineModel : HomographyModel {
+  static const ProfileStage stage = PROFILE_AFFINE;
+  static const int sampleSize = 3;
+  static const int maxModels = 1;
+  static const int minPts = 4;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    double x[6];
+    for (int row=0;row<2;row++) {
+      double a[3][3], b[3];
+      for (int i=0;i<3;i++) {
+        const int pt = sample[i];
+        a[i][0] = data.x1[pt];
+        a[i][1] = data.y1[pt];
+        a[i][2] = 1.0;
+        b[i] = (row ? data.y2[pt] : data.x2[pt]);
+      }
+      if (!SolveLinear<3>(a, b, &x[3*row]))
+        return 0;
+    }
+    for (int k=0;k<6;k++)
+      models[0][k] = (float)x[k];
+    models[0][6] = models[0][7] = 0.0f;
+    models[0][8] = 1.0f;
+    return 1;
+  }
+
+  static int refine(const RansacData &data, float *h, float thresh2, int loops) {
+    if (!ReweightHomography(data, h, thresh2, loops, 6))
+      return -1;
+    return count(data, h, thresh2);
+  }
+};
+
+// Similarity [a -b tx; b a ty; 0 0 1] from two matches, the rotation and
+// scale taking the vector between them in the first image to the one in the
+// second
+struct SimilarityModel : HomographyModel {
+  static const ProfileStage stage = PROFILE_SIMILARITY;
+  static const int sampleSize = 2;
+  static const int maxModels = 1;
+  static const int minPts = 3;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    const int i = sample[0], j = sample[1];
+    const double dx1 = data.x1[j] - data.x1[i], dy1 = data.y1[j] - data.y1[i];
+    const double dx2 = data.x2[j] - data.x2[i], dy2 = data.y2[j] - data.y2[i];
+    const double len2 = dx1*dx1 + dy1*dy1;
+    if (len2<1e-12)
+      return 0;
+    const double a = (dx1*dx2 + dy1*dy2)/len2;
+    const double b = (dx1*dy2 - dy1*dx2)/len2;
+    store(data, i, a, b, models[0]);
+    return 1;
+  }
+
+  // The similarity with a and b that maps match i exactly
+  static void store(const RansacData &data, int i, double a, double b, float *h) {
+    h[0] = (float)a;
+    h[1] = (float)-b;
+    h[2] = (float)(data.x2[i] - a*data.x1[i] + b*data.y1[i]);
+    h[3] = (float)b;
+    h[4] = (float)a;
+    h[5] = (float)(data.y2[i] - b*data.x1[i] - a*data.y1[i]);
+    h[6] = h[7] = 0.0f;
+    h[8] = 1.0f;
+  }
+
+  static int refine(const RansacData &data, float *h, float thresh2, int loops) {
+    if (!ReweightHomography(data, h, thresh2, loops, 4))
+      return -1;
+    return count(data, h, thresh2);
+  }
+};
+
+// Similarity from a single match, with the rotation and scale from the
+// difference of orientations and the ratio of scales of its keypoints
+struct FrameSimilarityModel : SimilarityModel {
+  static const int sampleSize = 1;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    const int i = sample[0];
+    const double a = data.frameA[i], b = data.frameB[i];
+    if (!(a*a + b*b>0.0))
+      return 0;
+    store(data, i, a, b, models[0]);
+    return 1;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Epipolar models
+///////////////////////////////////////////////////////////////////////////////
+
+// Weighted sums of the products q2*q1, with q = x^2, x*y, y^2, x, y and 1
+// in either image, from which the 9 x 9 normal equations of the epipolar
+// constraint p2^T F p1 = 0 are assembled, as its coefficient vector is the
+// Kronecker product of p2 = (x2, y2, 1) and p1 = (x1, y1, 1)
+#define EPIPOLAR_PRODUCTS 6
+#define EPIPOLAR_SUMS (EPIPOLAR_PRODUCTS*EPIPOLAR_PRODUCTS)
+
+// Adds the sums of the matches i0 to i1 - 1, weighted for f by the Cauchy
+// weight t2/(t2 + e^2) of their Sampson distance e, times the inverse of its
+// denominator so that the algebraic error approximates the distance.
+// Matches farther away than twice the threshold are left out.
+static void AccumulateEpipolarSums(const RansacData &data, const float *f, float thresh2, int i0, int i1,
+                                   double *sums)
+{
+  float res[EPIPOLAR_SUMS];
+  const float cut = 4.0f*thresh2;
+  int i = i0;
+#if defined(__AVX512F__)
+  __m512 acc[EPIPOLAR_SUMS];
+  for (int k=0;k<EPIPOLAR_SUMS;k++)
+    acc[k] = _mm512_setzero_ps();
+  const __m512 t = _mm512_set1_ps(thresh2);
+  const __m512 c = _mm512_set1_ps(cut);
+  for (;i+16<=i1;i+=16) {
+    __m512 x1 = _mm512_load_ps(&data.x1[i]);
+    __m512 y1 = _mm512_load_ps(&data.y1[i]);
+    __m512 x2 = _mm512_load_ps(&data.x2[i]);
+    __m512 y2 = _mm512_load_ps(&data.y2[i]);
+    const __m512 l0 = _mm512_fmadd_ps(_mm512_set1_ps(f[0]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[1]), y1, _mm512_set1_ps(f[2])));
+    const __m512 l1 = _mm512_fmadd_ps(_mm512_set1_ps(f[3]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[4]), y1, _mm512_set1_ps(f[5])));
+    const __m512 l2 = _mm512_fmadd_ps(_mm512_set1_ps(f[6]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[7]), y1, _mm512_set1_ps(f[8])));
+    const __m512 m0 = _mm512_fmadd_ps(_mm512_set1_ps(f[0]), x2, _mm512_fmadd_ps(_mm512_set1_ps(f[3]), y2, _mm512_set1_ps(f[6])));
+    const __m512 m1 = _mm512_fmadd_ps(_mm512_set1_ps(f[1]), x2, _mm512_fmadd_ps(_mm512_set1_ps(f[4]), y2, _mm512_set1_ps(f[7])));
+    const __m512 err = _mm512_fmadd_ps(x2, l0, _mm512_fmadd_ps(y2, l1, l2));
+    const __m512 err2 = _mm512_mul_ps(err, err);
+    const __m512 deno = _mm512_fmadd_ps(l0, l0, _mm512_fmadd_ps(l1, l1, _mm512_fmadd_ps(m0, m0, _mm512_mul_ps(m1, m1))));
+    const __mmask16 in = _mm512_cmp_ps_mask(err2, _mm512_mul_ps(c, deno), _CMP_LT_OQ);
+    const __m512 w = _mm512_maskz_div_ps(in, t, _mm512_fmadd_ps(t, deno, err2));
+    x1 = _mm512_maskz_mov_ps(in, x1);
+    y1 = _mm512_maskz_mov_ps(in, y1);
+    x2 = _mm512_maskz_mov_ps(in, x2);
+    y2 = _mm512_maskz_mov_ps(in, y2);
+    const __m512 wx2 = _mm512_mul_ps(w, x2), wy2 = _mm512_mul_ps(w, y2);
+    const __m512 u[EPIPOLAR_PRODUCTS] = {_mm512_mul_ps(wx2, x2), _mm512_mul_ps(wx2, y2), _mm512_mul_ps(wy2, y2), wx2, wy2, w};
+    const __m512 p[EPIPOLAR_PRODUCTS - 1] = {_mm512_mul_ps(x1, x1), _mm512_mul_ps(x1, y1), _mm512_mul_ps(y1, y1), x1, y1};
+    for (int a=0;a<EPIPOLAR_PRODUCTS;a++) {
+      for (int b=0;b<EPIPOLAR_PRODUCTS - 1;b++)
+        acc[a*EPIPOLAR_PRODUCTS + b] = _mm512_fmadd_ps(u[a], p[b], acc[a*EPIPOLAR_PRODUCTS + b]);
+      acc[a*EPIPOLAR_PRODUCTS + EPIPOLAR_PRODUCTS - 1] = _mm512_add_ps(u[a], acc[a*EPIPOLAR_PRODUCTS + EPIPOLAR_PRODUCTS - 1]);
+    }
+  }
+  for (int k=0;k<EPIPOLAR_SUMS;k++)
+    res[k] = _mm512_reduce_add_ps(acc[k]);
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc[EPIPOLAR_SUMS];
+  for (int k=0;k<EPIPOLAR_SUMS;k++)
+    acc[k] = _mm256_setzero_ps();
+  const __m256 t = _mm256_set1_ps(thresh2);
+  const __m256 c = _mm256_set1_ps(cut);
+  for (;i+8<=i1;i+=8) {
+    __m256 x1 = _mm256_load_ps(&data.x1[i]);
+    __m256 y1 = _mm256_load_ps(&data.y1[i]);
+    __m256 x2 = _mm256_load_ps(&data.x2[i]);
+    __m256 y2 = _mm256_load_ps(&data.y2[i]);
+    const __m256 l0 = _mm256_fmadd_ps(_mm256_set1_ps(f[0]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[1]), y1, _mm256_set1_ps(f[2])));
+    const __m256 l1 = _mm256_fmadd_ps(_mm256_set1_ps(f[3]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[4]), y1, _mm256_set1_ps(f[5])));
+    const __m256 l2 = _mm256_fmadd_ps(_mm256_set1_ps(f[6]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[7]), y1, _mm256_set1_ps(f[8])));
+    const __m256 m0 = _mm256_fmadd_ps(_mm256_set1_ps(f[0]), x2, _mm256_fmadd_ps(_mm256_set1_ps(f[3]), y2, _mm256_set1_ps(f[6])));
+    const __m256 m1 = _mm256_fmadd_ps(_mm256_set1_ps(f[1]), x2, _mm256_fmadd_ps(_mm256_set1_ps(f[4]), y2, _mm256_set1_ps(f[7])));
+    const __m256 err = _mm256_fmadd_ps(x2, l0, _mm256_fmadd_ps(y2, l1, l2));
+    const __m256 err2 = _mm256_mul_ps(err, err);
+    const __m256 deno = _mm256_fmadd_ps(l0, l0, _mm256_fmadd_ps(l1, l1, _mm256_fmadd_ps(m0, m0, _mm256_mul_ps(m1, m1))));
+    const __m256 in = _mm256_cmp_ps(err2, _mm256_mul_ps(c, deno), _CMP_LT_OQ);
+    const __m256 w = _mm256_and_ps(in, _mm256_div_ps(t, _mm256_fmadd_ps(t, deno, err2)));
+    x1 = _mm256_and_ps(in, x1);
+    y1 = _mm256_and_ps(in, y1);
+    x2 = _mm256_and_ps(in, x2);
+    y2 = _mm256_and_ps(in, y2);
+    const __m256 wx2 = _mm256_mul_ps(w, x2), wy2 = _mm256_mul_ps(w, y2);
+    const __m256 u[EPIPOLAR_PRODUCTS] = {_mm256_mul_ps(wx2, x2), _mm256_mul_ps(wx2, y2), _mm256_mul_ps(wy2, y2), wx2, wy2, w};
+    const __m256 p[EPIPOLAR_PRODUCTS - 1] = {_mm256_mul_ps(x1, x1), _mm256_mul_ps(x1, y1), _mm256_mul_ps(y1, y1), x1, y1};
+    for (int a=0;a<EPIPOLAR_PRODUCTS;a++) {
+      for (int b=0;b<EPIPOLAR_PRODUCTS - 1;b++)
+        acc[a*EPIPOLAR_PRODUCTS + b] = _mm256_fmadd_ps(u[a], p[b], acc[a*EPIPOLAR_PRODUCTS + b]);
+      acc[a*EPIPOLAR_PRODUCTS + EPIPOLAR_PRODUCTS - 1] = _mm256_add_ps(u[a], acc[a*EPIPOLAR_PRODUCTS + EPIPOLAR_PRODUCTS - 1]);
+    }
+  }
+  for (int k=0;k<EPIPOLAR_SUMS;k++) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc[k]), _mm256_extractf128_ps(acc[k], 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    res[k] = _mm_cvtss_f32(s);
+  }
+#else
+  for (int k=0;k<EPIPOLAR_SUMS;k++)
+    res[k] = 0.0f;
+#endif
+  for (;i<i1;i++) {
+    const float x1 = data.x1[i], y1 = data.y1[i];
+    const float x2 = data.x2[i], y2 = data.y2[i];
+    const float l0 = f[0]*x1 + f[1]*y1 + f[2];
+    const float l1 = f[3]*x1 + f[4]*y1 + f[5];
+    const float l2 = f[6]*x1 + f[7]*y1 + f[8];
+    const float m0 = f[0]*x2 + f[3]*y2 + f[6];
+    const float m1 = f[1]*x2 + f[4]*y2 + f[7];
+    const float err = x2*l0 + y2*l1 + l2;
+    const float deno = l0*l0 + l1*l1 + m0*m0 + m1*m1;
+    if (!(err*err<cut*deno))
+      continue;
+    const float w = thresh2/(thresh2*deno + err*err);
+    const float u[EPIPOLAR_PRODUCTS] = {w*x2*x2, w*x2*y2, w*y2*y2, w*x2, w*y2, w};
+    const float p[EPIPOLAR_PRODUCTS] = {x1*x1, x1*y1, y1*y1, x1, y1, 1.0f};
+    for (int a=0;a<EPIPOLAR_PRODUCTS;a++)
+      for (int b=0;b<EPIPOLAR_PRODUCTS;b++)
+        res[a*EPIPOLAR_PRODUCTS + b] += u[a]*p[b];
+  }
+  for (int k=0;k<EPIPOLAR_SUMS;k++)
+    sums[k] = res[k];
+}
+
+// Closest matrix of rank two to the 3 x 3 matrix f, in the Frobenius norm,
+// or with essential the closest one with two equal singular values
+static void ProjectEpipolar(double *f, bool essential)
+{
+  double ftf[3][3], vals[3], v[3][3];
+  for (int r=0;r<3;r++)
+    for (int c=0;c<3;c++)
+      ftf[r][c] = f[r]*f[c] + f[3 + r]*f[3 + c] + f[6 + r]*f[6 + c];
+  SymmetricEigen<3>(ftf, vals, v);
+  int order[3] = {0, 1, 2};
+  std::sort(order, order + 3, [&](int a, int b) { return vals[a]>vals[b]; });
+  if (!essential) {
+    // F - (F v3) v3^T
+    const int k = order[2];
+    double fv[3];
+    for (int r=0;r<3;r++)
+      fv[r] = f[3*r]*v[0][k] + f[3*r + 1]*v[1][k] + f[3*r + 2]*v[2][k];
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++)
+        f[3*r + c] -= fv[r]*v[c][k];
+    return;
+  }
+  // s (u1 v1^T + u2 v2^T), with u = F v/sigma and s the mean sigma
+  double sigma[2], u[2][3];
+  for (int j=0;j<2;j++) {
+    const int k = order[j];
+    sigma[j] = std::sqrt(std::max(vals[k], 0.0));
+    for (int r=0;r<3;r++)
+      u[j][r] = (f[3*r]*v[0][k] + f[3*r + 1]*v[1][k] + f[3*r + 2]*v[2][k])/std::max(sigma[j], 1e-300);
+  }
+  const double s = 0.5*(sigma[0] + sigma[1]);
+  for (int r=0;r<3;r++)
+    for (int c=0;c<3;c++)
+      f[3*r + c] = s*(u[0][r]*v[c][order[0]] + u[1][r]*v[c][order[1]]);
+}
+
+// Iteratively reweighted least-squares refinement of the epipolar matrix f,
+// as the unit vector minimizing the weighted algebraic error, projected back
+// to rank two or to an essential matrix
+static bool ReweightEpipolar(const RansacData &data, float *f, float thresh2, int loops, bool essential)
+{
+  const int numBlocks = (data.numPts + RANSAC_REFINE_BLOCK - 1)/RANSAC_REFINE_BLOCK;
+  std::vector<double> blockSums((size_t)numBlocks*EPIPOLAR_SUMS);
+  // Position of the product of two of x, y and 1 among the products
+  static const int pos[3][3] = {{0, 1, 3}, {1, 2, 4}, {3, 4, 5}};
+  for (int loop=0;loop<loops;loop++) {
+    ForRange(data, 0, numBlocks, 1, [&](int b0, int b1) {
+      for (int b=b0;b<b1;b++) {
+        const int i0 = b*RANSAC_REFINE_BLOCK;
+        const int i1 = std::min(i0 + RANSAC_REFINE_BLOCK, data.numPtsUp);
+        AccumulateEpipolarSums(data, f, thresh2, i0, i1, &blockSums[(size_t)b*EPIPOLAR_SUMS]);
+      }
+    });
+    double sums[EPIPOLAR_SUMS] = {0.0};
+    for (int b=0;b<numBlocks;b++)
+      for (int k=0;k<EPIPOLAR_SUMS;k++)
+        sums[k] += blockSums[(size_t)b*EPIPOLAR_SUMS + k];
+    if (sums[EPIPOLAR_SUMS - 1]<=0.0)
+      return false;
+    double a[9][9], x[9];
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++)
+        for (int r2=0;r2<3;r2++)
+          for (int c2=0;c2<3;c2++)
+            a[3*r + c][3*r2 + c2] = sums[pos[r][r2]*EPIPOLAR_PRODUCTS + pos[c][c2]];
+    SmallestEigenvector<9>(a, x);
+    ProjectEpipolar(x, essential);
+    for (int k=0;k<9;k++)
+      f[k] = (float)x[k];
+  }
+  return true;
+}
+
+// Models f with p2^T f p1 = 0 for the matches, scored by the Sampson
+// distance |p2^T f p1|/sqrt((f p1)_0^2 + (f p1)_1^2 + (f^T p2)_0^2 + (f^T p2)_1^2)
+struct EpipolarModel {
+  static void reset(float *f) {
+    for (int k=0;k<9;k++)
+      f[k] = 0.0f;
+  }
+
+  // Matches with a Sampson distance below sqrt(thresh2), tested without
+  // division
+  static int count(const RansacData &data, const float *f, float thresh2) {
+    int cnt = 0;
+    int i = 0;
+#if defined(__AVX512F__)
+    __m512i acc = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512 t = _mm512_set1_ps(thresh2);
+    for (;i<data.numPtsUp;i+=16) {
+      const __m512 x1 = _mm512_load_ps(&data.x1[i]);
+      const __m512 y1 = _mm512_load_ps(&data.y1[i]);
+      const __m512 x2 = _mm512_load_ps(&data.x2[i]);
+      const __m512 y2 = _mm512_load_ps(&data.y2[i]);
+      const __m512 l0 = _mm512_fmadd_ps(_mm512_set1_ps(f[0]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[1]), y1, _mm512_set1_ps(f[2])));
+      const __m512 l1 = _mm512_fmadd_ps(_mm512_set1_ps(f[3]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[4]), y1, _mm512_set1_ps(f[5])));
+      const __m512 l2 = _mm512_fmadd_ps(_mm512_set1_ps(f[6]), x1, _mm512_fmadd_ps(_mm512_set1_ps(f[7]), y1, _mm512_set1_ps(f[8])));
+      const __m512 m0 = _mm512_fmadd_ps(_mm512_set1_ps(f[0]), x2, _mm512_fmadd_ps(_mm512_set1_ps(f[3]), y2, _mm512_set1_ps(f[6])));
+      const __m512 m1 = _mm512_fmadd_ps(_mm512_set1_ps(f[1]), x2, _mm512_fmadd_ps(_mm512_set1_ps(f[4]), y2, _mm512_set1_ps(f[7])));
+      const __m512 err = _mm512_fmadd_ps(x2, l0, _mm512_fmadd_ps(y2, l1, l2));
+      const __m512 deno = _mm512_fmadd_ps(l0, l0, _mm512_fmadd_ps(l1, l1, _mm512_fmadd_ps(m0, m0, _mm512_mul_ps(m1, m1))));
+      const __mmask16 in = _mm512_cmp_ps_mask(_mm512_mul_ps(err, err), _mm512_mul_ps(t, deno), _CMP_LT_OQ);
+      acc = _mm512_mask_add_epi32(acc, in, acc, one);
+    }
+    cnt = _mm512_reduce_add_epi32(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256i acc = _mm256_setzero_si256();
+    const __m256 t = _mm256_set1_ps(thresh2);
+    for (;i<data.numPtsUp;i+=8) {
+      const __m256 x1 = _mm256_load_ps(&data.x1[i]);
+      const __m256 y1 = _mm256_load_ps(&data.y1[i]);
+      const __m256 x2 = _mm256_load_ps(&data.x2[i]);
+      const __m256 y2 = _mm256_load_ps(&data.y2[i]);
+      const __m256 l0 = _mm256_fmadd_ps(_mm256_set1_ps(f[0]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[1]), y1, _mm256_set1_ps(f[2])));
+      const __m256 l1 = _mm256_fmadd_ps(_mm256_set1_ps(f[3]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[4]), y1, _mm256_set1_ps(f[5])));
+      const __m256 l2 = _mm256_fmadd_ps(_mm256_set1_ps(f[6]), x1, _mm256_fmadd_ps(_mm256_set1_ps(f[7]), y1, _mm256_set1_ps(f[8])));
+      const __m256 m0 = _mm256_fmadd_ps(_mm256_set1_ps(f[0]), x2, _mm256_fmadd_ps(_mm256_set1_ps(f[3]), y2, _mm256_set1_ps(f[6])));
+      const __m256 m1 = _mm256_fmadd_ps(_mm256_set1_ps(f[1]), x2, _mm256_fmadd_ps(_mm256_set1_ps(f[4]), y2, _mm256_set1_ps(f[7])));
+      const __m256 err = _mm256_fmadd_ps(x2, l0, _mm256_fmadd_ps(y2, l1, l2));
+      const __m256 deno = _mm256_fmadd_ps(l0, l0, _mm256_fmadd_ps(l1, l1, _mm256_fmadd_ps(m0, m0, _mm256_mul_ps(m1, m1))));
+      const __m256 in = _mm256_cmp_ps(_mm256_mul_ps(err, err), _mm256_mul_ps(t, deno), _CMP_LT_OQ);
+      acc = _mm256_sub_epi32(acc, _mm256_castps_si256(in));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    cnt = _mm_cvtsi128_si32(s);
+#endif
+    for (;i<data.numPts;i++)
+      cnt += inlier(data, f, i, thresh2);
+    return cnt;
+  }
+
+  static bool inlier(const RansacData &data, const float *f, int i, float thresh2) {
+    const float x1 = data.x1[i], y1 = data.y1[i];
+    const float x2 = data.x2[i], y2 = data.y2[i];
+    const float l0 = f[0]*x1 + f[1]*y1 + f[2];
+    const float l1 = f[3]*x1 + f[4]*y1 + f[5];
+    const float l2 = f[6]*x1 + f[7]*y1 + f[8];
+    const float m0 = f[0]*x2 + f[3]*y2 + f[6];
+    const float m1 = f[1]*x2 + f[4]*y2 + f[7];
+    const float err = x2*l0 + y2*l1 + l2;
+    return err*err<thresh2*(l0*l0 + l1*l1 + m0*m0 + m1*m1);
+  }
+
+  // Rows of the constraint p2^T f p1 = 0 of the sample
+  template <int rows>
+  static void constraints(const RansacData &data, const int *sample, double a[rows][9]) {
+    for (int i=0;i<rows;i++) {
+      const int pt = sample[i];
+      const double p1[3] = {data.x1[pt], data.y1[pt], 1.0};
+      const double p2[3] = {data.x2[pt], data.y2[pt], 1.0};
+      for (int r=0;r<3;r++)
+        for (int c=0;c<3;c++)
+          a[i][3*r + c] = p2[r]*p1[c];
+    }
+  }
+
+  static void store(const double *f, float *model) {
+    double norm = 0.0;
+    for (int k=0;k<9;k++)
+      norm += f[k]*f[k];
+    norm = (norm>0.0 ? 1.0/std::sqrt(norm) : 1.0);
+    for (int k=0;k<9;k++)
+      model[k] = (float)(f[k]*norm);
+  }
+};
+
+// Fundamental matrix in pixel coordinates, F = T2^T Fn T1
+struct FundamentalModel : EpipolarModel {
+  static const ProfileStage stage = PROFILE_FUNDAMENTAL;
+
+  static int refine(const RansacData &data, float *f, float thresh2, int loops) {
+    if (!ReweightEpipolar(data, f, thresh2, loops, false))
+      return -1;
+    return count(data, f, thresh2);
+  }
+
+  static void denormalize(const RansacData &data, const float *fn, float *f) {
+    // T = [s 0 -s cx; 0 s -s cy; 0 0 1]
+    const double s = data.scale;
+    const double t1[3][3] = {{s, 0.0, -s*data.cx1}, {0.0, s, -s*data.cy1}, {0.0, 0.0, 1.0}};
+    const double t2[3][3] = {{s, 0.0, -s*data.cx2}, {0.0, s, -s*data.cy2}, {0.0, 0.0, 1.0}};
+    double m[3][3], res[9];
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++)
+        m[r][c] = fn[3*r]*t1[0][c] + fn[3*r + 1]*t1[1][c] + fn[3*r + 2]*t1[2][c];
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++)
+        res[3*r + c] = t2[0][r]*m[0][c] + t2[1][r]*m[1][c] + t2[2][r]*m[2][c];
+    store(res, f);
+  }
+};
+
+// Seven matches give a two-dimensional null space F1, F2 of the constraints,
+// in which det(F2 + a (F1 - F2)) = 0 is a cubic in a with one or three
+// real roots
+struct Fundamental7Model : FundamentalModel {
+  static const int sampleSize = 7;
+  static const int maxModels = 3;
+  static const int minPts = 8;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    double a[7][9], basis[2][9];
+    constraints<7>(data, sample, a);
+    if (!NullSpace9<7>(a, basis))
+      return 0;
+    double d[9];
+    for (int k=0;k<9;k++)
+      d[k] = basis[0][k] - basis[1][k];
+    // Cubic coefficients from the determinant at a = 0, 1, -1 and 2
+    auto det = [&](double x) {
+      double m[9];
+      for (int k=0;k<9;k++)
+        m[k] = basis[1][k] + x*d[k];
+      return m[0]*(m[4]*m[8] - m[5]*m[7]) - m[1]*(m[3]*m[8] - m[5]*m[6]) + m[2]*(m[3]*m[7] - m[4]*m[6]);
+    };
+    const double f0 = det(0.0), f1 = det(1.0), fm1 = det(-1.0), f2 = det(2.0);
+    double c[4];
+    c[0] = f0;
+    c[2] = 0.5*(f1 + fm1) - f0;
+    const double odd = 0.5*(f1 - fm1);
+    c[3] = (f2 - f0 - 4.0*c[2] - 2.0*odd)/6.0;
+    c[1] = odd - c[3];
+    double roots[3];
+    const int numRoots = PolynomialRoots(c, 3, roots);
+    for (int j=0;j<numRoots;j++) {
+      double f[9];
+      for (int k=0;k<9;k++)
+        f[k] = basis[1][k] + roots[j]*d[k];
+      store(f, models[j]);
+    }
+    return numRoots;
+  }
+};
+
+// Eight matches give a one-dimensional null space, projected to rank two
+struct Fundamental8Model : FundamentalModel {
+  static const int sampleSize = 8;
+  static const int maxModels = 1;
+  static const int minPts = 9;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    double a[8][9], basis[1][9];
+    constraints<8>(data, sample, a);
+    if (!NullSpace9<8>(a, basis))
+      return 0;
+    ProjectEpipolar(basis[0], false);
+    store(basis[0], models[0]);
+    return 1;
+  }
+};
+
+// Monomials x^i y^j z^k of degree up to three in the order of Nister's
+// five-point solver, the last ten being those left after elimination
+static const int essentialMonomials[20][3] = {
+  {3, 0, 0}, {0, 3, 0}, {2, 1, 0}, {1, 2, 0}, {2, 0, 1}, {2, 0, 0}, {0, 2, 1}, {0, 2, 0}, {1, 1, 1}, {1, 1, 0},
+  {1, 0, 2}, {1, 0, 1}, {1, 0, 0}, {0, 1, 2}, {0, 1, 1}, {0, 1, 0}, {0, 0, 3}, {0, 0, 2}, {0, 0, 1}, {0, 0, 0}};
+
+// Polynomial in x, y and z of degree up to three, by its coefficients of
+// essentialMonomials
+struct EssentialPoly {
+  double c[20];
+
+  // Product of a polynomial of degree up to two and a linear one, with the
+  // coefficients of x, y, z and 1
+  static EssentialPoly multiply(const EssentialPoly &p, const double *l) {
+    static const struct Table {
+      int index[4][4][4];
+      Table() {
+        for (int m=0;m<20;m++)
+          index[essentialMonomials[m][0]][essentialMonomials[m][1]][essentialMonomials[m][2]] = m;
+      }
+    } table;
+    static const int linear[4][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0}};
+    EssentialPoly res;
+    std::fill(res.c, res.c + 20, 0.0);
+    for (int m=0;m<20;m++) {
+      const int *e = essentialMonomials[m];
+      if (p.c[m]==0.0 || e[0] + e[1] + e[2]>2)
+        continue;
+      for (int k=0;k<4;k++)
+        res.c[table.index[e[0] + linear[k][0]][e[1] + linear[k][1]][e[2] + linear[k][2]]] += p.c[m]*l[k];
+    }
+    return res;
+  }
+  static EssentialPoly linear(const double *l) {
+    EssentialPoly res;
+    std::fill(res.c, res.c + 20, 0.0);
+    res.c[12] = l[0];
+    res.c[15] = l[1];
+    res.c[18] = l[2];
+    res.c[19] = l[3];
+    return res;
+  }
+  EssentialPoly &operator+=(const EssentialPoly &p) {
+    for (int m=0;m<20;m++)
+      c[m] += p.c[m];
+    return *this;
+  }
+  EssentialPoly &operator*=(double s) {
+    for (int m=0;m<20;m++)
+      c[m] *= s;
+    return *this;
+  }
+};
+
+// Product of polynomials in z of degrees da and db
+static inline void MultiplyPolynomials(const double *a, int da, const double *b, int db, double *res)
+{
+  for (int i=0;i<=da + db;i++)
+    res[i] = 0.0;
+  for (int i=0;i<=da;i++)
+    for (int j=0;j<=db;j++)
+      res[i + j] += a[i]*b[j];
+}
+
+// Essential matrix in calibrated coordinates from five matches (Nister),
+// E = x X + y Y + z Z + W in the null space of the constraints, with the
+// determinant and trace constraints giving ten cubics in x, y and z that
+// Gauss-Jordan elimination reduces to a degree ten polynomial in z
+struct EssentialModel : EpipolarModel {
+  static const ProfileStage stage = PROFILE_ESSENTIAL;
+  static const int sampleSize = 5;
+  static const int maxModels = 10;
+  static const int minPts = 6;
+
+  static int solve(const RansacData &data, const int *sample, float models[][9]) {
+    double a[5][9], basis[4][9];
+    constraints<5>(data, sample, a);
+    if (!NullSpace9<5>(a, basis))
+      return 0;
+    // Entries of E as linear polynomials
+    double l[9][4];
+    for (int k=0;k<9;k++)
+      for (int j=0;j<4;j++)
+        l[k][j] = basis[j][k];
+    EssentialPoly e[9], eet[9];
+    for (int k=0;k<9;k++)
+      e[k] = EssentialPoly::linear(l[k]);
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++) {
+        EssentialPoly sum = EssentialPoly::multiply(e[3*r], l[3*c]);
+        sum += EssentialPoly::multiply(e[3*r + 1], l[3*c + 1]);
+        sum += EssentialPoly::multiply(e[3*r + 2], l[3*c + 2]);
+        eet[3*r + c] = sum;
+      }
+    double m[10][20];
+    // det(E) = 0
+    {
+      EssentialPoly det = EssentialPoly::multiply(EssentialPoly::multiply(e[4], l[8]), l[0]);
+      EssentialPoly t = EssentialPoly::multiply(EssentialPoly::multiply(e[5], l[7]), l[0]);
+      det += (t *= -1.0);
+      t = EssentialPoly::multiply(EssentialPoly::multiply(e[3], l[8]), l[1]);
+      det += (t *= -1.0);
+      det += EssentialPoly::multiply(EssentialPoly::multiply(e[5], l[6]), l[1]);
+      det += EssentialPoly::multiply(EssentialPoly::multiply(e[3], l[7]), l[2]);
+      t = EssentialPoly::multiply(EssentialPoly::multiply(e[4], l[6]), l[2]);
+      det += (t *= -1.0);
+      std::copy(det.c, det.c + 20, m[0]);
+    }
+    // 2 E E^T E - trace(E E^T) E = 0
+    EssentialPoly trace = eet[0];
+    trace += eet[4];
+    trace += eet[8];
+    trace *= -0.5;
+    for (int r=0;r<3;r++)
+      for (int c=0;c<3;c++) {
+        EssentialPoly sum = EssentialPoly::multiply(eet[3*r], l[c]);
+        sum += EssentialPoly::multiply(eet[3*r + 1], l[3 + c]);
+        sum += EssentialPoly::multiply(eet[3*r + 2], l[6 + c]);
+        sum += EssentialPoly::multiply(trace, l[3*r + c]);
+        std::copy(sum.c, sum.c + 20, m[1 + 3*r + c]);
+      }
+    // Reduce the first ten columns to the identity
+    for (int c=0;c<10;c++) {
+      int p = c;
+      for (int r=c+1;r<10;r++)
+        if (std::fabs(m[r][c])>std::fabs(m[p][c]))
+          p = r;
+      if (std::fabs(m[p][c])<1e-12)
+        return 0;
+      for (int k=0;k<20;k++)
+        std::swap(m[c][k], m[p][k]);
+      const double inv = 1.0/m[c][c];
+      for (int k=c;k<20;k++)
+        m[c][k] *= inv;
+      for (int r=0;r<10;r++) {
+        const double f = m[r][c];
+        if (r==c || f==0.0)
+          continue;
+        for (int k=c;k<20;k++)
+          m[r][k] -= f*m[c][k];
+      }
+    }
+    // Rows 4 - z row 5, 6 - z row 7 and 8 - z row 9 as x px(z) + y py(z) +
+    // p1(z), of degrees 3, 3 and 4
+    double b[3][3][5];
+    for (int i=0;i<3;i++) {
+      const double *r0 = &m[4 + 2*i][10], *r1 = &m[5 + 2*i][10];
+      const double px0[3] = {r0[2], r0[1], r0[0]}, px1[3] = {r1[2], r1[1], r1[0]};
+      const double py0[3] = {r0[5], r0[4], r0[3]}, py1[3] = {r1[5], r1[4], r1[3]};
+      const double p10[4] = {r0[9], r0[8], r0[7], r0[6]}, p11[4] = {r1[9], r1[8], r1[7], r1[6]};
+      for (int k=0;k<5;k++)
+        b[i][0][k] = b[i][1][k] = b[i][2][k] = 0.0;
+      for (int k=0;k<3;k++) {
+        b[i][0][k] += px0[k];
+        b[i][0][k + 1] -= px1[k];
+        b[i][1][k] += py0[k];
+        b[i][1][k + 1] -= py1[k];
+      }
+      for (int k=0;k<4;k++) {
+        b[i][2][k] += p10[k];
+        b[i][2][k + 1] -= p11[k];
+      }
+    }
+    // Determinant of b, of degree 10
+    double det[11] = {0.0};
+    for (int j=0;j<3;j++) {
+      const int j1 = (j + 1)%3, j2 = (j + 2)%3;
+      const int d0 = (j==2 ? 4 : 3), d1 = (j1==2 ? 4 : 3), d2 = (j2==2 ? 4 : 3);
+      double t0[8], t1[8], minor[8], term[11];
+      MultiplyPolynomials(b[1][j1], d1, b[2][j2], d2, t0);
+      MultiplyPolynomials(b[1][j2], d2, b[2][j1], d1, t1);
+      for (int k=0;k<=d1 + d2;k++)
+        minor[k] = t0[k] - t1[k];
+      MultiplyPolynomials(b[0][j], d0, minor, d1 + d2, term);
+      for (int k=0;k<=10;k++)
+        det[k] += term[k];
+    }
+    double roots[10];
+    const int numRoots = PolynomialRoots(det, 10, roots);
+    int num = 0;
+    for (int j=0;j<numRoots;j++) {
+      const double z = roots[j];
+      double v[3][3];
+      for (int i=0;i<3;i++)
+        for (int k=0;k<3;k++) {
+          double f, df;
+          EvalPolynomial(b[i][k], (k==2 ? 4 : 3), z, f, df);
+          v[i][k] = f;
+        }
+      // (x, y, 1) from the cross product of the best conditioned two rows
+      double best[3] = {0.0, 0.0, 0.0}, bestNorm = 0.0;
+      for (int i=0;i<3;i++) {
+        const double *p = v[i], *q = v[(i + 1)%3];
+        const double cross[3] = {p[1]*q[2] - p[2]*q[1], p[2]*q[0] - p[0]*q[2], p[0]*q[1] - p[1]*q[0]};
+        const double norm = cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2];
+        if (norm>bestNorm) {
+          bestNorm = norm;
+          std::copy(cross, cross + 3, best);
+        }
+      }
+      if (std::fabs(best[2])<=1e-12*std::sqrt(bestNorm))
+        continue;
+      const double x = best[0]/best[2], y = best[1]/best[2];
+      double f[9];
+      for (int k=0;k<9;k++)
+        f[k] = x*basis[0][k] + y*basis[1][k] + z*basis[2][k] + basis[3][k];
+      store(f, models[num++]);
+    }
+    return num;
+  }
+
+  static int refine(const RansacData &data, float *f, float thresh2, int loops) {
+    if (!ReweightEpipolar(data, f, thresh2, loops, true))
+      return -1;
+    return count(data, f, thresh2);
+  }
+
+  // Calibrated coordinates are used as they are
+  static void denormalize(const RansacData &, const float *en, float *e) {
+    std::copy(en, en + 9, e);
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// RANSAC driver
+///////////////////////////////////////////////////////////////////////////////
+
+// Evaluates up to params.numLoops hypotheses in growing batches, each batch
+// in parallel, and then scans the batch in the order of the hypotheses for a
+// better model and the end of the search. The best hypothesis has the most
+// inliers and the lowest number among equal ones, and the search ends after
+// the same hypothesis as a serial one would, so the result does not depend
+// on the batches or the scheduling. A better model is locally optimized as
+// soon as it is found, so that its refined inlier count raises the bar for
+// the remaining hypotheses and shortens an adaptive search.
+template <class Model>
+static bool RunRansac(const RansacData &data, const RansacParams &params, float *best,
+                      RansacResult &result)
+{
+  result.numInliers = 0;
+  result.numHypotheses = 0;
+  if (data.numPts<std::max(Model::minPts, Model::sampleSize))
+    return false;
+  const float thresh2 = (float)(params.thresh*data.scale*params.thresh*data.scale);
+  const int maxHyps = std::max(params.numLoops, 1);
+  const bool adaptive = (params.confidence>0.0f);
+  const bool prosac = (params.sampling==RANSAC_PROSAC);
+  ProsacSchedule schedule(Model::sampleSize, data.numPts, maxHyps);
+  std::vector<int> counts((size_t)RANSAC_MAX_BATCH*Model::maxModels);
+  std::vector<float> models((size_t)RANSAC_MAX_BATCH*Model::maxModels*9);
+  std::vector<int> setSize(RANSAC_MAX_BATCH);
+  std::vector<uint8_t> setLast(RANSAC_MAX_BATCH);
+  int bestCount = -1;
+  int limit = maxHyps;
+  int batch = RANSAC_MIN_BATCH;
+  for (int h0=0;h0<limit;h0+=batch, batch=std::min(2*batch, RANSAC_MAX_BATCH)) {
+    const int num = std::min(batch, limit - h0);
+    for (int j=0;j<num;j++) {
+      setSize[j] = data.numPts;
+      bool last = false;
+      if (prosac)
+        schedule.next(h0 + j, setSize[j], last);
+      setLast[j] = last;
+    }
+    ForRange(data, 0, num, RANSAC_GRAIN, [&](int j0, int j1) {
+      int sample[Model::sampleSize];
+      for (int j=j0;j<j1;j++) {
+        float (*hyp)[9] = (float (*)[9])&models[(size_t)j*Model::maxModels*9];
+        DrawSample(params.seed, h0 + j, setSize[j], Model::sampleSize, sample, setLast[j]);
+        const int numModels = Model::solve(data, sample, hyp);
+        for (int m=0;m<Model::maxModels;m++)
+          counts[(size_t)j*Model::maxModels + m] = (m<numModels ? Model::count(data, hyp[m], thresh2) : -1);
+      }
+    });
+    for (int j=0;j<num && h0 + j<limit;j++) {
+      for (int m=0;m<Model::maxModels;m++) {
+        const size_t k = (size_t)j*Model::maxModels + m;
+        if (counts[k]>bestCount) {
+          bestCount = counts[k];
+          std::memcpy(best, &models[k*9], 9*sizeof(float));
+          if (params.refineLoops>0) {
+            float refined[9];
+            std::memcpy(refined, best, 9*sizeof(float));
+            const int refinedCount = Model::refine(data, refined, thresh2, params.refineLoops);
+            // Kept on equal counts too, as a refit on the same inliers is
+            // still the more accurate model
+            if (refinedCount>=bestCount) {
+              bestCount = refinedCount;
+              std::memcpy(best, refined, 9*sizeof(float));
+            }
+          }
+          if (adaptive)
+            limit = std::min(limit, RequiredHypotheses(params.confidence, bestCount, data.numPts,
+                                                       Model::sampleSize, maxHyps));
+        }
+      }
+      result.numHypotheses = h0 + j + 1;
+    }
+  }
+  if (bestCount<0)
+    return false;
+  result.numInliers = bestCount;
+  return true;
+}
+
+struct NoPrepare {
+  void operator()(RansacData &) const {}
+};
+
+// Runs RANSAC on the matches of a feature set, after prepare has completed
+// the matches for the model, and writes the model in pixel coordinates, or
+// the reset model if there is none. The buffers of data are reused.
+template <class Model, class Access, class Prepare = NoPrepare>
+static void FitModel(int numPts, Access access, const RansacParams &params, float *model,
+                     RansacResult &result, uint8_t *inliers, RansacData &data, Prepare prepare = Prepare())
+{
+  PrepareRansacData(numPts, access, params, data);
+  prepare(data);
+  float best[9];
+  const bool found = RunRansac<Model>(data, params, best, result);
+  Model::reset(model);
+  if (inliers)
+    std::fill(inliers, inliers + numPts, 0);
+  if (found) {
+    Model::denormalize(data, best, model);
+    // Recounted point by point, so that the count agrees with the mask
+    const float thresh2 = (float)(params.thresh*data.scale*params.thresh*data.scale);
+    result.numInliers = 0;
+    for (int i=0;i<data.numPts;i++) {
+      const bool in = Model::inlier(data, best, i, thresh2);
+      result.numInliers += in;
+      if (inliers)
+        inliers[data.ids[i]] = in;
+    }
+  }
+}
+
+template <class Model, class Access, class Prepare = NoPrepare>
+static double EstimateModel(int numPts, Access access, const RansacParams &params, float *model,
+                            RansacResult &result, uint8_t *inliers, Prepare prepare = Prepare())
+{
+  ProfileScope profile(Model::stage);
+  auto start = std::chrono::steady_clock::now();
+  RansacData data;
+  FitModel<Model>(numPts, access, params, model, result, inliers, data, prepare);
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+// Runs RANSAC on each of a batch of feature sets. With at least as many sets
+// as threads, one task per thread takes the next set, largest first, until
+// none is left, and processes it in a single thread with the buffers of the
+// task, reused from one set to the next. This avoids synchronizing the
+// threads for every batch of hypotheses of small sets. Otherwise the sets
+// are processed one at a time, each in parallel. The results are the same
+// either way.
+template <class Model, class Access, class Set>
+static double EstimateModels(const Set *sets, int numSets, const RansacParams &params, float *models,
+                             RansacResult *results, uint8_t *const *inliers)
+{
+  ProfileScope profile(Model::stage);
+  auto start = std::chrono::steady_clock::now();
+  HostThreadPool &pool = HostThreadPool::global();
+  if (numSets<pool.numThreads()) {
+    RansacData data;
+    for (int k=0;k<numSets;k++)
+      FitModel<Model>(sets[k].numPts, Access{sets[k]}, params, &models[9*(size_t)k], results[k],
+                      (inliers ? inliers[k] : nullptr), data);
+  } else {
+    std::vector<int> order(numSets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sets[a].numPts>sets[b].numPts; });
+    std::atomic<int> next{0};
+    pool.parallelFor(0, pool.numThreads(), 1, [&](int, int) {
+      RansacData data;
+      data.parallel = false;
+      for (int k=next++;k<numSets;k=next++) {
+        const int set = order[k];
+        FitModel<Model>(sets[set].numPts, Access{sets[set]}, params, &models[9*(size_t)set], results[set],
+                        (inliers ? inliers[set] : nullptr), data);
+      }
+    });
+  }
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+// Refines a given model in pixel coordinates on the matches of a feature set
+template <class Model, class Access>
+static double RefineModel(int numPts, Access access, const RansacParams &params, float *model,
+                          RansacResult &result, uint8_t *inliers)
+{
+  ProfileScope profile(Model::stage);
+  auto start = std::chrono::steady_clock::now();
+  RansacData data;
+  PrepareRansacData(numPts, access, params, data);
+  result.numInliers = 0;
+  result.numHypotheses = 0;
+  if (inliers)
+    std::fill(inliers, inliers + numPts, 0);
+  const float thresh2 = (float)(params.thresh*data.scale*params.thresh*data.scale);
+  float current[9];
+  Model::normalize(data, model, current);
+  if (data.numPts>=Model::minPts) {
+    float refined[9];
+    std::memcpy(refined, current, 9*sizeof(float));
+    if (Model::refine(data, refined, thresh2, std::max(params.refineLoops, 1))>=Model::count(data, current, thresh2)) {
+      std::memcpy(current, refined, 9*sizeof(float));
+      Model::denormalize(data, current, model);
+    }
+  }
+  for (int i=0;i<data.numPts;i++) {
+    const bool in = Model::inlier(data, current, i, thresh2);
+    result.numInliers += in;
+    if (inliers)
+      inliers[data.ids[i]] = in;
+  }
+  std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+double EstimateHomography(const SiftData &data, float *homography, RansacResult &result,
+                          const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<HomographyModel>(data.numPts, SiftDataAccess{data}, params, homography,
+                                        result, inliers);
+}
+
+double EstimateHomography(const SiftFeatureSet &data, float *homography, RansacResult &result,
+                          const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<HomographyModel>(data.numPts, SiftFeatureSetAccess{data}, params, homography,
+                                        result, inliers);
+}
+
+double EstimateHomographies(const SiftData *data, int numSets, float *homographies,
+                            RansacResult *results, const RansacParams &params, uint8_t *const *inliers)
+{
+  return EstimateModels<HomographyModel, SiftDataAccess>(data, numSets, params, homographies, results,
+                                                         inliers);
+}
+
+double EstimateHomographies(const SiftFeatureSet *data, int numSets, float *homographies,
+                            RansacResult *results, const RansacParams &params, uint8_t *const *inliers)
+{
+  return EstimateModels<HomographyModel, SiftFeatureSetAccess>(data, numSets, params, homographies, results,
+                                                               inliers);
+}
+
+double FindHomography(const SiftFeatureSet &data, float *homography, int *numMatches,
+                      int numLoops, float minScore, float maxAmbiguity, float thresh, uint32_t seed)
+{
+  RansacParams params;
+  params.numLoops = numLoops;
+  params.thresh = thresh;
+  params.minScore = minScore;
+  params.maxAmbiguity = maxAmbiguity;
+  params.seed = seed;
+  RansacResult result;
+  double ms = EstimateHomography(data, homography, result, params);
+  *numMatches = result.numInliers;
+  return ms;
+}
+
+double RefineHomography(const SiftData &data, float *homography, RansacResult &result,
+                        const RansacParams &params, uint8_t *inliers)
+{
+  return RefineModel<HomographyModel>(data.numPts, SiftDataAccess{data}, params, homography,
+                                      result, inliers);
+}
+
+double RefineHomography(const SiftFeatureSet &data, float *homography, RansacResult &result,
+                        const RansacParams &params, uint8_t *inliers)
+{
+  return RefineModel<HomographyModel>(data.numPts, SiftFeatureSetAccess{data}, params, homography,
+                                      result, inliers);
+}
+
+double EstimateFundamental(const SiftData &data, float *fundamental, RansacResult &result,
+                           const RansacParams &params, uint8_t *inliers, FundamentalSolver solver)
+{
+  if (solver==FUNDAMENTAL_8POINT)
+    return EstimateModel<Fundamental8Model>(data.numPts, SiftDataAccess{data}, params, fundamental,
+                                            result, inliers);
+  return EstimateModel<Fundamental7Model>(data.numPts, SiftDataAccess{data}, params, fundamental,
+                                          result, inliers);
+}
+
+double EstimateFundamental(const SiftFeatureSet &data, float *fundamental, RansacResult &result,
+                           const RansacParams &params, uint8_t *inliers, FundamentalSolver solver)
+{
+  if (solver==FUNDAMENTAL_8POINT)
+    return EstimateModel<Fundamental8Model>(data.numPts, SiftFeatureSetAccess{data}, params, fundamental,
+                                            result, inliers);
+  return EstimateModel<Fundamental7Model>(data.numPts, SiftFeatureSetAccess{data}, params, fundamental,
+                                          result, inliers);
+}
+
+double EstimateEssential(const SiftData &data, const CameraIntrinsics &camera1,
+                         const CameraIntrinsics &camera2, float *essential, RansacResult &result,
+                         const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<EssentialModel>(data.numPts, SiftDataAccess{data}, params, essential, result,
+                                       inliers, [&](RansacData &d) { CalibrateRansacData(d, camera1, camera2); });
+}
+
+double EstimateEssential(const SiftFeatureSet &data, const CameraIntrinsics &camera1,
+                         const CameraIntrinsics &camera2, float *essential, RansacResult &result,
+                         const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<EssentialModel>(data.numPts, SiftFeatureSetAccess{data}, params, essential, result,
+                                       inliers, [&](RansacData &d) { CalibrateRansacData(d, camera1, camera2); });
+}
+
+double EstimateAffine(const SiftData &data, float *affine, RansacResult &result,
+                      const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<AffineModel>(data.numPts, SiftDataAccess{data}, params, affine, result, inliers);
+}
+
+double EstimateAffine(const SiftFeatureSet &data, float *affine, RansacResult &result,
+                      const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<AffineModel>(data.numPts, SiftFeatureSetAccess{data}, params, affine, result, inliers);
+}
+
+double EstimateSimilarity(const SiftData &data, float *similarity, RansacResult &result,
+                          const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<SimilarityModel>(data.numPts, SiftDataAccess{data}, params, similarity, result,
+                                        inliers);
+}
+
+double EstimateSimilarity(const SiftFeatureSet &data, float *similarity, RansacResult &result,
+                          const RansacParams &params, uint8_t *inliers)
+{
+  return EstimateModel<SimilarityModel>(data.numPts, SiftFeatureSetAccess{data}, params, similarity, result,
+                                        inliers);
+}
+
+double EstimateSimilarity(const SiftData &data1, const SiftData &data2, float *similarity,
+                          RansacResult &result, const RansacParams &params, uint8_t *inliers)
+{
+  FramePairAccess<SiftDataAccess, SiftData> access(data1, data2);
+  return EstimateModel<FrameSimilarityModel>(data1.numPts, access, params, similarity, result, inliers,
+                                             [&](RansacData &d) { PrepareFrames(access, d); });
+}
+
+double EstimateSimilarity(const SiftFeatureSet &data1, const SiftFeatureSet &data2, float *similarity,
+                          RansacResult &result, const RansacParams &params, uint8_t *inliers)
+{
+  FramePairAccess<SiftFeatureSetAccess, SiftFeatureSet> access(data1, data2);
+  return EstimateModel<FrameSimilarityModel>(data1.numPts, access, params, similarity, result, inliers,
+                                             [&](RansacData &d) { PrepareFrames(access, d); });
+}
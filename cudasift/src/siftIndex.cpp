@@ -0,0 +1,528 @@
+//********************************************************//
+// HNSW descriptor index, see siftIndex.h                 //
+//********************************************************//
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/siftIndex.h"
+
+#include "hostinternal.h"
+
+#define NDIM 128
+// Upper bound on the number of layers
+#define INDEX_MAX_LEVEL 16
+// Number of mutexes guarding the links of the points while inserting
+#define INDEX_NUM_LOCKS 4096
+
+struct SiftIndex::Candidate {
+  float sim;
+  int id;
+  bool operator<(const Candidate &other) const { return sim<other.sim; }
+};
+
+// Lists of visited points tagged with a per-search number, so that they only
+// have to be cleared once every 2^32 searches
+struct SiftIndex::VisitedPool {
+  struct List {
+    std::vector<uint32_t> tags;
+    uint32_t current = 0;
+  };
+  std::mutex mutex;
+  std::vector<std::unique_ptr<List>> free;
+
+  std::unique_ptr<List> acquire(int numPts) {
+    std::unique_ptr<List> list;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!free.empty()) {
+        list = std::move(free.back());
+        free.pop_back();
+      }
+    }
+    if (!list)
+      list.reset(new List());
+    if ((int)list->tags.size()<numPts)
+      list->tags.resize(numPts, 0);
+    if (++list->current==0) {
+      std::fill(list->tags.begin(), list->tags.end(), 0);
+      list->current = 1;
+    }
+    return list;
+  }
+  void release(std::unique_ptr<List> list) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(std::move(list));
+  }
+};
+
+static inline void Prefetch(const float *ptr)
+{
+#if defined(__AVX2__) || defined(__AVX512F__)
+  for (int d=0;d<NDIM;d+=16)
+    _mm_prefetch((const char *)(ptr + d), _MM_HINT_T0);
+#else
+  (void)ptr;
+#endif
+}
+
+SiftIndex::SiftIndex(const SiftIndexParams &params)
+  : param(params), numPts(0), entryPoint(-1), maxLevel(-1), visited(new VisitedPool())
+{
+  if (param.M<2 || param.efConstruction<1 || param.efSearch<1)
+    throw std::invalid_argument("Invalid SiftIndex parameters");
+}
+
+SiftIndex::~SiftIndex() = default;
+SiftIndex::SiftIndex(SiftIndex &&other) noexcept = default;
+SiftIndex &SiftIndex::operator=(SiftIndex &&other) noexcept = default;
+
+void SiftIndex::clear()
+{
+  numPts = 0;
+  entryPoint = -1;
+  maxLevel = -1;
+  vectors.clear();
+  px.clear();
+  py.clear();
+  levels.clear();
+  links0.clear();
+  upper.clear();
+}
+
+// Geometric distribution with ratio 1/M, from a hash of the seed and the
+// point number so that it does not depend on the order of insertion
+int SiftIndex::randomLevel(int i) const
+{
+  uint64_t z = ((uint64_t)param.seed << 32) + (uint64_t)i + 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+  z ^= z >> 31;
+  const double u = ((z >> 11) + 0.5)*(1.0/9007199254740992.0);
+  const int level = (int)(-std::log(u)/std::log((double)param.M));
+  return std::min(level, INDEX_MAX_LEVEL - 1);
+}
+
+int SiftIndex::add(const float *descriptors, size_t stride, const float *xpos, const float *ypos, int num)
+{
+  if (num<=0)
+    return numPts;
+  if (num>INT_MAX - numPts)
+    throw std::invalid_argument("SiftIndex cannot hold more than INT_MAX points");
+  const int first = numPts;
+  const int total = numPts + num;
+  vectors.resize((size_t)total*NDIM);
+  px.resize(total);
+  py.resize(total);
+  levels.resize(total);
+  links0.resize((size_t)total*(2*param.M + 1), 0);
+  upper.resize(total);
+  for (int i=0;i<num;i++) {
+    std::memcpy(&vectors[(size_t)(first + i)*NDIM], descriptors + i*stride, NDIM*sizeof(float));
+    px[first + i] = xpos[i];
+    py[first + i] = ypos[i];
+    levels[first + i] = randomLevel(first + i);
+    upper[first + i].assign((size_t)levels[first + i]*(param.M + 1), 0);
+  }
+  numPts = total;
+
+  std::vector<std::mutex> locks(INDEX_NUM_LOCKS);
+  std::mutex entryLock;
+  int next = first;
+  // The first point and a few more are inserted serially, so that the
+  // parallel insertions start from a connected graph
+  const int serial = std::min(total, std::max(first, std::min(first + num, 2*param.M)));
+  for (;next<serial;next++)
+    insert(next, locks, entryLock);
+  HostThreadPool::global().parallelFor(next, total, 16, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++)
+      insert(i, locks, entryLock);
+  });
+  return first;
+}
+
+int SiftIndex::add(const SiftData &data)
+{
+  if (data.numPts==0)
+    return numPts;
+  const size_t stride = sizeof(SiftPoint)/sizeof(float);
+  std::vector<float> xpos(data.numPts), ypos(data.numPts);
+  for (int i=0;i<data.numPts;i++) {
+    xpos[i] = data.h_data[i].xpos;
+    ypos[i] = data.h_data[i].ypos;
+  }
+  return add(data.h_data[0].data, stride, xpos.data(), ypos.data(), data.numPts);
+}
+
+int SiftIndex::add(const SiftFeatureSet &data)
+{
+  if (data.numPts==0)
+    return numPts;
+  return add(data.descriptor(0), NDIM, data.xpos.data(), data.ypos.data(), data.numPts);
+}
+
+// Follows the links of a layer to the most similar point reachable by always
+// moving to a more similar neighbour
+int SiftIndex::greedyClosest(const float *query, int entry, float &sim, int level,
+                             std::vector<std::mutex> *locks) const
+{
+  std::vector<int> buffer(maxLinks(level) + 1);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    const int *list = links(entry, level);
+    if (locks) {
+      std::lock_guard<std::mutex> lock((*locks)[entry%INDEX_NUM_LOCKS]);
+      std::copy(list, list + list[0] + 1, buffer.begin());
+      list = buffer.data();
+    }
+    for (int j=1;j<=list[0];j++) {
+      const float s = Dot128(query, descriptor(list[j]));
+      if (s>sim) {
+        sim = s;
+        entry = list[j];
+        changed = true;
+      }
+    }
+  }
+  return entry;
+}
+
+// Best-first search of a layer keeping the ef most similar points, returned
+// in decreasing order of similarity. With locks, the links of each point are
+// copied under its lock, as other threads may be inserting.
+void SiftIndex::searchLayer(const float *query, int entry, float sim, int ef, int level,
+                            std::vector<std::mutex> *locks, std::vector<Candidate> &result) const
+{
+  auto list = visited->acquire(numPts);
+  uint32_t *tags = list->tags.data();
+  const uint32_t tag = list->current;
+  std::priority_queue<Candidate> frontier;   // Most similar on top
+  std::vector<Candidate> best;               // Min-heap of the ef most similar
+  auto worse = [](const Candidate &a, const Candidate &b) { return a.sim>b.sim; };
+  std::vector<int> buffer(maxLinks(level) + 1);
+  frontier.push({sim, entry});
+  best.push_back({sim, entry});
+  tags[entry] = tag;
+  while (!frontier.empty()) {
+    const Candidate c = frontier.top();
+    if ((int)best.size()>=ef && c.sim<best.front().sim)
+      break;
+    frontier.pop();
+    const int *links_ = links(c.id, level);
+    if (locks) {
+      std::lock_guard<std::mutex> lock((*locks)[c.id%INDEX_NUM_LOCKS]);
+      std::copy(links_, links_ + links_[0] + 1, buffer.begin());
+      links_ = buffer.data();
+    }
+    for (int j=1;j<=links_[0];j++)
+      if (tags[links_[j]]!=tag)
+        Prefetch(descriptor(links_[j]));
+    for (int j=1;j<=links_[0];j++) {
+      const int n = links_[j];
+      if (tags[n]==tag)
+        continue;
+      tags[n] = tag;
+      const float s = Dot128(query, descriptor(n));
+      if ((int)best.size()<ef || s>best.front().sim) {
+        frontier.push({s, n});
+        best.push_back({s, n});
+        std::push_heap(best.begin(), best.end(), worse);
+        if ((int)best.size()>ef) {
+          std::pop_heap(best.begin(), best.end(), worse);
+          best.pop_back();
+        }
+      }
+    }
+  }
+  visited->release(std::move(list));
+  std::sort(best.begin(), best.end(), worse);
+  result.swap(best);
+}
+
+// Neighbour selection heuristic of HNSW: candidates, in decreasing order of
+// similarity to the new point, are kept only if they are more similar to it
+// than to any candidate kept before, which keeps links in all directions
+void SiftIndex::selectNeighbours(std::vector<Candidate> &candidates, int maxNum) const
+{
+  if ((int)candidates.size()<=maxNum)
+    return;
+  std::vector<Candidate> kept;
+  for (const Candidate &c : candidates) {
+    if ((int)kept.size()>=maxNum)
+      break;
+    bool good = true;
+    for (const Candidate &k : kept)
+      if (Dot128(descriptor(c.id), descriptor(k.id))>c.sim) {
+        good = false;
+        break;
+      }
+    if (good)
+      kept.push_back(c);
+  }
+  candidates.swap(kept);
+}
+
+void SiftIndex::insert(int i, std::vector<std::mutex> &locks, std::mutex &entryLock)
+{
+  const int level = levels[i];
+  int entry, top;
+  {
+    std::lock_guard<std::mutex> lock(entryLock);
+    entry = entryPoint;
+    top = maxLevel;
+    if (entry<0) {
+      entryPoint = i;
+      maxLevel = level;
+      return;
+    }
+  }
+  const float *query = descriptor(i);
+  float sim = Dot128(query, descriptor(entry));
+  for (int l=top;l>level;l--)
+    entry = greedyClosest(query, entry, sim, l, &locks);
+  std::vector<Candidate> candidates;
+  std::vector<Candidate> merged;
+  for (int l=std::min(level, top);l>=0;l--) {
+    searchLayer(query, entry, sim, param.efConstruction, l, &locks, candidates);
+    entry = candidates[0].id;
+    sim = candidates[0].sim;
+    selectNeighbours(candidates, param.M);
+    const int maxNum = maxLinks(l);
+    {
+      // Other insertions may reach i through its upper layers and have added
+      // reverse links to this list already, which are merged, not replaced
+      std::lock_guard<std::mutex> lock(locks[i%INDEX_NUM_LOCKS]);
+      int *list = links(i, l);
+      merged.assign(candidates.begin(), candidates.end());
+      for (int j=1;j<=list[0];j++) {
+        const int n = list[j];
+        if (std::none_of(candidates.begin(), candidates.end(), [n](const Candidate &c) { return c.id==n; }))
+          merged.push_back({Dot128(query, descriptor(n)), n});
+      }
+      if ((int)merged.size()>(int)candidates.size()) {
+        std::sort(merged.begin(), merged.end(), [](const Candidate &a, const Candidate &b) {
+          return a.sim>b.sim;
+        });
+        selectNeighbours(merged, maxNum);
+      }
+      list[0] = (int)merged.size();
+      for (size_t j=0;j<merged.size();j++)
+        list[j + 1] = merged[j].id;
+    }
+    // Reverse links, pruned with the same heuristic when a list is full
+    for (const Candidate &c : candidates) {
+      std::lock_guard<std::mutex> lock(locks[c.id%INDEX_NUM_LOCKS]);
+      int *list = links(c.id, l);
+      if (list[0]<maxNum) {
+        list[++list[0]] = i;
+        continue;
+      }
+      const float *base = descriptor(c.id);
+      merged.clear();
+      merged.push_back({c.sim, i});
+      for (int j=1;j<=list[0];j++)
+        merged.push_back({Dot128(base, descriptor(list[j])), list[j]});
+      std::sort(merged.begin(), merged.end(), [](const Candidate &a, const Candidate &b) {
+        return a.sim>b.sim;
+      });
+      selectNeighbours(merged, maxNum);
+      list[0] = (int)merged.size();
+      for (size_t j=0;j<merged.size();j++)
+        list[j + 1] = merged[j].id;
+    }
+  }
+  if (level>top) {
+    std::lock_guard<std::mutex> lock(entryLock);
+    if (level>maxLevel) {
+      entryPoint = i;
+      maxLevel = level;
+    }
+  }
+}
+
+void SiftIndex::search(const float *queries, size_t stride, int numQueries, int k,
+                       int *indices, float *scores, int ef) const
+{
+  if (k<=0 || numQueries<=0)
+    return;
+  ef = std::max(ef>0 ? ef : param.efSearch, k);
+  HostThreadPool::global().parallelFor(0, numQueries, [&](int q0, int q1) {
+    std::vector<Candidate> result;
+    for (int q=q0;q<q1;q++) {
+      int *idx = indices + (size_t)q*k;
+      float *score = scores + (size_t)q*k;
+      result.clear();
+      if (numPts) {
+        const float *query = queries + q*stride;
+        int entry = entryPoint;
+        float sim = Dot128(query, descriptor(entry));
+        for (int l=maxLevel;l>0;l--)
+          entry = greedyClosest(query, entry, sim, l, nullptr);
+        searchLayer(query, entry, sim, ef, 0, nullptr, result);
+      }
+      for (int j=0;j<k;j++) {
+        idx[j] = (j<(int)result.size() ? result[j].id : -1);
+        score[j] = (j<(int)result.size() ? result[j].sim : 0.0f);
+      }
+    }
+  });
+}
+
+void SiftIndex::search(const SiftData &queries, int k, int *indices, float *scores, int ef) const
+{
+  if (queries.numPts)
+    search(queries.h_data[0].data, sizeof(SiftPoint)/sizeof(float), queries.numPts, k,
+           indices, scores, ef);
+}
+
+void SiftIndex::search(const SiftFeatureSet &queries, int k, int *indices, float *scores, int ef) const
+{
+  if (queries.numPts)
+    search(queries.descriptor(0), NDIM, queries.numPts, k, indices, scores, ef);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Index files
+///////////////////////////////////////////////////////////////////////////////
+
+struct SiftIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t numPts;
+  uint32_t M;
+  uint32_t efConstruction;
+  uint32_t efSearch;
+  uint32_t seed;
+  int32_t entryPoint;
+  int32_t maxLevel;
+  uint8_t reserved[16];
+};
+static_assert(sizeof(SiftIndexHeader)==64, "SiftIndexHeader must be 64 bytes");
+
+// Header, then the descriptors, x and y positions, layers and the links of
+// the lowest layer of all points, then the upper layer links of every point
+// with any, all as 32-bit values
+void SiftIndex::save(const char *filename) const
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Index files are only supported on little-endian hosts");
+  SiftIndexHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SIFT_INDEX_MAGIC, sizeof(header.magic));
+  header.version = SIFT_INDEX_VERSION;
+  header.numPts = numPts;
+  header.M = param.M;
+  header.efConstruction = param.efConstruction;
+  header.efSearch = param.efSearch;
+  header.seed = param.seed;
+  header.entryPoint = entryPoint;
+  header.maxLevel = maxLevel;
+  HostFile file(filename, true);
+  file.write(&header, sizeof(header));
+  file.write(vectors.data(), (size_t)numPts*NDIM*sizeof(float));
+  file.write(px.data(), (size_t)numPts*sizeof(float));
+  file.write(py.data(), (size_t)numPts*sizeof(float));
+  file.write(levels.data(), (size_t)numPts*sizeof(int));
+  file.write(links0.data(), links0.size()*sizeof(int));
+  for (int i=0;i<numPts;i++)
+    file.write(upper[i].data(), upper[i].size()*sizeof(int));
+  file.close();
+}
+
+SiftIndex SiftIndex::load(const char *filename)
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Index files are only supported on little-endian hosts");
+  const std::string name(filename);
+  HostFile file(filename, false);
+  SiftIndexHeader header;
+  file.read(&header, sizeof(header));
+  const char *error = nullptr;
+  if (std::memcmp(header.magic, SIFT_INDEX_MAGIC, sizeof(header.magic)))
+    error = " is not an index file";
+  else if (header.version==0 || header.version>SIFT_INDEX_VERSION)
+    error = " has an unsupported version";
+  else if (header.numPts>INT_MAX || header.M<2 || header.M>1024 || header.efConstruction<1 ||
+           header.efSearch<1 || header.maxLevel>=INDEX_MAX_LEVEL ||
+           (header.numPts==0) != (header.entryPoint<0) ||
+           (header.numPts && (header.entryPoint>=(int64_t)header.numPts || header.maxLevel<0)))
+    error = " is truncated or corrupt";
+  // The descriptors, positions, layers and lowest links of all points must be
+  // in the file before they are allocated
+  else if (!file.holds(header.numPts, (NDIM + 3 + 2*header.M + 1)*sizeof(int)))
+    error = " is truncated or corrupt";
+  if (error)
+    throw std::runtime_error(name + error);
+  SiftIndexParams params;
+  params.M = header.M;
+  params.efConstruction = header.efConstruction;
+  params.efSearch = header.efSearch;
+  params.seed = header.seed;
+  SiftIndex index(params);
+  const int num = (int)header.numPts;
+  const int M = params.M;
+  index.numPts = num;
+  index.entryPoint = header.entryPoint;
+  index.maxLevel = header.maxLevel;
+  index.vectors.resize((size_t)num*NDIM);
+  index.px.resize(num);
+  index.py.resize(num);
+  index.levels.resize(num);
+  index.links0.resize((size_t)num*(2*M + 1));
+  index.upper.resize(num);
+  file.read(index.vectors.data(), index.vectors.size()*sizeof(float));
+  file.read(index.px.data(), (size_t)num*sizeof(float));
+  file.read(index.py.data(), (size_t)num*sizeof(float));
+  file.read(index.levels.data(), (size_t)num*sizeof(int));
+  file.read(index.links0.data(), index.links0.size()*sizeof(int));
+  bool valid = (num==0 || index.levels[index.entryPoint]==index.maxLevel);
+  for (int i=0;i<num && valid;i++) {
+    const int level = index.levels[i];
+    if (level<0 || level>index.maxLevel) {
+      valid = false;
+      break;
+    }
+    index.upper[i].resize((size_t)level*(M + 1));
+    file.read(index.upper[i].data(), index.upper[i].size()*sizeof(int));
+  }
+  // Links must stay within the index and the layers of their targets
+  for (int i=0;i<num && valid;i++)
+    for (int l=0;l<=index.levels[i] && valid;l++) {
+      const int *list = index.links(i, l);
+      valid = (list[0]>=0 && list[0]<=index.maxLinks(l));
+      for (int j=1;j<=list[0] && valid;j++)
+        valid = (list[j]>=0 && list[j]<num && index.levels[list[j]]>=l);
+    }
+  if (!valid)
+    throw std::runtime_error(name + " is truncated or corrupt");
+  return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Matching against an index
+///////////////////////////////////////////////////////////////////////////////
+
+double MatchSiftData(SiftData &data1, const SiftIndex &index, int ef)
+{
+  return MatchIndexHost(data1, index, ef);
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const SiftIndex &index, int ef)
+{
+  return MatchIndexHost(data1, index, ef);
+}
@@ -0,0 +1,593 @@
+//********************************************************//
+// Product quantization and IVF-PQ index, see siftPQ.h    //
+//********************************************************//
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaImage.h"
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/siftPQ.h"
+
+#include "hostinternal.h"
+
+#define NDIM 128
+// Centroids per subspace, one 4-bit code
+#define PQ_CENTROIDS 16
+// Points per block of interleaved codes
+#define PQ_BLOCK 32
+
+///////////////////////////////////////////////////////////////////////////////
+// Product quantizer
+///////////////////////////////////////////////////////////////////////////////
+
+ProductQuantizer::ProductQuantizer(int numSubspaces)
+  : M(numSubspaces)
+{
+  if (M!=16 && M!=32 && M!=64)
+    throw std::invalid_argument("ProductQuantizer needs 16, 32 or 64 subspaces");
+}
+
+void ProductQuantizer::train(const float *descriptors, size_t stride, int numPts, int iterations,
+                             uint32_t seed)
+{
+  if (numPts<PQ_CENTROIDS)
+    throw std::invalid_argument("ProductQuantizer needs at least 16 training descriptors");
+  const int dsub = subspaceSize();
+  codebook.resize((size_t)M*PQ_CENTROIDS*dsub);
+  for (int m=0;m<M;m++)
+    KMeansHost(descriptors + m*dsub, stride, nullptr, numPts, dsub, PQ_CENTROIDS, iterations,
+               seed + m, false, &codebook[(size_t)m*PQ_CENTROIDS*dsub], nullptr);
+}
+
+void ProductQuantizer::train(const SiftData &data, int iterations, uint32_t seed)
+{
+  train(data.numPts ? data.h_data[0].data : nullptr, sizeof(SiftPoint)/sizeof(float), data.numPts,
+        iterations, seed);
+}
+
+void ProductQuantizer::train(const SiftFeatureSet &data, int iterations, uint32_t seed)
+{
+  train(data.numPts ? data.descriptor(0) : nullptr, NDIM, data.numPts, iterations, seed);
+}
+
+int ProductQuantizer::nearest(const float *sub, int m) const
+{
+  const int dsub = subspaceSize();
+  const float *centroids = &codebook[(size_t)m*PQ_CENTROIDS*dsub];
+  int best = 0;
+  float bestDist = INFINITY;
+  for (int c=0;c<PQ_CENTROIDS;c++) {
+    float dist = 0.0f;
+    for (int d=0;d<dsub;d++) {
+      const float diff = sub[d] - centroids[c*dsub + d];
+      dist += diff*diff;
+    }
+    if (dist<bestDist) {
+      bestDist = dist;
+      best = c;
+    }
+  }
+  return best;
+}
+
+void ProductQuantizer::encode(const float *descriptors, size_t stride, int numPts, uint8_t *codes) const
+{
+  if (!trained())
+    throw std::runtime_error("ProductQuantizer must be trained before encoding");
+  const int dsub = subspaceSize();
+  HostThreadPool::global().parallelFor(0, numPts, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const float *x = descriptors + i*stride;
+      uint8_t *code = codes + (size_t)i*codeSize();
+      for (int m=0;m<M;m+=2)
+        code[m/2] = (uint8_t)(nearest(x + m*dsub, m) | nearest(x + (m + 1)*dsub, m + 1) << 4);
+    }
+  });
+}
+
+void ProductQuantizer::encode(const SiftData &data, std::vector<uint8_t> &codes) const
+{
+  codes.resize((size_t)data.numPts*codeSize());
+  if (data.numPts)
+    encode(data.h_data[0].data, sizeof(SiftPoint)/sizeof(float), data.numPts, codes.data());
+}
+
+void ProductQuantizer::encode(const SiftFeatureSet &data, std::vector<uint8_t> &codes) const
+{
+  codes.resize((size_t)data.numPts*codeSize());
+  if (data.numPts)
+    encode(data.descriptor(0), NDIM, data.numPts, codes.data());
+}
+
+void ProductQuantizer::decode(const uint8_t *codes, int numPts, float *descriptors) const
+{
+  if (!trained())
+    throw std::runtime_error("ProductQuantizer must be trained before decoding");
+  const int dsub = subspaceSize();
+  for (int i=0;i<numPts;i++) {
+    const uint8_t *code = codes + (size_t)i*codeSize();
+    float *x = descriptors + (size_t)i*NDIM;
+    for (int m=0;m<M;m++) {
+      const int c = (m%2 ? code[m/2] >> 4 : code[m/2] & 15);
+      std::memcpy(x + m*dsub, &codebook[((size_t)m*PQ_CENTROIDS + c)*dsub], dsub*sizeof(float));
+    }
+  }
+}
+
+void ProductQuantizer::similarityTable(const float *query, float *table) const
+{
+  const int dsub = subspaceSize();
+  for (int m=0;m<M;m++)
+    for (int c=0;c<PQ_CENTROIDS;c++)
+      table[m*PQ_CENTROIDS + c] = Dot(query + m*dsub, &codebook[((size_t)m*PQ_CENTROIDS + c)*dsub], dsub);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fast scan of code blocks
+///////////////////////////////////////////////////////////////////////////////
+
+// Sums the 8-bit table entries lut[16*m + code] over the M subspaces for the
+// 32 points of a block into sums, and returns a mask of the points whose sum
+// exceeds threshold. Byte j of the 16 bytes of subspace m holds the code of
+// point j in its low nibble and that of point j + 16 in its high nibble.
+static inline uint32_t ScanBlock(const uint8_t *block, const uint8_t *lut, int M, int threshold,
+                                 uint16_t *sums)
+{
+#if defined(__AVX2__)
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i lowByte = _mm256_set1_epi16(0xff);
+  __m256i even = _mm256_setzero_si256();
+  __m256i odd = _mm256_setzero_si256();
+  for (int m=0;m<M;m++) {
+    __m128i c = _mm_load_si128((const __m128i *)(block + 16*m));
+    // Points 0-15 in the lower lane, 16-31 in the upper
+    __m256i idx = _mm256_inserti128_si256(_mm256_castsi128_si256(c), _mm_srli_epi16(c, 4), 1);
+    idx = _mm256_and_si256(idx, nibble);
+    __m256i table = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)(lut + 16*m)));
+    __m256i v = _mm256_shuffle_epi8(table, idx);
+    even = _mm256_add_epi16(even, _mm256_and_si256(v, lowByte));
+    odd = _mm256_add_epi16(odd, _mm256_srli_epi16(v, 8));
+  }
+  __m256i r0 = _mm256_unpacklo_epi16(even, odd);   // Points 0-7 and 16-23
+  __m256i r1 = _mm256_unpackhi_epi16(even, odd);   // Points 8-15 and 24-31
+  __m256i s0 = _mm256_permute2x128_si256(r0, r1, 0x20);
+  __m256i s1 = _mm256_permute2x128_si256(r0, r1, 0x31);
+  _mm256_storeu_si256((__m256i *)sums, s0);
+  _mm256_storeu_si256((__m256i *)(sums + 16), s1);
+  const __m256i thresh = _mm256_set1_epi16((short)threshold);
+  __m256i above = _mm256_packs_epi16(_mm256_cmpgt_epi16(s0, thresh), _mm256_cmpgt_epi16(s1, thresh));
+  above = _mm256_permute4x64_epi64(above, 0xd8);
+  return (uint32_t)_mm256_movemask_epi8(above);
+#else
+  uint32_t mask = 0;
+  for (int j=0;j<PQ_BLOCK;j++) {
+    int sum = 0;
+    for (int m=0;m<M;m++) {
+      const uint8_t byte = block[16*m + j%16];
+      sum += lut[16*m + (j<16 ? byte & 15 : byte >> 4)];
+    }
+    sums[j] = (uint16_t)sum;
+    mask |= (uint32_t)(sum>threshold) << j;
+  }
+  return mask;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IVF-PQ index
+///////////////////////////////////////////////////////////////////////////////
+
+SiftIVFPQIndex::SiftIVFPQIndex(const SiftIVFPQParams &params)
+  : param(params), numPts(0), pq(params.numSubspaces)
+{
+  if (param.numLists<1 || param.numProbes<1 || param.rerank<1 || param.iterations<0)
+    throw std::invalid_argument("Invalid SiftIVFPQIndex parameters");
+}
+
+void SiftIVFPQIndex::train(const float *descriptors, size_t stride, int num)
+{
+  if (num<param.numLists || num<PQ_CENTROIDS)
+    throw std::invalid_argument("SiftIVFPQIndex needs at least one training descriptor per list");
+  // Spherical k-means, as descriptors are compared by dot products. The lists
+  // are chosen by the direction of their centroids, the residuals taken to
+  // the centroids themselves.
+  const int numLists = param.numLists;
+  coarse.resize((size_t)numLists*NDIM);
+  AlignedVector<float> dirs((size_t)numLists*NDIM);
+  std::vector<float> maxScore(num), secScore(num);
+  std::vector<int> assign(num);
+  auto assignStep = [&](const float *centroids, int *labels) {
+    for (int c=0;c<numLists;c++) {
+      const float *x = centroids + (size_t)c*NDIM;
+      const float norm = std::sqrt(Dot(x, x, NDIM));
+      for (int d=0;d<NDIM;d++)
+        dirs[(size_t)c*NDIM + d] = (norm>0.0f ? x[d]/norm : 0.0f);
+    }
+    PackedDescriptors packed;
+    PackDescriptors(dirs.data(), NDIM, numLists, packed);
+    FindMaxCorrHost(descriptors, stride, num, packed, maxScore.data(), secScore.data(), labels);
+    for (int i=0;i<num;i++)
+      labels[i] = std::max(labels[i], 0);
+  };
+  KMeansHost(descriptors, stride, nullptr, num, NDIM, numLists, param.iterations, param.seed,
+             false, coarse.data(), assign.data(), assignStep);
+  coarseDirs.swap(dirs);
+
+  // Residual quantizer, trained on the residuals of the final assignment
+  AlignedVector<float> residuals((size_t)num*NDIM);
+  HostThreadPool::global().parallelFor(0, num, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const float *c = &coarse[(size_t)assign[i]*NDIM];
+      for (int d=0;d<NDIM;d++)
+        residuals[(size_t)i*NDIM + d] = descriptors[i*stride + d] - c[d];
+    }
+  });
+  pq.train(residuals.data(), NDIM, num, param.iterations, param.seed);
+  clear();
+}
+
+void SiftIVFPQIndex::train(const SiftData &data)
+{
+  train(data.numPts ? data.h_data[0].data : nullptr, sizeof(SiftPoint)/sizeof(float), data.numPts);
+}
+
+void SiftIVFPQIndex::train(const SiftFeatureSet &data)
+{
+  train(data.numPts ? data.descriptor(0) : nullptr, NDIM, data.numPts);
+}
+
+void SiftIVFPQIndex::clear()
+{
+  numPts = 0;
+  lists.assign(coarse.size()/NDIM, List());
+  px.clear();
+  py.clear();
+}
+
+int SiftIVFPQIndex::add(const float *descriptors, size_t stride, const float *xpos, const float *ypos,
+                        int num)
+{
+  if (!trained())
+    throw std::runtime_error("SiftIVFPQIndex must be trained before adding points");
+  if (num<=0)
+    return numPts;
+  if (num>INT_MAX - numPts)
+    throw std::invalid_argument("SiftIVFPQIndex cannot hold more than INT_MAX points");
+  const int first = numPts;
+  const int M = pq.numSubspaces();
+  const int codeSize = pq.codeSize();
+  const int dsub = pq.subspaceSize();
+  PackedDescriptors packed;
+  PackDescriptors(coarseDirs.data(), NDIM, param.numLists, packed);
+  std::vector<float> maxScore(num), secScore(num);
+  std::vector<int> assign(num);
+  FindMaxCorrHost(descriptors, stride, num, packed, maxScore.data(), secScore.data(), assign.data());
+  std::vector<uint8_t> codes((size_t)num*codeSize);
+  HostThreadPool::global().parallelFor(0, num, [&](int i0, int i1) {
+    float residual[NDIM];
+    for (int i=i0;i<i1;i++) {
+      assign[i] = std::max(assign[i], 0);
+      const float *c = &coarse[(size_t)assign[i]*NDIM];
+      for (int d=0;d<NDIM;d++)
+        residual[d] = descriptors[i*stride + d] - c[d];
+      uint8_t *code = &codes[(size_t)i*codeSize];
+      for (int m=0;m<M;m+=2)
+        code[m/2] = (uint8_t)(pq.nearest(residual + m*dsub, m) | pq.nearest(residual + (m + 1)*dsub, m + 1) << 4);
+    }
+  });
+  for (int i=0;i<num;i++) {
+    List &list = lists[assign[i]];
+    const int pos = (int)list.ids.size();
+    if (pos%PQ_BLOCK==0)
+      list.blocks.resize(list.blocks.size() + (size_t)16*M, 0);
+    uint8_t *block = &list.blocks[(size_t)(pos/PQ_BLOCK)*16*M];
+    const int j = pos%PQ_BLOCK;
+    for (int m=0;m<M;m++) {
+      const uint8_t c = (m%2 ? codes[(size_t)i*codeSize + m/2] >> 4 : codes[(size_t)i*codeSize + m/2] & 15);
+      block[16*m + j%16] |= (j<16 ? c : c << 4);
+    }
+    list.ids.push_back(first + i);
+  }
+  px.insert(px.end(), xpos, xpos + num);
+  py.insert(py.end(), ypos, ypos + num);
+  numPts += num;
+  return first;
+}
+
+int SiftIVFPQIndex::add(const SiftData &data)
+{
+  if (data.numPts==0)
+    return numPts;
+  std::vector<float> xpos(data.numPts), ypos(data.numPts);
+  for (int i=0;i<data.numPts;i++) {
+    xpos[i] = data.h_data[i].xpos;
+    ypos[i] = data.h_data[i].ypos;
+  }
+  return add(data.h_data[0].data, sizeof(SiftPoint)/sizeof(float), xpos.data(), ypos.data(), data.numPts);
+}
+
+int SiftIVFPQIndex::add(const SiftFeatureSet &data)
+{
+  if (data.numPts==0)
+    return numPts;
+  return add(data.descriptor(0), NDIM, data.xpos.data(), data.ypos.data(), data.numPts);
+}
+
+// The lists with the most similar centroid directions, and the dot products
+// of the query with their centroids
+void SiftIVFPQIndex::probe(const float *query, int numProbes, int *probes, float *offsets) const
+{
+  std::vector<std::pair<float, int>> sims(param.numLists);
+  for (int c=0;c<param.numLists;c++)
+    sims[c] = {-Dot(query, &coarseDirs[(size_t)c*NDIM], NDIM), c};
+  std::partial_sort(sims.begin(), sims.begin() + numProbes, sims.end());
+  for (int p=0;p<numProbes;p++) {
+    probes[p] = sims[p].second;
+    offsets[p] = Dot(query, &coarse[(size_t)probes[p]*NDIM], NDIM);
+  }
+}
+
+void SiftIVFPQIndex::search(const float *queries, size_t stride, int numQueries, int k,
+                            int *indices, float *scores, int numProbes) const
+{
+  if (k<=0 || numQueries<=0)
+    return;
+  numProbes = std::min(numProbes>0 ? numProbes : param.numProbes, param.numLists);
+  const int numCands = std::max(param.rerank, k);
+  const int M = pq.numSubspaces();
+  struct Candidate {
+    float sim;
+    int probe, pos;
+  };
+  auto worse = [](const Candidate &a, const Candidate &b) { return a.sim>b.sim; };
+  HostThreadPool::global().parallelFor(0, numQueries, [&](int q0, int q1) {
+    std::vector<float> table(M*PQ_CENTROIDS);
+    AlignedVector<uint8_t> lut(M*PQ_CENTROIDS);
+    std::vector<int> probes(numProbes);
+    std::vector<float> offsets(numProbes);
+    std::vector<float> mins(M);
+    std::vector<Candidate> cands;
+    alignas(32) uint16_t sums[PQ_BLOCK];
+    for (int q=q0;q<q1;q++) {
+      int *idx = indices + (size_t)q*k;
+      float *score = scores + (size_t)q*k;
+      cands.clear();
+      if (numPts) {
+        const float *query = queries + q*stride;
+        pq.similarityTable(query, table.data());
+        // Quantize the table to 8 bits with one step for all subspaces, so
+        // that sums of entries stay comparable
+        float range = 0.0f, bias = 0.0f;
+        for (int m=0;m<M;m++) {
+          const float *t = &table[m*PQ_CENTROIDS];
+          mins[m] = *std::min_element(t, t + PQ_CENTROIDS);
+          range = std::max(range, *std::max_element(t, t + PQ_CENTROIDS) - mins[m]);
+          bias += mins[m];
+        }
+        const float step = (range>0.0f ? range/255.0f : 1.0f);
+        for (int m=0;m<M;m++)
+          for (int c=0;c<PQ_CENTROIDS;c++)
+            lut[m*PQ_CENTROIDS + c] = (uint8_t)std::lrint((table[m*PQ_CENTROIDS + c] - mins[m])/step);
+        probe(query, numProbes, probes.data(), offsets.data());
+        for (int p=0;p<numProbes;p++) {
+          const List &list = lists[probes[p]];
+          const int count = (int)list.ids.size();
+          const float base = offsets[p] + bias;
+          for (int b=0;b*PQ_BLOCK<count;b++) {
+            // Sums are never negative, so -1 accepts all and bounds the threshold
+            // from below as 32767 does from above for the 16-bit compare
+            int threshold = -1;
+            if ((int)cands.size()==numCands) {
+              const float t = std::floor((cands.front().sim - base)/step);
+              threshold = (int)std::max(-1.0f, std::min(t, 32767.0f));
+            }
+            uint32_t mask = ScanBlock(&list.blocks[(size_t)b*16*M], lut.data(), M, threshold, sums);
+            if (count - b*PQ_BLOCK<PQ_BLOCK)
+              mask &= (1u << (count - b*PQ_BLOCK)) - 1;
+            for (int j=0;mask;j++, mask>>=1) {
+              if (!(mask & 1))
+                continue;
+              const float sim = base + step*sums[j];
+              if ((int)cands.size()<numCands) {
+                cands.push_back({sim, p, b*PQ_BLOCK + j});
+                std::push_heap(cands.begin(), cands.end(), worse);
+              } else if (sim>cands.front().sim) {
+                std::pop_heap(cands.begin(), cands.end(), worse);
+                cands.back() = {sim, p, b*PQ_BLOCK + j};
+                std::push_heap(cands.begin(), cands.end(), worse);
+              }
+            }
+          }
+        }
+        // Rescore with the float table
+        for (Candidate &c : cands) {
+          const List &list = lists[probes[c.probe]];
+          const uint8_t *block = &list.blocks[(size_t)(c.pos/PQ_BLOCK)*16*M];
+          const int j = c.pos%PQ_BLOCK;
+          float sim = offsets[c.probe];
+          for (int m=0;m<M;m++) {
+            const uint8_t byte = block[16*m + j%16];
+            sim += table[m*PQ_CENTROIDS + (j<16 ? byte & 15 : byte >> 4)];
+          }
+          c.sim = sim;
+          c.pos = list.ids[c.pos];
+        }
+        std::sort(cands.begin(), cands.end(), [](const Candidate &a, const Candidate &b) {
+          return a.sim>b.sim || (a.sim==b.sim && a.pos<b.pos);
+        });
+      }
+      for (int j=0;j<k;j++) {
+        idx[j] = (j<(int)cands.size() ? cands[j].pos : -1);
+        score[j] = (j<(int)cands.size() ? cands[j].sim : 0.0f);
+      }
+    }
+  });
+}
+
+void SiftIVFPQIndex::search(const SiftData &queries, int k, int *indices, float *scores,
+                            int numProbes) const
+{
+  if (queries.numPts)
+    search(queries.h_data[0].data, sizeof(SiftPoint)/sizeof(float), queries.numPts, k,
+           indices, scores, numProbes);
+}
+
+void SiftIVFPQIndex::search(const SiftFeatureSet &queries, int k, int *indices, float *scores,
+                            int numProbes) const
+{
+  if (queries.numPts)
+    search(queries.descriptor(0), NDIM, queries.numPts, k, indices, scores, numProbes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Index files
+///////////////////////////////////////////////////////////////////////////////
+
+struct SiftIVFPQHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t numPts;
+  uint32_t numLists;
+  uint32_t numSubspaces;
+  uint32_t numProbes;
+  uint32_t rerank;
+  uint32_t iterations;
+  uint32_t seed;
+  uint8_t reserved[16];
+};
+static_assert(sizeof(SiftIVFPQHeader)==64, "SiftIVFPQHeader must be 64 bytes");
+
+// Header, coarse centroids, residual codebook, x and y positions and the
+// list sizes, then the point numbers and code blocks of every list
+void SiftIVFPQIndex::save(const char *filename) const
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Index files are only supported on little-endian hosts");
+  if (!trained())
+    throw std::runtime_error("SiftIVFPQIndex must be trained before saving");
+  SiftIVFPQHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SIFT_IVFPQ_MAGIC, sizeof(header.magic));
+  header.version = SIFT_IVFPQ_VERSION;
+  header.numPts = numPts;
+  header.numLists = param.numLists;
+  header.numSubspaces = param.numSubspaces;
+  header.numProbes = param.numProbes;
+  header.rerank = param.rerank;
+  header.iterations = param.iterations;
+  header.seed = param.seed;
+  HostFile file(filename, true);
+  file.write(&header, sizeof(header));
+  file.write(coarse.data(), coarse.size()*sizeof(float));
+  file.write(pq.codebook.data(), pq.codebook.size()*sizeof(float));
+  file.write(px.data(), (size_t)numPts*sizeof(float));
+  file.write(py.data(), (size_t)numPts*sizeof(float));
+  std::vector<uint32_t> sizes(param.numLists);
+  for (int l=0;l<param.numLists;l++)
+    sizes[l] = (uint32_t)lists[l].ids.size();
+  file.write(sizes.data(), sizes.size()*sizeof(uint32_t));
+  for (const List &list : lists) {
+    file.write(list.ids.data(), list.ids.size()*sizeof(int));
+    file.write(list.blocks.data(), list.blocks.size());
+  }
+  file.close();
+}
+
+SiftIVFPQIndex SiftIVFPQIndex::load(const char *filename)
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Index files are only supported on little-endian hosts");
+  const std::string name(filename);
+  HostFile file(filename, false);
+  SiftIVFPQHeader header;
+  file.read(&header, sizeof(header));
+  const char *error = nullptr;
+  if (std::memcmp(header.magic, SIFT_IVFPQ_MAGIC, sizeof(header.magic)))
+    error = " is not an index file";
+  else if (header.version==0 || header.version>SIFT_IVFPQ_VERSION)
+    error = " has an unsupported version";
+  else if (header.numPts>INT_MAX || header.numLists<1 || header.numLists>(1u << 24) ||
+           (header.numSubspaces!=16 && header.numSubspaces!=32 && header.numSubspaces!=64) ||
+           header.numProbes<1 || header.rerank<1 || header.iterations>INT_MAX)
+    error = " is truncated or corrupt";
+  // The centroids, codebook, positions and list sizes must be in the file
+  // before they are allocated, the counts being bounded above
+  else if (!file.holds((uint64_t)header.numLists*(NDIM + 1) + NDIM*PQ_CENTROIDS + 2*header.numPts, 4))
+    error = " is truncated or corrupt";
+  if (error)
+    throw std::runtime_error(name + error);
+  SiftIVFPQParams params;
+  params.numLists = header.numLists;
+  params.numSubspaces = header.numSubspaces;
+  params.numProbes = header.numProbes;
+  params.rerank = header.rerank;
+  params.iterations = header.iterations;
+  params.seed = header.seed;
+  SiftIVFPQIndex index(params);
+  const int num = (int)header.numPts;
+  const int M = params.numSubspaces;
+  index.coarse.resize((size_t)params.numLists*NDIM);
+  index.pq.codebook.resize((size_t)NDIM*PQ_CENTROIDS);
+  index.px.resize(num);
+  index.py.resize(num);
+  file.read(index.coarse.data(), index.coarse.size()*sizeof(float));
+  file.read(index.pq.codebook.data(), index.pq.codebook.size()*sizeof(float));
+  file.read(index.px.data(), (size_t)num*sizeof(float));
+  file.read(index.py.data(), (size_t)num*sizeof(float));
+  std::vector<uint32_t> sizes(params.numLists);
+  file.read(sizes.data(), sizes.size()*sizeof(uint32_t));
+  uint64_t total = 0;
+  for (uint32_t s : sizes)
+    total += s;
+  bool valid = (total==header.numPts);
+  index.lists.resize(params.numLists);
+  for (int l=0;l<params.numLists && valid;l++) {
+    List &list = index.lists[l];
+    const uint64_t numBlocks = ((uint64_t)sizes[l] + PQ_BLOCK - 1)/PQ_BLOCK;
+    if (!file.holds((uint64_t)sizes[l]*sizeof(int) + numBlocks*16*M, 1)) {
+      valid = false;
+      break;
+    }
+    list.ids.resize(sizes[l]);
+    list.blocks.resize((size_t)numBlocks*16*M);
+    file.read(list.ids.data(), list.ids.size()*sizeof(int));
+    file.read(list.blocks.data(), list.blocks.size());
+    for (int id : list.ids)
+      valid = valid && id>=0 && id<num;
+  }
+  if (!valid)
+    throw std::runtime_error(name + " is truncated or corrupt");
+  index.numPts = num;
+  // Directions of the centroids
+  index.coarseDirs.resize(index.coarse.size());
+  for (int c=0;c<params.numLists;c++) {
+    const float *x = &index.coarse[(size_t)c*NDIM];
+    const float norm = std::sqrt(Dot(x, x, NDIM));
+    for (int d=0;d<NDIM;d++)
+      index.coarseDirs[(size_t)c*NDIM + d] = (norm>0.0f ? x[d]/norm : 0.0f);
+  }
+  return index;
+}
+
+double MatchSiftData(SiftData &data1, const SiftIVFPQIndex &index, int numProbes)
+{
+  return MatchIndexHost(data1, index, numProbes);
+}
+
+double MatchSiftData(SiftFeatureSet &data1, const SiftIVFPQIndex &index, int numProbes)
+{
+  return MatchIndexHost(data1, index, numProbes);
+}
@@ -0,0 +1,435 @@
+//********************************************************//
+// Vocabulary tree and image database, see              //
+// siftVocabulary.h                                       //
+//********************************************************//
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostutils.h"
+#include "cudasift/siftVocabulary.h"
+
+#include "hostinternal.h"
+
+#define NDIM 128
+// Images scored by a task of a query
+#define VOCABULARY_QUERY_GRAIN 4096
+
+///////////////////////////////////////////////////////////////////////////////
+// Vocabulary tree
+///////////////////////////////////////////////////////////////////////////////
+
+SiftVocabulary::SiftVocabulary(const SiftVocabularyParams &params) : param(params)
+{
+  if (params.branching<2 || params.depth<1 || params.iterations<0)
+    throw std::invalid_argument("Invalid SiftVocabularyParams");
+  double leaves = 1.0;
+  for (int l=0;l<params.depth;l++)
+    leaves *= params.branching;
+  if (leaves>(double)INT_MAX/2)
+    throw std::invalid_argument("SiftVocabulary cannot have more than INT_MAX/2 words");
+}
+
+void SiftVocabulary::train(const float *descriptors, size_t stride, const int *offsets, int numImages)
+{
+  if (numImages<1)
+    throw std::invalid_argument("SiftVocabulary needs at least one training image");
+  for (int i=0;i<numImages;i++)
+    if (offsets[i + 1]<offsets[i])
+      throw std::invalid_argument("SiftVocabulary image offsets must not decrease");
+  const int first = offsets[0];
+  const int num = offsets[numImages] - first;
+  const int branching = param.branching;
+  if (num<branching)
+    throw std::invalid_argument("SiftVocabulary needs at least branching training descriptors");
+  const float *data = descriptors + (size_t)first*stride;
+
+  // The tree is grown a level at a time, with the nodes of a level split in
+  // parallel and their children numbered in the order of the nodes
+  centers.assign(NDIM, 0.0f);
+  children.assign(1, -1);
+  numChildren.assign(1, 0);
+  std::vector<int> level(1, 0);
+  std::vector<std::vector<int>> members(1);
+  members[0].resize(num);
+  std::iota(members[0].begin(), members[0].end(), 0);
+  for (int depth=0;depth<param.depth && !level.empty();depth++) {
+    const int numNodes = (int)level.size();
+    std::vector<AlignedVector<float>> centroids(numNodes);
+    std::vector<std::vector<std::vector<int>>> split(numNodes);
+    HostThreadPool::global().parallelFor(0, numNodes, 1, [&](int n0, int n1) {
+      for (int n=n0;n<n1;n++) {
+        const std::vector<int> &ids = members[n];
+        if ((int)ids.size()<=branching)
+          continue;
+        std::vector<int> assign(ids.size());
+        centroids[n].resize((size_t)branching*NDIM);
+        const uint32_t seed = param.seed*0x9e3779b9u + (uint32_t)level[n];
+        KMeansHost(data, stride, ids.data(), (int)ids.size(), NDIM, branching, param.iterations,
+                   seed, true, centroids[n].data(), assign.data());
+        split[n].resize(branching);
+        for (size_t i=0;i<ids.size();i++)
+          split[n][assign[i]].push_back(ids[i]);
+      }
+    });
+    std::vector<int> nextLevel;
+    std::vector<std::vector<int>> nextMembers;
+    for (int n=0;n<numNodes;n++) {
+      if (split[n].empty())
+        continue;
+      const int node = level[n];
+      children[node] = (int)children.size();
+      for (int c=0;c<branching;c++) {
+        if (split[n][c].empty())
+          continue;
+        nextLevel.push_back((int)children.size());
+        nextMembers.push_back(std::move(split[n][c]));
+        centers.insert(centers.end(), &centroids[n][(size_t)c*NDIM], &centroids[n][(size_t)(c + 1)*NDIM]);
+        children.push_back(-1);
+        numChildren.push_back(0);
+        numChildren[node]++;
+      }
+    }
+    level.swap(nextLevel);
+    members.swap(nextMembers);
+  }
+  const int numNodes = (int)children.size();
+  words.assign(numNodes, -1);
+  int numLeaves = 0;
+  for (int n=0;n<numNodes;n++)
+    if (children[n]<0)
+      words[n] = numLeaves++;
+
+  // Smoothed inverse document frequencies of the words, positive even for
+  // words in every image, so that a single training image still gives
+  // nonzero weights
+  std::vector<int> assign(num);
+  quantize(data, stride, num, assign.data());
+  std::vector<int> frequency(numLeaves, 0);
+  std::vector<int> last(numLeaves, -1);
+  for (int i=0;i<numImages;i++)
+    for (int j=offsets[i] - first;j<offsets[i + 1] - first;j++)
+      if (last[assign[j]]!=i) {
+        last[assign[j]] = i;
+        frequency[assign[j]]++;
+      }
+  weights.resize(numLeaves);
+  for (int w=0;w<numLeaves;w++)
+    weights[w] = (float)(std::log((numImages + 1.0)/(frequency[w] + 1.0)) + 1.0);
+}
+
+void SiftVocabulary::train(const SiftData *images, int numImages)
+{
+  std::vector<int> offsets(1, 0);
+  for (int i=0;i<numImages;i++)
+    offsets.push_back(offsets.back() + images[i].numPts);
+  AlignedVector<float> descriptors((size_t)offsets.back()*NDIM);
+  for (int i=0;i<numImages;i++)
+    for (int j=0;j<images[i].numPts;j++)
+      std::memcpy(&descriptors[(size_t)(offsets[i] + j)*NDIM], images[i].h_data[j].data, NDIM*sizeof(float));
+  train(descriptors.data(), NDIM, offsets.data(), numImages);
+}
+
+void SiftVocabulary::train(const SiftFeatureSet *images, int numImages)
+{
+  std::vector<int> offsets(1, 0);
+  for (int i=0;i<numImages;i++)
+    offsets.push_back(offsets.back() + images[i].numPts);
+  AlignedVector<float> descriptors((size_t)offsets.back()*NDIM);
+  for (int i=0;i<numImages;i++)
+    if (images[i].numPts)
+      std::memcpy(&descriptors[(size_t)offsets[i]*NDIM], images[i].descriptor(0),
+                  (size_t)images[i].numPts*NDIM*sizeof(float));
+  train(descriptors.data(), NDIM, offsets.data(), numImages);
+}
+
+void SiftVocabulary::quantize(const float *descriptors, size_t stride, int numPts, int *result) const
+{
+  if (!trained())
+    throw std::runtime_error("SiftVocabulary must be trained before quantizing");
+  HostThreadPool::global().parallelFor(0, numPts, 256, [&](int i0, int i1) {
+    for (int i=i0;i<i1;i++) {
+      const float *x = descriptors + i*stride;
+      int node = 0;
+      while (children[node]>=0) {
+        const int first = children[node];
+        int best = first;
+        float bestSim = -INFINITY;
+        for (int c=first;c<first + numChildren[node];c++) {
+          const float s = Dot128(x, &centers[(size_t)c*NDIM]);
+          if (s>bestSim) {
+            bestSim = s;
+            best = c;
+          }
+        }
+        node = best;
+      }
+      result[i] = words[node];
+    }
+  });
+}
+
+void SiftVocabulary::transform(const float *descriptors, size_t stride, int numPts, SiftBowVector &bow) const
+{
+  bow.clear();
+  if (numPts<=0)
+    return;
+  std::vector<int> assign(numPts);
+  quantize(descriptors, stride, numPts, assign.data());
+  std::sort(assign.begin(), assign.end());
+  float total = 0.0f;
+  for (int i=0;i<numPts;) {
+    int j = i;
+    while (j<numPts && assign[j]==assign[i])
+      j++;
+    const float weight = (j - i)*weights[assign[i]];
+    if (weight>0.0f) {
+      bow.push_back({assign[i], weight});
+      total += weight;
+    }
+    i = j;
+  }
+  for (SiftBowEntry &entry : bow)
+    entry.weight /= total;
+}
+
+void SiftVocabulary::transform(const SiftData &data, SiftBowVector &bow) const
+{
+  if (data.numPts==0) {
+    bow.clear();
+    return;
+  }
+  transform(data.h_data[0].data, sizeof(SiftPoint)/sizeof(float), data.numPts, bow);
+}
+
+void SiftVocabulary::transform(const SiftFeatureSet &data, SiftBowVector &bow) const
+{
+  if (data.numPts==0) {
+    bow.clear();
+    return;
+  }
+  transform(data.descriptor(0), NDIM, data.numPts, bow);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Vocabulary files
+///////////////////////////////////////////////////////////////////////////////
+
+struct SiftVocabularyHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t branching;
+  uint32_t depth;
+  uint32_t iterations;
+  uint32_t seed;
+  uint32_t numNodes;
+  uint32_t numWords;
+  uint8_t reserved[24];
+};
+static_assert(sizeof(SiftVocabularyHeader)==64, "SiftVocabularyHeader must be 64 bytes");
+
+// Header, then per node the first child and number of children, the node
+// centers and the word weights
+void SiftVocabulary::save(const char *filename) const
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Vocabulary files are only supported on little-endian hosts");
+  if (!trained())
+    throw std::runtime_error("SiftVocabulary must be trained before saving");
+  SiftVocabularyHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SIFT_VOCABULARY_MAGIC, sizeof(header.magic));
+  header.version = SIFT_VOCABULARY_VERSION;
+  header.branching = param.branching;
+  header.depth = param.depth;
+  header.iterations = param.iterations;
+  header.seed = param.seed;
+  header.numNodes = (uint32_t)children.size();
+  header.numWords = (uint32_t)weights.size();
+  HostFile file(filename, true);
+  file.write(&header, sizeof(header));
+  file.write(children.data(), children.size()*sizeof(int));
+  file.write(numChildren.data(), numChildren.size()*sizeof(int));
+  file.write(centers.data(), centers.size()*sizeof(float));
+  file.write(weights.data(), weights.size()*sizeof(float));
+  file.close();
+}
+
+SiftVocabulary SiftVocabulary::load(const char *filename)
+{
+  if (!IsLittleEndian())
+    throw std::runtime_error("Vocabulary files are only supported on little-endian hosts");
+  const std::string name(filename);
+  HostFile file(filename, false);
+  SiftVocabularyHeader header;
+  file.read(&header, sizeof(header));
+  const char *error = nullptr;
+  if (std::memcmp(header.magic, SIFT_VOCABULARY_MAGIC, sizeof(header.magic)))
+    error = " is not a vocabulary file";
+  else if (header.version==0 || header.version>SIFT_VOCABULARY_VERSION)
+    error = " has an unsupported version";
+  else if (header.branching<2 || header.branching>(1u << 16) || header.depth<1 ||
+           header.depth>64 || header.iterations>INT_MAX || header.numNodes<1 ||
+           header.numNodes>(1u << 28) || header.numWords<1 || header.numWords>header.numNodes)
+    error = " is truncated or corrupt";
+  // The tree and weights must be in the file before they are allocated
+  else if (!file.holds((uint64_t)header.numNodes*(NDIM + 2) + header.numWords, 4))
+    error = " is truncated or corrupt";
+  if (error)
+    throw std::runtime_error(name + error);
+  SiftVocabularyParams params;
+  params.branching = header.branching;
+  params.depth = header.depth;
+  params.iterations = header.iterations;
+  params.seed = header.seed;
+  SiftVocabulary voc(params);
+  const int numNodes = (int)header.numNodes;
+  voc.children.resize(numNodes);
+  voc.numChildren.resize(numNodes);
+  voc.centers.resize((size_t)numNodes*NDIM);
+  voc.weights.resize(header.numWords);
+  file.read(voc.children.data(), voc.children.size()*sizeof(int));
+  file.read(voc.numChildren.data(), voc.numChildren.size()*sizeof(int));
+  file.read(voc.centers.data(), voc.centers.size()*sizeof(float));
+  file.read(voc.weights.data(), voc.weights.size()*sizeof(float));
+  // Children follow their parent, and the leaves are numbered in node order
+  bool valid = true;
+  voc.words.assign(numNodes, -1);
+  int numLeaves = 0;
+  for (int n=0;n<numNodes && valid;n++) {
+    const int first = voc.children[n];
+    const int count = voc.numChildren[n];
+    if (first<0)
+      valid = (first==-1 && count==0);
+    else
+      valid = (first>n && count>=1 && count<=params.branching && first<=numNodes - count);
+    if (first<0)
+      voc.words[n] = numLeaves++;
+  }
+  if (!valid || numLeaves!=(int)header.numWords)
+    throw std::runtime_error(name + " is truncated or corrupt");
+  return voc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Image database
+///////////////////////////////////////////////////////////////////////////////
+
+SiftImageDatabase::SiftImageDatabase(const SiftVocabulary &vocabulary)
+  : voc(&vocabulary), numImages(0), files(vocabulary.numWords())
+{
+  if (!vocabulary.trained())
+    throw std::invalid_argument("SiftImageDatabase needs a trained vocabulary");
+}
+
+int SiftImageDatabase::add(const SiftBowVector &bow)
+{
+  if (numImages==INT_MAX)
+    throw std::invalid_argument("SiftImageDatabase cannot hold more than INT_MAX images");
+  for (const SiftBowEntry &entry : bow)
+    files[entry.word].push_back({numImages, entry.weight});
+  return numImages++;
+}
+
+int SiftImageDatabase::add(const float *descriptors, size_t stride, int numPts)
+{
+  SiftBowVector bow;
+  voc->transform(descriptors, stride, numPts, bow);
+  return add(bow);
+}
+
+int SiftImageDatabase::add(const SiftData &data)
+{
+  SiftBowVector bow;
+  voc->transform(data, bow);
+  return add(bow);
+}
+
+int SiftImageDatabase::add(const SiftFeatureSet &data)
+{
+  SiftBowVector bow;
+  voc->transform(data, bow);
+  return add(bow);
+}
+
+void SiftImageDatabase::clear()
+{
+  for (std::vector<Posting> &file : files)
+    file.clear();
+  numImages = 0;
+}
+
+int SiftImageDatabase::query(const SiftBowVector &bow, int numResults, int *images, float *scores,
+                             int maxImage) const
+{
+  struct Result {
+    float score;
+    int image;
+    bool operator<(const Result &other) const {
+      return score>other.score || (score==other.score && image<other.image);
+    }
+  };
+  if (numResults<=0)
+    return 0;
+  const int end = (maxImage<0 ? numImages : std::min(maxImage, numImages));
+  std::vector<Result> found;
+  std::mutex mutex;
+  // Every task accumulates the scores of a range of images from the part of
+  // each inverted file that falls into it, and keeps its best numResults
+  HostThreadPool::global().parallelFor(0, end, VOCABULARY_QUERY_GRAIN, [&](int i0, int i1) {
+    std::vector<float> sums(i1 - i0, 0.0f);
+    for (const SiftBowEntry &entry : bow) {
+      const std::vector<Posting> &file = files[entry.word];
+      auto it = std::lower_bound(file.begin(), file.end(), i0,
+                                 [](const Posting &p, int image) { return p.image<image; });
+      for (;it!=file.end() && it->image<i1;++it)
+        sums[it->image - i0] += std::min(entry.weight, it->weight);
+    }
+    std::vector<Result> best;
+    for (int i=i0;i<i1;i++)
+      if (sums[i - i0]>0.0f)
+        best.push_back({sums[i - i0], i});
+    if ((int)best.size()>numResults) {
+      std::nth_element(best.begin(), best.begin() + numResults, best.end());
+      best.resize(numResults);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    found.insert(found.end(), best.begin(), best.end());
+  });
+  const int num = std::min((int)found.size(), numResults);
+  std::partial_sort(found.begin(), found.begin() + num, found.end());
+  for (int j=0;j<numResults;j++) {
+    images[j] = (j<num ? found[j].image : -1);
+    scores[j] = (j<num ? found[j].score : 0.0f);
+  }
+  return num;
+}
+
+int SiftImageDatabase::query(const SiftData &data, int numResults, int *images, float *scores,
+                             int maxImage) const
+{
+  SiftBowVector bow;
+  voc->transform(data, bow);
+  return query(bow, numResults, images, scores, maxImage);
+}
+
+int SiftImageDatabase::query(const SiftFeatureSet &data, int numResults, int *images, float *scores,
+                             int maxImage) const
+{
+  SiftBowVector bow;
+  voc->transform(data, bow);
+  return query(bow, numResults, images, scores, maxImage);
+}
@@ -0,0 +1,503 @@
+//********************************************************//
+// Benchmark of extraction and matching on the host and   //
+// the device, with machine-readable output               //
+//********************************************************//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cudasift/cudaImage.h"
+#include "cudasift/cudaSift.h"
+#include "cudasift/deviceProfiler.h"
+#include "cudasift/hostutils.h"
+
+struct Options {
+  std::vector<std::pair<int, int>> sizes = {{1280, 960}};
+  std::vector<int> octaves = {5};
+  std::vector<float> thresholds = {3.0f};
+  std::vector<int> features = {32768};
+  std::vector<int> matchSizes = {2000};
+  std::vector<int> threads = {1};
+  std::vector<std::string> cases = {"extract", "match"};
+  std::string backend = "all";
+  std::string format = "json";
+  std::string output;
+  std::string image;
+  std::string trace;
+  int iterations = 50;
+  int warmup = 5;
+  int device = 0;
+  unsigned seed = 1;
+};
+
+struct Result {
+  std::string name, backend;
+  int width = 0, height = 0, octaves = 0, features = 0, matchSize = 0, threads = 0;
+  float thresh = 0.0f;
+  int warmup = 0, iterations = 0;
+  double warmupMs = 0.0, minMs = 0.0, meanMs = 0.0, medianMs = 0.0, p95Ms = 0.0, p99Ms = 0.0;
+  double throughput = 0.0;   // Calls per second over all threads
+  int numPts = 0;            // Features found or matched in the last call
+};
+
+// One benchmarked call per thread and iteration. The returned count is
+// reported as numPts: the features found for extraction, and for host
+// matching the points matched to their true counterpart.
+typedef std::function<int()> Call;
+
+static void Usage()
+{
+  std::cerr <<
+    "Usage: cudasift_bench [options]\n"
+    "  --sizes WxH,...      image sizes of synthetic images (1280x960)\n"
+    "  --image FILE         binary PGM image instead of synthetic images\n"
+    "  --octaves N,...      octave counts (5)\n"
+    "  --thresh T,...       DoG thresholds (3.0)\n"
+    "  --features N,...     maximum feature counts (32768)\n"
+    "  --match N,...        points per set for the matcher cases (2000)\n"
+    "  --threads N,...      concurrent callers, each with its own buffers (1)\n"
+    "  --cases LIST         extract,match (both)\n"
+    "  --backend B          host, device or all (all)\n"
+    "  --iterations N       measured calls per thread (50)\n"
+    "  --warmup N           unmeasured calls per thread (5)\n"
+    "  --seed N             seed of the synthetic data (1)\n"
+    "  --device N           CUDA device (0)\n"
+    "  --format F           json or csv (json)\n"
+    "  --output FILE        results file instead of stdout\n"
+    "  --trace FILE         Chrome trace of the measured calls\n"
+    "Device cases are skipped if no CUDA device is available.\n";
+}
+
+template <class T>
+static std::vector<T> ParseList(const std::string &text, T (*parse)(const std::string &))
+{
+  std::vector<T> list;
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty())
+      list.push_back(parse(item));
+  if (list.empty())
+    throw std::invalid_argument("Empty list: " + text);
+  return list;
+}
+
+static int ParseInt(const std::string &s) { return std::stoi(s); }
+static float ParseFloat(const std::string &s) { return std::stof(s); }
+static std::string ParseString(const std::string &s) { return s; }
+static std::pair<int, int> ParseSize(const std::string &s)
+{
+  size_t x = s.find('x');
+  if (x==std::string::npos)
+    throw std::invalid_argument("Size must be WxH: " + s);
+  return {std::stoi(s.substr(0, x)), std::stoi(s.substr(x + 1))};
+}
+
+static Options ParseOptions(int argc, char **argv)
+{
+  Options opt;
+  for (int i=1;i<argc;i++) {
+    std::string arg = argv[i];
+    if (arg=="--help" || arg=="-h") {
+      Usage();
+      exit(0);
+    }
+    if (i + 1>=argc)
+      throw std::invalid_argument("Missing value for " + arg);
+    std::string val = argv[++i];
+    if (arg=="--sizes") opt.sizes = ParseList(val, ParseSize);
+    else if (arg=="--image") opt.image = val;
+    else if (arg=="--octaves") opt.octaves = ParseList(val, ParseInt);
+    else if (arg=="--thresh") opt.thresholds = ParseList(val, ParseFloat);
+    else if (arg=="--features") opt.features = ParseList(val, ParseInt);
+    else if (arg=="--match") opt.matchSizes = ParseList(val, ParseInt);
+    else if (arg=="--threads") opt.threads = ParseList(val, ParseInt);
+    else if (arg=="--cases") opt.cases = ParseList(val, ParseString);
+    else if (arg=="--backend") opt.backend = val;
+    else if (arg=="--iterations") opt.iterations = std::stoi(val);
+    else if (arg=="--warmup") opt.warmup = std::stoi(val);
+    else if (arg=="--seed") opt.seed = (unsigned)std::stoul(val);
+    else if (arg=="--device") opt.device = std::stoi(val);
+    else if (arg=="--format") opt.format = val;
+    else if (arg=="--output") opt.output = val;
+    else if (arg=="--trace") opt.trace = val;
+    else
+      throw std::invalid_argument("Unknown option " + arg);
+  }
+  if (opt.backend!="all" && opt.backend!="host" && opt.backend!="device")
+    throw std::invalid_argument("Unknown backend " + opt.backend);
+  if (opt.format!="json" && opt.format!="csv")
+    throw std::invalid_argument("Unknown format " + opt.format);
+  for (int octaves : opt.octaves)
+    if (octaves<1 || octaves>7)
+      throw std::invalid_argument("Octave counts must be in [1, 7]");
+  if (opt.iterations<1 || opt.warmup<0)
+    throw std::invalid_argument("Need at least one iteration");
+  return opt;
+}
+
+// Gaussian blobs of random size and contrast on a noisy background, so that
+// all octaves have structure to detect
+static std::vector<float> SyntheticImage(int w, int h, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  std::normal_distribution<float> noise(0.0f, 2.0f);
+  std::vector<float> img((size_t)w*h, 128.0f);
+  const int numBlobs = w*h/100;
+  for (int b=0;b<numBlobs;b++) {
+    float cx = uni(rng)*w, cy = uni(rng)*h;
+    float sigma = 1.0f*std::pow(2.0f, 4.0f*uni(rng));
+    float amp = 160.0f*(uni(rng) - 0.5f);
+    int r = (int)(3.0f*sigma);
+    int x0 = std::max(0, (int)cx - r), x1 = std::min(w - 1, (int)cx + r);
+    int y0 = std::max(0, (int)cy - r), y1 = std::min(h - 1, (int)cy + r);
+    for (int y=y0;y<=y1;y++)
+      for (int x=x0;x<=x1;x++) {
+        float d2 = (x - cx)*(x - cx) + (y - cy)*(y - cy);
+        img[(size_t)y*w + x] += amp*std::exp(-d2/(2.0f*sigma*sigma));
+      }
+  }
+  for (auto &v : img)
+    v = std::min(255.0f, std::max(0.0f, v + noise(rng)));
+  return img;
+}
+
+static std::vector<float> ReadPGM(const std::string &filename, int &w, int &h)
+{
+  std::ifstream file(filename, std::ios::binary);
+  std::string magic;
+  int maxval = 0;
+  file >> magic >> w >> h >> maxval;
+  file.get();
+  if (!file || magic!="P5" || maxval<=0 || maxval>255)
+    throw std::runtime_error(filename + " is not an 8-bit binary PGM image");
+  std::vector<unsigned char> bytes((size_t)w*h);
+  file.read((char *)bytes.data(), bytes.size());
+  if (!file)
+    throw std::runtime_error("Failed to read " + filename);
+  return std::vector<float>(bytes.begin(), bytes.end());
+}
+
+// Descriptors of set2 are noisy copies of those of set1 in shuffled order,
+// point i of set1 being point perm[i] of set2
+static void SyntheticMatchSets(int num, unsigned seed, SiftData &data1, SiftData &data2,
+                               std::vector<int> &perm)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  perm.resize(num);
+  for (int i=0;i<num;i++)
+    perm[i] = i;
+  std::shuffle(perm.begin(), perm.end(), rng);
+  data1.numPts = data2.numPts = num;
+  for (int i=0;i<num;i++) {
+    SiftPoint &p1 = data1.h_data[i];
+    SiftPoint &p2 = data2.h_data[perm[i]];
+    std::memset(&p1, 0, sizeof(p1));
+    p1.xpos = 1000.0f*uni(rng);
+    p1.ypos = 1000.0f*uni(rng);
+    p1.scale = 1.0f + 4.0f*uni(rng);
+    p1.subsampling = 1.0f;
+    float sum1 = 0.0f, sum2 = 0.0f;
+    for (int d=0;d<128;d++) {
+      float v = uni(rng);
+      p1.data[d] = v*v;
+      sum1 += p1.data[d]*p1.data[d];
+    }
+    p2 = p1;
+    for (int d=0;d<128;d++) {
+      p1.data[d] /= std::sqrt(sum1);
+      p2.data[d] = std::max(0.0f, p1.data[d] + 0.02f*(uni(rng) - 0.5f));
+      sum2 += p2.data[d]*p2.data[d];
+    }
+    for (int d=0;d<128;d++)
+      p2.data[d] /= std::sqrt(sum2);
+  }
+}
+
+// Nearest-rank percentile of sorted samples
+static double Percentile(const std::vector<double> &sorted, double p)
+{
+  size_t rank = (size_t)std::ceil(p/100.0*sorted.size());
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Runs the warmup calls of all threads, then the measured calls, each
+// thread with its own call object from makeCall
+static void Measure(const Options &opt, int numThreads,
+                    const std::function<Call(int)> &makeCall, Result &res)
+{
+  std::vector<Call> calls;
+  for (int t=0;t<numThreads;t++)
+    calls.push_back(makeCall(t));
+  std::vector<std::vector<double>> samples(numThreads);
+  std::vector<int> counts(numThreads, 0);
+  auto run = [&](int iterations, bool measure) {
+    std::vector<std::thread> workers;
+    for (int t=0;t<numThreads;t++)
+      workers.emplace_back([&, t] {
+        for (int i=0;i<iterations;i++) {
+          auto start = std::chrono::steady_clock::now();
+          counts[t] = calls[t]();
+          std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+          if (measure)
+            samples[t].push_back(ms.count());
+        }
+      });
+    for (auto &w : workers)
+      w.join();
+  };
+  auto start = std::chrono::steady_clock::now();
+  run(opt.warmup, false);
+  auto middle = std::chrono::steady_clock::now();
+  // Only a requested trace touches the profiler, which CUDASIFT_PROFILE or
+  // the caller may have enabled already
+  const bool profiling = SiftProfiler::global().enabled();
+  if (!opt.trace.empty())
+    SiftProfiler::global().setEnabled(true);
+  run(opt.iterations, true);
+  if (!opt.trace.empty())
+    SiftProfiler::global().setEnabled(profiling);
+  auto end = std::chrono::steady_clock::now();
+
+  std::vector<double> all;
+  for (const auto &s : samples)
+    all.insert(all.end(), s.begin(), s.end());
+  std::sort(all.begin(), all.end());
+  double sum = 0.0;
+  for (double v : all)
+    sum += v;
+  std::chrono::duration<double, std::milli> warmupMs = middle - start;
+  std::chrono::duration<double> wall = end - middle;
+  res.threads = numThreads;
+  res.warmup = opt.warmup;
+  res.iterations = opt.iterations;
+  res.warmupMs = warmupMs.count();
+  res.minMs = all.front();
+  res.meanMs = sum/all.size();
+  res.medianMs = Percentile(all, 50.0);
+  res.p95Ms = Percentile(all, 95.0);
+  res.p99Ms = Percentile(all, 99.0);
+  res.throughput = all.size()/wall.count();
+  res.numPts = counts[0];
+}
+
+static void RunExtract(const Options &opt, bool host, bool device, std::vector<Result> &results)
+{
+  int steps[] = {1, 4, 1, 3, 0};
+  float alpha[] = {0.2f};
+  DescriptorNormalizerData normalizer{5, 1, steps, alpha};
+  const float initBlur = 1.0f;
+  for (auto size : opt.sizes) {
+    int w = size.first, h = size.second;
+    std::vector<float> img = (opt.image.empty() ? SyntheticImage(w, h, opt.seed) : ReadPGM(opt.image, w, h));
+    for (int octaves : opt.octaves)
+      for (float thresh : opt.thresholds)
+        for (int features : opt.features)
+          for (int numThreads : opt.threads) {
+            Result res;
+            res.name = "extract";
+            res.width = w;
+            res.height = h;
+            res.octaves = octaves;
+            res.thresh = thresh;
+            res.features = features;
+            if (host) {
+              res.backend = "host";
+              Measure(opt, numThreads, [&](int) -> Call {
+                auto data = std::make_shared<SiftData>(features);
+                auto tmp = std::make_shared<HostTempMemory>(w, h, octaves);
+                return [&, data, tmp] {
+                  ExtractSift(*data, normalizer, HostImage(img.data(), w, h), octaves, initBlur,
+                              thresh, 0.0f, false, *tmp);
+                  return data->numPts;
+                };
+              }, res);
+              results.push_back(res);
+            }
+            if (device) {
+              res.backend = "device";
+              InitCuda(features, octaves, initBlur, opt.device);
+              DeviceDescriptorNormalizerData d_normalizer(normalizer);
+              struct State {
+                cudaStream_t stream;
+                CudaImage img;
+                DeviceSiftData data;
+                TempMemory tmp;
+                State(int features, int w, int h, int octaves)
+                  : data(features), tmp(w, h, octaves) { cudaStreamCreate(&stream); }
+                ~State() { cudaStreamDestroy(stream); }
+              };
+              Measure(opt, numThreads, [&](int) -> Call {
+                auto s = std::make_shared<State>(features, w, h, octaves);
+                s->img.Allocate(w, h, iAlignUp(w, 128), false, nullptr, img.data(), s->stream);
+                return [&, s] {
+                  s->img.Download();
+                  ExtractSift(s->data, d_normalizer, s->img, octaves, thresh, 0.0f, false,
+                              s->tmp, s->stream);
+                  return s->data.numPts;
+                };
+              }, res);
+              results.push_back(res);
+            }
+          }
+  }
+}
+
+static void RunMatch(const Options &opt, bool host, bool device, std::vector<Result> &results)
+{
+  for (int num : opt.matchSizes) {
+    SiftData data1(num), data2(num);
+    std::vector<int> perm;
+    SyntheticMatchSets(num, opt.seed, data1, data2, perm);
+    QuantizedSiftData quantized1, quantized2;
+    QuantizeDescriptors(data1, quantized1);
+    QuantizeDescriptors(data2, quantized2);
+    auto countCorrect = [&perm](const SiftData &data) {
+      int correct = 0;
+      for (int i=0;i<data.numPts;i++)
+        correct += (data.h_data[i].match==perm[i]);
+      return correct;
+    };
+    for (int numThreads : opt.threads) {
+      Result res;
+      res.name = "match";
+      res.matchSize = num;
+      if (host) {
+        res.backend = "host";
+        Measure(opt, numThreads, [&](int) -> Call {
+          auto query = std::make_shared<SiftData>(num);
+          *query = data1;
+          return [&, query] {
+            MatchSiftData(*query, data2);
+            return countCorrect(*query);
+          };
+        }, res);
+        results.push_back(res);
+        res.backend = "host-quantized";
+        Measure(opt, numThreads, [&](int) -> Call {
+          auto query = std::make_shared<SiftData>(num);
+          *query = data1;
+          return [&, query] {
+            MatchSiftData(*query, quantized1, data2, quantized2);
+            return countCorrect(*query);
+          };
+        }, res);
+        results.push_back(res);
+      }
+      if (device) {
+        res.backend = "device";
+        struct State {
+          cudaStream_t stream;
+          DeviceSiftData data1, data2;
+          State(int num) : data1(num), data2(num) { cudaStreamCreate(&stream); }
+          ~State() { cudaStreamDestroy(stream); }
+        };
+        Measure(opt, numThreads, [&](int) -> Call {
+          auto s = std::make_shared<State>(num);
+          s->data1.uploadFeatures(data1, s->stream);
+          s->data2.uploadFeatures(data2, s->stream);
+          return [s, num] {
+            MatchSiftData(s->data1, s->data2, s->stream);
+            SynchronizeStream(s->stream);
+            return num;
+          };
+        }, res);
+        results.push_back(res);
+      }
+    }
+  }
+}
+
+static void WriteResults(const Options &opt, const std::vector<Result> &results, std::ostream &out)
+{
+  char line[1024];
+  if (opt.format=="csv") {
+    out << "name,backend,width,height,octaves,thresh,features,matchSize,threads,warmup,iterations,"
+           "warmupMs,minMs,meanMs,medianMs,p95Ms,p99Ms,throughput,numPts\n";
+    for (const auto &r : results) {
+      snprintf(line, sizeof(line), "%s,%s,%d,%d,%d,%.3f,%d,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f,%d\n",
+               r.name.c_str(), r.backend.c_str(), r.width, r.height, r.octaves, r.thresh,
+               r.features, r.matchSize, r.threads, r.warmup, r.iterations, r.warmupMs, r.minMs,
+               r.meanMs, r.medianMs, r.p95Ms, r.p99Ms, r.throughput, r.numPts);
+      out << line;
+    }
+    return;
+  }
+  out << "{\n  \"hostThreads\": " << HostThreadPool::global().numThreads() << ",\n  \"cases\": [";
+  for (size_t i=0;i<results.size();i++) {
+    const Result &r = results[i];
+    snprintf(line, sizeof(line), "%s\n    {\"name\": \"%s\", \"backend\": \"%s\", \"width\": %d, "
+             "\"height\": %d, \"octaves\": %d, \"thresh\": %.3f, \"features\": %d, \"matchSize\": %d, "
+             "\"threads\": %d, \"warmup\": %d, \"iterations\": %d, \"warmupMs\": %.4f, \"minMs\": %.4f, "
+             "\"meanMs\": %.4f, \"medianMs\": %.4f, \"p95Ms\": %.4f, \"p99Ms\": %.4f, "
+             "\"throughput\": %.3f, \"numPts\": %d}", (i ? "," : ""), r.name.c_str(),
+             r.backend.c_str(), r.width, r.height, r.octaves, r.thresh, r.features, r.matchSize,
+             r.threads, r.warmup, r.iterations, r.warmupMs, r.minMs, r.meanMs, r.medianMs,
+             r.p95Ms, r.p99Ms, r.throughput, r.numPts);
+    out << line;
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  try {
+    opt = ParseOptions(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    Usage();
+    return 1;
+  }
+  int numDevices = 0;
+  if (cudaGetDeviceCount(&numDevices)!=cudaSuccess)
+    numDevices = 0;
+  bool host = (opt.backend!="device");
+  bool device = (opt.backend!="host" && numDevices>0);
+  if (opt.backend=="device" && !device)
+    std::cerr << "No CUDA device available, skipping device cases\n";
+
+  std::vector<Result> results;
+  try {
+    for (const auto &c : opt.cases) {
+      if (c=="extract")
+        RunExtract(opt, host, device, results);
+      else if (c=="match")
+        RunMatch(opt, host, device, results);
+      else
+        throw std::invalid_argument("Unknown case " + c);
+    }
+    if (!opt.trace.empty())
+      SiftProfiler::global().writeChromeTrace(opt.trace.c_str());
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  if (opt.output.empty()) {
+    WriteResults(opt, results, std::cout);
+  } else {
+    std::ofstream out(opt.output);
+    WriteResults(opt, results, out);
+    if (!out) {
+      std::cerr << "Failed to write " << opt.output << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -3,21 +3,18 @@
 //              celle @ csc.kth.se                       //
 //********************************************************//
 
-#include <atomic>
-#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
-#include <tbb/parallel_for.h>
-#include <tbb/task_scheduler_init.h>
-#include <thread>
 
 #include "cudasift/cudaImage.h"
 #include "cudasift/cudaSift.h"
+#include "cudasift/deviceProfiler.h"
+#include "cudasift/siftGeometry.h"
 
-int ImproveHomography(SiftData &data, float *homography, int numLoops, float minScore, float maxAmbiguity, float thresh);
 void PrintMatchData(SiftData &siftData1, SiftData &siftData2, CudaImage &img);
 void MatchAll(SiftData &siftData1, SiftData &siftData2, float *homography);
 
@@ -33,6 +30,10 @@ int main(int argc, char **argv)
     devNum = std::atoi(argv[1]);
   if (argc>2)
     imgSet = std::atoi(argv[2]);
+  // Stage timeline for chrome://tracing or ui.perfetto.dev
+  const char *traceFile = std::getenv("CUDASIFT_TRACE");
+  if (traceFile)
+    SiftProfiler::global().setEnabled(true);
 
   // Read images using OpenCV
   cv::Mat limg, rimg;
@@ -79,37 +80,14 @@ int main(int argc, char **argv)
     // Extract Sift features from images
     DeviceSiftData siftData1(num_features), siftData2(num_features);
 
-    // A bit of benchmarking
     // for (float thresh1=1.00f;thresh1<=4.01f;thresh1+=0.50f) {
     TempMemory memoryTmp1(w, h, 5, false);
     TempMemory memoryTmp2(w, h, 5, false);
     ExtractSift(siftData1, d_normalizer, img1, 5, thresh, 0.0f, false, memoryTmp1, stream1);
     ExtractSift(siftData2, d_normalizer, img2, 5, thresh, 0.0f, false, memoryTmp2, stream2);
 
-    constexpr int iterations = 1000;
-
-    auto bench_start = std::chrono::high_resolution_clock::now();
-    std::thread thread1([&]() {
-      for (int i = 0; i < iterations; i++) {
-        ExtractSift(siftData1, d_normalizer, img1, 5, thresh, 0.0f, false,
-                    memoryTmp1, stream1);
-      }
-    });
-    std::thread thread2([&]() {
-      for (int i = 0; i < iterations; i++) {
-        ExtractSift(siftData2, d_normalizer, img2, 5, thresh, 0.0f, false,
-                    memoryTmp2, stream2);
-      }
-    });
-    thread1.join();
-    thread2.join();
-    auto bench_end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> bench_ms =
-        bench_end - bench_start;
-    std::cout << "Simple 2 thread benchmark (excluding copy): " << bench_ms.count() << " ms, "
-              << iterations*2. * 1000. / bench_ms.count() << " fps\n";
-
     // Match Sift features and find a homography
+    SynchronizeStream(stream2);
     for (int i=0;i<1;i++)
       MatchSiftData(siftData1, siftData2, stream1);
     float homography[9];
@@ -118,8 +96,22 @@ int main(int argc, char **argv)
                    5.0, stream1);
     SiftData hostData1(num_features);
     siftData1.downloadFeatures(hostData1, stream1);
-    cudaStreamSynchronize(stream1);
-    int numFit = ImproveHomography(hostData1, homography, 5, 0.00f, 0.95f, 3.0);
+    SynchronizeStream(stream1);
+    RansacParams refine;
+    refine.thresh = 3.0f;
+    refine.minScore = 0.00f;
+    refine.maxAmbiguity = 0.95f;
+    refine.refineLoops = 5;
+    RansacResult refined;
+    RefineHomography(hostData1, homography, refined, refine);
+    int numFit = refined.numInliers;
+    for (int i=0;i<hostData1.numPts;i++) {
+      SiftPoint &pt = hostData1.h_data[i];
+      float den = homography[6]*pt.xpos + homography[7]*pt.ypos + homography[8];
+      float dx = (homography[0]*pt.xpos + homography[1]*pt.ypos + homography[2])/den - pt.match_xpos;
+      float dy = (homography[3]*pt.xpos + homography[4]*pt.ypos + homography[5])/den - pt.match_ypos;
+      pt.match_error = std::sqrt(dx*dx + dy*dy);
+    }
 
     std::cout << "Number of original features: " <<  siftData1.numPts << " " << siftData2.numPts << std::endl;
     std::cout << "Number of matching features: " << numFit << " " << numMatches << " " << 100.0f*numFit/std::min(siftData1.numPts, siftData2.numPts) << "% " << initBlur << " " << thresh << std::endl;
@@ -138,58 +130,8 @@ int main(int argc, char **argv)
     cudaStreamDestroy(stream2);
   }
 
-  std::cout << "Multithreaded benchmark\n";
-
-  DescriptorNormalizerData norm_data;
-  norm_data.n_steps = 5;
-  norm_data.n_data = 1;
-  int steps[] = {1, 4, 1, 3, 0};
-  float dataf[] = {0.2f};
-  norm_data.normalizer_steps = steps;
-  norm_data.data = dataf;
-  DeviceDescriptorNormalizerData d_normalizer(norm_data);
-
-  for (int i = 1; i <= 16; ++i) {
-    std::vector<TempMemory> memoryTmp;
-    std::vector<cudaStream_t> streams;
-    std::vector<CudaImage> imgs;
-    std::vector<DeviceSiftData> siftData;
-    for (int j = 0; j < i; ++j) {
-      memoryTmp.emplace_back(w, h, 5, false);
-      cudaStream_t stream;
-      cudaStreamCreate(&stream);
-      streams.push_back(stream);
-      CudaImage img;
-      img.Allocate(w, h, iAlignUp(w, 128), false, nullptr, (float*)limg.data, stream);
-      imgs.push_back(std::move(img));
-      DeviceSiftData data(num_features);
-      siftData.push_back(std::move(data));
-    }
-
-    tbb::task_scheduler_init scheduler{i};
-    std::atomic<int> ctr{0};
-
-    constexpr int iterations = 1000;
-
-    auto bench_start = std::chrono::high_resolution_clock::now();
-    tbb::parallel_for(0, iterations, [&](const auto &) {
-      int tid = ctr++ % i;
-      imgs[tid].Download();
-      ExtractSift(siftData[tid], d_normalizer, imgs[tid], 5, thresh, 0.0f, false,
-                  memoryTmp[tid], streams[tid]);
-    });
-    for (int j = 0; j < i; ++j) {
-      cudaStreamSynchronize(streams[j]);
-    }
-    auto bench_end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> bench_ms =
-        bench_end - bench_start;
-    std::cout << i << " threads: " << bench_ms.count() << " ms, "
-              << iterations * 1000. / bench_ms.count() << " fps\n";
-    for (int j = 0; j < i; ++j) {
-      cudaStreamDestroy(streams[j]);
-    }
-  }
+  if (traceFile)
+    SiftProfiler::global().writeChromeTrace(traceFile);
 }
 
 void MatchAll(SiftData &siftData1, SiftData &siftData2, float *homography)
@@ -0,0 +1,362 @@
+//********************************************************//
+// Host matchers against brute-force references: float    //
+// and 8-bit matching, top-k, mutual and guided matching, //
+// runs without a device                                  //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "testUtils.h"
+
+// Random SIFT-like descriptors, unit length and non-negative, at random
+// positions in a 1000 x 1000 image. With base, every point is a noisy copy
+// of the point of base it is numbered after, so that matches are distinct.
+// The last point of a set without base points away from all others, so
+// that it has no positive correlation.
+static void MakePoints(SiftData &data, int numPts, uint32_t seed, const SiftData *base = nullptr)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  data.numPts = numPts;
+  for (int i=0;i<numPts;i++) {
+    SiftPoint &pt = data.h_data[i];
+    std::memset(&pt, 0, sizeof(pt));
+    pt.xpos = 1000.0f*uni(rng);
+    pt.ypos = 1000.0f*uni(rng);
+    pt.scale = 1.0f;
+    pt.match = -1;
+    float sum = 0.0f;
+    for (int d=0;d<128;d++) {
+      const float v = uni(rng);
+      pt.data[d] = (base ? base->h_data[i%base->numPts].data[d] + 0.05f*v : v*v*v);
+      sum += pt.data[d]*pt.data[d];
+    }
+    for (int d=0;d<128;d++)
+      pt.data[d] /= std::sqrt(sum);
+  }
+  if (!base && numPts>1) {
+    std::memset(data.h_data[numPts - 1].data, 0, sizeof(data.h_data[0].data));
+    data.h_data[numPts - 1].data[0] = -1.0f;
+  }
+}
+
+// Best and second best positive correlation of query among the points of
+// data2 that pass the filter, and the index of the best one
+struct Best {
+  double maxScore = 0.0, secScore = 0.0;
+  int index = -1;
+};
+
+template <class Filter>
+static Best BruteForce(const float *query, const SiftData &data2, Filter filter)
+{
+  Best best;
+  for (int j=0;j<data2.numPts;j++) {
+    if (!filter(j))
+      continue;
+    const double s = Dot(query, data2.h_data[j].data);
+    if (s>best.maxScore) {
+      best.secScore = best.maxScore;
+      best.maxScore = s;
+      best.index = j;
+    } else if (s>best.secScore)
+      best.secScore = s;
+  }
+  return best;
+}
+
+// The match fields of pt agree with the reference, the index whenever the
+// two best scores are not within rounding of each other
+static bool Agrees(float score, float ambiguity, int match, float matchX, float matchY,
+                   const Best &ref, const SiftData &data2)
+{
+  if (std::fabs(score - ref.maxScore)>1e-5)
+    return false;
+  if (std::fabs(ambiguity - ref.secScore/(ref.maxScore + 1e-6))>1e-4)
+    return false;
+  if (ref.maxScore - ref.secScore<1e-5)
+    return true;
+  if (match!=ref.index)
+    return false;
+  return match<0 ? (matchX==0.0f && matchY==0.0f) :
+    (matchX==data2.h_data[match].xpos && matchY==data2.h_data[match].ypos);
+}
+
+static bool Agrees(const SiftPoint &pt, const Best &ref, const SiftData &data2)
+{
+  return Agrees(pt.score, pt.ambiguity, pt.match, pt.match_xpos, pt.match_ypos, ref, data2);
+}
+
+static bool Agrees(const SiftFeatureSet &set, int i, const Best &ref, const SiftData &data2)
+{
+  return Agrees(set.score[i], set.ambiguity[i], set.match[i], set.match_xpos[i], set.match_ypos[i],
+                ref, data2);
+}
+
+// No point of the set keeps a match, score, ambiguity or match position
+static bool Cleared(const SiftData &data)
+{
+  for (int i=0;i<data.numPts;i++) {
+    const SiftPoint &pt = data.h_data[i];
+    if (pt.match!=-1 || pt.score!=0.0f || pt.ambiguity!=0.0f || pt.match_xpos!=0.0f || pt.match_ypos!=0.0f)
+      return false;
+  }
+  return true;
+}
+
+static bool Cleared(const SiftFeatureSet &set)
+{
+  for (int i=0;i<set.numPts;i++)
+    if (set.match[i]!=-1 || set.score[i]!=0.0f || set.ambiguity[i]!=0.0f ||
+        set.match_xpos[i]!=0.0f || set.match_ypos[i]!=0.0f)
+      return false;
+  return true;
+}
+
+// Set sizes around the query blocks, register tiles and candidate panels
+static const int sizes[][2] = {{301, 517}, {5, 3}, {1, 1}, {70, 1000}, {200, 17}};
+
+// MatchSiftData finds the best and second best correlation of every point,
+// for SiftData and SiftFeatureSet, noisy copies matching their originals.
+// Matching against an empty set then clears the results.
+static void TestMatch()
+{
+  for (const auto &size : sizes) {
+    SiftData data1(size[0]), data2(size[1]);
+    MakePoints(data2, size[1], 2);
+    MakePoints(data1, size[0], 1, (size[0]%3 ? &data2 : nullptr));
+    SiftFeatureSet set1, set2;
+    ToFeatureSet(data1, set1);
+    ToFeatureSet(data2, set2);
+    MatchSiftData(data1, data2);
+    MatchSiftData(set1, set2);
+    for (int i=0;i<data1.numPts;i++) {
+      const Best ref = BruteForce(data1.h_data[i].data, data2, [](int) { return true; });
+      CHECK(Agrees(data1.h_data[i], ref, data2));
+      CHECK(Agrees(set1, i, ref, data2));
+    }
+    SiftData empty(1);
+    MatchSiftData(data1, empty);
+    MatchSiftData(set1, SiftFeatureSet());
+    CHECK(Cleared(data1) && Cleared(set1));
+  }
+}
+
+// The 8-bit matcher finds exactly the best integer correlations of the codes,
+// scaled, and mostly the same matches as the float matcher. Codes that do not
+// hold the points of their features are rejected.
+static void TestQuantized()
+{
+  for (const auto &size : sizes) {
+    SiftData data1(size[0]), data2(size[1]);
+    MakePoints(data2, size[1], 4);
+    MakePoints(data1, size[0], 3, &data2);
+    QuantizedSiftData quantized1, quantized2;
+    QuantizeDescriptors(data1, quantized1);
+    QuantizeDescriptors(data2, quantized2);
+    CHECK(quantized1.numPts==data1.numPts && quantized2.numPts==data2.numPts);
+    SiftFeatureSet set1, set2;
+    ToFeatureSet(data1, set1);
+    ToFeatureSet(data2, set2);
+    MatchSiftData(data1, quantized1, data2, quantized2);
+    MatchSiftData(set1, quantized1, set2, quantized2);
+    for (int i=0;i<data1.numPts;i++) {
+      Best ref;
+      for (int j=0;j<data2.numPts;j++) {
+        int dot = 0;
+        for (int d=0;d<128;d++)
+          dot += quantized1.codes[128*i + d]*quantized2.codes[128*j + d];
+        const double s = (double)dot*quantized1.scales[i]*quantized2.scales[j];
+        if (s>ref.maxScore) {
+          ref.secScore = ref.maxScore;
+          ref.maxScore = s;
+          ref.index = j;
+        } else if (s>ref.secScore)
+          ref.secScore = s;
+      }
+      CHECK(Agrees(data1.h_data[i], ref, data2));
+      CHECK(Agrees(set1, i, ref, data2));
+      CHECK(data1.h_data[i].match==i%data2.numPts);
+    }
+    // Codes of other sizes than their features are rejected, and an empty
+    // second set clears the results
+    QuantizedSiftData emptyQuantized;
+    CHECK(Throws<std::invalid_argument>([&] { MatchSiftData(data1, quantized1, data2, emptyQuantized); }));
+    CHECK(Throws<std::invalid_argument>([&] { MatchSiftData(set1, emptyQuantized, set2, quantized2); }));
+    SiftData empty(1);
+    MatchSiftData(data1, quantized1, empty, emptyQuantized);
+    MatchSiftData(set1, quantized1, SiftFeatureSet(), emptyQuantized);
+    CHECK(Cleared(data1) && Cleared(set1));
+  }
+  // Dequantized descriptors are within half a step of the originals
+  SiftData data(50), restored(50);
+  MakePoints(data, 50, 5);
+  QuantizedSiftData quantized;
+  QuantizeDescriptors(data, quantized);
+  restored.numPts = 50;
+  DequantizeDescriptors(quantized, restored);
+  for (int i=0;i<50;i++)
+    for (int d=0;d<128;d++)
+      CHECK(std::fabs(restored.h_data[i].data[d] - data.h_data[i].data[d])<=0.5f*quantized.scales[i] + 1e-7f);
+}
+
+// MatchSiftDataTopK returns the K best positive correlations in decreasing
+// order, padded with -1 and 0
+template <int K>
+static void TestTopK()
+{
+  for (const auto &size : sizes) {
+    SiftData data1(size[0]), data2(size[1]);
+    MakePoints(data1, size[0], 6);
+    MakePoints(data2, size[1], 7);
+    SiftFeatureSet set1, set2;
+    ToFeatureSet(data1, set1);
+    ToFeatureSet(data2, set2);
+    std::vector<SiftMatchCandidate> matches((size_t)K*size[0]), matchesSet((size_t)K*size[0]);
+    MatchSiftDataTopK<K>(data1, data2, matches.data());
+    MatchSiftDataTopK<K>(set1, set2, matchesSet.data());
+    for (int i=0;i<data1.numPts;i++) {
+      std::vector<std::pair<double, int>> ref;
+      for (int j=0;j<data2.numPts;j++) {
+        const double s = Dot(data1.h_data[i].data, data2.h_data[j].data);
+        if (s>0.0)
+          ref.push_back({-s, j});
+      }
+      std::sort(ref.begin(), ref.end());
+      for (int k=0;k<K;k++) {
+        for (const auto *m : {&matches[(size_t)K*i + k], &matchesSet[(size_t)K*i + k]}) {
+          if (k>=(int)ref.size()) {
+            CHECK(m->index==-1 && m->score==0.0f);
+            continue;
+          }
+          CHECK(std::fabs(m->score + ref[k].first)<1e-5);
+          const bool tied = (k>0 && -ref[k - 1].first - -ref[k].first<1e-5) ||
+            (k + 1<(int)ref.size() && -ref[k].first - -ref[k + 1].first<1e-5);
+          CHECK(tied || m->index==ref[k].second);
+          if (k>0)
+            CHECK(m->score<=(m - 1)->score);
+        }
+      }
+    }
+  }
+  // An empty second set gives only padding
+  SiftData data1(4), data2(1);
+  MakePoints(data1, 4, 8);
+  data2.numPts = 0;
+  std::vector<SiftMatchCandidate> matches(4*K, SiftMatchCandidate{7, 1.0f});
+  MatchSiftDataTopK<K>(data1, data2, matches.data());
+  for (const auto &m : matches)
+    CHECK(m.index==-1 && m.score==0.0f);
+}
+
+// MatchSiftDataMutual fills both sets like matching in each direction and
+// flags the pairs that are each other's best match, or none against an
+// empty set
+static void TestMutual()
+{
+  for (const auto &size : sizes) {
+    SiftData data1(size[0]), data2(size[1]);
+    MakePoints(data2, size[1], 10);
+    MakePoints(data1, size[0], 9, (size[0]%2 ? &data2 : nullptr));
+    SiftFeatureSet set1, set2;
+    ToFeatureSet(data1, set1);
+    ToFeatureSet(data2, set2);
+    std::vector<uint8_t> mutual(size[0]), mutualSet(size[0]);
+    MatchSiftDataMutual(data1, data2, mutual.data());
+    MatchSiftDataMutual(set1, set2, mutualSet.data());
+    std::vector<Best> ref1(size[0]), ref2(size[1]);
+    for (int i=0;i<data1.numPts;i++) {
+      ref1[i] = BruteForce(data1.h_data[i].data, data2, [](int) { return true; });
+      CHECK(Agrees(data1.h_data[i], ref1[i], data2));
+      CHECK(Agrees(set1, i, ref1[i], data2));
+    }
+    for (int j=0;j<data2.numPts;j++) {
+      ref2[j] = BruteForce(data2.h_data[j].data, data1, [](int) { return true; });
+      CHECK(Agrees(data2.h_data[j], ref2[j], data1));
+      CHECK(Agrees(set2, j, ref2[j], data1));
+    }
+    for (int i=0;i<data1.numPts;i++) {
+      const int j = data1.h_data[i].match;
+      CHECK(mutual[i]==(j>=0 && data2.h_data[j].match==i));
+      CHECK(mutualSet[i]==mutual[i]);
+    }
+    // An empty side clears the results of both
+    SiftData empty(1);
+    SiftFeatureSet emptySet;
+    MatchSiftDataMutual(data1, empty, mutual.data());
+    MatchSiftDataMutual(set1, emptySet, mutualSet.data());
+    CHECK(Cleared(data1) && Cleared(set1));
+    CHECK(std::count(mutual.begin(), mutual.end(), 0)==size[0] && mutualSet==mutual);
+    MatchSiftDataMutual(empty, data2);
+    MatchSiftDataMutual(emptySet, set2);
+    CHECK(Cleared(data2) && Cleared(set2));
+  }
+}
+
+// MatchSiftDataGuided only considers the points within the tolerance of the
+// position mapped by a homography, or of the epipolar line of a fundamental
+// matrix, and finds the best of them. An empty second set clears the results.
+static void TestGuided()
+{
+  const float H[9] = {0.9f, 0.1f, 30.0f, -0.05f, 1.1f, -20.0f, 1e-5f, 2e-5f, 1.0f};
+  // Pure horizontal translation, with the epipolar lines y2 = y1
+  const float F[9] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f};
+  for (const auto &size : sizes) {
+    SiftData data1(size[0]), data2(size[1]);
+    MakePoints(data1, size[0], 11);
+    MakePoints(data2, size[1], 12);
+    SiftFeatureSet set1, set2;
+    ToFeatureSet(data1, set1);
+    ToFeatureSet(data2, set2);
+    for (float tolerance : {10.0f, 150.0f}) {
+      MatchSiftDataGuided(data1, data2, H, GUIDED_HOMOGRAPHY, tolerance);
+      MatchSiftDataGuided(set1, set2, H, GUIDED_HOMOGRAPHY, tolerance);
+      for (int i=0;i<data1.numPts;i++) {
+        const SiftPoint &p = data1.h_data[i];
+        const float z = H[6]*p.xpos + H[7]*p.ypos + H[8];
+        const float px = (H[0]*p.xpos + H[1]*p.ypos + H[2])/z;
+        const float py = (H[3]*p.xpos + H[4]*p.ypos + H[5])/z;
+        const Best ref = BruteForce(p.data, data2, [&](int j) {
+          const float dx = data2.h_data[j].xpos - px, dy = data2.h_data[j].ypos - py;
+          return dx*dx + dy*dy<=tolerance*tolerance;
+        });
+        CHECK(Agrees(p, ref, data2));
+        CHECK(Agrees(set1, i, ref, data2));
+      }
+      MatchSiftDataGuided(data1, data2, F, GUIDED_FUNDAMENTAL, tolerance);
+      MatchSiftDataGuided(set1, set2, F, GUIDED_FUNDAMENTAL, tolerance);
+      for (int i=0;i<data1.numPts;i++) {
+        const SiftPoint &p = data1.h_data[i];
+        const Best ref = BruteForce(p.data, data2, [&](int j) {
+          return std::fabs(data2.h_data[j].ypos - p.ypos)<=tolerance;
+        });
+        CHECK(Agrees(p, ref, data2));
+        CHECK(Agrees(set1, i, ref, data2));
+      }
+      SiftData empty(1);
+      MatchSiftDataGuided(data1, empty, F, GUIDED_FUNDAMENTAL, tolerance);
+      MatchSiftDataGuided(set1, SiftFeatureSet(), F, GUIDED_FUNDAMENTAL, tolerance);
+      CHECK(Cleared(data1) && Cleared(set1));
+    }
+  }
+}
+
+int main()
+{
+  TestMatch();
+  TestQuantized();
+  TestTopK<1>();
+  TestTopK<3>();
+  TestTopK<8>();
+  TestMutual();
+  TestGuided();
+
+  return TestResult();
+}
@@ -0,0 +1,165 @@
+//********************************************************//
+// Host descriptor normalizers: the fused presets against //
+// the step interpreter and the choice between them,      //
+// runs without a device                                  //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/hostSiftH.h"
+#include "testUtils.h"
+
+// Step list of a preset with its data: alpha, then the negated mean and a
+// ZCA matrix close to the identity for the whitening presets
+struct Normalizer {
+  std::vector<int> steps;
+  std::vector<float> data;
+  DescriptorNormalizerData get()
+  {
+    return {(int)steps.size(), (int)data.size(), steps.data(), data.data()};
+  }
+};
+
+static Normalizer MakeNormalizer(DescriptorNormalizerPreset preset, uint32_t seed)
+{
+  Normalizer n;
+  switch (preset) {
+  case NORMALIZER_SIFT:
+    n.steps = {1, 4, 1, 3, 0};
+    break;
+  case NORMALIZER_RSIFT:
+    n.steps = {1, 4, 2, 3, 0};
+    break;
+  case NORMALIZER_ZCA_RSIFT:
+    n.steps = {1, 4, 2, 3, 5, 6, 1, 3, 0};
+    break;
+  default:
+    n.steps = {1, 4, 2, 3, 5, 6, 2, 3, 7, 0};
+    break;
+  }
+  n.data.push_back(0.2f);
+  if (preset==NORMALIZER_ZCA_RSIFT || preset==NORMALIZER_PLUS_RSIFT) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+    for (int d=0;d<128;d++)
+      n.data.push_back(-0.01f*uni(rng));
+    for (int j=0;j<128;j++)
+      for (int k=0;k<128;k++)
+        n.data.push_back((j==k ? 1.0f : 0.0f) + 0.1f*(uni(rng) - 0.5f));
+  }
+  return n;
+}
+
+// Histograms as the descriptor extraction leaves them, some with a single
+// dominant bin that is clamped, and a few with negative entries
+static void MakeHistogram(float *buffer, int i, std::mt19937 &rng)
+{
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  for (int d=0;d<128;d++) {
+    const float v = uni(rng);
+    buffer[d] = 100.0f*v*v*v;
+  }
+  if (i%3==1)
+    buffer[rng()%128] = 2000.0f;
+  if (i%5==4)
+    for (int d=0;d<128;d+=7)
+      buffer[d] = -buffer[d];
+}
+
+template <int Preset>
+static void TestPreset()
+{
+  Normalizer n = MakeNormalizer((DescriptorNormalizerPreset)Preset, Preset);
+  const DescriptorNormalizerData normalizer = n.get();
+  CHECK(FindNormalizerPreset(normalizer)==Preset);
+  CHECK(GetHostNormalizer((DescriptorNormalizerPreset)Preset)==NormalizeDescriptorFusedHost<Preset>);
+
+  // Every element of the fused result agrees with the interpreter, each run
+  // on its own copy of the input as both use the buffer as scratch space.
+  // A signed square root magnifies rounding near zero, so those results are
+  // compared squared.
+  std::mt19937 rng(10 + Preset);
+  float maxError = 0.0f;
+  bool finite = true;
+  for (int i=0;i<300;i++) {
+    alignas(64) float input[128], buffer[128], expected[128], desc[128];
+    MakeHistogram(input, i, rng);
+    std::copy(input, input + 128, buffer);
+    NormalizeDescriptorHost(buffer, expected, normalizer);
+    std::copy(input, input + 128, buffer);
+    NormalizeDescriptorFusedHost<Preset>(buffer, desc, normalizer);
+    for (int d=0;d<128;d++) {
+      finite = finite && std::isfinite(desc[d]);
+      const float error = (NormalizerTraits<Preset>::signedSqrt ?
+                           desc[d]*std::fabs(desc[d]) - expected[d]*std::fabs(expected[d]) :
+                           desc[d] - expected[d]);
+      maxError = std::max(maxError, std::fabs(error));
+    }
+  }
+  printf("Preset %d: largest difference %.2e\n", Preset, (double)maxError);
+  CHECK(finite);
+  CHECK(maxError<=1e-5f);
+}
+
+// Step lists other than the presets, and presets without enough data, are
+// run by the interpreter
+static void TestCustom()
+{
+  Normalizer n = MakeNormalizer(NORMALIZER_ZCA_RSIFT, 1);
+  DescriptorNormalizerData normalizer = n.get();
+  normalizer.n_data = 128*128;
+  CHECK(FindNormalizerPreset(normalizer)==NORMALIZER_CUSTOM);
+  normalizer.n_data = (int)n.data.size();
+  normalizer.n_steps = 8;
+  CHECK(FindNormalizerPreset(normalizer)==NORMALIZER_CUSTOM);
+  normalizer.normalizer_steps = nullptr;
+  CHECK(FindNormalizerPreset(normalizer)==NORMALIZER_CUSTOM);
+  n = MakeNormalizer(NORMALIZER_SIFT, 1);
+  normalizer = n.get();
+  normalizer.n_data = 0;
+  CHECK(FindNormalizerPreset(normalizer)==NORMALIZER_CUSTOM);
+  CHECK(GetHostNormalizer(NORMALIZER_CUSTOM)==NormalizeDescriptorHost);
+
+  // L1 normalization followed by the signed square root gives unit L2 norm
+  // with the signs of the input
+  n.steps = {2, 3, 7, 0};
+  n.data.clear();
+  normalizer = n.get();
+  const DescriptorNormalizerPreset preset = FindNormalizerPreset(normalizer);
+  CHECK(preset==NORMALIZER_CUSTOM);
+  HostNormalizerFunc normalize = GetHostNormalizer(preset);
+  std::mt19937 rng(2);
+  for (int i=0;i<20;i++) {
+    float buffer[128], input[128], desc[128];
+    MakeHistogram(input, i, rng);
+    std::copy(input, input + 128, buffer);
+    normalize(buffer, desc, normalizer);
+    double sum = 0.0, norm = 0.0;
+    for (int d=0;d<128;d++)
+      sum += std::fabs(input[d]);
+    bool agrees = true;
+    for (int d=0;d<128;d++) {
+      const double expected = std::copysign(std::sqrt(std::fabs(input[d])/sum), (double)input[d]);
+      agrees = agrees && std::fabs(desc[d] - expected)<1e-5;
+      norm += (double)desc[d]*desc[d];
+    }
+    CHECK(agrees);
+    CHECK(std::fabs(norm - 1.0)<1e-5);
+  }
+}
+
+int main()
+{
+  TestPreset<NORMALIZER_SIFT>();
+  TestPreset<NORMALIZER_RSIFT>();
+  TestPreset<NORMALIZER_ZCA_RSIFT>();
+  TestPreset<NORMALIZER_PLUS_RSIFT>();
+  TestCustom();
+
+  return TestResult();
+}
@@ -0,0 +1,297 @@
+//********************************************************//
+// Host SIFT extraction: the SIMD filters and extremum    //
+// scan against scalar references, and the pipeline on    //
+// synthetic images, runs without a device                //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/cudaSiftD.h"
+#include "cudasift/hostSiftH.h"
+#include "testUtils.h"
+
+static inline int Clamp(int v, int lo, int hi)
+{
+  return v<lo ? lo : (v>hi ? hi : v);
+}
+
+// Image of w x h uniform random values in [0, 255) with a padded pitch, the
+// padding filled with a large value that shows up if a filter reads it
+static AlignedVector<float> RandomImage(int w, int h, int pitch, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0.0f, 255.0f);
+  AlignedVector<float> img((size_t)pitch*h, 1e9f);
+  for (int y=0;y<h;y++)
+    for (int x=0;x<w;x++)
+      img[(size_t)y*pitch + x] = uni(rng);
+  return img;
+}
+
+// Gaussian blobs of fixed size at the given centres on a uniform background
+static std::vector<float> BlobImage(int w, int h, const std::vector<float> &centres, float sigma)
+{
+  std::vector<float> img((size_t)w*h, 64.0f);
+  for (size_t b=0;b<centres.size();b+=2)
+    for (int y=0;y<h;y++)
+      for (int x=0;x<w;x++) {
+        const float dx = x - centres[b], dy = y - centres[b + 1];
+        img[(size_t)y*w + x] += 128.0f*std::exp(-(dx*dx + dy*dy)/(2.0f*sigma*sigma));
+      }
+  return img;
+}
+
+// Largest difference between two images relative to the largest value of ref
+static float MaxDifference(const HostImage &res, const std::vector<float> &ref)
+{
+  float maxDiff = 0.0f, maxRef = 0.0f;
+  for (int y=0;y<res.height;y++)
+    for (int x=0;x<res.width;x++) {
+      maxDiff = std::max(maxDiff, std::fabs(res.row(y)[x] - ref[(size_t)y*res.width + x]));
+      maxRef = std::max(maxRef, std::fabs(ref[(size_t)y*res.width + x]));
+    }
+  return maxDiff/std::max(maxRef, 1e-6f);
+}
+
+// LowPassHost and ScaleDownHost match the separable filters computed
+// directly, with the borders clamped, for images of several tiles whose
+// widths are not multiples of the vector width
+static void TestFilters()
+{
+  const int w = 1100, h = 150, pitch = 1104;
+  AlignedVector<float> src = RandomImage(w, h, pitch, 1);
+  HostImage srcImg(src.data(), w, h, pitch);
+
+  float lowPass[2*LOWPASS_R + 1];
+  PrepareLowPassKernel(1.6f, lowPass);
+  AlignedVector<float> low((size_t)pitch*h, 0.0f);
+  HostImage lowImg(low.data(), w, h, pitch);
+  LowPassHost(lowImg, srcImg, lowPass);
+  std::vector<float> ref((size_t)w*h);
+  for (int y=0;y<h;y++)
+    for (int x=0;x<w;x++) {
+      double sum = 0.0;
+      for (int i=-LOWPASS_R;i<=LOWPASS_R;i++)
+        for (int j=-LOWPASS_R;j<=LOWPASS_R;j++)
+          sum += (double)lowPass[i + LOWPASS_R]*lowPass[j + LOWPASS_R]*
+            srcImg.row(Clamp(y + i, 0, h - 1))[Clamp(x + j, 0, w - 1)];
+      ref[(size_t)y*w + x] = (float)sum;
+    }
+  CHECK(MaxDifference(lowImg, ref)<1e-5f);
+
+  float scaleDown[5];
+  PrepareScaleDownKernel(scaleDown);
+  const int nw = w/2 - 3, nh = h/2;
+  AlignedVector<float> down((size_t)nw*nh, 0.0f);
+  HostImage downImg(down.data(), nw, nh, nw);
+  ScaleDownHost(downImg, srcImg, scaleDown);
+  ref.assign((size_t)nw*nh, 0.0f);
+  for (int y=0;y<nh;y++)
+    for (int x=0;x<nw;x++) {
+      double sum = 0.0;
+      for (int i=-2;i<=2;i++)
+        for (int j=-2;j<=2;j++)
+          sum += (double)scaleDown[i + 2]*scaleDown[j + 2]*
+            srcImg.row(Clamp(2*y + i, 0, h - 1))[Clamp(2*x + j, 0, w - 1)];
+      ref[(size_t)y*nw + x] = (float)sum;
+    }
+  CHECK(MaxDifference(downImg, ref)<1e-5f);
+}
+
+// LaplaceMultiHost matches the differences of the Gaussian blurs of all
+// scales computed separately, for every octave's kernels
+static void TestLaplace()
+{
+  const int w = 700, h = 130, pitch = 704;
+  AlignedVector<float> src = RandomImage(w, h, pitch, 2);
+  HostImage srcImg(src.data(), w, h, pitch);
+  float kernels[8*12*16];
+  PrepareLaplaceKernels(5, 0.0f, kernels);
+  std::vector<AlignedVector<float>> dog(LAPLACE_S - 1, AlignedVector<float>((size_t)pitch*h, 0.0f));
+  HostImage results[LAPLACE_S - 1];
+  for (int s=0;s<LAPLACE_S-1;s++)
+    results[s] = HostImage(dog[s].data(), w, h, pitch);
+  for (int octave=1;octave<=5;octave+=2) {
+    LaplaceMultiHost(srcImg, results, kernels, octave);
+    std::vector<std::vector<float>> blur(LAPLACE_S, std::vector<float>((size_t)w*h));
+    std::vector<double> vert((size_t)w*h);
+    for (int s=0;s<LAPLACE_S;s++) {
+      const float *k = kernels + octave*12*16 + 16*s;
+      for (int y=0;y<h;y++)
+        for (int x=0;x<w;x++) {
+          double sum = 0.0;
+          for (int j=-LAPLACE_R;j<=LAPLACE_R;j++)
+            sum += (double)k[std::abs(j)]*srcImg.row(Clamp(y + j, 0, h - 1))[x];
+          vert[(size_t)y*w + x] = sum;
+        }
+      for (int y=0;y<h;y++)
+        for (int x=0;x<w;x++) {
+          double sum = 0.0;
+          for (int j=-LAPLACE_R;j<=LAPLACE_R;j++)
+            sum += k[std::abs(j)]*vert[(size_t)y*w + Clamp(x + j, 0, w - 1)];
+          blur[s][(size_t)y*w + x] = (float)sum;
+        }
+    }
+    for (int s=0;s<LAPLACE_S-1;s++) {
+      std::vector<float> ref((size_t)w*h);
+      for (size_t i=0;i<ref.size();i++)
+        ref[i] = blur[s + 1][i] - blur[s][i];
+      // Relative to the blurred values, as the differences are small
+      float maxDiff = 0.0f;
+      for (int y=0;y<h;y++)
+        for (int x=0;x<w;x++)
+          maxDiff = std::max(maxDiff, std::fabs(results[s].row(y)[x] - ref[(size_t)y*w + x]));
+      CHECK(maxDiff<255.0f*1e-5f);
+    }
+  }
+}
+
+// FindPointsMultiHost finds exactly the isolated peaks placed in a stack of
+// DoG images, of both signs, at all offsets within a vector and next to the
+// borders, in row-major order, and nothing in the padding
+static void TestFindPoints()
+{
+  const int w = 203, h = 61, pitch = 208;
+  const int nd = NUM_SCALES + 2;
+  std::vector<AlignedVector<float>> dog(nd, AlignedVector<float>((size_t)pitch*h, 0.0f));
+  HostImage sources[nd];
+  for (int s=0;s<nd;s++) {
+    for (int y=0;y<h;y++)
+      std::fill(dog[s].begin() + (size_t)y*pitch + w, dog[s].begin() + (size_t)(y + 1)*pitch, 1e9f);
+    sources[s] = HostImage(dog[s].data(), w, h, pitch);
+  }
+  // Peaks of value a with half of it in their six nearest neighbours, so that
+  // the refinement leaves them in place, spaced so that they do not touch
+  struct Peak { int x, y, scale; float value; };
+  std::vector<Peak> peaks;
+  for (int y=1;y<h-1;y+=3) {
+    const int scale = (y/3)%NUM_SCALES;
+    for (int x=1 + (y/3)%5;x<w-1;x+=5) {
+      const float a = ((x + y)%2 ? 4.0f : -4.0f)*(1.0f + 0.01f*x);
+      peaks.push_back({x, y, scale, a});
+      sources[scale + 1].row(y)[x] = a;
+      sources[scale + 1].row(y)[x - 1] = sources[scale + 1].row(y)[x + 1] = 0.5f*a;
+      sources[scale + 1].row(y - 1)[x] = sources[scale + 1].row(y + 1)[x] = 0.5f*a;
+      sources[scale].row(y)[x] = sources[scale + 2].row(y)[x] = 0.5f*a;
+    }
+  }
+  SiftData data((int)peaks.size() + 10);
+  FindPointsMultiHost(sources, data, 3.0f, 10.0f, 1.0f/NUM_SCALES, 0.0f, 1.0f);
+  CHECK(data.numPts==(int)peaks.size());
+  for (int i=0;i<std::min(data.numPts, (int)peaks.size());i++) {
+    const SiftPoint &pt = data.h_data[i];
+    CHECK(pt.xpos==peaks[i].x && pt.ypos==peaks[i].y);
+    CHECK(pt.scale==powf(2.0f, (float)peaks[i].scale/NUM_SCALES));
+    CHECK(pt.sharpness==peaks[i].value);
+  }
+}
+
+// ExtractSift finds every blob of a synthetic image with unit descriptors,
+// gives the same points on every call, with pooled or explicit scratch memory
+// and with a larger buffer restricted to the image, and the points of an
+// image shifted by a multiple of the coarsest subsampling are shifted copies
+static void TestExtract()
+{
+  int steps[] = {1, 4, 1, 3, 0};
+  float alpha[] = {0.2f};
+  DescriptorNormalizerData normalizer{5, 1, steps, alpha};
+  const int w = 320, h = 240, numOctaves = 5;
+  const int shiftX = 32, shiftY = 16;
+  std::vector<float> centres, shifted;
+  for (int y=40;y<h-40;y+=40)
+    for (int x=40;x<w-40;x+=40) {
+      centres.push_back((float)x + 0.3f);
+      centres.push_back((float)y + 0.6f);
+      shifted.push_back((float)x + 0.3f + shiftX);
+      shifted.push_back((float)y + 0.6f + shiftY);
+    }
+  std::vector<float> img = BlobImage(w, h, centres, 3.0f);
+  std::vector<float> img2 = BlobImage(w + shiftX, h + shiftY, shifted, 3.0f);
+  HostImage image(img.data(), w, h);
+
+  SiftData data(4096);
+  HostTempMemory tmp(w, h, numOctaves);
+  ExtractSift(data, normalizer, image, numOctaves, 1.0f, 3.0f, 0.0f, false, tmp);
+  CHECK(data.numPts>0);
+  for (size_t b=0;b<centres.size();b+=2) {
+    bool found = false;
+    for (int i=0;i<data.numPts;i++) {
+      const SiftPoint &pt = data.h_data[i];
+      found |= (std::fabs(pt.xpos - centres[b])<1.0f && std::fabs(pt.ypos - centres[b + 1])<1.0f);
+    }
+    CHECK(found);
+  }
+  for (int i=0;i<data.numPts;i++) {
+    const SiftPoint &pt = data.h_data[i];
+    float norm = 0.0f;
+    for (int d=0;d<128;d++)
+      norm += pt.data[d]*pt.data[d];
+    CHECK(std::fabs(norm - 1.0f)<1e-3f);
+    CHECK(pt.xpos>=0.0f && pt.xpos<w && pt.ypos>=0.0f && pt.ypos<h);
+  }
+
+  auto same = [](const SiftData &a, const SiftData &b) {
+    return a.numPts==b.numPts && !std::memcmp(a.h_data, b.h_data, sizeof(SiftPoint)*a.numPts);
+  };
+  SiftData again(4096);
+  ExtractSift(again, normalizer, image, numOctaves, 1.0f, 3.0f, 0.0f, false, tmp);
+  CHECK(same(data, again));
+  ExtractSift(again, normalizer, image, numOctaves, 1.0f, 3.0f);
+  CHECK(same(data, again));
+  HostTempMemory larger(w + shiftX, h + shiftY, numOctaves);
+  larger.setSize(w + shiftX, h + shiftY);
+  HostImage image2(img2.data(), w + shiftX, h + shiftY);
+  SiftData moved(4096);
+  ExtractSift(moved, normalizer, image2, numOctaves, 1.0f, 3.0f, 0.0f, false, larger);
+  larger.setSize(w, h);
+  ExtractSift(again, normalizer, image, numOctaves, 1.0f, 3.0f, 0.0f, false, larger);
+  CHECK(same(data, again));
+
+  // Points away from the borders of both images, where neither the filters
+  // nor the descriptors reach a border
+  int numInterior = 0;
+  for (int i=0;i<data.numPts;i++) {
+    const SiftPoint &pt = data.h_data[i];
+    const float margin = 8.0f*pt.scale + 16.0f;
+    if (pt.xpos<margin || pt.xpos>w - margin || pt.ypos<margin || pt.ypos>h - margin)
+      continue;
+    numInterior++;
+    bool found = false;
+    for (int j=0;j<moved.numPts && !found;j++) {
+      const SiftPoint &q = moved.h_data[j];
+      if (std::fabs(q.xpos - shiftX - pt.xpos)>1e-3f || std::fabs(q.ypos - shiftY - pt.ypos)>1e-3f ||
+          std::fabs(q.scale - pt.scale)>1e-3f || std::fabs(q.orientation - pt.orientation)>1e-2f)
+        continue;
+      float dot = 0.0f;
+      for (int d=0;d<128;d++)
+        dot += pt.data[d]*q.data[d];
+      found = (dot>0.9999f);
+    }
+    CHECK(found);
+  }
+  CHECK(numInterior>0);
+
+  // Octave counts beyond the Laplace kernel array and sizes beyond the
+  // allocation are rejected
+  CHECK(Throws<std::invalid_argument>([&] {
+    ExtractSift(again, normalizer, image, 8, 1.0f, 3.0f, 0.0f, false, tmp);
+  }));
+  CHECK(Throws<std::invalid_argument>([&] { tmp.setSize(w + 1, h); }));
+}
+
+int main()
+{
+  TestFilters();
+  TestLaplace();
+  TestFindPoints();
+  TestExtract();
+
+  return TestResult();
+}
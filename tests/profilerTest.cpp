@@ -0,0 +1,417 @@
+//********************************************************//
+// Stage profiler on the host: scopes, aggregates, the    //
+// record ring buffer, the JSON output and the Chrome     //
+// trace, runs without a device                           //
+//********************************************************//
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cudasift/profiler.h"
+#include "testUtils.h"
+
+// Parsed JSON value, enough to check the structure and fields of the output
+struct Json {
+  enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  bool boolean = false;
+  double number = 0.0;
+  std::string string;
+  std::vector<Json> array;
+  std::map<std::string, Json> object;
+  const Json &operator[](const std::string &key) const
+  {
+    static const Json none;
+    auto it = object.find(key);
+    return it==object.end() ? none : it->second;
+  }
+};
+
+// Recursive descent over the JSON grammar, false on any syntax error
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : p(text.c_str()) {}
+  bool parse(Json &value)
+  {
+    if (!parseValue(value))
+      return false;
+    skip();
+    return *p==0;
+  }
+
+private:
+  void skip()
+  {
+    while (*p==' ' || *p=='\n' || *p=='\r' || *p=='\t')
+      p++;
+  }
+  bool literal(const char *word)
+  {
+    const size_t n = std::strlen(word);
+    if (std::strncmp(p, word, n))
+      return false;
+    p += n;
+    return true;
+  }
+  bool parseString(std::string &s)
+  {
+    if (*p!='"')
+      return false;
+    for (p++;*p!='"';p++) {
+      if (*p==0 || (unsigned char)*p<0x20)
+        return false;
+      if (*p=='\\') {
+        p++;
+        if (*p=='u') {
+          for (int i=0;i<4;i++)
+            if (!std::isxdigit((unsigned char)*++p))
+              return false;
+          s += '?';
+          continue;
+        }
+        if (!std::strchr("\"\\/bfnrt", *p) || *p==0)
+          return false;
+      }
+      s += *p;
+    }
+    p++;
+    return true;
+  }
+  bool parseNumber(double &x)
+  {
+    const char *start = p;
+    if (*p=='-')
+      p++;
+    if (!std::isdigit((unsigned char)*p))
+      return false;
+    if (*p=='0')
+      p++;
+    else
+      while (std::isdigit((unsigned char)*p))
+        p++;
+    if (*p=='.') {
+      p++;
+      if (!std::isdigit((unsigned char)*p))
+        return false;
+      while (std::isdigit((unsigned char)*p))
+        p++;
+    }
+    if (*p=='e' || *p=='E') {
+      p++;
+      if (*p=='+' || *p=='-')
+        p++;
+      if (!std::isdigit((unsigned char)*p))
+        return false;
+      while (std::isdigit((unsigned char)*p))
+        p++;
+    }
+    x = std::strtod(std::string(start, p).c_str(), nullptr);
+    return true;
+  }
+  bool parseValue(Json &v)
+  {
+    skip();
+    if (*p=='{') {
+      v.type = Json::OBJECT;
+      p++;
+      skip();
+      if (*p=='}') {
+        p++;
+        return true;
+      }
+      for (;;) {
+        std::string key;
+        skip();
+        if (!parseString(key))
+          return false;
+        skip();
+        if (*p++!=':')
+          return false;
+        if (!parseValue(v.object[key]))
+          return false;
+        skip();
+        if (*p=='}') {
+          p++;
+          return true;
+        }
+        if (*p++!=',')
+          return false;
+      }
+    }
+    if (*p=='[') {
+      v.type = Json::ARRAY;
+      p++;
+      skip();
+      if (*p==']') {
+        p++;
+        return true;
+      }
+      for (;;) {
+        v.array.emplace_back();
+        if (!parseValue(v.array.back()))
+          return false;
+        skip();
+        if (*p==']') {
+          p++;
+          return true;
+        }
+        if (*p++!=',')
+          return false;
+      }
+    }
+    if (*p=='"') {
+      v.type = Json::STRING;
+      return parseString(v.string);
+    }
+    if (literal("true")) {
+      v.type = Json::BOOLEAN;
+      v.boolean = true;
+      return true;
+    }
+    if (literal("false")) {
+      v.type = Json::BOOLEAN;
+      return true;
+    }
+    if (literal("null"))
+      return true;
+    v.type = Json::NUMBER;
+    return parseNumber(v.number);
+  }
+
+  const char *p;
+};
+
+static bool ParseJson(const std::string &text, Json &value)
+{
+  return JsonParser(text).parse(value);
+}
+
+static ProfileRecord MakeRecord(ProfileStage stage, int octave, int numPts, bool device, double startMs,
+                                double durationMs, uint64_t thread = 1, uint64_t stream = 0)
+{
+  return {stage, octave, numPts, device, startMs, durationMs, thread, stream};
+}
+
+static const ProfileStats *FindStats(const std::vector<ProfileStats> &stats, ProfileStage stage, int octave,
+                                     bool device)
+{
+  for (const ProfileStats &s : stats)
+    if (s.stage==stage && s.octave==octave && s.device==device)
+      return &s;
+  return nullptr;
+}
+
+// Scopes of a disabled profiler record nothing, also if it is enabled while
+// they are open, and the parser rejects malformed JSON
+static void TestDisabled()
+{
+  SiftProfiler prof;
+  CHECK(!prof.enabled());
+  {
+    ProfileScope scope(PROFILE_MATCH, -1, prof);
+    scope.setPoints(10);
+  }
+  {
+    ProfileScope scope(PROFILE_OCTAVE, 2, prof);
+    prof.setEnabled(true);
+  }
+  CHECK(prof.records().empty() && prof.summary().empty());
+  prof.setEnabled(false);
+  CHECK(!prof.enabled());
+
+  Json json;
+  for (const char *bad : {"", "{", "[1,]", "{\"a\" 1}", "{\"a\": 01}", "\"\\x\"", "[1] 2", "tru"})
+    CHECK(!ParseJson(bad, json));
+  CHECK(ParseJson(" {\"a\": [1, -2.5e3, true, null, \"\\\"b\\u0041\"], \"c\": {}} ", json));
+  CHECK(json["a"].array.size()==5 && json["a"].array[1].number==-2500.0);
+  CHECK(json["c"].type==Json::OBJECT && json["c"].object.empty());
+}
+
+// The summary aggregates the count, extremes, total and counted points per
+// stage, octave and timer kind, over all records since the last clear()
+static void TestSummary()
+{
+  SiftProfiler prof;
+  prof.setEnabled(true);
+  prof.record(MakeRecord(PROFILE_OCTAVE, 0, 100, false, 0.0, 2.0));
+  prof.record(MakeRecord(PROFILE_OCTAVE, 0, -1, false, 3.0, 1.0));
+  prof.record(MakeRecord(PROFILE_OCTAVE, 0, 20, false, 5.0, 4.5));
+  prof.record(MakeRecord(PROFILE_OCTAVE, 1, 7, false, 6.0, 0.5));
+  prof.record(MakeRecord(PROFILE_OCTAVE, 0, 30, true, 1.0, 3.0, 1, 16));
+  {
+    ProfileScope scope(PROFILE_MATCH, -1, prof);
+    scope.setPoints(42);
+  }
+  // Deferred device timings are waited for by the queries
+  prof.defer([](bool wait, std::vector<ProfileRecord> &records) {
+    if (wait)
+      records.push_back(MakeRecord(PROFILE_OCTAVE, 0, 5, true, 2.0, 1.0, 1, 16));
+    return wait;
+  });
+
+  const std::vector<ProfileStats> stats = prof.summary();
+  CHECK(stats.size()==4);
+  const ProfileStats *host0 = FindStats(stats, PROFILE_OCTAVE, 0, false);
+  CHECK(host0 && host0->count==3 && host0->minMs==1.0 && host0->maxMs==4.5 && host0->totalMs==7.5);
+  CHECK(host0 && host0->numPts==120 && std::fabs(host0->meanMs() - 2.5)<1e-12);
+  const ProfileStats *host1 = FindStats(stats, PROFILE_OCTAVE, 1, false);
+  CHECK(host1 && host1->count==1 && host1->minMs==0.5 && host1->maxMs==0.5 && host1->numPts==7);
+  const ProfileStats *device0 = FindStats(stats, PROFILE_OCTAVE, 0, true);
+  CHECK(device0 && device0->count==2 && device0->minMs==1.0 && device0->maxMs==3.0);
+  CHECK(device0 && device0->totalMs==4.0 && device0->numPts==35);
+  const ProfileStats *match = FindStats(stats, PROFILE_MATCH, -1, false);
+  CHECK(match && match->count==1 && match->numPts==42 && match->minMs>=0.0);
+
+  const std::vector<ProfileRecord> records = prof.records();
+  CHECK(records.size()==7);
+  const ProfileRecord &scope = records[5];
+  CHECK(scope.stage==PROFILE_MATCH && scope.octave==-1 && scope.numPts==42 && !scope.device);
+  CHECK(scope.thread==SiftProfiler::threadId() && scope.startMs>=0.0 && scope.startMs<=prof.now());
+  CHECK(records[6].device && records[6].numPts==5);
+}
+
+// The ring buffer keeps the latest records up to its capacity, trimmed when
+// it shrinks, while the aggregates cover all of them until clear()
+static void TestCapacity()
+{
+  SiftProfiler prof(3);
+  prof.setEnabled(true);
+  for (int i=0;i<5;i++)
+    prof.record(MakeRecord(PROFILE_LOW_PASS, i, i, false, i, 1.0));
+  std::vector<ProfileRecord> records = prof.records();
+  CHECK(records.size()==3);
+  for (int i=0;i<(int)records.size();i++)
+    CHECK(records[i].octave==2 + i);
+  CHECK(prof.summary().size()==5);
+
+  prof.setCapacity(2);
+  records = prof.records();
+  CHECK(records.size()==2 && records[0].octave==3 && records[1].octave==4);
+  prof.setCapacity(0);
+  prof.record(MakeRecord(PROFILE_LOW_PASS, 0, 1, false, 6.0, 2.0));
+  CHECK(prof.records().empty());
+  const std::vector<ProfileStats> stats = prof.summary();
+  const ProfileStats *octave0 = FindStats(stats, PROFILE_LOW_PASS, 0, false);
+  CHECK(stats.size()==5 && octave0 && octave0->count==2 && octave0->numPts==1);
+
+  prof.setCapacity(10);
+  prof.record(MakeRecord(PROFILE_LAPLACE, 1, 1, false, 7.0, 1.0));
+  prof.clear();
+  CHECK(prof.records().empty() && prof.summary().empty());
+  prof.record(MakeRecord(PROFILE_LAPLACE, 1, 1, false, 8.0, 1.0));
+  CHECK(prof.records().size()==1 && prof.summary().size()==1);
+}
+
+// toJson() holds the records and summary with the stage names as strings
+static void TestJson()
+{
+  SiftProfiler prof;
+  prof.setEnabled(true);
+  Json json;
+  CHECK(ParseJson(prof.toJson(), json));
+  CHECK(json["records"].type==Json::ARRAY && json["records"].array.empty());
+  CHECK(json["summary"].type==Json::ARRAY && json["summary"].array.empty());
+
+  prof.record(MakeRecord(PROFILE_DESCRIPTORS, 2, 50, false, 1.25, 0.5, 3, 0));
+  prof.record(MakeRecord(PROFILE_DESCRIPTORS, 2, 10, false, 2.0, 1.5, 3, 0));
+  prof.record(MakeRecord(PROFILE_SYNC, -1, -1, false, 4.0, 0.25, 3, 0x1234));
+  CHECK(ParseJson(prof.toJson(), json));
+  const std::vector<Json> &records = json["records"].array;
+  CHECK(records.size()==3);
+  if (records.size()==3) {
+    const Json &r = records[0];
+    CHECK(r["stage"].string=="Descriptors" && r["octave"].number==2 && r["numPts"].number==50);
+    CHECK(r["device"].type==Json::BOOLEAN && !r["device"].boolean);
+    CHECK(r["startMs"].number==1.25 && r["durationMs"].number==0.5 && r["thread"].number==3);
+    CHECK(records[2]["stage"].string=="Synchronize" && records[2]["stream"].number==0x1234);
+  }
+  const std::vector<Json> &summary = json["summary"].array;
+  CHECK(summary.size()==2);
+  bool found = false;
+  for (const Json &s : summary)
+    if (s["stage"].string=="Descriptors") {
+      found = true;
+      CHECK(s["count"].number==2 && s["totalMs"].number==2.0 && s["meanMs"].number==1.0);
+      CHECK(s["minMs"].number==0.5 && s["maxMs"].number==1.5 && s["numPts"].number==60);
+    }
+  CHECK(found);
+}
+
+// The Chrome trace is valid JSON with complete events in microseconds, one
+// named track per host thread and per stream, and synchronization waits in
+// their own category
+static void TestChromeTrace()
+{
+  SiftProfiler prof;
+  prof.setEnabled(true);
+  {
+    ProfileScope scope(PROFILE_EXTRACT, -1, prof);
+    scope.setPoints(9);
+  }
+  std::thread worker([&] { ProfileScope scope(PROFILE_MATCH, -1, prof); });
+  worker.join();
+  prof.record(MakeRecord(PROFILE_LAPLACE, 1, -1, true, 1.5, 0.25, SiftProfiler::threadId(), 0xa0));
+  prof.record(MakeRecord(PROFILE_LAPLACE, 2, -1, true, 2.0, 0.125, SiftProfiler::threadId(), 0xb0));
+  prof.record(MakeRecord(PROFILE_DESCRIPTORS, 1, 12, true, 3.0, 0.5, SiftProfiler::threadId(), 0xa0));
+  prof.record(MakeRecord(PROFILE_SYNC, -1, -1, false, 4.25, 1.75, SiftProfiler::threadId(), 0xa0));
+
+  Json json;
+  CHECK(ParseJson(prof.toChromeTrace(), json));
+  CHECK(json["traceEvents"].type==Json::ARRAY);
+  const std::vector<ProfileRecord> records = prof.records();
+  std::set<double> threadTracks, streamTracks;
+  std::map<double, std::string> streamNames;
+  size_t numComplete = 0;
+  for (const Json &e : json["traceEvents"].array) {
+    const std::string &ph = e["ph"].string;
+    if (ph=="M" && e["name"].string=="thread_name") {
+      if (e["pid"].number==1) {
+        CHECK(threadTracks.insert(e["tid"].number).second);
+      } else {
+        CHECK(e["pid"].number==2 && streamTracks.insert(e["tid"].number).second);
+        streamNames[e["tid"].number] = e["args"]["name"].string;
+      }
+      continue;
+    }
+    if (ph!="X")
+      continue;
+    // Each event matches its record in order, with times in microseconds
+    CHECK(numComplete<records.size());
+    if (numComplete>=records.size())
+      break;
+    const ProfileRecord &r = records[numComplete++];
+    CHECK(std::fabs(e["ts"].number - 1000.0*r.startMs)<=0.001);
+    CHECK(std::fabs(e["dur"].number - 1000.0*r.durationMs)<=0.001);
+    CHECK(e["pid"].number==(r.device ? 2 : 1));
+    CHECK(e["args"]["octave"].number==r.octave && e["args"]["numPts"].number==r.numPts);
+    CHECK(e["cat"].string==(r.device ? "device" : r.stage==PROFILE_SYNC ? "sync" : "host"));
+    if (r.device) {
+      CHECK(streamTracks.count(e["tid"].number));
+      char name[32];
+      snprintf(name, sizeof(name), "Stream 0x%x", (unsigned)r.stream);
+      CHECK(streamNames[e["tid"].number]==name);
+    } else {
+      CHECK(threadTracks.count(e["tid"].number) && e["tid"].number==r.thread);
+    }
+  }
+  CHECK(numComplete==records.size() && records.size()==6);
+  CHECK(threadTracks.size()==2 && streamTracks.size()==2);
+}
+
+int main()
+{
+  TestDisabled();
+  TestSummary();
+  TestCapacity();
+  TestJson();
+  TestChromeTrace();
+
+  return TestResult();
+}
@@ -0,0 +1,191 @@
+//********************************************************//
+// Feature files: write and map round trips, matching     //
+// against a mapped file and rejection of truncated or    //
+// corrupt files, runs without a device                   //
+//********************************************************//
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/siftFile.h"
+#include "testUtils.h"
+
+static const char *fileName = "siftFileTest.sift";
+
+static bool Rejected(const char *name)
+{
+  try {
+    MappedSiftFeatures mapped(name);
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+static bool SameColumns(const SiftFeatureView &view, const SiftFeatureSet &set)
+{
+  const size_t bytes = set.numPts*sizeof(float);
+  return view.numPts==set.numPts &&
+    !std::memcmp(view.xpos, set.xpos.data(), bytes) && !std::memcmp(view.ypos, set.ypos.data(), bytes) &&
+    !std::memcmp(view.scale, set.scale.data(), bytes) &&
+    !std::memcmp(view.sharpness, set.sharpness.data(), bytes) &&
+    !std::memcmp(view.edgeness, set.edgeness.data(), bytes) &&
+    !std::memcmp(view.orientation, set.orientation.data(), bytes) &&
+    !std::memcmp(view.subsampling, set.subsampling.data(), bytes);
+}
+
+static bool SameMatches(const SiftFeatureSet &a, const SiftFeatureSet &b)
+{
+  for (int i=0;i<a.numPts;i++)
+    if (a.match[i]!=b.match[i] || a.score[i]!=b.score[i] || a.ambiguity[i]!=b.ambiguity[i] ||
+        a.match_xpos[i]!=b.match_xpos[i] || a.match_ypos[i]!=b.match_ypos[i])
+      return false;
+  return true;
+}
+
+// Float and quantized files map back to the written columns, descriptors or
+// codes at 64-byte aligned offsets, and matching against the mapped file
+// gives the same results as matching against the set, on every call
+static void TestRoundTrip()
+{
+  for (int numPts : {0, 1, 37, 300}) {
+    SiftFeatureSet set, query;
+    MakeFeatures(set, numPts, 10, 1 + numPts, 1.0f);
+    MakeFeatures(query, 50, 10, 2, 1.0f);
+    for (bool quantize : {false, true}) {
+      WriteSiftFeatures(fileName, set, quantize);
+      MappedSiftFeatures mapped(fileName);
+      const SiftFileHeader &h = mapped.header();
+      CHECK(!std::memcmp(h.magic, SIFT_FILE_MAGIC, 8) && h.version==SIFT_FILE_VERSION);
+      CHECK(h.numPts==(uint64_t)numPts && h.fileSize==ReadFile(fileName).size());
+      CHECK(h.keypointOffset%64==0 && h.descriptorOffset%64==0 && h.scaleOffset%64==0);
+      const SiftFeatureView &view = mapped.view();
+      CHECK(SameColumns(view, set));
+      QuantizedSiftData quantized;
+      QuantizeDescriptors(set, quantized);
+      if (quantize) {
+        CHECK(view.descriptors==nullptr && mapped.packedDescriptors()==nullptr);
+        CHECK(!numPts || (!std::memcmp(view.codes, quantized.codes.data(), 128*numPts) &&
+                          !std::memcmp(view.scales, quantized.scales.data(), sizeof(float)*numPts)));
+      } else {
+        CHECK(view.codes==nullptr && mapped.packedCodes()==nullptr);
+        CHECK(!numPts || !std::memcmp(view.descriptors, set.descriptors.data(), sizeof(float)*128*numPts));
+      }
+
+      // Copies dequantize, with the match fields reset
+      SiftFeatureSet copy;
+      ToFeatureSet(view, copy);
+      CHECK(copy.numPts==numPts);
+      for (int i=0;i<numPts;i++) {
+        CHECK(copy.match[i]==-1 && copy.score[i]==0.0f);
+        for (int d=0;d<128;d++)
+          CHECK(std::fabs(copy.descriptor(i)[d] - set.descriptor(i)[d])<=
+                (quantize ? 0.5f*quantized.scales[i] + 1e-7f : 0.0f));
+      }
+
+      SiftFeatureSet expected = query, fromView = query, fromMapped = query;
+      QuantizedSiftData quantizedQuery;
+      QuantizeDescriptors(query, quantizedQuery);
+      if (quantize)
+        MatchSiftData(expected, quantizedQuery, set, quantized);
+      else
+        MatchSiftData(expected, set);
+      MatchSiftData(fromView, view);
+      CHECK(SameMatches(fromView, expected));
+      for (int k=0;k<2;k++) {
+        MatchSiftData(fromMapped, mapped);
+        CHECK(SameMatches(fromMapped, expected));
+      }
+
+      // A moved mapping keeps its view and packed descriptors
+      MappedSiftFeatures moved(std::move(mapped));
+      CHECK(moved.view().numPts==numPts && mapped.view().numPts==0);
+      SiftFeatureSet fromMoved = query;
+      MatchSiftData(fromMoved, moved);
+      CHECK(SameMatches(fromMoved, expected));
+    }
+  }
+  // Matching against an empty file clears earlier results
+  {
+    SiftFeatureSet set, query, empty;
+    MakeFeatures(set, 40, 10, 5, 1.0f);
+    MakeFeatures(query, 40, 10, 6, 1.0f);
+    WriteSiftFeatures(fileName, empty);
+    MappedSiftFeatures mapped(fileName);
+    for (int k=0;k<2;k++) {
+      MatchSiftData(query, set);
+      if (k)
+        MatchSiftData(query, mapped.view());
+      else
+        MatchSiftData(query, mapped);
+      bool cleared = true;
+      for (int i=0;i<query.numPts;i++)
+        cleared = cleared && query.match[i]==-1 && query.score[i]==0.0f && query.ambiguity[i]==0.0f &&
+          query.match_xpos[i]==0.0f && query.match_ypos[i]==0.0f;
+      CHECK(cleared);
+    }
+  }
+  // SiftData is written through its feature set
+  SiftFeatureSet set;
+  MakeFeatures(set, 20, 10, 3, 1.0f);
+  SiftData data(20);
+  ToSiftData(set, data);
+  WriteSiftFeatures(fileName, data);
+  MappedSiftFeatures mapped(fileName);
+  CHECK(SameColumns(mapped.view(), set));
+  std::remove(fileName);
+}
+
+// Files cut short anywhere, or with a wrong magic or version, or whose header
+// places a block beyond the end of the file, are rejected
+static void TestCorrupt()
+{
+  SiftFeatureSet set;
+  MakeFeatures(set, 100, 10, 4, 1.0f);
+  CHECK(Rejected("siftFileTestMissing.sift"));
+  for (bool quantize : {false, true}) {
+    WriteSiftFeatures(fileName, set, quantize);
+    const std::vector<char> bytes = ReadFile(fileName);
+    CHECK(!Rejected(fileName));
+    for (size_t size : {(size_t)0, (size_t)10, sizeof(SiftFileHeader) - 1, sizeof(SiftFileHeader),
+                        (size_t)1000, bytes.size()/2, bytes.size() - 1}) {
+      WriteFile(fileName, bytes, size);
+      CHECK(Rejected(fileName));
+    }
+    auto corrupt = [&](size_t offset, uint64_t value, size_t width) {
+      std::vector<char> copy = bytes;
+      std::memcpy(&copy[offset], &value, width);
+      WriteFile(fileName, copy, copy.size());
+      return Rejected(fileName);
+    };
+    CHECK(corrupt(offsetof(SiftFileHeader, magic), 0x5446495341445544ull, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, version), 0, 4));
+    CHECK(corrupt(offsetof(SiftFileHeader, version), SIFT_FILE_VERSION + 1, 4));
+    CHECK(corrupt(offsetof(SiftFileHeader, numPts), 200, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, numPts), 1ull << 62, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, columnStride), 0, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, columnStride), 1ull << 61, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, keypointOffset), 0, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, descriptorOffset), 0xffffffffffffffc0ull, 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, descriptorOffset), bytes.size(), 8));
+    CHECK(corrupt(offsetof(SiftFileHeader, fileSize), bytes.size() + 64, 8));
+    if (quantize) {
+      CHECK(corrupt(offsetof(SiftFileHeader, flags), 0, 4));
+      CHECK(corrupt(offsetof(SiftFileHeader, scaleOffset), bytes.size() - 64, 8));
+    }
+  }
+  std::remove(fileName);
+}
+
+int main()
+{
+  TestRoundTrip();
+  TestCorrupt();
+
+  return TestResult();
+}
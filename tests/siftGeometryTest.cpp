@@ -0,0 +1,499 @@
+//********************************************************//
+// Host geometric estimation on synthetic matches with    //
+// known models, runs without a device                    //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "cudasift/siftGeometry.h"
+#include "testUtils.h"
+
+// Matches of random points in a 1280 x 960 image mapped by the 3 x 3 matrix
+// M with Gaussian noise of sigma pixels, a fraction outliers of them mapped
+// to random points instead. isInlier marks the true inliers.
+static void MakeScene(SiftFeatureSet &set, std::vector<uint8_t> &isInlier, int numPts,
+                      const float *M, float sigma, float outliers, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> ux(0.0f, 1280.0f), uy(0.0f, 960.0f), u01(0.0f, 1.0f);
+  std::normal_distribution<float> noise(0.0f, sigma);
+  set.resize(numPts);
+  isInlier.assign(numPts, 0);
+  for (int i=0;i<numPts;i++) {
+    const float x = ux(rng), y = uy(rng);
+    set.xpos[i] = x;
+    set.ypos[i] = y;
+    set.score[i] = 0.9f;
+    set.ambiguity[i] = 0.5f;
+    if (u01(rng)<outliers) {
+      set.match_xpos[i] = ux(rng);
+      set.match_ypos[i] = uy(rng);
+    } else {
+      const float z = M[6]*x + M[7]*y + M[8];
+      set.match_xpos[i] = (M[0]*x + M[1]*y + M[2])/z + noise(rng);
+      set.match_ypos[i] = (M[3]*x + M[4]*y + M[5])/z + noise(rng);
+      isInlier[i] = 1;
+    }
+  }
+}
+
+// Largest distance between the points mapped by A and B over a grid on the
+// image, with both scaled to A[8] = B[8] = 1
+static float MaxTransferDifference(const float *A, const float *B)
+{
+  float maxDiff = 0.0f;
+  for (float y=0.0f;y<=960.0f;y+=96.0f)
+    for (float x=0.0f;x<=1280.0f;x+=128.0f) {
+      const float za = A[6]*x + A[7]*y + A[8], zb = B[6]*x + B[7]*y + B[8];
+      const float dx = (A[0]*x + A[1]*y + A[2])/za - (B[0]*x + B[1]*y + B[2])/zb;
+      const float dy = (A[3]*x + A[4]*y + A[5])/za - (B[3]*x + B[4]*y + B[5])/zb;
+      maxDiff = std::max(maxDiff, std::sqrt(dx*dx + dy*dy));
+    }
+  return maxDiff;
+}
+
+// A homography with half outliers is recovered within a few pixels over the
+// whole image, as far as a minimal sample extrapolates, its inliers are the
+// true ones up to the noise, and the same seed gives the same result
+static void TestHomography()
+{
+  const float H[9] = {1.05f, 0.03f, 12.0f, -0.02f, 0.97f, -8.0f, 2e-5f, -1e-5f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, H, 0.5f, 0.5f, 7);
+  RansacParams params;
+  params.thresh = 3.0f;
+  float est[9];
+  RansacResult result;
+  std::vector<uint8_t> inliers(set.numPts);
+  EstimateHomography(set, est, result, params, inliers.data());
+  CHECK(std::fabs(est[8] - 1.0f)<1e-6f);
+  CHECK(MaxTransferDifference(est, H)<2.0f*params.thresh);
+  CHECK(result.numHypotheses==params.numLoops);
+  int numInliers = 0, trueInliers = 0, falseInliers = 0;
+  for (int i=0;i<set.numPts;i++) {
+    numInliers += inliers[i];
+    trueInliers += isInlier[i];
+    falseInliers += (inliers[i] && !isInlier[i]);
+  }
+  CHECK(numInliers==result.numInliers);
+  CHECK(numInliers>=0.98f*trueInliers);
+  CHECK(falseInliers<=0.01f*numInliers);
+
+  // Same seed, same result, independent of the thread scheduling
+  float again[9];
+  RansacResult againResult;
+  std::vector<uint8_t> againInliers(set.numPts);
+  EstimateHomography(set, again, againResult, params, againInliers.data());
+  CHECK(std::equal(est, est + 9, again));
+  CHECK(againResult.numInliers==result.numInliers);
+  CHECK(againResult.numHypotheses==result.numHypotheses);
+  CHECK(againInliers==inliers);
+
+  // FindHomography of host features is EstimateHomography with its parameters
+  int numMatches = 0;
+  FindHomography(set, again, &numMatches, params.numLoops, params.minScore, params.maxAmbiguity,
+                 params.thresh, params.seed);
+  CHECK(std::equal(est, est + 9, again) && numMatches==result.numInliers);
+
+  // Matches below minScore or above maxAmbiguity take no part
+  for (int i=0;i<set.numPts;i++)
+    if (!isInlier[i])
+      set.score[i] = 0.5f;
+  EstimateHomography(set, est, result, params, inliers.data());
+  CHECK(MaxTransferDifference(est, H)<2.0f*params.thresh);
+  for (int i=0;i<set.numPts;i++)
+    CHECK(!inliers[i] || isInlier[i]);
+
+  // Too few matches give the identity
+  set.resize(7);
+  EstimateHomography(set, est, result, params, inliers.data());
+  const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  CHECK(std::equal(est, est + 9, identity));
+  CHECK(result.numInliers==0);
+}
+
+// With a confidence the search ends once an all-inlier sample has been
+// drawn with that probability, given the inlier ratio of the best model
+static void TestAdaptiveTermination()
+{
+  const float H[9] = {0.95f, -0.1f, 40.0f, 0.08f, 1.01f, -25.0f, -1e-5f, 3e-5f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, H, 0.5f, 0.5f, 11);
+  RansacParams params;
+  params.thresh = 3.0f;
+  params.numLoops = 10000;
+  params.confidence = 0.99f;
+  float est[9];
+  RansacResult result;
+  EstimateHomography(set, est, result, params);
+  const double ratio = (double)result.numInliers/set.numPts;
+  const double required = std::log(1.0 - params.confidence)/std::log(1.0 - std::pow(ratio, 4));
+  CHECK(result.numHypotheses<=std::ceil(1.1*required));
+  CHECK(MaxTransferDifference(est, H)<2.0f*params.thresh);
+}
+
+// PROSAC samples the matches of the best quality first, so that it finds a
+// model among 10% inliers in a few hypotheses if those are the best matches,
+// where uniform samples would need thousands
+static void TestProsac()
+{
+  const float H[9] = {1.05f, 0.03f, 12.0f, -0.02f, 0.97f, -8.0f, 2e-5f, -1e-5f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, H, 0.5f, 0.9f, 5);
+  int trueInliers = 0;
+  for (int i=0;i<set.numPts;i++) {
+    set.ambiguity[i] = (isInlier[i] ? 0.2f : 0.6f) + 0.01f*(i%10);
+    trueInliers += isInlier[i];
+  }
+  RansacParams params;
+  params.thresh = 3.0f;
+  params.numLoops = 50;
+  params.sampling = RANSAC_PROSAC;
+  float est[9];
+  RansacResult result;
+  EstimateHomography(set, est, result, params);
+  CHECK(result.numInliers>=0.95f*trueInliers);
+  CHECK(MaxTransferDifference(est, H)<2.0f*params.thresh);
+
+  // Uniform samples of the same number mostly contain outliers
+  params.sampling = RANSAC_UNIFORM;
+  RansacResult uniform;
+  EstimateHomography(set, est, uniform, params);
+  CHECK(uniform.numInliers<result.numInliers/2);
+}
+
+// Affine and similarity transforms are recovered with the structure of
+// their models, the similarity also from the keypoint frames of single
+// matches
+static void TestAffineSimilarity()
+{
+  const float A[9] = {0.9f, 0.15f, 30.0f, -0.1f, 1.1f, -20.0f, 0.0f, 0.0f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, A, 0.5f, 0.5f, 17);
+  RansacParams params;
+  params.thresh = 3.0f;
+  float est[9];
+  RansacResult result;
+  EstimateAffine(set, est, result, params);
+  CHECK(est[6]==0.0f && est[7]==0.0f && est[8]==1.0f);
+  CHECK(MaxTransferDifference(est, A)<2.0f*params.thresh);
+
+  const float scale = 1.1f, angle = 0.3f;
+  const float S[9] = {scale*std::cos(angle), -scale*std::sin(angle), 100.0f,
+                      scale*std::sin(angle), scale*std::cos(angle), -150.0f, 0.0f, 0.0f, 1.0f};
+  MakeScene(set, isInlier, 1000, S, 0.5f, 0.5f, 19);
+  int trueInliers = 0;
+  for (int i=0;i<set.numPts;i++)
+    trueInliers += isInlier[i];
+  EstimateSimilarity(set, est, result, params);
+  CHECK(est[0]==est[4] && est[1]==-est[3]);
+  CHECK(est[6]==0.0f && est[7]==0.0f && est[8]==1.0f);
+  CHECK(MaxTransferDifference(est, S)<2.0f*params.thresh);
+  CHECK(result.numInliers>=0.98f*trueInliers);
+
+  // Keypoints of the second image in reverse order, with the scales and
+  // orientations of the matched keypoints changed by the similarity up to
+  // 2% and 3 degrees, and those of the outliers at random
+  std::mt19937 rng(23);
+  std::uniform_real_distribution<float> u01(0.0f, 1.0f);
+  SiftFeatureSet set2(set.numPts);
+  for (int i=0;i<set.numPts;i++) {
+    const int j = set.numPts - 1 - i;
+    set.match[i] = j;
+    set.scale[i] = 1.0f + 4.0f*u01(rng);
+    set.orientation[i] = 360.0f*u01(rng);
+    set2.xpos[j] = set.match_xpos[i];
+    set2.ypos[j] = set.match_ypos[i];
+    if (isInlier[i]) {
+      set2.scale[j] = set.scale[i]*scale*(0.98f + 0.04f*u01(rng));
+      set2.orientation[j] = set.orientation[i] + angle*(180.0f/3.14159265f) + 6.0f*u01(rng) - 3.0f;
+    } else {
+      set2.scale[j] = 1.0f + 4.0f*u01(rng);
+      set2.orientation[j] = 360.0f*u01(rng);
+    }
+  }
+  params.confidence = 0.99f;
+  params.refineLoops = 3;
+  RansacResult frameResult;
+  EstimateSimilarity(set, set2, est, frameResult, params);
+  CHECK(est[0]==est[4] && est[1]==-est[3]);
+  CHECK(MaxTransferDifference(est, S)<0.5f);
+  CHECK(frameResult.numInliers>=0.98f*trueInliers);
+  // Half the single matches are inliers, so a few hypotheses suffice
+  CHECK(frameResult.numHypotheses<20);
+}
+
+// The local optimization refits the model to all its inliers, also when
+// that does not add any, so that it is more accurate than a minimal sample
+static void TestLocalOptimization()
+{
+  const float A[9] = {1.02f, 0.05f, -3.0f, -0.04f, 0.98f, 5.0f, 0.0f, 0.0f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, A, 0.5f, 0.5f, 3);
+  RansacParams params;
+  params.thresh = 3.0f;
+  float plain[9], refined[9];
+  RansacResult plainResult, refinedResult;
+  EstimateAffine(set, plain, plainResult, params);
+  params.refineLoops = 3;
+  EstimateAffine(set, refined, refinedResult, params);
+  CHECK(refinedResult.numInliers>=plainResult.numInliers);
+  CHECK(std::fabs(refined[5] - A[5])<0.3f);
+  CHECK(MaxTransferDifference(refined, A)<0.3f);
+  CHECK(MaxTransferDifference(refined, A)<MaxTransferDifference(plain, A));
+}
+
+// RefineHomography moves a homography that is a pixel or two off, as from a
+// minimal sample, onto all the inliers
+static void TestRefineHomography()
+{
+  const float H[9] = {1.05f, 0.03f, 12.0f, -0.02f, 0.97f, -8.0f, 2e-5f, -1e-5f, 1.0f};
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  MakeScene(set, isInlier, 1000, H, 0.5f, 0.5f, 13);
+  RansacParams params;
+  params.thresh = 3.0f;
+  params.refineLoops = 3;
+  float est[9];
+  std::copy(H, H + 9, est);
+  est[2] += 1.5f;
+  est[5] -= 1.0f;
+  est[0] *= 1.001f;
+  const float before = MaxTransferDifference(est, H);
+  RansacResult result;
+  std::vector<uint8_t> inliers(set.numPts);
+  RefineHomography(set, est, result, params, inliers.data());
+  CHECK(MaxTransferDifference(est, H)<0.5f);
+  CHECK(MaxTransferDifference(est, H)<0.25f*before);
+  int numInliers = 0, trueInliers = 0;
+  for (int i=0;i<set.numPts;i++) {
+    numInliers += inliers[i];
+    trueInliers += isInlier[i];
+  }
+  CHECK(numInliers==result.numInliers);
+  CHECK(numInliers>=0.98f*trueInliers);
+}
+
+// Matches of random 3D points seen by two cameras of focal length 800 pixels
+// with a principal point (640, 480), the second one rotated by 0.15 radians
+// about the y axis and moved by t, with the essential matrix E = [t]x R of
+// unit norm
+static void MakeTwoViewScene(SiftFeatureSet &set, std::vector<uint8_t> &isInlier, float *E,
+                             CameraIntrinsics &camera, int numPts, float sigma, float outliers,
+                             uint32_t seed)
+{
+  const double f = 800.0, cx = 640.0, cy = 480.0, angle = 0.15;
+  const double R[9] = {std::cos(angle), 0.0, std::sin(angle), 0.0, 1.0, 0.0,
+                       -std::sin(angle), 0.0, std::cos(angle)};
+  const double t[3] = {1.0, 0.2, 0.1};
+  camera.fx = camera.fy = (float)f;
+  camera.cx = (float)cx;
+  camera.cy = (float)cy;
+  const double tx[9] = {0.0, -t[2], t[1], t[2], 0.0, -t[0], -t[1], t[0], 0.0};
+  double e[9] = {0.0}, norm = 0.0;
+  for (int r=0;r<3;r++)
+    for (int c=0;c<3;c++) {
+      for (int k=0;k<3;k++)
+        e[3*r + c] += tx[3*r + k]*R[3*k + c];
+      norm += e[3*r + c]*e[3*r + c];
+    }
+  for (int k=0;k<9;k++)
+    E[k] = (float)(e[k]/std::sqrt(norm));
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> u01(0.0, 1.0);
+  std::normal_distribution<double> noise(0.0, sigma);
+  set.resize(numPts);
+  isInlier.assign(numPts, 0);
+  for (int i=0;i<numPts;i++) {
+    const double X = (u01(rng) - 0.5)*8.0, Y = (u01(rng) - 0.5)*6.0, Z = 4.0 + u01(rng)*8.0;
+    const double X2 = R[0]*X + R[1]*Y + R[2]*Z + t[0];
+    const double Y2 = R[3]*X + R[4]*Y + R[5]*Z + t[1];
+    const double Z2 = R[6]*X + R[7]*Y + R[8]*Z + t[2];
+    set.xpos[i] = (float)(f*X/Z + cx + noise(rng));
+    set.ypos[i] = (float)(f*Y/Z + cy + noise(rng));
+    set.score[i] = 0.9f;
+    set.ambiguity[i] = 0.5f;
+    if (u01(rng)<outliers) {
+      set.match_xpos[i] = (float)(u01(rng)*1280.0);
+      set.match_ypos[i] = (float)(u01(rng)*960.0);
+    } else {
+      set.match_xpos[i] = (float)(f*X2/Z2 + cx + noise(rng));
+      set.match_ypos[i] = (float)(f*Y2/Z2 + cy + noise(rng));
+      isInlier[i] = 1;
+    }
+  }
+}
+
+// Root mean square Sampson distance of the true inliers to the fundamental
+// matrix F in pixels, or to the essential matrix F in calibrated coordinates
+// scaled back to pixels
+static double SampsonError(const SiftFeatureSet &set, const std::vector<uint8_t> &isInlier,
+                           const float *F, const CameraIntrinsics *camera)
+{
+  double sum = 0.0;
+  int num = 0;
+  for (int i=0;i<set.numPts;i++) {
+    if (!isInlier[i])
+      continue;
+    double p1[3] = {set.xpos[i], set.ypos[i], 1.0};
+    double p2[3] = {set.match_xpos[i], set.match_ypos[i], 1.0};
+    if (camera) {
+      p1[0] = (p1[0] - camera->cx)/camera->fx;
+      p1[1] = (p1[1] - camera->cy)/camera->fy;
+      p2[0] = (p2[0] - camera->cx)/camera->fx;
+      p2[1] = (p2[1] - camera->cy)/camera->fy;
+    }
+    double l1[3], l2[3];
+    for (int r=0;r<3;r++) {
+      l1[r] = F[3*r]*p1[0] + F[3*r + 1]*p1[1] + F[3*r + 2];
+      l2[r] = F[r]*p2[0] + F[3 + r]*p2[1] + F[6 + r];
+    }
+    const double err = p2[0]*l1[0] + p2[1]*l1[1] + l1[2];
+    const double d2 = err*err/(l1[0]*l1[0] + l1[1]*l1[1] + l2[0]*l2[0] + l2[1]*l2[1]);
+    sum += (camera ? d2*camera->fx*camera->fx : d2);
+    num++;
+  }
+  return std::sqrt(sum/num);
+}
+
+static double Determinant(const float *M)
+{
+  return (double)M[0]*(M[4]*M[8] - M[5]*M[7]) - (double)M[1]*(M[3]*M[8] - M[5]*M[6]) +
+    (double)M[2]*(M[3]*M[7] - M[4]*M[6]);
+}
+
+// The epipolar solvers fit the true geometry of a two-view scene with 40%
+// outliers to about the noise, with the constraints of their models
+static void TestEpipolar()
+{
+  SiftFeatureSet set;
+  std::vector<uint8_t> isInlier;
+  float trueE[9];
+  CameraIntrinsics camera;
+  MakeTwoViewScene(set, isInlier, trueE, camera, 1000, 0.5f, 0.4f, 11);
+  int trueInliers = 0;
+  for (int i=0;i<set.numPts;i++)
+    trueInliers += isInlier[i];
+  for (int kind=0;kind<3;kind++) {
+    for (int refineLoops=0;refineLoops<=5;refineLoops+=5) {
+      RansacParams params;
+      params.thresh = 2.0f;
+      params.confidence = 0.999f;
+      params.refineLoops = refineLoops;
+      float M[9];
+      RansacResult result;
+      std::vector<uint8_t> inliers(set.numPts);
+      if (kind<2)
+        EstimateFundamental(set, M, result, params, inliers.data(),
+                            kind==0 ? FUNDAMENTAL_7POINT : FUNDAMENTAL_8POINT);
+      else
+        EstimateEssential(set, camera, camera, M, result, params, inliers.data());
+      int numInliers = 0, falseInliers = 0;
+      for (int i=0;i<set.numPts;i++) {
+        numInliers += inliers[i];
+        falseInliers += (inliers[i] && !isInlier[i]);
+      }
+      CHECK(numInliers==result.numInliers);
+      CHECK(numInliers>=0.98f*trueInliers);
+      CHECK(falseInliers<=0.01f*numInliers);
+      CHECK(SampsonError(set, isInlier, M, kind==2 ? &camera : nullptr)<1.0);
+      double norm = 0.0;
+      for (int k=0;k<9;k++)
+        norm += M[k]*M[k];
+      CHECK(std::fabs(norm - 1.0)<1e-4);
+      // Rank two, so that all epipolar lines meet in the epipoles
+      CHECK(std::fabs(Determinant(M))<1e-6);
+      if (kind==2) {
+        // Two equal singular values, 2 E E^T E = trace(E E^T) E, and the
+        // true essential matrix up to sign
+        double EEt[9] = {0.0}, trace = 0.0, constraint = 0.0, diff[2] = {0.0, 0.0};
+        for (int r=0;r<3;r++)
+          for (int c=0;c<3;c++)
+            for (int k=0;k<3;k++)
+              EEt[3*r + c] += M[3*r + k]*M[3*c + k];
+        for (int r=0;r<3;r++)
+          trace += EEt[4*r];
+        for (int r=0;r<3;r++)
+          for (int c=0;c<3;c++) {
+            double v = -trace*M[3*r + c];
+            for (int k=0;k<3;k++)
+              v += 2.0*EEt[3*r + k]*M[3*k + c];
+            constraint += v*v;
+          }
+        for (int k=0;k<9;k++) {
+          diff[0] += (M[k] - trueE[k])*(M[k] - trueE[k]);
+          diff[1] += (M[k] + trueE[k])*(M[k] + trueE[k]);
+        }
+        CHECK(std::sqrt(constraint)<1e-5);
+        CHECK(std::sqrt(std::min(diff[0], diff[1]))<0.05);
+      }
+    }
+  }
+}
+
+// EstimateHomographies gives the same results as separate calls, whether the
+// sets are spread over the threads or estimated in turn
+static void TestBatchHomographies()
+{
+  const int numSets = 12;
+  std::vector<SiftFeatureSet> sets(numSets);
+  std::vector<uint8_t> isInlier;
+  for (int k=0;k<numSets;k++) {
+    const float H[9] = {1.0f + 0.01f*k, 0.02f, 5.0f*k, -0.01f, 0.98f, -3.0f*k, 1e-5f*k, 0.0f, 1.0f};
+    MakeScene(sets[k], isInlier, (k==3 ? 5 : 50 + 100*k), H, 0.5f, 0.1f + 0.05f*k, 100 + k);
+  }
+  for (int mode=0;mode<3;mode++) {
+    RansacParams params;
+    params.thresh = 3.0f;
+    if (mode>=1) {
+      params.confidence = 0.99f;
+      params.sampling = RANSAC_PROSAC;
+    }
+    if (mode==2)
+      params.refineLoops = 3;
+    for (int num=1;num<=numSets;num+=numSets - 1) {
+      std::vector<float> batch(9*num);
+      std::vector<RansacResult> results(num);
+      std::vector<std::vector<uint8_t>> masks(num);
+      std::vector<uint8_t *> inliers(num);
+      for (int k=0;k<num;k++) {
+        masks[k].resize(sets[k].numPts);
+        inliers[k] = masks[k].data();
+      }
+      EstimateHomographies(sets.data(), num, batch.data(), results.data(), params, inliers.data());
+      for (int k=0;k<num;k++) {
+        float H[9];
+        RansacResult result;
+        std::vector<uint8_t> mask(sets[k].numPts);
+        EstimateHomography(sets[k], H, result, params, mask.data());
+        CHECK(std::equal(H, H + 9, &batch[9*k]));
+        CHECK(result.numInliers==results[k].numInliers);
+        CHECK(result.numHypotheses==results[k].numHypotheses);
+        CHECK(mask==masks[k]);
+      }
+    }
+  }
+}
+
+int main()
+{
+  TestHomography();
+  TestAdaptiveTermination();
+  TestProsac();
+  TestAffineSimilarity();
+  TestLocalOptimization();
+  TestRefineHomography();
+  TestEpipolar();
+  TestBatchHomographies();
+
+  return TestResult();
+}
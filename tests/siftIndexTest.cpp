@@ -0,0 +1,223 @@
+//********************************************************//
+// HNSW index against brute force: recall, ordering and   //
+// scores of searches, matching and save/load round       //
+// trips, runs without a device                           //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/siftIndex.h"
+#include "testUtils.h"
+
+static const char *fileName = "siftIndexTest.idx";
+
+// Fraction of the true k nearest neighbours of the queries found
+static double Recall(const SiftFeatureSet &queries, const SiftFeatureSet &data, int k,
+                     const std::vector<int> &indices)
+{
+  int found = 0;
+  for (int q=0;q<queries.numPts;q++) {
+    const std::vector<int> best = BruteForce(queries.descriptor(q), data, k);
+    for (int j : best)
+      found += (std::find(&indices[(size_t)q*k], &indices[(size_t)(q + 1)*k], j)!=&indices[(size_t)(q + 1)*k]);
+  }
+  return (double)found/(queries.numPts*k);
+}
+
+// Results are distinct points in decreasing order of their exact similarity
+static bool Consistent(const SiftFeatureSet &queries, const SiftIndex &index, int k,
+                       const std::vector<int> &indices, const std::vector<float> &scores)
+{
+  for (int q=0;q<queries.numPts;q++)
+    for (int j=0;j<k;j++) {
+      const int i = indices[(size_t)q*k + j];
+      const float s = scores[(size_t)q*k + j];
+      if (i<0 || i>=index.size() || std::fabs(s - Dot(queries.descriptor(q), index.descriptor(i)))>1e-4)
+        return false;
+      for (int l=0;l<j;l++)
+        if (indices[(size_t)q*k + l]==i || scores[(size_t)q*k + l]<s)
+          return false;
+    }
+  return true;
+}
+
+// Queries find nearly all true nearest neighbours, more with a larger ef,
+// and matching equals the two best search results
+static void TestRecall()
+{
+  SiftFeatureSet data, more, copies, queries;
+  MakeFeatures(data, 3000, 60, 1, 0.3f);
+  MakeFeatures(more, 2000, 60, 2, 0.3f);
+  MakeFeatures(copies, 500, 60, 3, 0.3f, &data);
+  MakeFeatures(queries, 300, 60, 4, 0.3f);
+
+  SiftIndex index;
+  CHECK(index.add(data)==0);
+  CHECK(index.add(more)==3000);
+  CHECK(index.size()==5000);
+  SiftFeatureSet all(5000);
+  all.numPts = 5000;
+  for (int i=0;i<5000;i++) {
+    const SiftFeatureSet &src = (i<3000 ? data : more);
+    const int j = (i<3000 ? i : i - 3000);
+    std::memcpy(all.descriptor(i), src.descriptor(j), 128*sizeof(float));
+    CHECK(index.xpos(i)==src.xpos[j] && index.ypos(i)==src.ypos[j]);
+    CHECK(!std::memcmp(index.descriptor(i), src.descriptor(j), 128*sizeof(float)));
+  }
+
+  // Noisy copies of indexed points find their original
+  std::vector<int> indices(500*10);
+  std::vector<float> scores(500*10);
+  index.search(copies, 1, indices.data(), scores.data());
+  int correct = 0;
+  for (int q=0;q<500;q++)
+    correct += (indices[q]==q);
+  CHECK(correct>=495);
+
+  const int k = 10;
+  double previous = 0.0;
+  for (int ef : {16, 64, 256}) {
+    index.search(queries, k, indices.data(), scores.data(), ef);
+    CHECK(Consistent(queries, index, k, indices, scores));
+    const double recall = Recall(queries, all, k, indices);
+    printf("ef %3d: recall@%d %.3f\n", ef, k, recall);
+    CHECK(recall>=previous - 0.01);
+    previous = recall;
+  }
+  CHECK(previous>=0.95);
+
+  // Repeated queries give the same results
+  std::vector<int> again(indices.size());
+  std::vector<float> againScores(scores.size());
+  index.search(queries, k, again.data(), againScores.data(), 256);
+  CHECK(again==indices && againScores==scores);
+
+  SiftFeatureSet matched = copies;
+  MatchSiftData(matched, index);
+  index.search(copies, 2, indices.data(), scores.data());
+  for (int q=0;q<500;q++) {
+    CHECK(matched.match[q]==indices[2*q] && matched.score[q]==scores[2*q]);
+    CHECK(std::fabs(matched.ambiguity[q] - scores[2*q + 1]/(scores[2*q] + 1e-6f))<1e-6f);
+    CHECK(matched.match_xpos[q]==index.xpos(indices[2*q]) &&
+          matched.match_ypos[q]==index.ypos(indices[2*q]));
+  }
+}
+
+// Small and empty indices pad their results, and matching against an empty
+// index clears the match fields
+static void TestSmall()
+{
+  SiftFeatureSet data, queries;
+  MakeFeatures(data, 5, 2, 5, 0.3f);
+  MakeFeatures(queries, 20, 2, 6, 0.3f);
+  SiftIndex index;
+  std::vector<int> indices(20*8);
+  std::vector<float> scores(20*8);
+  index.search(queries, 8, indices.data(), scores.data());
+  CHECK(std::count(indices.begin(), indices.end(), -1)==20*8);
+  CHECK(std::count(scores.begin(), scores.end(), 0.0f)==20*8);
+
+  index.add(data);
+  index.search(queries, 8, indices.data(), scores.data());
+  for (int q=0;q<20;q++) {
+    std::vector<int> found(&indices[q*8], &indices[q*8 + 5]);
+    std::sort(found.begin(), found.end());
+    CHECK(found==std::vector<int>({0, 1, 2, 3, 4}));
+    for (int j=5;j<8;j++)
+      CHECK(indices[q*8 + j]==-1 && scores[q*8 + j]==0.0f);
+  }
+
+  index.clear();
+  CHECK(index.size()==0);
+  SiftFeatureSet matched = queries;
+  for (int q=0;q<20;q++)
+    matched.match[q] = 3;
+  MatchSiftData(matched, index);
+  for (int q=0;q<20;q++)
+    CHECK(matched.match[q]==-1 && matched.score[q]==0.0f);
+  CHECK(index.add(data)==0);
+}
+
+// A loaded index holds the same points and parameters and answers queries
+// exactly as the saved one, while truncated or corrupt files are rejected
+static void TestSaveLoad()
+{
+  SiftFeatureSet data, queries;
+  MakeFeatures(data, 2000, 40, 7, 0.3f);
+  MakeFeatures(queries, 100, 40, 8, 0.3f);
+  SiftIndexParams params;
+  params.M = 12;
+  params.efSearch = 48;
+  params.seed = 5;
+  SiftIndex index(params);
+  index.add(data);
+  index.save(fileName);
+  SiftIndex loaded = SiftIndex::load(fileName);
+  CHECK(loaded.size()==index.size());
+  CHECK(loaded.params().M==12 && loaded.params().efSearch==48 && loaded.params().seed==5 &&
+        loaded.params().efConstruction==index.params().efConstruction);
+  for (int i=0;i<index.size();i++)
+    CHECK(loaded.xpos(i)==index.xpos(i) && loaded.ypos(i)==index.ypos(i) &&
+          !std::memcmp(loaded.descriptor(i), index.descriptor(i), 128*sizeof(float)));
+  const int k = 5;
+  std::vector<int> indices(100*k), loadedIndices(100*k);
+  std::vector<float> scores(100*k), loadedScores(100*k);
+  index.search(queries, k, indices.data(), scores.data());
+  loaded.search(queries, k, loadedIndices.data(), loadedScores.data());
+  CHECK(indices==loadedIndices && scores==loadedScores);
+
+  // A loaded index can grow
+  SiftFeatureSet more;
+  MakeFeatures(more, 100, 40, 9, 0.3f);
+  CHECK(loaded.add(more)==2000);
+  loaded.search(more, 1, loadedIndices.data(), loadedScores.data());
+  int found = 0;
+  for (int q=0;q<100;q++)
+    found += (loadedIndices[q]==2000 + q);
+  CHECK(found>=98);
+
+  SiftIndex empty;
+  empty.save(fileName);
+  CHECK(SiftIndex::load(fileName).size()==0);
+
+  index.save(fileName);
+  const std::vector<char> bytes = ReadFile(fileName);
+  auto rejected = [&](const std::vector<char> &copy, size_t size) {
+    WriteFile(fileName, copy, size);
+    return Throws<std::runtime_error>([] { SiftIndex::load(fileName); });
+  };
+  for (size_t size : {(size_t)0, (size_t)63, (size_t)64, bytes.size()/2, bytes.size() - 1})
+    CHECK(rejected(bytes, size));
+  std::vector<char> copy = bytes;
+  copy[0] = 'X';
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[8] = 2;        // Version
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[16 + 7] = 1;   // Point count beyond the file
+  CHECK(rejected(copy, copy.size()));
+  // A link of the first point beyond the index
+  copy = bytes;
+  const size_t links0 = 64 + (size_t)2000*(128 + 3)*sizeof(float);
+  const int bad = 2000;
+  std::memcpy(&copy[links0 + sizeof(int)], &bad, sizeof(int));
+  CHECK(rejected(copy, copy.size()));
+  CHECK(!rejected(bytes, bytes.size()));
+  std::remove(fileName);
+}
+
+int main()
+{
+  TestRecall();
+  TestSmall();
+  TestSaveLoad();
+
+  return TestResult();
+}
@@ -0,0 +1,267 @@
+//********************************************************//
+// Product quantizer and IVF-PQ index against brute       //
+// force: codes, recall and scores of searches, matching  //
+// and save/load round trips, runs without a device       //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/siftPQ.h"
+#include "testUtils.h"
+
+static const char *fileName = "siftPQTest.ivf";
+
+// Every subvector is coded by its nearest centroid, decoded back to it, and
+// the similarity table sums to the dot product with the decoded descriptor
+static void TestQuantizer()
+{
+  CHECK(Throws([] { ProductQuantizer pq(24); }));
+  SiftFeatureSet data;
+  MakeFeatures(data, 2000, 30, 1, 1.0f);
+  double previous = INFINITY;
+  for (int M : {16, 32, 64}) {
+    ProductQuantizer pq(M);
+    CHECK(!pq.trained() && pq.codeSize()==M/2 && pq.subspaceSize()*M==128);
+    std::vector<uint8_t> codes;
+    CHECK(Throws([&] { pq.encode(data, codes); }));
+    CHECK(Throws([&] { pq.train(data.descriptor(0), 128, 15); }));
+    pq.train(data);
+    CHECK(pq.trained());
+    pq.encode(data, codes);
+    CHECK(codes.size()==(size_t)2000*M/2);
+    std::vector<float> decoded((size_t)2000*128);
+    pq.decode(codes.data(), 2000, decoded.data());
+    const int dsub = pq.subspaceSize();
+    double error = 0.0;
+    std::vector<float> table(M*16);
+    for (int i=0;i<2000;i++) {
+      const float *x = data.descriptor(i);
+      const float *y = &decoded[(size_t)i*128];
+      for (int m=0;m<M;m++) {
+        // The decoded subvector is a centroid no farther than any other
+        double best = INFINITY, chosen = 0.0;
+        bool isCentroid = false;
+        for (int c=0;c<16;c++) {
+          const float *centroid = pq.centroids() + ((size_t)m*16 + c)*dsub;
+          double dist = 0.0;
+          for (int d=0;d<dsub;d++)
+            dist += (x[m*dsub + d] - centroid[d])*(x[m*dsub + d] - centroid[d]);
+          best = std::min(best, dist);
+          if (!std::memcmp(centroid, y + m*dsub, dsub*sizeof(float))) {
+            isCentroid = true;
+            chosen = dist;
+          }
+        }
+        CHECK(isCentroid && chosen<=best*(1.0 + 1e-5) + 1e-12);
+      }
+      for (int d=0;d<128;d++)
+        error += (x[d] - y[d])*(x[d] - y[d]);
+      if (i<100) {
+        pq.similarityTable(data.descriptor((i + 1)%2000), table.data());
+        double sum = 0.0;
+        for (int m=0;m<M;m++)
+          sum += table[m*16 + (m%2 ? codes[(size_t)i*M/2 + m/2] >> 4 : codes[(size_t)i*M/2 + m/2] & 15)];
+        CHECK(std::fabs(sum - Dot(data.descriptor((i + 1)%2000), y))<1e-4);
+      }
+    }
+    // Finer subspaces reconstruct more closely, far below the unit length
+    printf("M %2d: mean squared error %.4f\n", M, error/2000);
+    CHECK(error/2000<0.2 && error<previous);
+    previous = error;
+  }
+}
+
+// Copies of indexed points find their original, and noisier ones their true
+// nearest neighbour, more often with more probes. Scores are close to the
+// exact similarities, and matching equals the two best search results.
+static void TestRecall()
+{
+  SiftFeatureSet data, copies, queries;
+  MakeFeatures(data, 6000, 60, 2, 1.0f);
+  MakeFeatures(copies, 500, 60, 3, 1.0f, &data);
+  MakeFeatures(queries, 300, 60, 4, 1.0f, &data, 0.2f);
+
+  SiftIVFPQParams params;
+  params.numLists = 64;
+  SiftIVFPQIndex index(params);
+  CHECK(Throws([] { SiftIVFPQParams bad; bad.numProbes = 0; SiftIVFPQIndex index(bad); }));
+  CHECK(Throws([&] { index.add(data); }));
+  CHECK(Throws([&] { index.train(data.descriptor(0), 128, 63); }));
+  index.train(data);
+  CHECK(index.trained() && index.size()==0);
+  SiftFeatureSet first(4000), second(2000);
+  first.numPts = 4000;
+  second.numPts = 2000;
+  for (int i=0;i<6000;i++) {
+    SiftFeatureSet &dst = (i<4000 ? first : second);
+    const int j = (i<4000 ? i : i - 4000);
+    std::memcpy(dst.descriptor(j), data.descriptor(i), 128*sizeof(float));
+    dst.xpos[j] = data.xpos[i];
+    dst.ypos[j] = data.ypos[i];
+  }
+  CHECK(index.add(first)==0);
+  CHECK(index.add(second)==4000);
+  CHECK(index.size()==6000);
+  for (int i=0;i<6000;i++)
+    CHECK(index.xpos(i)==data.xpos[i] && index.ypos(i)==data.ypos[i]);
+
+  // Noisy copies of indexed points find their original
+  const int k = 10;
+  std::vector<int> indices(500*k);
+  std::vector<float> scores(500*k);
+  index.search(copies, 1, indices.data(), scores.data());
+  int correct = 0;
+  for (int q=0;q<500;q++)
+    correct += (indices[q]==q);
+  CHECK(correct>=475);
+
+  // Recall@10 of the true nearest neighbour. Beyond the default probes it
+  // need not grow, as the extra lists add candidates whose approximate
+  // similarity may exceed that of the true neighbour.
+  std::vector<double> recalls;
+  for (int numProbes : {1, 16, 64}) {
+    index.search(queries, k, indices.data(), scores.data(), numProbes);
+    int found = 0;
+    double error = 0.0;
+    for (int q=0;q<300;q++) {
+      const int best = BruteForce(queries.descriptor(q), data, 1)[0];
+      found += (std::find(&indices[q*k], &indices[(q + 1)*k], best)!=&indices[(q + 1)*k]);
+      for (int j=0;j<k;j++) {
+        // A single list may hold fewer than k points
+        const int i = indices[q*k + j];
+        if (i<0 && numProbes==1)
+          continue;
+        CHECK(i>=0 && i<6000 && (j==0 || scores[q*k + j]<=scores[q*k + j - 1]));
+        if (i<0)
+          continue;
+        CHECK(std::count(&indices[q*k], &indices[(q + 1)*k], i)==1);
+        error = std::max(error, std::fabs(scores[q*k + j] - Dot(queries.descriptor(q), data.descriptor(i))));
+      }
+    }
+    const double recall = (double)found/300;
+    printf("%2d probes: recall@%d %.3f, largest score error %.3f\n", numProbes, k, recall, error);
+    CHECK(error<0.15);
+    recalls.push_back(recall);
+  }
+  CHECK(recalls[1]>recalls[0] && recalls[1]>=0.85 && recalls[2]>=0.85);
+
+  // Scanning with 8-bit tables keeps the candidates of a scan that reranks
+  // every point of the probed lists with the float table
+  SiftIVFPQParams exactParams = params;
+  exactParams.rerank = 6000;
+  SiftIVFPQIndex exact(exactParams);
+  exact.train(data);
+  exact.add(data);
+  CHECK(!std::memcmp(exact.quantizer().centroids(), index.quantizer().centroids(), 128*16*sizeof(float)));
+  std::vector<int> exactIndices(indices.size());
+  std::vector<float> exactScores(scores.size());
+  exact.search(queries, k, exactIndices.data(), exactScores.data(), 64);
+  int kept = 0;
+  for (int q=0;q<300;q++)
+    for (int j=0;j<k;j++)
+      kept += (std::find(&indices[q*k], &indices[(q + 1)*k], exactIndices[q*k + j])!=&indices[(q + 1)*k]);
+  CHECK(kept>=0.98*300*k);
+
+  SiftFeatureSet matched = copies;
+  MatchSiftData(matched, index);
+  index.search(copies, 2, indices.data(), scores.data());
+  for (int q=0;q<500;q++) {
+    CHECK(matched.match[q]==indices[2*q] && matched.score[q]==scores[2*q]);
+    CHECK(std::fabs(matched.ambiguity[q] - scores[2*q + 1]/(scores[2*q] + 1e-6f))<1e-6f);
+    CHECK(matched.match_xpos[q]==index.xpos(indices[2*q]) &&
+          matched.match_ypos[q]==index.ypos(indices[2*q]));
+  }
+
+  // Clearing keeps the training
+  index.clear();
+  CHECK(index.trained() && index.size()==0);
+  index.search(queries, k, indices.data(), scores.data());
+  CHECK(std::count(indices.begin(), indices.begin() + 300*k, -1)==300*k);
+  CHECK(index.add(first)==0);
+}
+
+// A loaded index holds the same training, points and parameters and answers
+// queries exactly as the saved one, while truncated or corrupt files are
+// rejected
+static void TestSaveLoad()
+{
+  SiftFeatureSet data, queries;
+  MakeFeatures(data, 3000, 40, 5, 1.0f);
+  MakeFeatures(queries, 100, 40, 6, 1.0f);
+  SiftIVFPQParams params;
+  params.numLists = 32;
+  params.numSubspaces = 16;
+  params.numProbes = 4;
+  params.rerank = 20;
+  params.seed = 7;
+  SiftIVFPQIndex index(params);
+  CHECK(Throws([&] { index.save(fileName); }));
+  index.train(data);
+  index.add(data);
+  index.save(fileName);
+  SiftIVFPQIndex loaded = SiftIVFPQIndex::load(fileName);
+  const SiftIVFPQParams &p = loaded.params();
+  CHECK(p.numLists==32 && p.numSubspaces==16 && p.numProbes==4 && p.rerank==20 && p.seed==7 &&
+        p.iterations==params.iterations);
+  CHECK(loaded.size()==3000);
+  CHECK(!std::memcmp(loaded.quantizer().centroids(), index.quantizer().centroids(), 128*16*sizeof(float)));
+  for (int i=0;i<3000;i++)
+    CHECK(loaded.xpos(i)==index.xpos(i) && loaded.ypos(i)==index.ypos(i));
+  const int k = 5;
+  std::vector<int> indices(100*k), loadedIndices(100*k);
+  std::vector<float> scores(100*k), loadedScores(100*k);
+  for (int numProbes : {0, 32}) {
+    index.search(queries, k, indices.data(), scores.data(), numProbes);
+    loaded.search(queries, k, loadedIndices.data(), loadedScores.data(), numProbes);
+    CHECK(indices==loadedIndices && scores==loadedScores);
+  }
+  CHECK(loaded.add(queries)==3000);
+
+  index.clear();
+  index.save(fileName);
+  CHECK(SiftIVFPQIndex::load(fileName).size()==0);
+
+  loaded.save(fileName);
+  const std::vector<char> bytes = ReadFile(fileName);
+  auto rejected = [&](const std::vector<char> &copy, size_t size) {
+    WriteFile(fileName, copy, size);
+    return Throws([] { SiftIVFPQIndex::load(fileName); });
+  };
+  for (size_t size : {(size_t)0, (size_t)63, (size_t)64, bytes.size()/2, bytes.size() - 1})
+    CHECK(rejected(bytes, size));
+  std::vector<char> copy = bytes;
+  copy[0] = 'X';
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[8] = 2;        // Version
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[28] = 24;      // Subspaces
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[16] = 1;       // Point count unlike the list sizes
+  CHECK(rejected(copy, copy.size()));
+  // The first point number of the first list beyond the index
+  copy = bytes;
+  const size_t ids = 64 + ((size_t)32*128 + 128*16 + 2*3100 + 32)*sizeof(float);
+  const int bad = 3100;
+  std::memcpy(&copy[ids], &bad, sizeof(int));
+  CHECK(rejected(copy, copy.size()));
+  CHECK(!rejected(bytes, bytes.size()));
+  std::remove(fileName);
+}
+
+int main()
+{
+  TestQuantizer();
+  TestRecall();
+  TestSaveLoad();
+
+  return TestResult();
+}
@@ -0,0 +1,268 @@
+//********************************************************//
+// Vocabulary tree and image database against brute       //
+// force: word weights, bag-of-words vectors, retrieval   //
+// and save/load round trips, runs without a device       //
+//********************************************************//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+#include "cudasift/siftVocabulary.h"
+#include "testUtils.h"
+
+static const char *fileName = "siftVocabularyTest.voc";
+
+// Images of numPts unit, non-negative descriptors, each image drawing from a
+// few of numClusters patch types shared by all images. With base, every
+// image is instead a noisy copy of the image of base it is numbered after,
+// as another view of the same scene.
+static void MakeImages(std::vector<SiftFeatureSet> &images, int numImages, int numPts, uint32_t seed,
+                       const std::vector<SiftFeatureSet> *base = nullptr)
+{
+  const int numClusters = 200;
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  std::vector<float> centres((size_t)numClusters*128);
+  std::mt19937 centreRng(1);
+  for (float &c : centres)
+    c = uni(centreRng)*uni(centreRng);
+  images.resize(numImages);
+  for (int n=0;n<numImages;n++) {
+    SiftFeatureSet &set = images[n];
+    set.resize(numPts);
+    set.numPts = numPts;
+    const int firstCluster = rng()%numClusters;
+    for (int i=0;i<numPts;i++) {
+      const float *centre = &centres[(size_t)((firstCluster + rng()%20)%numClusters)*128];
+      float sum = 0.0f;
+      for (int d=0;d<128;d++) {
+        const float v = uni(rng);
+        float &x = set.descriptor(i)[d];
+        x = (base ? (*base)[n%base->size()].descriptor(i)[d] + 0.05f*v : centre[d] + 0.5f*v*v);
+        sum += x*x;
+      }
+      for (int d=0;d<128;d++)
+        set.descriptor(i)[d] /= std::sqrt(sum);
+    }
+  }
+}
+
+// Words of all descriptors of an image
+static std::vector<int> Words(const SiftVocabulary &voc, const SiftFeatureSet &image)
+{
+  std::vector<int> words(image.numPts);
+  voc.quantize(image.descriptor(0), 128, image.numPts, words.data());
+  return words;
+}
+
+// Weights are the smoothed inverse document frequencies among the training
+// images, and bag-of-words vectors the normalized weighted word counts
+static void TestVocabulary()
+{
+  SiftVocabularyParams bad;
+  bad.branching = 1;
+  CHECK(Throws([&] { SiftVocabulary voc(bad); }));
+  bad.branching = 10;
+  bad.depth = 10;
+  CHECK(Throws([&] { SiftVocabulary voc(bad); }));
+
+  std::vector<SiftFeatureSet> training, copies;
+  MakeImages(training, 60, 150, 2);
+  MakeImages(copies, 60, 150, 3, &training);
+  SiftVocabularyParams params;
+  params.branching = 8;
+  params.depth = 3;
+  SiftVocabulary voc(params);
+  CHECK(!voc.trained());
+  CHECK(Throws([&] { Words(voc, training[0]); }));
+  CHECK(Throws([&] { voc.train(training.data(), 0); }));
+  voc.train(training.data(), (int)training.size());
+  CHECK(voc.trained() && voc.numWords()>params.branching && voc.numWords()<=8*8*8);
+
+  // Training only depends on the descriptors, parameters and seed
+  SiftVocabulary again(params);
+  again.train(training.data(), (int)training.size());
+  CHECK(again.numWords()==voc.numWords());
+
+  std::vector<int> frequency(voc.numWords(), 0);
+  int kept = 0, total = 0;
+  for (size_t n=0;n<training.size();n++) {
+    const std::vector<int> words = Words(voc, training[n]);
+    CHECK(words==Words(again, training[n]));
+    std::vector<int> distinct = words;
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    for (int w : distinct) {
+      CHECK(w>=0 && w<voc.numWords());
+      frequency[w]++;
+    }
+    // Slightly perturbed descriptors mostly keep their word
+    const std::vector<int> copyWords = Words(voc, copies[n]);
+    for (size_t i=0;i<words.size();i++)
+      kept += (copyWords[i]==words[i]);
+    total += (int)words.size();
+
+    SiftBowVector bow;
+    voc.transform(training[n], bow);
+    std::vector<double> expected(voc.numWords(), 0.0);
+    double sum = 0.0;
+    for (int w : words) {
+      expected[w] += voc.weight(w);
+      sum += voc.weight(w);
+    }
+    float weights = 0.0f;
+    for (size_t j=0;j<bow.size();j++) {
+      CHECK(j==0 || bow[j].word>bow[j - 1].word);
+      CHECK(std::fabs(bow[j].weight - expected[bow[j].word]/sum)<1e-5);
+      weights += bow[j].weight;
+    }
+    CHECK(bow.size()==distinct.size() && std::fabs(weights - 1.0f)<1e-5f);
+  }
+  printf("%d words, %.3f of perturbed descriptors keep their word\n", voc.numWords(), (double)kept/total);
+  CHECK(kept>=0.8*total);
+  for (int w=0;w<voc.numWords();w++) {
+    CHECK(std::fabs(voc.weight(w) - (std::log((training.size() + 1.0)/(frequency[w] + 1.0)) + 1.0))<1e-5);
+    CHECK(voc.weight(w)==again.weight(w));
+  }
+
+  SiftFeatureSet empty;
+  SiftBowVector bow(1, {0, 1.0f});
+  voc.transform(empty, bow);
+  CHECK(bow.empty());
+}
+
+// Query results equal an exhaustive scoring of all images by the shared
+// weights of their vectors, summed in the order of the query words, and other
+// views of an image retrieve it first
+static void TestDatabase()
+{
+  std::vector<SiftFeatureSet> images, views;
+  MakeImages(images, 300, 100, 4);
+  MakeImages(views, 100, 100, 5, &images);
+  SiftVocabularyParams params;
+  params.branching = 6;
+  params.depth = 3;
+  SiftVocabulary untrained(params);
+  CHECK(Throws([&] { SiftImageDatabase db(untrained); }));
+  SiftVocabulary voc(params);
+  voc.train(images.data(), 100);
+
+  SiftImageDatabase db(voc);
+  std::vector<SiftBowVector> bows(images.size());
+  for (size_t n=0;n<images.size();n++) {
+    voc.transform(images[n], bows[n]);
+    CHECK(db.add(images[n])==(int)n);
+  }
+  CHECK(db.size()==300);
+
+  const int numResults = 10;
+  int first = 0;
+  for (int q=0;q<100;q++) {
+    SiftBowVector bow;
+    voc.transform(views[q], bow);
+    for (int maxImage : {-1, 150}) {
+      const int end = (maxImage<0 ? 300 : maxImage);
+      std::vector<std::pair<float, int>> expected;
+      for (int n=0;n<end;n++) {
+        float score = 0.0f;
+        for (const SiftBowEntry &entry : bow)
+          for (const SiftBowEntry &other : bows[n])
+            if (other.word==entry.word)
+              score += std::min(entry.weight, other.weight);
+        if (score>0.0f)
+          expected.push_back({-score, n});
+      }
+      std::sort(expected.begin(), expected.end());
+      int result[numResults];
+      float scores[numResults];
+      const int num = db.query(views[q], numResults, result, scores, maxImage);
+      CHECK(num==std::min((int)expected.size(), numResults));
+      for (int j=0;j<numResults;j++) {
+        if (j<num) {
+          CHECK(result[j]==expected[j].second && scores[j]==-expected[j].first);
+          CHECK(scores[j]<=1.0f + 1e-5f);
+        } else {
+          CHECK(result[j]==-1 && scores[j]==0.0f);
+        }
+      }
+      if (maxImage<0)
+        first += (result[0]==q);
+    }
+  }
+  printf("%d of 100 views retrieve their image first\n", first);
+  CHECK(first>=95);
+
+  // An image retrieves itself with a similarity of one
+  int result[3];
+  float scores[3];
+  CHECK(db.query(bows[7], 3, result, scores)>=1);
+  CHECK(result[0]==7 && std::fabs(scores[0] - 1.0f)<1e-5f);
+
+  db.clear();
+  CHECK(db.size()==0 && db.query(bows[7], 3, result, scores)==0);
+  CHECK(result[0]==-1 && scores[0]==0.0f);
+  CHECK(db.add(images[0])==0);
+}
+
+// A loaded vocabulary has the same parameters, words and weights, while
+// truncated or corrupt files are rejected
+static void TestSaveLoad()
+{
+  std::vector<SiftFeatureSet> images;
+  MakeImages(images, 40, 100, 6);
+  SiftVocabularyParams params;
+  params.branching = 5;
+  params.depth = 4;
+  params.seed = 9;
+  SiftVocabulary voc(params);
+  CHECK(Throws([&] { voc.save(fileName); }));
+  voc.train(images.data(), (int)images.size());
+  voc.save(fileName);
+  SiftVocabulary loaded = SiftVocabulary::load(fileName);
+  const SiftVocabularyParams &p = loaded.params();
+  CHECK(p.branching==5 && p.depth==4 && p.seed==9 && p.iterations==params.iterations);
+  CHECK(loaded.numWords()==voc.numWords());
+  for (int w=0;w<voc.numWords();w++)
+    CHECK(loaded.weight(w)==voc.weight(w));
+  for (const SiftFeatureSet &image : images)
+    CHECK(Words(loaded, image)==Words(voc, image));
+
+  const std::vector<char> bytes = ReadFile(fileName);
+  auto rejected = [&](const std::vector<char> &copy, size_t size) {
+    WriteFile(fileName, copy, size);
+    return Throws([] { SiftVocabulary::load(fileName); });
+  };
+  for (size_t size : {(size_t)0, (size_t)63, (size_t)64, bytes.size()/2, bytes.size() - 1})
+    CHECK(rejected(bytes, size));
+  std::vector<char> copy = bytes;
+  copy[0] = 'X';
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[8] = 2;        // Version
+  CHECK(rejected(copy, copy.size()));
+  copy = bytes;
+  copy[36]++;         // Word count unlike the leaves
+  CHECK(rejected(copy, copy.size()));
+  // The root as its own child
+  copy = bytes;
+  const int root = 0;
+  std::memcpy(&copy[64], &root, sizeof(int));
+  CHECK(rejected(copy, copy.size()));
+  CHECK(!rejected(bytes, bytes.size()));
+  std::remove(fileName);
+}
+
+int main()
+{
+  TestVocabulary();
+  TestDatabase();
+  TestSaveLoad();
+
+  return TestResult();
+}
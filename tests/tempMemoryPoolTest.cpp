@@ -0,0 +1,161 @@
+//********************************************************//
+// Bookkeeping of TempMemoryPoolT with a fake allocator,  //
+// runs without a device                                  //
+//********************************************************//
+
+#include <cstdio>
+#include <memory>
+#include <new>
+
+#include "cudasift/tempMemoryPool.h"
+#include "testUtils.h"
+
+// Buffer that records its allocated and restricted sizes
+struct FakeMemory {
+  FakeMemory(int w, int h, int n) : width(w), height(h), numOctaves(n),
+                                    restrictWidth(w), restrictHeight(h) {}
+  void setSize(int w, int h) {
+    restrictWidth = w;
+    restrictHeight = h;
+  }
+  int width, height, numOctaves;
+  int restrictWidth, restrictHeight;
+};
+
+struct FakeAllocator {
+  typedef FakeMemory Memory;
+  int *context_;
+  int *allocations;
+  bool *fail;
+  int context() const { return *context_; }
+  size_t bytes(int width, int height, int) const { return (size_t)width*height; }
+  std::unique_ptr<FakeMemory> allocate(int width, int height, int numOctaves) const {
+    if (*fail)
+      throw std::bad_alloc();
+    (*allocations)++;
+    return std::unique_ptr<FakeMemory>(new FakeMemory(width, height, numOctaves));
+  }
+};
+
+typedef TempMemoryPoolT<FakeAllocator> FakePool;
+
+int main()
+{
+  int context = 0, allocations = 0;
+  bool fail = false;
+  FakePool pool(1000, FakeAllocator{&context, &allocations, &fail});
+
+  // A new size allocates, the same size is served again
+  FakeMemory *first;
+  {
+    auto a = pool.acquire(20, 10, 5);
+    first = a.get();
+    CHECK(a->width==20 && a->height==10 && a->numOctaves==5);
+  }
+  {
+    auto a = pool.acquire(20, 10, 5);
+    CHECK(a.get()==first);
+    CHECK(a->restrictWidth==20 && a->restrictHeight==10);
+  }
+  CHECK(allocations==1);
+  CHECK(pool.stats().hits==1 && pool.stats().misses==1);
+
+  // scaleUp doubles the key, so (10, 5) with scaleUp is the same buffer
+  {
+    auto a = pool.acquire(10, 5, 5, true);
+    CHECK(a.get()==first);
+  }
+
+  // A smaller image reuses the larger idle buffer, restricted with setSize
+  {
+    auto a = pool.acquire(15, 8, 5);
+    CHECK(a.get()==first);
+    CHECK(a->restrictWidth==15 && a->restrictHeight==8);
+    CHECK(pool.stats().resized==1);
+  }
+  // and is restricted back when the full size is requested again
+  {
+    auto a = pool.acquire(20, 10, 5);
+    CHECK(a.get()==first);
+    CHECK(a->restrictWidth==20 && a->restrictHeight==10);
+  }
+
+  // A buffer in use is not handed out twice, another number of octaves or
+  // another context gets its own buffer
+  {
+    auto a = pool.acquire(20, 10, 5);
+    auto b = pool.acquire(20, 10, 5);
+    CHECK(a.get()!=b.get());
+    auto c = pool.acquire(20, 10, 4);
+    CHECK(c.get()!=a.get() && c.get()!=b.get());
+    context = 1;
+    auto d = pool.acquire(20, 10, 5);
+    CHECK(d->width==20 && d.get()!=a.get() && d.get()!=b.get());
+    context = 0;
+    CHECK(pool.count()==4);
+    CHECK(pool.size()==800);
+  }
+  CHECK(allocations==4);
+
+  // Among larger idle buffers the smallest is used
+  pool.clear();
+  CHECK(pool.count()==0 && pool.size()==0);
+  pool.setCapacity(2000);
+  {
+    auto a = pool.acquire(30, 30, 5);
+    auto b = pool.acquire(20, 20, 5);
+  }
+  {
+    auto a = pool.acquire(10, 10, 5);
+    CHECK(a->width==20 && a->height==20);
+  }
+  pool.setCapacity(1000);
+
+  // Allocations beyond the capacity evict idle buffers in LRU order, but
+  // never those in use
+  pool.clear();
+  {
+    auto a = pool.acquire(20, 20, 5);   // 400 bytes
+  }
+  {
+    auto b = pool.acquire(10, 30, 5);   // 300 bytes
+  }
+  {
+    auto a = pool.acquire(20, 20, 5);   // Makes the 10 x 30 buffer the LRU
+    size_t evictions = pool.stats().evictions;
+    auto c = pool.acquire(25, 20, 5);   // 500 bytes, 1200 > 1000
+    CHECK(pool.stats().evictions==evictions + 1);
+    CHECK(pool.count()==2 && pool.size()==900);
+    auto d = pool.acquire(20, 20, 5);   // Both in use, exceeds the capacity
+    CHECK(pool.count()==3 && pool.size()==1300);
+  }
+  // and shrinks back on release
+  CHECK(pool.size()<=1000);
+
+  pool.setCapacity(0);
+  CHECK(pool.count()==0 && pool.size()==0);
+  CHECK(pool.getCapacity()==0);
+  pool.setCapacity(1000);
+
+  // A failed allocation leaves the bookkeeping unchanged
+  fail = true;
+  const bool thrown = Throws<std::bad_alloc>([&] { auto a = pool.acquire(10, 10, 5); });
+  fail = false;
+  CHECK(thrown);
+  CHECK(pool.count()==0 && pool.size()==0);
+
+  // Moved leases keep the buffer in use until the last one is released
+  {
+    FakePool::Lease a = pool.acquire(10, 10, 5);
+    FakeMemory *mem = a.get();
+    FakePool::Lease b(std::move(a));
+    CHECK(!a && b.get()==mem);
+    auto c = pool.acquire(10, 10, 5);
+    CHECK(c.get()!=mem);
+    b.release();
+    auto d = pool.acquire(10, 10, 5);
+    CHECK(d.get()==mem);
+  }
+
+  return TestResult();
+}
@@ -0,0 +1,137 @@
+//********************************************************//
+// Harness shared by the tests: checks, expected          //
+// exceptions, files and synthetic features with their    //
+// brute-force references                                 //
+//********************************************************//
+
+#ifndef TESTUTILS_H
+#define TESTUTILS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "cudasift/cudaSift.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                      \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                        \
+    }                                                                    \
+  } while (0)
+
+// Exit code of a test, reporting the failed checks if there are any
+inline int TestResult()
+{
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
+
+// Whether func throws an exception of type E
+template <class E = std::exception, class T>
+inline bool Throws(T func)
+{
+  try {
+    func();
+  } catch (const E &) {
+    return true;
+  }
+  return false;
+}
+
+// All bytes of a file, none if it cannot be opened
+inline std::vector<char> ReadFile(const char *name)
+{
+  std::vector<char> bytes;
+  FILE *file = fopen(name, "rb");
+  if (file==nullptr)
+    return bytes;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file))>0)
+    bytes.insert(bytes.end(), buffer, buffer + n);
+  fclose(file);
+  return bytes;
+}
+
+// The first size bytes as the whole file
+inline void WriteFile(const char *name, const std::vector<char> &bytes, size_t size)
+{
+  FILE *file = fopen(name, "wb");
+  fwrite(bytes.data(), 1, size, file);
+  fclose(file);
+}
+
+// Unit, non-negative descriptors around numClusters random centres, as SIFT
+// descriptors of different images share many similar patches, with spread
+// setting how far points stray from their centre. With base, every point is
+// instead a copy of the point of base it is numbered after with the given
+// noise, as a true correspondence in another image. Keypoints are random in
+// a 1000 x 1000 image, the columns besides the position drawn apart from the
+// descriptors.
+inline void MakeFeatures(SiftFeatureSet &set, int numPts, int numClusters, uint32_t seed, float spread,
+                         const SiftFeatureSet *base = nullptr, float noise = 0.05f)
+{
+  std::mt19937 rng(seed), keyRng(~seed);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  std::vector<float> centres((size_t)numClusters*128);
+  for (float &c : centres)
+    c = uni(rng)*uni(rng);
+  set.resize(numPts);
+  set.numPts = numPts;
+  for (int i=0;i<numPts;i++) {
+    set.xpos[i] = 1000.0f*uni(rng);
+    set.ypos[i] = 1000.0f*uni(rng);
+    set.scale[i] = 1.0f + 8.0f*uni(keyRng);
+    set.sharpness[i] = uni(keyRng);
+    set.edgeness[i] = 10.0f*uni(keyRng);
+    set.orientation[i] = 360.0f*uni(keyRng);
+    set.subsampling[i] = (float)(1 << (i%4));
+    const float *centre = &centres[(size_t)(rng()%numClusters)*128];
+    float sum = 0.0f;
+    for (int d=0;d<128;d++) {
+      const float v = uni(rng);
+      float &x = set.descriptor(i)[d];
+      x = (base ? base->descriptor(i%base->numPts)[d] + noise*v : centre[d] + spread*v*v);
+      sum += x*x;
+    }
+    for (int d=0;d<128;d++)
+      set.descriptor(i)[d] /= std::sqrt(sum);
+  }
+}
+
+inline double Dot(const float *a, const float *b, int n = 128)
+{
+  double sum = 0.0;
+  for (int d=0;d<n;d++)
+    sum += (double)a[d]*b[d];
+  return sum;
+}
+
+// Indices of the k points of data most similar to query
+inline std::vector<int> BruteForce(const float *query, const SiftFeatureSet &data, int k)
+{
+  std::vector<std::pair<double, int>> sims(data.numPts);
+  for (int j=0;j<data.numPts;j++)
+    sims[j] = {-Dot(query, data.descriptor(j)), j};
+  k = std::min(k, data.numPts);
+  std::partial_sort(sims.begin(), sims.begin() + k, sims.end());
+  std::vector<int> best(k);
+  for (int j=0;j<k;j++)
+    best[j] = sims[j].second;
+  return best;
+}
+
+#endif